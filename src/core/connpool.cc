@@ -0,0 +1,600 @@
+//
+// Copyright (C) 2013 Yeolar <yeolar@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "ctornado.h"
+
+namespace ctornado {
+
+using namespace std::placeholders;
+
+//
+// A name looked up on a ThreadPool worker.  The worker only uses name,
+// port and addrs: callback holds Str objects of the IOLoop thread.
+//
+typedef struct {
+    string name;
+    int port;
+    vector<sockinfo_t> addrs;
+    cb_resolve_t callback;
+    IOLoop *ioloop;
+} ResolveJob;
+
+static void finish_resolve_job(ResolveJob *job)
+{
+    job->callback(job->addrs);
+    delete job;
+}
+
+static void run_resolve_job(ResolveJob *job)
+{
+    int status;
+
+    status = socket_resolve_all(&job->addrs, AF_UNSPEC, job->name.c_str(),
+            job->port);
+    if (status != 0) {
+        log_warn("resolve %s failed: %s", job->name.c_str(),
+                gai_strerror(status));
+    }
+    job->ioloop->add_callback(bind(finish_resolve_job, job));
+}
+
+static bool is_ip_address(const char *name)
+{
+    uint8_t addr[sizeof(struct in6_addr)];
+
+    return inet_pton(AF_INET, name, addr) == 1 ||
+        inet_pton(AF_INET6, name, addr) == 1;
+}
+
+static void free_connector(Connector *connector)
+{
+    delete connector;
+}
+
+void resolve_async(const Str& host, int port, cb_resolve_t callback,
+        IOLoop *ioloop)
+{
+    ResolveJob *job;
+
+    job = new ResolveJob();
+    job->name = host.tos();
+    job->port = port;
+    job->callback = callback;
+    job->ioloop = (ioloop != nullptr) ? ioloop : IOLoop::instance();
+
+    if (is_ip_address(job->name.c_str())) {
+        socket_resolve_all(&job->addrs, AF_UNSPEC, job->name.c_str(), port);
+        job->ioloop->add_callback(bind(finish_resolve_job, job));
+        return;
+    }
+    ThreadPool::instance()->submit(bind(run_resolve_job, job));
+}
+
+Connector::Connector(const vector<sockinfo_t>& addrs, cb_conn_t callback,
+        IOLoop *ioloop)
+{
+    vector<sockinfo_t> first, second;
+    size_t i;
+
+    ioloop_ = (ioloop != nullptr) ? ioloop : IOLoop::instance();
+
+    for (auto& si : addrs) {
+        if (si.family == addrs[0].family)
+            first.push_back(si);
+        else
+            second.push_back(si);
+    }
+    for (i = 0; i < first.size() || i < second.size(); i++) {
+        if (i < first.size())
+            addrs_.push_back(first[i]);
+        if (i < second.size())
+            addrs_.push_back(second[i]);
+    }
+    next_ = 0;
+    callback_ = callback;
+    attempt_delay_ = CONNPOOL_ATTEMPT_DELAY;
+    attempt_timeout_ = nullptr;
+    timeout_ = nullptr;
+    done_ = false;
+}
+
+Connector::~Connector()
+{
+    ASSERT(attempts_.empty());
+}
+
+void Connector::start(int64_t attempt_delay, int64_t timeout)
+{
+    attempt_delay_ = attempt_delay;
+
+    if (timeout > 0) {
+        timeout_ = ioloop_->add_timeout(msec_now() + timeout,
+                bind(&Connector::on_timeout, this));
+    }
+    try_next();
+}
+
+void Connector::try_next()
+{
+    const sockinfo_t *si;
+    Socket *sock;
+    IOStream *stream;
+
+    while (next_ < addrs_.size()) {
+        si = &addrs_[next_++];
+
+        sock = Socket::create(si->family, SOCK_STREAM, 0);
+        if (sock == nullptr)
+            continue;
+        sock->set_close_exec();
+        sock->set_tcpnodelay();
+
+        stream = new IOStream(sock, ioloop_);
+        attempts_.push_back(stream);
+        stream->set_close_callback(bind(&Connector::on_close, this, stream));
+        stream->connect(si, bind(&Connector::on_connect, this, stream));
+
+        if (next_ < addrs_.size()) {
+            attempt_timeout_ = ioloop_->add_timeout(
+                    msec_now() + attempt_delay_,
+                    bind(&Connector::on_attempt_timeout, this));
+        }
+        return;
+    }
+    if (attempts_.empty())
+        finish(nullptr);
+}
+
+void Connector::on_attempt_timeout()
+{
+    attempt_timeout_ = nullptr;
+    try_next();
+}
+
+void Connector::on_timeout()
+{
+    timeout_ = nullptr;
+    error_ = "Connect timeout";
+    log_warn("connect timed out after %zu of %zu addresses", next_,
+            addrs_.size());
+    finish(nullptr);
+}
+
+void Connector::on_connect(IOStream *stream)
+{
+    //
+    // On a connect error the stream is closed, and the close callback
+    // runs first
+    //
+    if (done_ || stream->closed())
+        return;
+
+    finish(stream);
+}
+
+void Connector::on_close(IOStream *stream)
+{
+    attempts_.remove(stream);
+    if (stream->error_ != nullptr)
+        error_ = Str(stream->error_->what()).copy();
+    free_stream_later(stream);
+
+    if (done_) {
+        if (attempts_.empty())
+            ioloop_->add_callback(bind(free_connector, this));
+        return;
+    }
+    //
+    // A failed attempt does not wait for the delay to try the next one
+    //
+    if (attempt_timeout_ != nullptr) {
+        ioloop_->remove_timeout(attempt_timeout_);
+        attempt_timeout_ = nullptr;
+    }
+    try_next();
+}
+
+void Connector::finish(IOStream *stream)
+{
+    list<IOStream *> losers;
+
+    done_ = true;
+
+    if (attempt_timeout_ != nullptr) {
+        ioloop_->remove_timeout(attempt_timeout_);
+        attempt_timeout_ = nullptr;
+    }
+    if (timeout_ != nullptr) {
+        ioloop_->remove_timeout(timeout_);
+        timeout_ = nullptr;
+    }
+    if (stream != nullptr) {
+        attempts_.remove(stream);
+        stream->set_close_callback(nullptr);
+    }
+    losers = attempts_;
+    for (auto loser : losers) {
+        if (!loser->closed())
+            loser->close();
+    }
+    if (attempts_.empty())
+        ioloop_->add_callback(bind(free_connector, this));
+
+    callback_(stream);
+}
+
+Endpoint::Endpoint(const Str& host, int port)
+{
+    host_ = host.copy();
+    port_ = port;
+    resolved_at_ = 0;
+    resolving_ = false;
+    in_flight_ = 0;
+}
+
+Endpoint::~Endpoint()
+{
+}
+
+ConnectionPool::ConnectionPool(IOLoop *ioloop)
+{
+    ioloop_ = (ioloop != nullptr) ? ioloop : IOLoop::instance();
+    max_idle_ = CONNPOOL_MAX_IDLE;
+    max_age_ = CONNPOOL_MAX_AGE;
+    idle_timeout_ = CONNPOOL_IDLE_TIMEOUT;
+    max_in_flight_ = 0;
+    connect_timeout_ = CONNPOOL_CONNECT_TIMEOUT;
+    attempt_delay_ = CONNPOOL_ATTEMPT_DELAY;
+    resolve_ttl_ = CONNPOOL_RESOLVE_TTL;
+    next_id_ = 0;
+    health_checker_ = nullptr;
+}
+
+ConnectionPool::~ConnectionPool()
+{
+    if (health_checker_ != nullptr) {
+        health_checker_->stop();
+        delete health_checker_;
+    }
+    //
+    // The connections given out are left to their users
+    //
+    for (auto& kv : conns_) {
+        if (kv.second.ping_timeout != nullptr)
+            ioloop_->remove_timeout(kv.second.ping_timeout);
+        else if (find(kv.second.endpoint->idle_.begin(),
+                    kv.second.endpoint->idle_.end(), kv.first) ==
+                kv.second.endpoint->idle_.end())
+            continue;
+        kv.first->set_close_callback(nullptr);
+        if (!kv.first->closed())
+            kv.first->close();
+        free_stream_later(kv.first);
+    }
+    for (auto& kv : endpoints_) {
+        delete kv.second;
+    }
+}
+
+void ConnectionPool::acquire(const Str& host, int port, cb_conn_t callback)
+{
+    Endpoint *endpoint;
+    Str key;
+
+    key = str_format("%S:%d", host, port);
+
+    auto it = endpoints_.find(key);
+    if (it != endpoints_.end()) {
+        endpoint = it->second;
+    }
+    else {
+        endpoint = new Endpoint(host, port);
+        endpoints_[key] = endpoint;
+    }
+    endpoint->waiting_.push_back(callback);
+    dispatch(endpoint);
+}
+
+void ConnectionPool::release(IOStream *stream, bool reusable)
+{
+    Endpoint *endpoint;
+    int64_t now;
+
+    auto it = conns_.find(stream);
+    ASSERT(it != conns_.end());
+
+    endpoint = it->second.endpoint;
+    endpoint->in_flight_--;
+    now = msec_now();
+
+    if (!reusable || stream->closed() || stream->reading() ||
+            stream->writing() || now - it->second.created >= max_age_) {
+        log_verb("close released stream[%p]", stream);
+
+        conns_.erase(it);
+        if (stream->closed()) {
+            stream->set_close_callback(nullptr);
+            free_stream_later(stream);
+        }
+        else {
+            stream->set_close_callback(bind(free_stream_later, stream));
+            stream->close();
+        }
+    }
+    else {
+        it->second.idle_since = now;
+        make_idle(stream);
+    }
+    dispatch(endpoint);
+}
+
+void ConnectionPool::start_health_checks(int64_t interval)
+{
+    if (health_checker_ != nullptr) {
+        health_checker_->stop();
+        delete health_checker_;
+    }
+    health_checker_ = new PeriodicCallback(
+            bind(&ConnectionPool::check_health, this), interval, ioloop_);
+    health_checker_->start();
+}
+
+void ConnectionPool::ping(IOStream *stream, cb_ping_t done)
+{
+    char c;
+    ssize_t n;
+
+    if (stream->closed()) {
+        done(false);
+        return;
+    }
+    n = ::recv(stream->socket_->fd_, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+    done(n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK));
+}
+
+size_t ConnectionPool::idle_count()
+{
+    size_t n = 0;
+
+    for (auto& kv : endpoints_) {
+        n += kv.second->idle_.size();
+    }
+    return n;
+}
+
+void ConnectionPool::dispatch(Endpoint *endpoint)
+{
+    IOStream *stream;
+    cb_conn_t callback;
+    int64_t now;
+
+    now = msec_now();
+
+    while (!endpoint->waiting_.empty()) {
+        if (max_in_flight_ > 0 && endpoint->in_flight_ >= max_in_flight_)
+            break;
+
+        stream = nullptr;
+        while (!endpoint->idle_.empty()) {
+            stream = endpoint->idle_.front();
+            endpoint->idle_.pop_front();
+            if (!stream->closed() && !expired(conns_[stream], now))
+                break;
+            //
+            // Freed by on_idle_close
+            //
+            if (!stream->closed())
+                stream->close();
+            stream = nullptr;
+        }
+
+        callback = endpoint->waiting_.front();
+        endpoint->waiting_.pop_front();
+        endpoint->in_flight_++;
+
+        if (stream != nullptr) {
+            log_verb("reuse stream[%p]", stream);
+            stream->set_close_callback(nullptr);
+            ioloop_->add_callback(bind(callback, stream));
+        }
+        else {
+            connect(endpoint, callback);
+        }
+    }
+}
+
+void ConnectionPool::connect(Endpoint *endpoint, cb_conn_t callback)
+{
+    Connector *connector;
+
+    if (!endpoint->addrs_.empty() &&
+            msec_now() - endpoint->resolved_at_ < resolve_ttl_) {
+        connector = new Connector(endpoint->addrs_,
+                bind(&ConnectionPool::on_connect, this, endpoint, callback,
+                    _1), ioloop_);
+        connector->start(attempt_delay_, connect_timeout_);
+        return;
+    }
+    endpoint->resolve_waiting_.push_back(callback);
+
+    if (!endpoint->resolving_) {
+        endpoint->resolving_ = true;
+        resolve_async(endpoint->host_, endpoint->port_,
+                bind(&ConnectionPool::on_resolve, this, endpoint, _1),
+                ioloop_);
+    }
+}
+
+void ConnectionPool::on_resolve(Endpoint *endpoint,
+        const vector<sockinfo_t>& addrs)
+{
+    deque<cb_conn_t> waiting;
+    IOStream *none = nullptr;
+
+    endpoint->resolving_ = false;
+    endpoint->addrs_ = addrs;
+    endpoint->resolved_at_ = msec_now();
+    waiting.swap(endpoint->resolve_waiting_);
+
+    for (auto& callback : waiting) {
+        if (!addrs.empty()) {
+            connect(endpoint, callback);
+            continue;
+        }
+        endpoint->in_flight_--;
+        callback(none);
+    }
+    if (addrs.empty())
+        dispatch(endpoint);
+}
+
+void ConnectionPool::on_connect(Endpoint *endpoint, cb_conn_t callback,
+        IOStream *stream)
+{
+    conn_t conn;
+
+    if (stream == nullptr) {
+        log_warn("cannot connect to %.*s:%d",
+                static_cast<int>(endpoint->host_.len()),
+                endpoint->host_.data(), endpoint->port_);
+        //
+        // The addresses may have changed
+        //
+        endpoint->resolved_at_ = 0;
+        endpoint->in_flight_--;
+        callback(stream);
+        dispatch(endpoint);
+        return;
+    }
+    conn.endpoint = endpoint;
+    conn.created = msec_now();
+    conn.idle_since = conn.created;
+    conn.id = next_id_++;
+    conn.ping_timeout = nullptr;
+    conns_[stream] = conn;
+
+    callback(stream);
+}
+
+bool ConnectionPool::expired(const conn_t& conn, int64_t now)
+{
+    return now - conn.created >= max_age_ ||
+        now - conn.idle_since >= idle_timeout_;
+}
+
+void ConnectionPool::make_idle(IOStream *stream)
+{
+    Endpoint *endpoint;
+    IOStream *oldest;
+
+    endpoint = conns_[stream].endpoint;
+    endpoint->idle_.push_front(stream);
+    stream->set_close_callback(
+            bind(&ConnectionPool::on_idle_close, this, stream));
+
+    while (endpoint->idle_.size() > max_idle_) {
+        oldest = endpoint->idle_.back();
+        endpoint->idle_.pop_back();
+        if (!oldest->closed())
+            oldest->close();
+    }
+}
+
+void ConnectionPool::on_idle_close(IOStream *stream)
+{
+    log_verb("idle stream[%p] closed", stream);
+
+    auto it = conns_.find(stream);
+    ASSERT(it != conns_.end());
+
+    it->second.endpoint->idle_.remove(stream);
+    if (it->second.ping_timeout != nullptr)
+        ioloop_->remove_timeout(it->second.ping_timeout);
+    conns_.erase(it);
+
+    free_stream_later(stream);
+}
+
+void ConnectionPool::check_health()
+{
+    list<IOStream *> idle;
+    int64_t now;
+    uint64_t id;
+
+    now = msec_now();
+
+    for (auto& kv : endpoints_) {
+        //
+        // The streams being pinged are out of the idle list, so they
+        // are not given out meanwhile
+        //
+        idle.swap(kv.second->idle_);
+
+        for (auto stream : idle) {
+            conn_t& conn = conns_[stream];
+
+            if (stream->closed())
+                continue;
+            if (expired(conn, now)) {
+                stream->close();
+                continue;
+            }
+            id = conn.id;
+            conn.ping_timeout = ioloop_->add_timeout(now + connect_timeout_,
+                    bind(&ConnectionPool::on_ping_timeout, this, stream, id));
+            ping(stream, bind(&ConnectionPool::on_ping, this, stream, id, _1));
+        }
+        idle.clear();
+    }
+}
+
+void ConnectionPool::on_ping(IOStream *stream, uint64_t id, bool alive)
+{
+    auto it = conns_.find(stream);
+    if (it == conns_.end() || it->second.id != id ||
+            it->second.ping_timeout == nullptr)
+        return;
+
+    ioloop_->remove_timeout(it->second.ping_timeout);
+    it->second.ping_timeout = nullptr;
+
+    if (!alive || stream->closed()) {
+        log_warn("idle stream[%p] failed the health check", stream);
+        if (!stream->closed())
+            stream->close();
+        return;
+    }
+    //
+    // Behind the ones used meanwhile
+    //
+    it->second.endpoint->idle_.push_back(stream);
+    dispatch(it->second.endpoint);
+}
+
+void ConnectionPool::on_ping_timeout(IOStream *stream, uint64_t id)
+{
+    auto it = conns_.find(stream);
+    if (it == conns_.end() || it->second.id != id)
+        return;
+
+    it->second.ping_timeout = nullptr;
+
+    log_warn("idle stream[%p] health check timed out", stream);
+    if (!stream->closed())
+        stream->close();
+}
+
+} // namespace ctornado
@@ -0,0 +1,234 @@
+//
+// Copyright (C) 2013 Yeolar <yeolar@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef __CONNPOOL_H
+#define __CONNPOOL_H
+
+#include "ctornado.h"
+
+namespace ctornado {
+
+#define CONNPOOL_MAX_IDLE           32
+#define CONNPOOL_MAX_AGE            300000
+#define CONNPOOL_IDLE_TIMEOUT       60000
+#define CONNPOOL_CONNECT_TIMEOUT    5000
+#define CONNPOOL_ATTEMPT_DELAY      250
+#define CONNPOOL_RESOLVE_TTL        60000
+#define CONNPOOL_HEALTH_INTERVAL    10000
+
+typedef function<void (IOStream *)> cb_conn_t;
+typedef function<void (const vector<sockinfo_t>&)> cb_resolve_t;
+typedef function<void (bool)> cb_ping_t;
+
+//
+// Resolves host and port on a ThreadPool worker, so the IOLoop is not
+// blocked by getaddrinfo, and calls callback on the IOLoop with the
+// addresses, none if the resolution failed.  An IP address is not
+// looked up.
+//
+void resolve_async(const Str& host, int port, cb_resolve_t callback,
+        IOLoop *ioloop=nullptr);
+
+//
+// Connects to the first answering of several addresses of a host with
+// Happy Eyeballs (RFC 8305), and calls callback with the connected
+// stream, or nullptr if none answered in time.
+//
+// The addresses are tried in the order given, alternating between the
+// IPv6 and the IPv4 ones, the family of the first going first.  An
+// attempt is made every attempt_delay msec, or as soon as the previous
+// one fails, until one connects: the others are then closed.  So a
+// dual-stack host with broken IPv6 connects with a delay of
+// attempt_delay instead of a connect timeout.
+//
+// The connector frees itself when done.  Until then, error_ tells why
+// none connected: the error of the last failed attempt, or a timeout.
+//
+class Connector
+{
+public:
+    Connector(const vector<sockinfo_t>& addrs, cb_conn_t callback,
+            IOLoop *ioloop=nullptr);
+    ~Connector();
+
+    Connector(const Connector&) = delete;
+    Connector& operator=(const Connector&) = delete;
+
+    void start(int64_t attempt_delay=CONNPOOL_ATTEMPT_DELAY,
+            int64_t timeout=CONNPOOL_CONNECT_TIMEOUT);
+
+    Str error_;
+
+private:
+    IOLoop *ioloop_;
+    vector<sockinfo_t> addrs_;
+    size_t next_;
+    list<IOStream *> attempts_;
+    cb_conn_t callback_;
+    int64_t attempt_delay_;
+    Timeout *attempt_timeout_;
+    Timeout *timeout_;
+    bool done_;
+
+    void try_next();
+    void on_attempt_timeout();
+    void on_timeout();
+    void on_connect(IOStream *stream);
+    void on_close(IOStream *stream);
+    void finish(IOStream *stream);
+};
+
+//
+// A host and port the pool connects to, and its idle connections.
+//
+// in_flight_ is the number of connections given out or being made, and
+// waiting_ the acquires over max_in_flight_, served in order as soon
+// as a connection is released.
+//
+class Endpoint
+{
+public:
+    Endpoint(const Str& host, int port);
+    ~Endpoint();
+
+    Str host_;
+    int port_;
+    vector<sockinfo_t> addrs_;
+    int64_t resolved_at_;
+    bool resolving_;
+    int in_flight_;
+    list<IOStream *> idle_;
+    deque<cb_conn_t> waiting_;
+    deque<cb_conn_t> resolve_waiting_;
+};
+
+//
+// A pool of client connections, for any protocol spoken over IOStream.
+//
+//    pool = new ConnectionPool();
+//
+//    pool->acquire("backend.local", 6379, [](IOStream *stream) {
+//            if (stream == nullptr)
+//                return;     // could not connect
+//            stream->write(...);
+//            stream->read_until("\r\n", [stream](const Str& data) {
+//                    ...
+//                    pool->release(stream);
+//                });
+//        });
+//
+// Connections are per endpoint, a host and port.  A released connection
+// is kept idle, at most max_idle_ per endpoint, and the last released is
+// given out first.  It is not reused once max_age_ msec old, nor after
+// idle_timeout_ msec idle.  At most max_in_flight_ connections of an
+// endpoint are given out or being made at once (0 for no limit), the
+// acquires over it wait for a release.
+//
+// Host names are resolved on the ThreadPool and the addresses cached for
+// resolve_ttl_ msec, or until a connect fails.  New connections are made
+// by a Connector with Happy Eyeballs.
+//
+// With health checks, every interval msec the expired idle connections
+// are closed, and the others pinged: ping is given each one in turn,
+// and the connection is closed unless it calls back true within
+// connect_timeout_.  The default ping only checks that the peer neither
+// closed the connection nor sent anything unasked; a subclass would send
+// a request of its protocol, e.g. a PING command.
+//
+// The streams must be released as they were given: with no read or
+// write in progress, and no callback of the caller set.  A stream not
+// reusable, e.g. after a protocol error, is released with reusable
+// false, and then closed.  The pool may only be freed with no acquire
+// in progress; the idle connections are closed.
+//
+class ConnectionPool
+{
+public:
+    ConnectionPool(IOLoop *ioloop=nullptr);
+    virtual ~ConnectionPool();
+
+    ConnectionPool(const ConnectionPool&) = delete;
+    ConnectionPool& operator=(const ConnectionPool&) = delete;
+
+    //
+    // Calls callback with a connection to host and port, or nullptr if
+    // none could be made.
+    //
+    void acquire(const Str& host, int port, cb_conn_t callback);
+
+    //
+    // Gives back a connection acquired from the pool.
+    //
+    void release(IOStream *stream, bool reusable=true);
+
+    //
+    // Checks the idle connections every interval msec.
+    //
+    void start_health_checks(int64_t interval=CONNPOOL_HEALTH_INTERVAL);
+
+    //
+    // Checks that the idle connection stream is alive, and calls done
+    // with the result.
+    //
+    virtual void ping(IOStream *stream, cb_ping_t done);
+
+    //
+    // Returns the number of idle connections, of all endpoints.
+    //
+    size_t idle_count();
+
+    IOLoop *ioloop_;
+    size_t max_idle_;
+    int64_t max_age_;
+    int64_t idle_timeout_;
+    int max_in_flight_;
+    int64_t connect_timeout_;
+    int64_t attempt_delay_;
+    int64_t resolve_ttl_;
+
+private:
+    //
+    // The state of a connection made by the pool
+    //
+    typedef struct {
+        Endpoint *endpoint;
+        int64_t created;
+        int64_t idle_since;
+        uint64_t id;
+        Timeout *ping_timeout;
+    } conn_t;
+
+    map<Str, Endpoint *, StrLess> endpoints_;
+    map<IOStream *, conn_t> conns_;
+    uint64_t next_id_;
+    PeriodicCallback *health_checker_;
+
+    void dispatch(Endpoint *endpoint);
+    void connect(Endpoint *endpoint, cb_conn_t callback);
+    void on_resolve(Endpoint *endpoint, const vector<sockinfo_t>& addrs);
+    void on_connect(Endpoint *endpoint, cb_conn_t callback,
+            IOStream *stream);
+    bool expired(const conn_t& conn, int64_t now);
+    void make_idle(IOStream *stream);
+    void on_idle_close(IOStream *stream);
+    void check_health();
+    void on_ping(IOStream *stream, uint64_t id, bool alive);
+    void on_ping_timeout(IOStream *stream, uint64_t id);
+};
+
+} // namespace ctornado
+
+#endif // __CONNPOOL_H
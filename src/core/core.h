@@ -43,10 +43,17 @@
 #include <pthread.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 #include <sys/un.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/sendfile.h>
+#include <sys/inotify.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <netinet/tcp.h>
+#include <arpa/inet.h>
 
 #ifdef HAVE_BACKTRACE
 #include <execinfo.h>
@@ -57,6 +64,7 @@
 #include <new>
 #include <algorithm>
 #include <functional>
+#include <atomic>
 #include <string>
 #include <list>
 #include <vector>
@@ -68,6 +76,10 @@
 #include <jemalloc/jemalloc.h>
 #endif
 
+#ifdef USE_LIBDEFLATE
+#include <libdeflate.h>
+#endif
+
 namespace ctornado {
 
 //
@@ -110,6 +122,8 @@ struct StrLess;
 class Socket;
 class HTTPFile;
 class HTTPRequest;
+class IOLoop;
+class ThreadPool;
 
 typedef pair<int, uint32_t> Event;
 typedef vector<Event> EventList;
@@ -120,6 +134,7 @@ typedef pair<Str, Str> StrStrPair;
 typedef vector<Str> StrVector;
 typedef list<Str> StrList;
 typedef list<StrStrPair> StrStrList;
+typedef vector<StrStrPair> StrStrVector;
 typedef map<Str, Str, StrLess> StrStrMap;
 typedef multimap<Str, Str, StrLess> StrStrMMap;
 typedef multimap<Str, HTTPFile, StrLess> FileMMap;
@@ -0,0 +1,798 @@
+//
+// Copyright (C) 2013 Yeolar <yeolar@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "ctornado.h"
+
+namespace ctornado {
+
+using namespace std::placeholders;
+
+HTTPClientRequest::HTTPClientRequest(const Str& url, const Str& method,
+        const Str& body)
+{
+    url_ = url;
+    method_ = method;
+    body_ = body;
+    connect_timeout_ = HTTPCLIENT_CONNECT_TIMEOUT;
+    request_timeout_ = HTTPCLIENT_REQUEST_TIMEOUT;
+    decompress_response_ = true;
+    streaming_callback_ = nullptr;
+}
+
+HTTPClientResponse::HTTPClientResponse(HTTPClientRequest *request)
+{
+    request_ = request;
+    code_ = 599;
+    headers_ = nullptr;
+    error_ = nullptr;
+    request_time_ = 0;
+}
+
+HTTPClientResponse::~HTTPClientResponse()
+{
+    delete headers_;
+    delete error_;
+}
+
+HTTPClientFetch::HTTPClientFetch(HTTPClientRequest *request,
+        cb_client_t callback, IOLoop *ioloop)
+{
+    ioloop_ = ioloop;
+    request_ = request;
+    response_ = new HTTPClientResponse(request);
+    callback_ = callback;
+    timeout_ = nullptr;
+    start_time_ = msec_now();
+    connection_ = nullptr;
+    retried_ = false;
+}
+
+HTTPClientFetch::~HTTPClientFetch()
+{
+    if (timeout_ != nullptr)
+        ioloop_->remove_timeout(timeout_);
+    delete response_;
+    delete request_;
+}
+
+void HTTPClientFetch::complete()
+{
+    if (timeout_ != nullptr) {
+        ioloop_->remove_timeout(timeout_);
+        timeout_ = nullptr;
+    }
+    response_->request_time_ = msec_now() - start_time_;
+
+    try {
+        callback_(response_);
+    }
+    catch (Error& e) {
+        log_error("uncaught exception in fetch callback of %.*s: %s",
+                static_cast<int>(request_->url_.len()),
+                request_->url_.data(), e.what());
+    }
+    delete this;
+}
+
+void HTTPClientFetch::fail(const char *error)
+{
+    log_verb("fetch %.*s failed: %s",
+            static_cast<int>(request_->url_.len()), request_->url_.data(),
+            error);
+
+    response_->code_ = 599;
+    delete response_->error_;
+    response_->error_ = new HTTPError(599, "%s", error);
+    complete();
+}
+
+AsyncHTTPClient::AsyncHTTPClient(IOLoop *ioloop, size_t max_connections)
+{
+    ioloop_ = ioloop != nullptr ? ioloop : IOLoop::instance();
+    max_connections_ = max_connections;
+    idle_timeout_ = HTTPCLIENT_IDLE_TIMEOUT;
+    max_body_size_ = HTTPCLIENT_MAX_BODY_SIZE;
+}
+
+AsyncHTTPClient::~AsyncHTTPClient()
+{
+    for (auto& kv : pools_) {
+        delete kv.second;
+    }
+}
+
+void AsyncHTTPClient::fetch(const Str& url, cb_client_t callback)
+{
+    fetch(new HTTPClientRequest(url), callback);
+}
+
+void AsyncHTTPClient::fetch(HTTPClientRequest *request, cb_client_t callback)
+{
+    HTTPClientFetch *fetch;
+    HTTPClientPool *pool;
+    Str host, key;
+    int port, i;
+
+    fetch = new HTTPClientFetch(request, callback, ioloop_);
+
+    URL url = URL::split(request->url_);
+    host = url.host();
+
+    if (!url.scheme_.eq("http") || host.empty()) {
+        ioloop_->add_callback(bind(&HTTPClientFetch::fail, fetch,
+                    "Unsupported URL"));
+        return;
+    }
+    port = url.port() >= 0 ? url.port() : 80;
+
+    fetch->path_ = url.path_.empty() ? Str("/") : url.path_;
+    if (!url.query_.empty())
+        fetch->path_ = str_format("%S?%S", fetch->path_, url.query_);
+
+    i = url.netloc_.rfind('@');
+    fetch->host_ = i < 0 ? url.netloc_ : url.netloc_.substr(i + 1, -1);
+
+    key = str_format("%S:%d", host, port);
+    auto it = pools_.find(key);
+    if (it != pools_.end()) {
+        pool = it->second;
+    }
+    else {
+        pool = new HTTPClientPool(this, host, port);
+        pools_[key] = pool;
+    }
+    pool->fetch(fetch);
+}
+
+HTTPClientPool::HTTPClientPool(AsyncHTTPClient *client, const Str& host,
+        int port)
+{
+    client_ = client;
+    host_ = host;
+    port_ = port;
+}
+
+HTTPClientPool::~HTTPClientPool()
+{
+    HTTPClientConnection *connection;
+
+    for (auto fetch : queue_) {
+        delete fetch;
+    }
+    while (!connections_.empty()) {
+        connection = connections_.front();
+        connections_.pop_front();
+        connection->detach();
+    }
+}
+
+void HTTPClientPool::fetch(HTTPClientFetch *fetch)
+{
+    if (fetch->timeout_ == nullptr && fetch->request_->request_timeout_ > 0) {
+        fetch->timeout_ = client_->ioloop_->add_timeout(
+                fetch->start_time_ + fetch->request_->request_timeout_,
+                bind(&HTTPClientPool::on_timeout, this, fetch));
+    }
+    //
+    // A retried request goes first, it has waited already
+    //
+    if (fetch->retried_)
+        queue_.push_front(fetch);
+    else
+        queue_.push_back(fetch);
+
+    dispatch();
+}
+
+void HTTPClientPool::release(HTTPClientConnection *connection)
+{
+    idle_.push_back(connection);
+    connection->set_idle(client_->idle_timeout_);
+
+    dispatch();
+}
+
+void HTTPClientPool::remove(HTTPClientConnection *connection)
+{
+    idle_.remove(connection);
+    connections_.remove(connection);
+
+    dispatch();
+}
+
+void HTTPClientPool::dispatch()
+{
+    HTTPClientFetch *fetch;
+    HTTPClientConnection *connection;
+
+    while (!queue_.empty()) {
+        fetch = queue_.front();
+
+        //
+        // The most recently used connection is the least likely to have
+        // been closed by the server.  A retried request gets a new one.
+        //
+        if (!idle_.empty() && !fetch->retried_) {
+            connection = idle_.back();
+            idle_.pop_back();
+            queue_.pop_front();
+            connection->start(fetch);
+        }
+        else if (connections_.size() < client_->max_connections_) {
+            connection = new HTTPClientConnection(this);
+            connections_.push_back(connection);
+            queue_.pop_front();
+            connection->connect(fetch);
+        }
+        else if (!idle_.empty()) {
+            //
+            // Make room for a new connection, dispatched again once the
+            // idle one is removed
+            //
+            connection = idle_.front();
+            idle_.pop_front();
+            connection->close();
+            break;
+        }
+        else {
+            break;
+        }
+    }
+}
+
+void HTTPClientPool::on_timeout(HTTPClientFetch *fetch)
+{
+    fetch->timeout_ = nullptr;
+
+    if (fetch->connection_ != nullptr) {
+        fetch->connection_->fail("Timeout");
+        return;
+    }
+    for (auto it = queue_.begin(); it != queue_.end(); ++it) {
+        if (*it == fetch) {
+            queue_.erase(it);
+            break;
+        }
+    }
+    fetch->fail("Timeout while waiting for a connection");
+}
+
+HTTPClientConnection::HTTPClientConnection(HTTPClientPool *pool)
+{
+    pool_ = pool;
+    ioloop_ = pool->client_->ioloop_;
+    stream_ = nullptr;
+    fetch_ = nullptr;
+    requests_ = 0;
+    connector_ = nullptr;
+    connecting_ = false;
+    idle_timeout_ = nullptr;
+    keep_alive_ = false;
+    got_data_ = false;
+    body_size_ = 0;
+    decoder_ = nullptr;
+}
+
+HTTPClientConnection::~HTTPClientConnection()
+{
+    log_verb("free stream[%p]", stream_);
+    delete stream_;
+    delete decoder_;
+}
+
+void HTTPClientConnection::free(HTTPClientConnection *connection)
+{
+    log_verb("free client connection[%p]", connection);
+    delete connection;
+}
+
+void HTTPClientConnection::connect(HTTPClientFetch *fetch)
+{
+    fetch_ = fetch;
+    fetch->connection_ = this;
+    connecting_ = true;
+
+    resolve_async(pool_->host_, pool_->port_,
+            bind(&HTTPClientConnection::on_resolve, this, _1), ioloop_);
+}
+
+void HTTPClientConnection::on_resolve(const vector<sockinfo_t>& addrs)
+{
+    if (pool_ == nullptr || addrs.empty()) {
+        on_connect(nullptr);
+        return;
+    }
+    connector_ = new Connector(addrs,
+            bind(&HTTPClientConnection::on_connect, this, _1), ioloop_);
+    connector_->start(CONNPOOL_ATTEMPT_DELAY,
+            fetch_->request_->connect_timeout_);
+}
+
+void HTTPClientConnection::on_connect(IOStream *stream)
+{
+    HTTPClientFetch *fetch;
+    Str error;
+
+    connecting_ = false;
+
+    if (connector_ == nullptr)
+        error = "Unknown host";
+    else if (connector_->error_.null())
+        error = "Cannot connect";
+    else
+        error = connector_->error_;
+    connector_ = nullptr;
+
+    //
+    // Closed while connecting, the connection was forgotten then
+    //
+    if (pool_ == nullptr) {
+        if (stream != nullptr) {
+            stream->close();
+            free_stream_later(stream);
+        }
+        ioloop_->add_callback(bind(&HTTPClientConnection::free, this));
+        return;
+    }
+
+    if (stream == nullptr) {
+        fetch = fetch_;
+        fetch_ = nullptr;
+        fetch->connection_ = nullptr;
+        pool_->remove(this);
+        fetch->fail(error.tos().c_str());
+        ioloop_->add_callback(bind(&HTTPClientConnection::free, this));
+        return;
+    }
+
+    stream_ = stream;
+    stream_->set_close_callback(bind(&HTTPClientConnection::on_close, this));
+    start(fetch_);
+}
+
+void HTTPClientConnection::start(HTTPClientFetch *fetch)
+{
+    HTTPClientRequest *request;
+    Buffer out;
+    int method;
+
+    if (idle_timeout_ != nullptr) {
+        ioloop_->remove_timeout(idle_timeout_);
+        idle_timeout_ = nullptr;
+    }
+
+    fetch_ = fetch;
+    fetch->connection_ = this;
+    requests_++;
+    keep_alive_ = false;
+    got_data_ = false;
+    body_size_ = 0;
+
+    //
+    // Closed while idle, the close callback is due and retries
+    //
+    if (stream_->closed())
+        return;
+
+    request = fetch->request_;
+    method = Symbol::lookup(request->method_);
+
+    out.push(str_format("%S %S HTTP/1.1\r\n", request->method_, fetch->path_));
+    if (!request->headers_.has("Host"_s))
+        out.push(str_format("Host: %S\r\n", fetch->host_));
+
+    for (auto& kv : *request->headers_.get_all()) {
+        out.push(str_format("%S: %S\r\n", kv.first, kv.second));
+    }
+    if (request->decompress_response_ &&
+            !request->headers_.has("Accept-Encoding"_s))
+        out.push("Accept-Encoding: gzip\r\n");
+
+    if (!request->body_.null() || method == SYM_POST ||
+            method == SYM_PUT || method == SYM_PATCH)
+        out.push(str_format("Content-Length: %uz\r\n", request->body_.len()));
+
+    out.push("\r\n");
+    if (request->body_.len() > 0)
+        out.push(request->body_);
+
+    log_verb("client connection[%p] send request %d", this, requests_);
+
+    stream_->write(&out);
+    stream_->read_until("\r\n\r\n"_s,
+            bind(&HTTPClientConnection::on_headers, this, _1));
+}
+
+void HTTPClientConnection::fail(const char *error)
+{
+    HTTPClientFetch *fetch;
+
+    fetch = fetch_;
+    fetch_ = nullptr;
+    close();
+
+    if (fetch != nullptr) {
+        fetch->connection_ = nullptr;
+        fetch->fail(error);
+    }
+}
+
+void HTTPClientConnection::close()
+{
+    clear_timeouts();
+
+    //
+    // Still resolving or connecting: the pool forgets the connection
+    // now, it is freed once the connector is done
+    //
+    if (connecting_) {
+        if (pool_ != nullptr) {
+            pool_->remove(this);
+            pool_ = nullptr;
+        }
+        return;
+    }
+    if (stream_ != nullptr && !stream_->closed())
+        stream_->close();
+}
+
+void HTTPClientConnection::detach()
+{
+    HTTPClientFetch *fetch;
+
+    fetch = fetch_;
+    fetch_ = nullptr;
+    pool_ = nullptr;
+
+    if (fetch != nullptr) {
+        fetch->connection_ = nullptr;
+        delete fetch;
+    }
+    close();
+}
+
+void HTTPClientConnection::set_idle(int64_t idle_timeout)
+{
+    if (idle_timeout > 0) {
+        idle_timeout_ = ioloop_->add_timeout(
+                msec_now() + idle_timeout,
+                bind(&HTTPClientConnection::on_idle_timeout, this));
+    }
+}
+
+void HTTPClientConnection::on_idle_timeout()
+{
+    log_verb("client connection[%p] idle timeout", this);
+
+    idle_timeout_ = nullptr;
+    close();
+}
+
+void HTTPClientConnection::on_close()
+{
+    HTTPClientFetch *fetch;
+    int method;
+
+    log_verb("client connection[%p] closed", this);
+
+    clear_timeouts();
+
+    fetch = fetch_;
+    fetch_ = nullptr;
+
+    if (pool_ != nullptr) {
+        pool_->remove(this);
+
+        if (fetch != nullptr) {
+            fetch->connection_ = nullptr;
+            method = Symbol::lookup(fetch->request_->method_);
+
+            //
+            // A kept alive connection may have been closed by the server
+            // before it got the request: retry an idempotent request once
+            //
+            if (requests_ > 1 && !got_data_ && !fetch->retried_ &&
+                    (method == SYM_GET || method == SYM_HEAD)) {
+                log_verb("retry %.*s on a new connection",
+                        static_cast<int>(fetch->request_->url_.len()),
+                        fetch->request_->url_.data());
+                fetch->retried_ = true;
+                pool_->fetch(fetch);
+            }
+            else if (requests_ <= 1 && !got_data_ &&
+                    stream_->error_ != nullptr) {
+                fetch->fail(stream_->error_->what());
+            }
+            else {
+                fetch->fail(got_data_ ? "Connection closed" :
+                        "Connection closed before response");
+            }
+        }
+    }
+    ioloop_->add_callback(bind(&HTTPClientConnection::free, this));
+}
+
+void HTTPClientConnection::on_headers(const Str& data)
+{
+    HTTPClientRequest *request;
+    HTTPClientResponse *response;
+    HTTPHeaders *headers;
+    Str line, version, encoding, length;
+    int eol, sp, end, code, connection;
+
+    //
+    // Failed or dropped meanwhile, with the callback already queued
+    //
+    if (fetch_ == nullptr)
+        return;
+
+    got_data_ = true;
+    request = fetch_->request_;
+    response = fetch_->response_;
+
+    eol = data.find("\r\n");
+    line = data.substr(0, eol);
+    sp = line.find(' ');
+    end = sp < 0 ? -1 : line.find(' ', sp + 1);
+    code = sp < 0 ? 0 : line.substr(sp + 1, end).toi();
+
+    if (!line.starts_with("HTTP/") || code < 100 || code > 599) {
+        fail("Malformed HTTP response");
+        return;
+    }
+    //
+    // Interim responses such as 100 Continue come before the final one
+    //
+    if (code < 200) {
+        stream_->read_until("\r\n\r\n"_s,
+                bind(&HTTPClientConnection::on_headers, this, _1));
+        return;
+    }
+    version = line.substr(0, sp);
+
+    delete response->headers_;
+    response->headers_ = headers = HTTPHeaders::parse(data.substr(eol, -1));
+    response->code_ = code;
+    response->reason_ = end < 0 ? Str("") : line.substr(end + 1, -1);
+
+    connection = Symbol::lookup(headers->get("Connection"_s));
+    if (version.eq("HTTP/1.1"))
+        keep_alive_ = connection != SYM_CLOSE;
+    else
+        keep_alive_ = connection == SYM_KEEP_ALIVE;
+    if (Symbol::lookup(request->headers_.get("Connection"_s)) == SYM_CLOSE)
+        keep_alive_ = false;
+
+    encoding = headers->get("Content-Encoding"_s);
+    if (request->decompress_response_ && !encoding.null() &&
+            encoding.ieq("gzip")) {
+        headers->remove("Content-Encoding");
+        headers->set("X-Consumed-Content-Encoding", encoding);
+        decoder_ = new GZipDecompressor(STR_BUF_16K,
+                pool_->client_->max_body_size_, GZIP_MAX_RATIO);
+    }
+
+    if (Symbol::lookup(request->method_) == SYM_HEAD ||
+            code == 204 || code == 304) {
+        finish();
+        return;
+    }
+
+    encoding = headers->get("Transfer-Encoding"_s);
+    if (!encoding.null() && encoding.ieq("chunked")) {
+        stream_->read_until("\r\n"_s,
+                bind(&HTTPClientConnection::on_chunk_length, this, _1));
+        return;
+    }
+
+    length = headers->get("Content-Length"_s);
+    if (!length.null()) {
+        if (length.toi() < 0 ||
+                static_cast<size_t>(length.toi()) >
+                pool_->client_->max_body_size_) {
+            fail("Content-Length too long");
+            return;
+        }
+        if (length.toi() == 0) {
+            finish();
+        }
+        else if (decoder_ != nullptr ||
+                request->streaming_callback_ != nullptr) {
+            stream_->read_bytes(length.toi(),
+                    bind(&HTTPClientConnection::on_body, this, _1),
+                    bind(&HTTPClientConnection::on_data, this, _1));
+        }
+        else {
+            stream_->read_bytes(length.toi(),
+                    bind(&HTTPClientConnection::on_body, this, _1));
+        }
+        return;
+    }
+
+    //
+    // The body ends with the connection
+    //
+    keep_alive_ = false;
+    stream_->read_until_close(bind(&HTTPClientConnection::on_body, this, _1),
+            bind(&HTTPClientConnection::on_data, this, _1));
+}
+
+void HTTPClientConnection::on_chunk_length(const Str& data)
+{
+    size_t length;
+
+    if (fetch_ == nullptr)
+        return;
+
+    if (!parse_chunk_size(data, &length)) {
+        fail("Malformed chunked response");
+        return;
+    }
+
+    if (length == 0) {
+        stream_->read_until("\r\n"_s,
+                bind(&HTTPClientConnection::on_trailer, this, _1));
+    }
+    else {
+        stream_->read_bytes(length + 2,
+                bind(&HTTPClientConnection::on_chunk_data, this, _1));
+    }
+}
+
+void HTTPClientConnection::on_chunk_data(const Str& data)
+{
+    if (fetch_ == nullptr)
+        return;
+
+    if (!data.ends_with("\r\n")) {
+        fail("Malformed chunked response");
+        return;
+    }
+    if (!handle_data(data.substr(0, data.len() - 2)))
+        return;
+
+    stream_->read_until("\r\n"_s,
+            bind(&HTTPClientConnection::on_chunk_length, this, _1));
+}
+
+void HTTPClientConnection::on_trailer(const Str& data)
+{
+    if (fetch_ == nullptr)
+        return;
+
+    if (data.len() == 2) {
+        finish();
+        return;
+    }
+    stream_->read_until("\r\n"_s,
+            bind(&HTTPClientConnection::on_trailer, this, _1));
+}
+
+void HTTPClientConnection::on_data(const Str& data)
+{
+    if (fetch_ != nullptr)
+        handle_data(data);
+}
+
+void HTTPClientConnection::on_body(const Str& data)
+{
+    if (fetch_ != nullptr && handle_data(data))
+        finish();
+}
+
+bool HTTPClientConnection::handle_data(const Str& data)
+{
+    cb_stream_t& streaming_callback = fetch_->request_->streaming_callback_;
+    Buffer *buffer;
+
+    if (data.len() == 0)
+        return true;
+
+    body_size_ += data.len();
+
+    if (decoder_ != nullptr) {
+        try {
+            decoder_->decompress(data);
+        }
+        catch (GZipError& e) {
+            fail("Malformed gzip response");
+            return false;
+        }
+        if (streaming_callback != nullptr) {
+            buffer = decoder_->get_buffer();
+            while (buffer->size() > 0) {
+                streaming_callback(buffer->pop());
+            }
+        }
+        return true;
+    }
+    if (streaming_callback != nullptr) {
+        streaming_callback(data);
+        return true;
+    }
+
+    if (body_size_ > pool_->client_->max_body_size_) {
+        fail("Response body too long");
+        return false;
+    }
+    body_.push(data);
+    return true;
+}
+
+void HTTPClientConnection::finish()
+{
+    HTTPClientFetch *fetch;
+    HTTPClientResponse *response;
+    Buffer *buffer;
+
+    fetch = fetch_;
+    response = fetch->response_;
+
+    if (decoder_ != nullptr) {
+        try {
+            decoder_->close();
+        }
+        catch (GZipError& e) {
+            fail("Malformed gzip response");
+            return;
+        }
+        //
+        // A body cut short must not pass for the whole one, an empty
+        // body is taken as is
+        //
+        if (body_size_ > 0 && !decoder_->finished()) {
+            fail("Truncated gzip response");
+            return;
+        }
+        if (fetch->request_->streaming_callback_ != nullptr) {
+            buffer = decoder_->get_buffer();
+            while (buffer->size() > 0) {
+                fetch->request_->streaming_callback_(buffer->pop());
+            }
+        }
+        else {
+            response->body_ = decoder_->get_value();
+        }
+        delete decoder_;
+        decoder_ = nullptr;
+    }
+    else if (body_.size() > 0) {
+        body_.merge_prefix(body_.size());
+        response->body_ = body_.pop();
+    }
+    if (response->body_.null())
+        response->body_ = "";
+
+    fetch_ = nullptr;
+    fetch->connection_ = nullptr;
+
+    if (keep_alive_ && !stream_->closed())
+        pool_->release(this);
+    else
+        close();
+
+    fetch->complete();
+}
+
+void HTTPClientConnection::clear_timeouts()
+{
+    if (idle_timeout_ != nullptr) {
+        ioloop_->remove_timeout(idle_timeout_);
+        idle_timeout_ = nullptr;
+    }
+}
+
+} // namespace ctornado
@@ -0,0 +1,299 @@
+//
+// Copyright (C) 2013 Yeolar <yeolar@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef __HTTPCLIENT_H
+#define __HTTPCLIENT_H
+
+#include "ctornado.h"
+
+namespace ctornado {
+
+#define HTTPCLIENT_MAX_CONNECTIONS  16
+#define HTTPCLIENT_CONNECT_TIMEOUT  20000
+#define HTTPCLIENT_REQUEST_TIMEOUT  20000
+#define HTTPCLIENT_IDLE_TIMEOUT     60000
+#define HTTPCLIENT_MAX_BODY_SIZE    104857600
+
+class Connector;
+class AsyncHTTPClient;
+class HTTPClientPool;
+class HTTPClientConnection;
+
+//
+// HTTP client request object.
+//
+// The timeouts are in milliseconds: connect_timeout_ for the connection
+// to be established, request_timeout_ for the whole request, waiting for
+// a free connection included.
+//
+// If decompress_response_ is set, the server is asked for a gzip encoded
+// response, which is decompressed as it arrives.
+//
+// If streaming_callback_ is set, it is called with the chunks of the
+// response body as they arrive, and the body of the final response is
+// empty.
+//
+class HTTPClientRequest
+{
+public:
+    HTTPClientRequest(const Str& url, const Str& method="GET",
+            const Str& body=nullstr);
+    ~HTTPClientRequest() {}
+
+    Str url_;
+    Str method_;
+    HTTPHeaders headers_;
+    Str body_;
+    int64_t connect_timeout_;
+    int64_t request_timeout_;
+    bool decompress_response_;
+    cb_stream_t streaming_callback_;
+};
+
+//
+// HTTP response object.
+//
+// If the request failed without a response, code_ is 599 and error_
+// holds the reason, e.g. a timeout or a closed connection.  The
+// request_time_ is the time the fetch took, in milliseconds.
+//
+class HTTPClientResponse
+{
+public:
+    HTTPClientResponse(HTTPClientRequest *request);
+    ~HTTPClientResponse();
+
+    HTTPClientRequest *request_;
+    int code_;
+    Str reason_;
+    HTTPHeaders *headers_;
+    Str body_;
+    Error *error_;
+    int64_t request_time_;
+};
+
+typedef function<void (HTTPClientResponse *)> cb_client_t;
+
+//
+// A request in progress: queued in a pool, or sent on a connection.
+//
+class HTTPClientFetch
+{
+public:
+    HTTPClientFetch(HTTPClientRequest *request, cb_client_t callback,
+            IOLoop *ioloop);
+    ~HTTPClientFetch();
+
+    //
+    // Runs the callback with the response, the fetch is freed.
+    //
+    void complete();
+
+    //
+    // Completes with a 599 response and the given error.
+    //
+    void fail(const char *error);
+
+    IOLoop *ioloop_;
+    HTTPClientRequest *request_;
+    HTTPClientResponse *response_;
+    cb_client_t callback_;
+    Str path_;
+    Str host_;
+    Timeout *timeout_;
+    int64_t start_time_;
+    HTTPClientConnection *connection_;
+    bool retried_;
+};
+
+//
+// A non-blocking HTTP client.
+//
+//    void handle_response(HTTPClientResponse *response)
+//    {
+//        if (response->error_ != nullptr)
+//            log_error("Error: %s", response->error_->what());
+//        else
+//            response->body_.println();
+//    }
+//
+//    client = new AsyncHTTPClient();
+//    client->fetch("http://www.google.com/", handle_response);
+//
+// The connections are kept alive per host and port, up to
+// max_connections of them.  A request is sent on an idle connection if
+// there is one, the last used first, or on a new connection; if there
+// are already max_connections it waits for one to be free.  Requests
+// are not pipelined.  An idle connection is closed after idle_timeout_
+// msec.
+//
+// A GET or HEAD request sent on a kept alive connection which the server
+// closed meanwhile is retried once on a new connection.
+//
+// The callback is never called before fetch() returns.  The request and
+// the response are freed once it returns.  When the client is freed, the
+// requests in progress or queued are dropped without their callback
+// being called, and the connections closed.
+//
+// Only plain http URLs are supported.  The host name is resolved on the
+// ThreadPool, and a new connection made with Happy Eyeballs by a
+// Connector, so neither blocks the IOLoop.
+//
+class AsyncHTTPClient
+{
+public:
+    AsyncHTTPClient(IOLoop *ioloop=nullptr,
+            size_t max_connections=HTTPCLIENT_MAX_CONNECTIONS);
+    ~AsyncHTTPClient();
+
+    AsyncHTTPClient(const AsyncHTTPClient&) = delete;
+    AsyncHTTPClient& operator=(const AsyncHTTPClient&) = delete;
+
+    //
+    // Executes a request, calling callback with an HTTPClientResponse.
+    // The request is freed after the callback.
+    //
+    void fetch(HTTPClientRequest *request, cb_client_t callback);
+    void fetch(const Str& url, cb_client_t callback);
+
+    IOLoop *ioloop_;
+    size_t max_connections_;
+    int64_t idle_timeout_;
+    size_t max_body_size_;
+
+private:
+    map<Str, HTTPClientPool *, StrLess> pools_;
+};
+
+//
+// The connections to a host and port, and the requests waiting for one.
+//
+class HTTPClientPool
+{
+public:
+    HTTPClientPool(AsyncHTTPClient *client, const Str& host, int port);
+    ~HTTPClientPool();
+
+    //
+    // Queues the request, and sends it if a connection is free.
+    //
+    void fetch(HTTPClientFetch *fetch);
+
+    //
+    // Takes back a connection done with its request, kept alive.
+    //
+    void release(HTTPClientConnection *connection);
+
+    //
+    // Forgets a closed connection.
+    //
+    void remove(HTTPClientConnection *connection);
+
+    AsyncHTTPClient *client_;
+    Str host_;
+    int port_;
+
+private:
+    list<HTTPClientConnection *> connections_;
+    list<HTTPClientConnection *> idle_;
+    deque<HTTPClientFetch *> queue_;
+
+    void dispatch();
+    void on_timeout(HTTPClientFetch *fetch);
+};
+
+//
+// A connection to an HTTP server, reading one response at a time.
+//
+// Bodies delimited by Content-Length or chunked, or by the end of the
+// connection, are supported.
+//
+class HTTPClientConnection
+{
+public:
+    HTTPClientConnection(HTTPClientPool *pool);
+    ~HTTPClientConnection();
+
+    static void free(HTTPClientConnection *connection);
+
+    //
+    // Connects, then sends the request.
+    //
+    void connect(HTTPClientFetch *fetch);
+
+    //
+    // Sends the request on the connection.
+    //
+    void start(HTTPClientFetch *fetch);
+
+    //
+    // Fails the request in progress, if any, and closes the connection.
+    //
+    void fail(const char *error);
+
+    void close();
+
+    //
+    // Drops the request in progress, if any, and closes the connection,
+    // left to free itself: the pool is being freed.
+    //
+    void detach();
+
+    //
+    // Keeps the idle connection for idle_timeout msec.
+    //
+    void set_idle(int64_t idle_timeout);
+
+    HTTPClientPool *pool_;
+    IOLoop *ioloop_;
+    IOStream *stream_;
+    HTTPClientFetch *fetch_;
+    int requests_;
+
+private:
+    Connector *connector_;
+    bool connecting_;
+    Timeout *idle_timeout_;
+    bool keep_alive_;
+    bool got_data_;
+    size_t body_size_;
+    Buffer body_;
+    GZipDecompressor *decoder_;
+
+    void on_resolve(const vector<sockinfo_t>& addrs);
+    void on_connect(IOStream *stream);
+    void on_idle_timeout();
+    void on_close();
+    void on_headers(const Str& data);
+    void on_chunk_length(const Str& data);
+    void on_chunk_data(const Str& data);
+    void on_trailer(const Str& data);
+    void on_data(const Str& data);
+    void on_body(const Str& data);
+
+    //
+    // Hands the body data to the streaming callback or buffers it,
+    // decompressed if needed.  Returns false if the request failed.
+    //
+    bool handle_data(const Str& data);
+
+    void finish();
+    void clear_timeouts();
+};
+
+} // namespace ctornado
+
+#endif // __HTTPCLIENT_H
@@ -0,0 +1,884 @@
+//
+// Copyright (C) 2013 Yeolar <yeolar@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "ctornado.h"
+
+namespace ctornado {
+
+using namespace std::placeholders;
+
+static void on_idle_close(Upstream *upstream, IOStream *stream)
+{
+    log_verb("idle upstream stream[%p] closed", stream);
+
+    upstream->idle_.remove(stream);
+    free_stream_later(stream);
+}
+
+static bool is_hop_by_hop(int name)
+{
+    switch (name) {
+    case SYM_CONNECTION:
+    case SYM_KEEP_ALIVE:
+    case SYM_PROXY_CONNECTION:
+    case SYM_TE:
+    case SYM_TRAILER:
+    case SYM_TRANSFER_ENCODING:
+    case SYM_UPGRADE:
+        return true;
+    }
+    return false;
+}
+
+static uint32_t hash_point(const Str& key)
+{
+    uint8_t digest[MD5_LEN];
+
+    md5(digest, reinterpret_cast<const uint8_t *>(key.data()), key.len());
+
+    return (static_cast<uint32_t>(digest[3]) << 24) |
+        (static_cast<uint32_t>(digest[2]) << 16) |
+        (static_cast<uint32_t>(digest[1]) << 8) | digest[0];
+}
+
+static bool was_tried(const vector<Upstream *>& tried, Upstream *upstream)
+{
+    return find(tried.begin(), tried.end(), upstream) != tried.end();
+}
+
+Upstream::Upstream(const Str& host, int port, int weight)
+{
+    host_ = host;
+    port_ = port;
+    weight_ = weight > 0 ? weight : 1;
+    active_ = 0;
+    current_ = 0;
+    fails_ = 0;
+    ejected_until_ = 0;
+    healthy_ = true;
+    checking_ = false;
+}
+
+Upstream::~Upstream()
+{
+    for (auto stream : idle_) {
+        stream->set_close_callback(nullptr);
+        stream->close();
+        delete stream;
+    }
+}
+
+bool Upstream::available(int64_t now)
+{
+    return healthy_ && ejected_until_ <= now;
+}
+
+ReverseProxy::ReverseProxy(int policy, IOLoop *ioloop)
+{
+    ioloop_ = ioloop != nullptr ? ioloop : IOLoop::instance();
+    policy_ = policy;
+    max_fails_ = PROXY_MAX_FAILS;
+    fail_timeout_ = PROXY_FAIL_TIMEOUT;
+    connect_timeout_ = PROXY_CONNECT_TIMEOUT;
+    read_timeout_ = PROXY_READ_TIMEOUT;
+    max_idle_ = PROXY_MAX_IDLE;
+    next_ = 0;
+    health_checker_ = nullptr;
+    client_ = nullptr;
+}
+
+ReverseProxy::~ReverseProxy()
+{
+    if (health_checker_ != nullptr) {
+        health_checker_->stop();
+        delete health_checker_;
+    }
+    delete client_;
+
+    for (auto upstream : upstreams_) {
+        delete upstream;
+    }
+}
+
+void ReverseProxy::add_upstream(const Str& host, int port, int weight)
+{
+    upstreams_.push_back(new Upstream(host, port, weight));
+    build_ring();
+}
+
+void ReverseProxy::start_health_checks(const Str& path, int64_t interval)
+{
+    health_path_ = path;
+
+    if (client_ == nullptr)
+        client_ = new AsyncHTTPClient(ioloop_);
+    if (health_checker_ != nullptr) {
+        health_checker_->stop();
+        delete health_checker_;
+    }
+    health_checker_ = new PeriodicCallback(
+            bind(&ReverseProxy::check_health, this), interval, ioloop_);
+    health_checker_->start();
+
+    check_health();
+}
+
+cb_req_t ReverseProxy::callback()
+{
+    return bind(&ReverseProxy::handle_request, this, _1);
+}
+
+void ReverseProxy::handle_request(HTTPRequest *request)
+{
+    (new ProxyRequest(this, request))->start();
+}
+
+Str ReverseProxy::hash_key(HTTPRequest *request)
+{
+    return request->uri_;
+}
+
+Upstream *ReverseProxy::select(HTTPRequest *request,
+        const vector<Upstream *>& tried)
+{
+    int64_t now;
+
+    now = msec_now();
+
+    switch (policy_) {
+    case LEAST_CONNECTIONS:
+        return select_least_connections(now, tried);
+    case CONSISTENT_HASH:
+        return select_hash(now, tried, hash_key(request));
+    default:
+        return select_round_robin(now, tried);
+    }
+}
+
+void ReverseProxy::succeeded(Upstream *upstream)
+{
+    upstream->fails_ = 0;
+}
+
+void ReverseProxy::failed(Upstream *upstream)
+{
+    if (++upstream->fails_ < max_fails_)
+        return;
+
+    log_warn("upstream %.*s:%d failed %d times, ejected for %lld msec",
+            static_cast<int>(upstream->host_.len()), upstream->host_.data(),
+            upstream->port_, upstream->fails_,
+            static_cast<long long>(fail_timeout_));
+
+    upstream->fails_ = 0;
+    upstream->ejected_until_ = msec_now() + fail_timeout_;
+}
+
+void ReverseProxy::build_ring()
+{
+    int i, n;
+
+    ring_.clear();
+
+    for (auto upstream : upstreams_) {
+        n = PROXY_HASH_POINTS * upstream->weight_;
+        for (i = 0; i < n; i++) {
+            ring_.push_back(make_pair(hash_point(str_format("%S:%d-%d",
+                                upstream->host_, upstream->port_, i)),
+                        upstream));
+        }
+    }
+    sort(ring_.begin(), ring_.end(),
+            [](const pair<uint32_t, Upstream *>& a,
+                const pair<uint32_t, Upstream *>& b) {
+                return a.first < b.first;
+            });
+}
+
+//
+// Each available upstream gains its weight, the one with the highest
+// current weight is chosen and loses the total, as in nginx.
+//
+Upstream *ReverseProxy::select_round_robin(int64_t now,
+        const vector<Upstream *>& tried)
+{
+    Upstream *best;
+    int total;
+
+    best = nullptr;
+    total = 0;
+
+    for (auto upstream : upstreams_) {
+        if (!upstream->available(now) || was_tried(tried, upstream))
+            continue;
+
+        upstream->current_ += upstream->weight_;
+        total += upstream->weight_;
+
+        if (best == nullptr || upstream->current_ > best->current_)
+            best = upstream;
+    }
+    if (best != nullptr)
+        best->current_ -= total;
+
+    return best;
+}
+
+Upstream *ReverseProxy::select_least_connections(int64_t now,
+        const vector<Upstream *>& tried)
+{
+    Upstream *best, *upstream;
+    size_t i, n;
+
+    best = nullptr;
+    n = upstreams_.size();
+
+    for (i = 0; i < n; i++) {
+        upstream = upstreams_[(next_ + i) % n];
+        if (!upstream->available(now) || was_tried(tried, upstream))
+            continue;
+
+        if (best == nullptr || upstream->active_ * best->weight_ <
+                best->active_ * upstream->weight_)
+            best = upstream;
+    }
+    if (n > 0)
+        next_ = (next_ + 1) % n;
+
+    return best;
+}
+
+Upstream *ReverseProxy::select_hash(int64_t now,
+        const vector<Upstream *>& tried, const Str& key)
+{
+    Upstream *upstream;
+    uint32_t point;
+    size_t i, start;
+
+    if (ring_.empty())
+        return nullptr;
+
+    point = hash_point(key);
+    start = lower_bound(ring_.begin(), ring_.end(),
+            make_pair(point, static_cast<Upstream *>(nullptr))) -
+        ring_.begin();
+
+    for (i = 0; i < ring_.size(); i++) {
+        upstream = ring_[(start + i) % ring_.size()].second;
+        if (upstream->available(now) && !was_tried(tried, upstream))
+            return upstream;
+    }
+    return nullptr;
+}
+
+void ReverseProxy::check_health()
+{
+    HTTPClientRequest *request;
+    Str host;
+
+    for (auto upstream : upstreams_) {
+        if (upstream->checking_)
+            continue;
+        upstream->checking_ = true;
+
+        host = upstream->host_.find(':') >= 0 ?
+            str_format("[%S]", upstream->host_) : upstream->host_;
+
+        request = new HTTPClientRequest(str_format("http://%S:%d%S",
+                    host, upstream->port_, health_path_));
+        request->connect_timeout_ = connect_timeout_;
+        request->request_timeout_ = connect_timeout_;
+        request->decompress_response_ = false;
+
+        client_->fetch(request,
+                bind(&ReverseProxy::on_health, this, upstream, _1));
+    }
+}
+
+void ReverseProxy::on_health(Upstream *upstream,
+        HTTPClientResponse *response)
+{
+    list<IOStream *> idle;
+    bool healthy;
+
+    upstream->checking_ = false;
+    healthy = response->code_ >= 200 && response->code_ < 400;
+
+    if (healthy) {
+        if (!upstream->healthy_) {
+            log_info("upstream %.*s:%d is healthy",
+                    static_cast<int>(upstream->host_.len()),
+                    upstream->host_.data(), upstream->port_);
+        }
+        upstream->healthy_ = true;
+        upstream->fails_ = 0;
+        upstream->ejected_until_ = 0;
+        return;
+    }
+
+    if (upstream->healthy_) {
+        log_warn("upstream %.*s:%d failed health check: %d, ejected",
+                static_cast<int>(upstream->host_.len()),
+                upstream->host_.data(), upstream->port_, response->code_);
+    }
+    upstream->healthy_ = false;
+
+    idle = upstream->idle_;
+    for (auto stream : idle) {
+        stream->close();
+    }
+}
+
+ProxyRequest::ProxyRequest(ReverseProxy *proxy, HTTPRequest *request)
+{
+    proxy_ = proxy;
+    request_ = request;
+    client_ = request->connection_->stream_;
+    upstream_ = nullptr;
+    stream_ = nullptr;
+    timeout_ = nullptr;
+    bytes_read_ = 0;
+    reused_ = false;
+    retried_ = false;
+    got_data_ = false;
+    responded_ = false;
+    keep_alive_ = false;
+    timed_out_ = false;
+    dechunk_ = false;
+
+    build_head();
+}
+
+ProxyRequest::~ProxyRequest()
+{
+    clear_timeout();
+}
+
+void ProxyRequest::start()
+{
+    IOStream *stream;
+
+    upstream_ = proxy_->select(request_, tried_);
+    if (upstream_ == nullptr) {
+        log_warn("no upstream available for %.*s",
+                static_cast<int>(request_->uri_.len()),
+                request_->uri_.data());
+        fail(502);
+        return;
+    }
+    tried_.push_back(upstream_);
+    upstream_->active_++;
+
+    while (!upstream_->idle_.empty()) {
+        stream = upstream_->idle_.front();
+        upstream_->idle_.pop_front();
+
+        //
+        // Closed while idle, its close callback is due and frees it
+        //
+        if (stream->closed())
+            continue;
+
+        stream_ = stream;
+        stream_->set_close_callback(bind(&ProxyRequest::on_close, this));
+        reused_ = true;
+        send();
+        return;
+    }
+    connect();
+}
+
+void ProxyRequest::build_head()
+{
+    Buffer out;
+    Str forwarded_for;
+
+    out.push(str_format("%S %S %S\r\n", request_->method_, request_->uri_,
+                request_->supports_http_1_1() ? Str("HTTP/1.1") :
+                Str("HTTP/1.0")));
+
+    for (auto& kv : *request_->headers_->get_all()) {
+        switch (Symbol::lookup(kv.first)) {
+        case SYM_CONNECTION:
+        case SYM_KEEP_ALIVE:
+        case SYM_PROXY_CONNECTION:
+        case SYM_TE:
+        case SYM_TRAILER:
+        case SYM_TRANSFER_ENCODING:
+        case SYM_UPGRADE:
+        case SYM_EXPECT:
+        case SYM_CONTENT_LENGTH:
+        case SYM_X_REAL_IP:
+        case SYM_X_FORWARDED_PROTO:
+            break;
+        case SYM_X_FORWARDED_FOR:
+            forwarded_for = kv.second;
+            break;
+        default:
+            out.push(str_format("%S: %S\r\n", kv.first, kv.second));
+        }
+    }
+
+    if (forwarded_for.empty())
+        forwarded_for = request_->remote_ip_;
+    else
+        forwarded_for = str_format("%S, %S", forwarded_for,
+                request_->remote_ip_);
+
+    out.push(str_format("X-Forwarded-For: %S\r\n"
+                "X-Real-Ip: %S\r\n"
+                "X-Forwarded-Proto: %S\r\n",
+                forwarded_for, request_->remote_ip_, request_->protocol_));
+
+    if (!request_->supports_http_1_1())
+        out.push("Connection: keep-alive\r\n");
+
+    if (!request_->body_.null())
+        out.push(str_format("Content-Length: %uz\r\n",
+                    request_->body_.len()));
+
+    out.push("\r\n");
+
+    out.merge_prefix(out.size());
+    head_ = out.pop();
+}
+
+void ProxyRequest::connect()
+{
+    reused_ = false;
+
+    resolve_async(upstream_->host_, upstream_->port_,
+            bind(&ProxyRequest::on_resolve, this, _1), proxy_->ioloop_);
+}
+
+void ProxyRequest::on_resolve(const vector<sockinfo_t>& addrs)
+{
+    Connector *connector;
+
+    if (addrs.empty()) {
+        log_warn("upstream %.*s:%d could not be resolved",
+                static_cast<int>(upstream_->host_.len()),
+                upstream_->host_.data(), upstream_->port_);
+        on_connect(nullptr);
+        return;
+    }
+    connector = new Connector(addrs,
+            bind(&ProxyRequest::on_connect, this, _1), proxy_->ioloop_);
+    connector->start(CONNPOOL_ATTEMPT_DELAY, proxy_->connect_timeout_);
+}
+
+void ProxyRequest::on_connect(IOStream *stream)
+{
+    //
+    // None of the addresses answered: try another upstream
+    //
+    if (stream == nullptr) {
+        upstream_->active_--;
+        proxy_->failed(upstream_);
+        start();
+        return;
+    }
+    stream_ = stream;
+    stream_->set_close_callback(bind(&ProxyRequest::on_close, this));
+    send();
+}
+
+void ProxyRequest::send()
+{
+    Buffer out;
+
+    set_read_timeout();
+
+    out.push(head_);
+    if (request_->body_.len() > 0)
+        out.push(request_->body_);
+
+    stream_->write(&out);
+    stream_->read_until("\r\n\r\n"_s,
+            bind(&ProxyRequest::on_headers, this, _1));
+}
+
+void ProxyRequest::set_read_timeout()
+{
+    clear_timeout();
+
+    if (proxy_->read_timeout_ > 0) {
+        bytes_read_ = stream_->bytes_read_;
+        timeout_ = proxy_->ioloop_->add_timeout(
+                msec_now() + proxy_->read_timeout_,
+                bind(&ProxyRequest::on_timeout, this));
+    }
+}
+
+void ProxyRequest::on_timeout()
+{
+    timeout_ = nullptr;
+
+    //
+    // The body may be relayed without a callback for long: the upstream
+    // only times out if nothing was read from it meanwhile
+    //
+    if (responded_ && stream_->bytes_read_ != bytes_read_) {
+        set_read_timeout();
+        return;
+    }
+    timed_out_ = true;
+
+    log_warn("upstream %.*s:%d timed out reading",
+            static_cast<int>(upstream_->host_.len()), upstream_->host_.data(),
+            upstream_->port_);
+
+    stream_->close();
+}
+
+void ProxyRequest::on_close()
+{
+    IOStream *stream;
+    int method;
+
+    stream = stream_;
+    stream_ = nullptr;
+    clear_timeout();
+    upstream_->active_--;
+    free_stream_later(stream);
+
+    if (responded_) {
+        //
+        // The response is cut short, so is the connection to the client
+        //
+        log_warn("upstream %.*s:%d closed before the end of the response",
+                static_cast<int>(upstream_->host_.len()),
+                upstream_->host_.data(), upstream_->port_);
+
+        if (!client_->closed())
+            client_->close();
+        finish();
+        return;
+    }
+
+    method = request_->method_id_;
+    if (reused_ && !got_data_ && !timed_out_ && !retried_ &&
+            (method == SYM_GET || method == SYM_HEAD)) {
+        //
+        // A kept alive connection may have been closed by the upstream
+        // before it got the request
+        //
+        log_verb("retry %.*s on a new upstream connection",
+                static_cast<int>(request_->uri_.len()),
+                request_->uri_.data());
+        retried_ = true;
+        upstream_->active_++;
+        connect();
+        return;
+    }
+
+    if (!got_data_)
+        proxy_->failed(upstream_);
+    fail(timed_out_ ? 504 : 502);
+}
+
+void ProxyRequest::on_headers(const Str& data)
+{
+    Buffer out;
+    Str line, version, name, header, encoding, length;
+    int eol, next, sp, code, connection;
+    bool chunked, close_delimited;
+
+    got_data_ = true;
+
+    eol = data.find("\r\n");
+    line = data.substr(0, eol);
+    sp = line.find(' ');
+    code = sp < 0 ? 0 : line.substr(sp + 1, line.find(' ', sp + 1)).toi();
+
+    if (!line.starts_with("HTTP/") || code < 100 || code > 599) {
+        log_warn("malformed response from upstream %.*s:%d",
+                static_cast<int>(upstream_->host_.len()),
+                upstream_->host_.data(), upstream_->port_);
+        stream_->close();
+        return;
+    }
+    //
+    // Interim responses such as 100 Continue are not forwarded, the
+    // server answered Expect itself
+    //
+    if (code < 200) {
+        stream_->read_until("\r\n\r\n"_s,
+                bind(&ProxyRequest::on_headers, this, _1));
+        return;
+    }
+    set_read_timeout();
+    proxy_->succeeded(upstream_);
+
+    version = line.substr(0, sp);
+    keep_alive_ = version.eq("HTTP/1.1");
+    chunked = false;
+    length = nullstr;
+
+    //
+    // The header lines are forwarded as they are, but the hop-by-hop
+    // ones, so repeated headers such as Set-Cookie are kept
+    //
+    out.push(str_format("HTTP/1.1 %S\r\n", line.substr(sp + 1, -1)));
+
+    for (eol += 2; eol < static_cast<int>(data.len()) - 2; eol = next + 2) {
+        next = data.find("\r\n", eol);
+        header = data.substr(eol, next);
+        name = header.substr(0, header.find(':')).strip();
+
+        switch (Symbol::lookup(name)) {
+        case SYM_CONNECTION:
+            connection = Symbol::lookup(header.substr(
+                        header.find(':') + 1, -1).strip());
+            if (connection == SYM_CLOSE)
+                keep_alive_ = false;
+            else if (connection == SYM_KEEP_ALIVE)
+                keep_alive_ = true;
+            continue;
+        case SYM_TRANSFER_ENCODING:
+            encoding = header.substr(header.find(':') + 1, -1).strip();
+            chunked = encoding.ieq("chunked");
+            if (chunked && !request_->supports_http_1_1())
+                continue;
+            break;
+        case SYM_CONTENT_LENGTH:
+            length = header.substr(header.find(':') + 1, -1).strip();
+            break;
+        }
+        if (!is_hop_by_hop(Symbol::lookup(name)) ||
+                Symbol::lookup(name) == SYM_TRANSFER_ENCODING)
+            out.push(str_format("%S\r\n", header));
+    }
+
+    close_delimited = false;
+    if (request_->method_id_ == SYM_HEAD || code == 204 || code == 304) {
+        chunked = false;
+        length = "0";
+    }
+    else if (!chunked && length.null()) {
+        close_delimited = true;
+        keep_alive_ = false;
+        request_->connection_->no_keep_alive_ = true;
+    }
+    else if (chunked && !request_->supports_http_1_1()) {
+        //
+        // An HTTP/1.0 client does not know chunked: the body goes without
+        // its framing, and ends with the connection
+        //
+        dechunk_ = true;
+        request_->connection_->no_keep_alive_ = true;
+    }
+
+    if (!request_->connection_->keep_alive())
+        out.push("Connection: close\r\n");
+    else if (!request_->supports_http_1_1())
+        out.push("Connection: keep-alive\r\n");
+    out.push("\r\n");
+
+    out.merge_prefix(out.size());
+    responded_ = true;
+
+    //
+    // A small body is written with the head, splicing it would cost more
+    // system calls than copying it
+    //
+    if (!chunked && !close_delimited && length.toi() > 0 &&
+            length.toi() < PROXY_SPLICE_THRESHOLD) {
+        response_head_ = out.pop();
+        stream_->read_bytes(length.toi(),
+                bind(&ProxyRequest::on_small_body, this, _1));
+        return;
+    }
+    write(out.pop());
+
+    if (client_->closed()) {
+        keep_alive_ = false;
+        stream_->close();
+    }
+    else if (chunked) {
+        stream_->read_until("\r\n"_s,
+                bind(&ProxyRequest::on_chunk_length, this, _1));
+    }
+    else if (close_delimited) {
+        stream_->read_until_close(bind(&ProxyRequest::on_body, this, _1),
+                bind(&ProxyRequest::on_data, this, _1));
+    }
+    else if (length.toi() > 0) {
+        stream_->relay(client_, length.toi(),
+                bind(&ProxyRequest::finish, this));
+    }
+    else {
+        finish();
+    }
+}
+
+void ProxyRequest::on_small_body(const Str& data)
+{
+    Buffer out;
+
+    out.push(response_head_);
+    out.push(data);
+    if (!client_->closed())
+        request_->write(&out);
+    finish();
+}
+
+void ProxyRequest::on_chunk_length(const Str& data)
+{
+    size_t length;
+
+    // the chunk extensions are forwarded, unless dechunked
+    if (!parse_chunk_size(data, &length)) {
+        log_warn("malformed chunked response from upstream %.*s:%d",
+                static_cast<int>(upstream_->host_.len()),
+                upstream_->host_.data(), upstream_->port_);
+        keep_alive_ = false;
+        stream_->close();
+        return;
+    }
+
+    if (!dechunk_)
+        write(data);
+
+    if (client_->closed()) {
+        keep_alive_ = false;
+        stream_->close();
+    }
+    else if (length == 0) {
+        stream_->read_until("\r\n"_s,
+                bind(&ProxyRequest::on_trailer, this, _1));
+    }
+    else {
+        // the chunk and its line break, but when dechunked
+        stream_->relay(client_, dechunk_ ? length : length + 2,
+                bind(&ProxyRequest::on_chunk_data, this));
+    }
+}
+
+void ProxyRequest::on_chunk_data()
+{
+    if (dechunk_)
+        stream_->read_bytes(2, bind(&ProxyRequest::on_chunk_end, this, _1));
+    else
+        stream_->read_until("\r\n"_s,
+                bind(&ProxyRequest::on_chunk_length, this, _1));
+}
+
+void ProxyRequest::on_chunk_end(const Str& data)
+{
+    if (!data.eq("\r\n")) {
+        log_warn("malformed chunked response from upstream %.*s:%d",
+                static_cast<int>(upstream_->host_.len()),
+                upstream_->host_.data(), upstream_->port_);
+        keep_alive_ = false;
+        stream_->close();
+        return;
+    }
+    stream_->read_until("\r\n"_s,
+            bind(&ProxyRequest::on_chunk_length, this, _1));
+}
+
+void ProxyRequest::on_trailer(const Str& data)
+{
+    // the trailer fields are dropped when dechunked
+    if (!dechunk_)
+        write(data);
+
+    if (data.len() == 2) {
+        finish();
+        return;
+    }
+    stream_->read_until("\r\n"_s,
+            bind(&ProxyRequest::on_trailer, this, _1));
+}
+
+void ProxyRequest::on_data(const Str& data)
+{
+    write(data);
+}
+
+void ProxyRequest::on_body(const Str& data)
+{
+    write(data);
+    finish();
+}
+
+void ProxyRequest::write(const Str& data)
+{
+    if (!client_->closed() && data.len() > 0)
+        request_->write(data);
+}
+
+void ProxyRequest::fail(int code)
+{
+    HTTPResponse *response;
+
+    if (responded_ || client_->closed()) {
+        finish();
+        return;
+    }
+    responded_ = true;
+
+    response = new HTTPResponse(request_, code);
+    response->add_header("Content-Type", "text/plain");
+    response->write(str_format("%d: %s\n", code,
+                get_response_w3c_name(code)));
+    response->finish();
+    delete response;
+
+    delete this;
+}
+
+void ProxyRequest::finish()
+{
+    clear_timeout();
+
+    if (stream_ != nullptr)
+        release_stream();
+
+    if (client_->closed())
+        request_->connection_->no_keep_alive_ = true;
+
+    request_->finish();
+    delete this;
+}
+
+void ProxyRequest::release_stream()
+{
+    upstream_->active_--;
+
+    if (keep_alive_ && !stream_->closed() &&
+            upstream_->idle_.size() < proxy_->max_idle_) {
+        upstream_->idle_.push_front(stream_);
+        stream_->set_close_callback(bind(on_idle_close, upstream_, stream_));
+    }
+    else {
+        stream_->set_close_callback(bind(free_stream_later, stream_));
+        if (!stream_->closed())
+            stream_->close();
+    }
+    stream_ = nullptr;
+}
+
+void ProxyRequest::clear_timeout()
+{
+    if (timeout_ != nullptr) {
+        proxy_->ioloop_->remove_timeout(timeout_);
+        timeout_ = nullptr;
+    }
+}
+
+} // namespace ctornado
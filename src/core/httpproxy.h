@@ -0,0 +1,259 @@
+//
+// Copyright (C) 2013 Yeolar <yeolar@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef __HTTPPROXY_H
+#define __HTTPPROXY_H
+
+#include "ctornado.h"
+
+namespace ctornado {
+
+#define PROXY_MAX_FAILS         3
+#define PROXY_FAIL_TIMEOUT      10000
+#define PROXY_CONNECT_TIMEOUT   5000
+#define PROXY_READ_TIMEOUT      60000
+#define PROXY_MAX_IDLE          32
+#define PROXY_HASH_POINTS       160
+#define PROXY_SPLICE_THRESHOLD  16384
+#define PROXY_HEALTH_INTERVAL   5000
+
+class ReverseProxy;
+class ProxyRequest;
+
+//
+// An upstream server, and its idle kept alive connections.
+//
+// active_ is the number of requests in progress on it, and current_ its
+// current weight in the smooth weighted round-robin.  It is ejected
+// until ejected_until_ after max_fails consecutive failures, or while
+// healthy_ is false if it is health checked.
+//
+class Upstream
+{
+public:
+    Upstream(const Str& host, int port, int weight);
+    ~Upstream();
+
+    //
+    // Returns true if requests may be sent to the upstream now.
+    //
+    bool available(int64_t now);
+
+    Str host_;
+    int port_;
+    int weight_;
+    int active_;
+    int current_;
+    int fails_;
+    int64_t ejected_until_;
+    bool healthy_;
+    bool checking_;
+    list<IOStream *> idle_;
+};
+
+//
+// A reverse proxy: a request callback for HTTPServer that forwards the
+// requests to upstream servers, and relays their responses back.
+//
+//    proxy = new ReverseProxy(ReverseProxy::LEAST_CONNECTIONS);
+//    proxy->add_upstream("127.0.0.1", 8001);
+//    proxy->add_upstream("127.0.0.1", 8002, 2);
+//    proxy->start_health_checks("/health");
+//
+//    server = new HTTPServer(proxy->callback());
+//    server->parse_body_ = false;
+//    server->listen(8888);
+//
+// The upstream of a request is chosen by the policy:
+//
+//  ROUND_ROBIN
+//      Smooth weighted round-robin: over the sum of the weights, each
+//      upstream is chosen weight times, interleaved.
+//
+//  LEAST_CONNECTIONS
+//      The upstream with the fewest requests in progress relative to its
+//      weight, in round-robin order on ties.
+//
+//  CONSISTENT_HASH
+//      The upstream owning hash_key(request), the uri by default, on a
+//      ring of PROXY_HASH_POINTS points per weight per upstream, so
+//      adding or ejecting one moves only its share of the keys.  An
+//      ejected upstream's keys go to the next point of the ring.
+//
+// An upstream is ejected for fail_timeout_ msec after max_fails_
+// consecutive connection failures or timeouts.  With health checks, it
+// is also ejected while GET on the health path does not answer 2xx or
+// 3xx, and put back as soon as it does.  A request which could not be
+// sent is tried on another upstream; if none is available the client
+// gets a 502, or a 504 if the upstream did not answer in read_timeout_.
+//
+// The connections to the upstreams are kept alive, at most max_idle_
+// idle per upstream, and reused last used first.  A GET or HEAD request
+// sent on a kept alive connection closed meanwhile is retried once on a
+// new connection.  While the response is relayed, read_timeout_ is the
+// time allowed between two reads from the upstream.
+//
+// The hop-by-hop headers are not forwarded, X-Forwarded-For, X-Real-Ip
+// and X-Forwarded-Proto are set.  Response bodies, Content-Length or
+// chunked, are relayed with IOStream::relay: spliced from the upstream
+// socket to the client socket, not copied to user space.  A body smaller
+// than PROXY_SPLICE_THRESHOLD is rather written with the head in one
+// write, and a body ending with the connection is streamed through the
+// buffers.  A chunked body is dechunked for an HTTP/1.0 client, and ends
+// with the connection.  Request bodies
+// are read by HTTPServer before the callback, and forwarded from memory:
+// the server should have parse_body_ false, and gzip_ false.
+//
+// Only plain http upstreams are supported.  Their names are resolved on
+// the ThreadPool, and new connections made by a Connector with Happy
+// Eyeballs.  The proxy may only be freed with no request in progress.
+//
+class ReverseProxy
+{
+public:
+    enum {
+        ROUND_ROBIN,
+        LEAST_CONNECTIONS,
+        CONSISTENT_HASH,
+    };
+
+    ReverseProxy(int policy=ROUND_ROBIN, IOLoop *ioloop=nullptr);
+    virtual ~ReverseProxy();
+
+    ReverseProxy(const ReverseProxy&) = delete;
+    ReverseProxy& operator=(const ReverseProxy&) = delete;
+
+    void add_upstream(const Str& host, int port, int weight=1);
+
+    //
+    // Checks the upstreams with GET path every interval msec.
+    //
+    void start_health_checks(const Str& path,
+            int64_t interval=PROXY_HEALTH_INTERVAL);
+
+    //
+    // Returns the request callback for HTTPServer.
+    //
+    cb_req_t callback();
+
+    void handle_request(HTTPRequest *request);
+
+    //
+    // Returns the key of the request for CONSISTENT_HASH.
+    //
+    virtual Str hash_key(HTTPRequest *request);
+
+    //
+    // Returns the upstream for the request, or nullptr if none is
+    // available.  The upstreams in tried are not chosen.
+    //
+    Upstream *select(HTTPRequest *request,
+            const vector<Upstream *>& tried=vector<Upstream *>());
+
+    //
+    // Records the outcome of a request on the upstream, for ejection.
+    //
+    void succeeded(Upstream *upstream);
+    void failed(Upstream *upstream);
+
+    IOLoop *ioloop_;
+    int policy_;
+    int max_fails_;
+    int64_t fail_timeout_;
+    int64_t connect_timeout_;
+    int64_t read_timeout_;
+    size_t max_idle_;
+    vector<Upstream *> upstreams_;
+
+private:
+    vector<pair<uint32_t, Upstream *> > ring_;
+    size_t next_;
+    Str health_path_;
+    PeriodicCallback *health_checker_;
+    AsyncHTTPClient *client_;
+
+    void build_ring();
+    Upstream *select_round_robin(int64_t now,
+            const vector<Upstream *>& tried);
+    Upstream *select_least_connections(int64_t now,
+            const vector<Upstream *>& tried);
+    Upstream *select_hash(int64_t now, const vector<Upstream *>& tried,
+            const Str& key);
+    void check_health();
+    void on_health(Upstream *upstream, HTTPClientResponse *response);
+};
+
+//
+// A request forwarded to an upstream, until its response is relayed.
+//
+class ProxyRequest
+{
+public:
+    ProxyRequest(ReverseProxy *proxy, HTTPRequest *request);
+    ~ProxyRequest();
+
+    void start();
+
+private:
+    ReverseProxy *proxy_;
+    HTTPRequest *request_;
+    IOStream *client_;
+    Upstream *upstream_;
+    IOStream *stream_;
+    Timeout *timeout_;
+    uint64_t bytes_read_;
+    vector<Upstream *> tried_;
+    Str head_;
+    Str response_head_;
+    bool reused_;
+    bool retried_;
+    bool got_data_;
+    bool responded_;
+    bool keep_alive_;
+    bool timed_out_;
+    bool dechunk_;
+
+    void build_head();
+    void connect();
+    void on_resolve(const vector<sockinfo_t>& addrs);
+    void on_connect(IOStream *stream);
+    void send();
+    void set_read_timeout();
+    void on_timeout();
+    void on_close();
+    void on_headers(const Str& data);
+    void on_small_body(const Str& data);
+    void on_chunk_length(const Str& data);
+    void on_chunk_data();
+    void on_chunk_end(const Str& data);
+    void on_trailer(const Str& data);
+    void on_data(const Str& data);
+    void on_body(const Str& data);
+    void write(const Str& data);
+
+    //
+    // Sends an error response, if the response has not begun.
+    //
+    void fail(int code);
+
+    void finish();
+    void release_stream();
+    void clear_timeout();
+};
+
+} // namespace ctornado
+
+#endif // __HTTPPROXY_H
@@ -23,11 +23,14 @@ using namespace std::placeholders;
 void HTTPServer::handle_stream(IOStream *stream, const Str& address)
 {
     new HTTPConnection(stream, address,
-            request_callback_, no_keep_alive_, xheaders_);
+            request_callback_, no_keep_alive_, xheaders_,
+            max_body_size_, spool_threshold_, gzip_, parse_body_);
 }
 
 HTTPConnection::HTTPConnection(IOStream *stream, const Str& address,
-        cb_req_t request_callback, bool no_keep_alive, bool xheaders)
+        cb_req_t request_callback, bool no_keep_alive, bool xheaders,
+        size_t max_body_size, size_t spool_threshold, bool gzip,
+        bool parse_body)
 {
     log_verb("handle stream[%p] on connection[%p]", stream, this);
 
@@ -36,20 +39,33 @@ HTTPConnection::HTTPConnection(IOStream *stream, const Str& address,
     request_callback_ = request_callback;
     no_keep_alive_ = no_keep_alive;
     xheaders_ = xheaders;
+    max_body_size_ = max_body_size;
+    spool_threshold_ = spool_threshold;
+    gzip_ = gzip;
+    parse_body_ = parse_body;
     request_ = nullptr;
     request_finished_ = false;
     header_callback_ = bind(&HTTPConnection::on_headers, this, _1);
     write_callback_ = nullptr;
+    body_parser_ = nullptr;
+    body_decoder_ = nullptr;
+    transform_ = nullptr;
 
     log_verb("connection[%p] handle HTTP request", this);
 
-    stream_->read_until("\r\n\r\n", header_callback_);
+    stream_->read_until("\r\n\r\n"_s, header_callback_);
 }
 
 HTTPConnection::~HTTPConnection()
 {
     log_verb("free stream[%p]", stream_);
     delete stream_;
+    if (body_parser_ != nullptr)
+        delete body_parser_;
+    if (body_decoder_ != nullptr)
+        delete body_decoder_;
+    if (transform_ != nullptr)
+        delete transform_;
 }
 
 void HTTPConnection::free(HTTPConnection *connection)
@@ -69,22 +85,108 @@ void HTTPConnection::close()
 
 void HTTPConnection::write(const Str& chunk, cb_t callback)
 {
+    Str data;
+
     log_verb("connection[%p] write to stream", this);
 
     ASSERT(request_ != nullptr);
 
     if (!stream_->closed()) {
+        if (!gzip_) {
+            data = chunk;
+        }
+        else if (transform_ == nullptr) {
+            transform_ = new GZipContentEncoding(request_);
+            data = transform_->transform_first_chunk(chunk);
+        }
+        else {
+            data = transform_->transform_chunk(chunk);
+        }
         write_callback_ = callback;
-        stream_->write(chunk, bind(&HTTPConnection::on_write_complete, this));
+        stream_->write(data, bind(&HTTPConnection::on_write_complete, this));
     }
 }
 
+void HTTPConnection::write(Buffer *chunks, cb_t callback)
+{
+    ASSERT(request_ != nullptr);
+
+    if (gzip_) {
+        //
+        // The transform looks for the response head and the whole body
+        // in the first chunk.
+        //
+        chunks->merge_prefix(chunks->size());
+        write(chunks->chunks() > 0 ? chunks->pop() : Str(""), callback);
+        return;
+    }
+
+    log_verb("connection[%p] write to stream", this);
+
+    if (!stream_->closed()) {
+        write_callback_ = callback;
+        stream_->write(chunks, bind(&HTTPConnection::on_write_complete, this));
+    }
+}
+
+void HTTPConnection::write_file(Buffer *chunks, int fd, off_t offset,
+        size_t count, cb_t done, cb_t callback)
+{
+    ASSERT(request_ != nullptr);
+
+    log_verb("connection[%p] write file fd(%d) to stream", this, fd);
+
+    if (!stream_->closed()) {
+        write_callback_ = callback;
+        stream_->write_file(chunks, fd, offset, count, done,
+                bind(&HTTPConnection::on_write_complete, this));
+    }
+    else if (done != nullptr) {
+        done();
+    }
+}
+
+bool HTTPConnection::keep_alive()
+{
+    int connection;
+
+    ASSERT(request_ != nullptr);
+
+    if (no_keep_alive_)
+        return false;
+
+    connection = Symbol::lookup(request_->headers_->get("Connection"_s));
+
+    if (request_->supports_http_1_1())
+        return connection != SYM_CLOSE;
+
+    if (request_->headers_->has("Content-Length"_s) ||
+            request_->method_id_ == SYM_HEAD ||
+            request_->method_id_ == SYM_GET)
+        return connection == SYM_KEEP_ALIVE;
+
+    return false;
+}
+
 void HTTPConnection::finish()
 {
+    Str data;
+
     ASSERT(request_ != nullptr);
 
     request_finished_ = true;
 
+    if (transform_ != nullptr) {
+        data = transform_->finish();
+        delete transform_;
+        transform_ = nullptr;
+
+        if (!data.empty() && !stream_->closed()) {
+            stream_->write(data,
+                    bind(&HTTPConnection::on_write_complete, this));
+        }
+    }
+
     if (!stream_->writing()) {
         finish_request();
     }
@@ -117,27 +219,7 @@ void HTTPConnection::finish_request()
 {
     bool disconnect;
 
-    if (no_keep_alive_) {
-        disconnect = true;
-    }
-    else {
-        Str connection_header = request_->headers_->get("Connection");
-        if (connection_header.data() != nullptr) {
-            connection_header = connection_header.lower();
-        }
-
-        if (request_->supports_http_1_1()) {
-            disconnect = connection_header.eq("close");
-        }
-        else if (request_->headers_->has("Content-Length") ||
-                request_->method_.eq("HEAD") ||
-                request_->method_.eq("GET")) {
-            disconnect = !connection_header.eq("keep-alive");
-        }
-        else {
-            disconnect = true;
-        }
-    }
+    disconnect = !keep_alive();
 
     delete request_;
     request_ = nullptr;
@@ -150,15 +232,16 @@ void HTTPConnection::finish_request()
     }
     log_verb("connection[%p] handle HTTP request finished, keep alive", this);
 
-    stream_->read_until("\r\n\r\n", header_callback_);
+    stream_->read_until("\r\n\r\n"_s, header_callback_);
 }
 
 void HTTPConnection::on_headers(const Str& data)
 {
-    size_t content_length;
+    size_t content_length, max_length;
     int eol;
     int family;
     Str start_line, method, uri, version, remote_ip, content_length_str;
+    Str boundary, encoding;
     HTTPHeaders *headers;
 
     log_verb("connection[%p] handle headers in HTTP request", this);
@@ -196,22 +279,63 @@ void HTTPConnection::on_headers(const Str& data)
 
     request_ = new HTTPRequest(this, method, uri, version, headers, remote_ip);
 
-    content_length_str = headers->get("Content-Length");
+    content_length_str = headers->get("Content-Length"_s);
 
     if (!content_length_str.null()) {
         content_length = content_length_str.toi();
 
-        if (content_length > stream_->max_buffer_size_) {
+        if (parse_body_ && (request_->method_id_ == SYM_POST ||
+                request_->method_id_ == SYM_PATCH ||
+                request_->method_id_ == SYM_PUT)) {
+            boundary = parse_multipart_boundary(
+                    headers->get("Content-Type"_s, ""));
+        }
+        //
+        // A multipart/form-data body is parsed as it arrives and never
+        // kept in the read buffer as a whole.
+        //
+        max_length = boundary.null() ?
+            min(max_body_size_, stream_->max_buffer_size_) : max_body_size_;
+
+        if (content_length > max_length) {
             log_info("Malformed HTTP request from %.*s: "
                     "Content-Length too long", address_.len(), address_.data());
             close();
             return;
         }
-        if (headers->get("Expect").eq("100-continue")) {
+        if (Symbol::lookup(headers->get("Expect"_s)) == SYM_100_CONTINUE) {
             stream_->write("HTTP/1.1 100 (Continue)\r\n\r\n");
         }
-        stream_->read_bytes(content_length,
-                bind(&HTTPConnection::on_request_body, this, _1));
+        //
+        // A gzip encoded body is decompressed as it arrives, and the
+        // decompressed body is limited like an uncompressed one.
+        //
+        encoding = headers->get("Content-Encoding"_s);
+        if (parse_body_ && encoding.ieq("gzip")) {
+            headers->remove("Content-Encoding");
+            headers->set("X-Consumed-Content-Encoding", encoding);
+            body_decoder_ = new GZipDecompressor(STR_BUF_16K,
+                    max_length, GZIP_MAX_RATIO);
+        }
+        if (!boundary.null()) {
+            body_parser_ = new MultipartParser(boundary,
+                    request_->get_arguments(), request_->files_, spool_threshold_);
+        }
+
+        if (body_decoder_ != nullptr) {
+            stream_->read_bytes(content_length,
+                    bind(&HTTPConnection::on_gzip_body, this, _1),
+                    bind(&HTTPConnection::on_gzip_chunk, this, _1));
+        }
+        else if (body_parser_ != nullptr) {
+            stream_->read_bytes(content_length,
+                    bind(&HTTPConnection::on_multipart_body, this, _1),
+                    bind(&HTTPConnection::on_multipart_chunk, this, _1));
+        }
+        else {
+            stream_->read_bytes(content_length,
+                    bind(&HTTPConnection::on_request_body, this, _1));
+        }
     }
     else {
         request_callback_(request_);
@@ -224,15 +348,147 @@ void HTTPConnection::on_request_body(const Str& data)
 
     log_verb("connection[%p] handle body in HTTP request", this);
 
-    if (request_->method_.eq("POST") ||
-        request_->method_.eq("PATCH") ||
-        request_->method_.eq("PUT")) {
-        parse_body_arguments(request_->headers_->get("Content-Type", ""),
-                data, request_->arguments_, request_->files_);
+    if (parse_body_ && (request_->method_id_ == SYM_POST ||
+        request_->method_id_ == SYM_PATCH ||
+        request_->method_id_ == SYM_PUT)) {
+        parse_body_arguments(request_->headers_->get("Content-Type"_s, ""),
+                data, request_->get_arguments(), request_->files_);
+    }
+    request_callback_(request_);
+}
+
+void HTTPConnection::on_multipart_chunk(const Str& data)
+{
+    body_parser_->feed(data);
+}
+
+void HTTPConnection::on_multipart_body(const Str& data)
+{
+    log_verb("connection[%p] handle multipart body in HTTP request", this);
+
+    if (!body_parser_->finish()) {
+        log_info("Malformed HTTP request from %.*s: "
+                "invalid multipart/form-data", address_.len(), address_.data());
+        delete body_parser_;
+        body_parser_ = nullptr;
+        bad_request();
+        return;
     }
+    delete body_parser_;
+    body_parser_ = nullptr;
+
     request_callback_(request_);
 }
 
+void HTTPConnection::on_gzip_chunk(const Str& data)
+{
+    //
+    // The rest of a rejected body is read until the stream is closed
+    //
+    if (stream_->closed() || body_decoder_ == nullptr)
+        return;
+
+    try {
+        body_decoder_->decompress(data);
+    }
+    catch (GZipLimitError& e) {
+        bad_gzip_body(e.what(), 413);
+        return;
+    }
+    catch (GZipError& e) {
+        bad_gzip_body(e.what(), 400);
+        return;
+    }
+    if (body_parser_ != nullptr) {
+        feed_decoded_body();
+    }
+}
+
+void HTTPConnection::on_gzip_body(const Str& data)
+{
+    Str body;
+
+    if (stream_->closed() || body_decoder_ == nullptr)
+        return;
+
+    log_verb("connection[%p] handle gzip body in HTTP request", this);
+
+    try {
+        body_decoder_->close();
+    }
+    catch (GZipLimitError& e) {
+        bad_gzip_body(e.what(), 413);
+        return;
+    }
+    catch (GZipError& e) {
+        bad_gzip_body(e.what(), 400);
+        return;
+    }
+    //
+    // A cut off body must not pass for the whole one
+    //
+    if (!body_decoder_->finished()) {
+        bad_gzip_body("truncated gzip stream", 400);
+        return;
+    }
+
+    if (body_parser_ != nullptr) {
+        feed_decoded_body();
+        delete body_decoder_;
+        body_decoder_ = nullptr;
+        on_multipart_body(nullstr);
+    }
+    else {
+        body = body_decoder_->get_value();
+        delete body_decoder_;
+        body_decoder_ = nullptr;
+        on_request_body(body);
+    }
+}
+
+void HTTPConnection::bad_gzip_body(const char *error, int code)
+{
+    log_info("Malformed HTTP request from %.*s: %s",
+            address_.len(), address_.data(), error);
+
+    delete body_decoder_;
+    body_decoder_ = nullptr;
+    delete body_parser_;
+    body_parser_ = nullptr;
+    bad_request(code);
+}
+
+void HTTPConnection::feed_decoded_body()
+{
+    Buffer *buffer;
+
+    buffer = body_decoder_->get_buffer();
+
+    while (buffer->size() > 0) {
+        body_parser_->feed(buffer->pop());
+    }
+}
+
+void HTTPConnection::bad_request(int code)
+{
+    Buffer out;
+
+    delete request_;
+    request_ = nullptr;
+    header_callback_ = nullptr;
+
+    //
+    // Freed once closed, after the response or on a write error
+    //
+    stream_->set_close_callback([this]() {
+            stream_->ioloop_->add_callback(
+                bind(&HTTPConnection::free, this));
+        });
+    out.push(get_response_status_line(code));
+    out.push("Content-Length: 0\r\nConnection: close\r\n\r\n");
+    stream_->write(&out, [this]() { stream_->close(); });
+}
+
 HTTPRequest::HTTPRequest(HTTPConnection *connection,
         const Str& method, const Str& uri, const Str& version,
         HTTPHeaders *headers, const Str& remote_ip, const Str& protocol,
@@ -240,24 +496,29 @@ HTTPRequest::HTTPRequest(HTTPConnection *connection,
 {
     connection_ = connection;
     method_ = method;
+    method_id_ = Symbol::lookup(method);
+    if (Symbol::is_method(method_id_))
+        method_ = Symbol::str(method_id_);
+    else
+        method_id_ = SYM_NONE;
     uri_ = uri;
     version_ = version;
     body_ = body;
     headers_ = (headers != nullptr) ? headers : new HTTPHeaders();
     files_ = (files != nullptr) ? files : new FileMMap();
-    host_ = (!host.null()) ? host : headers_->get("Host", "127.0.0.1");
+    host_ = (!host.null()) ? host : headers_->get("Host"_s, "127.0.0.1");
 
     if (connection_ != nullptr && connection_->xheaders_) {
         // Squid uses X-Forward-For, others use X-Real-Ip
-        remote_ip_ = headers_->get("X-Real-Ip",
-                     headers_->get("X-Forwarded-For", remote_ip));
+        remote_ip_ = headers_->get("X-Real-Ip"_s,
+                     headers_->get("X-Forwarded-For"_s, remote_ip));
 
         if (!valid_ip(remote_ip_.tos().c_str()))
             remote_ip_ = remote_ip;
 
         // AWS uses X-Forwarded-Proto
-        protocol_ = headers_->get("X-Scheme",
-                    headers_->get("X-Forwarded-Proto", protocol));
+        protocol_ = headers_->get("X-Scheme"_s,
+                    headers_->get("X-Forwarded-Proto"_s, protocol));
 
         if (!protocol_.eq("http") && !protocol_.eq("https"))
             protocol_ = "http";
@@ -270,7 +531,7 @@ HTTPRequest::HTTPRequest(HTTPConnection *connection,
     auto kv = uri_.split_pair('?');
     path_ = kv.first;
     query_ = kv.second;
-    arguments_ = Query::parse(query_);
+    arguments_ = nullptr;
 
     start_time_ = msec_now();
     finish_time_ = 0;
@@ -280,7 +541,8 @@ HTTPRequest::HTTPRequest(HTTPConnection *connection,
 HTTPRequest::~HTTPRequest()
 {
     delete headers_;
-    delete arguments_;
+    if (arguments_)
+        delete arguments_;
     delete files_;
     if (cookies_)
         delete cookies_;
@@ -288,34 +550,74 @@ HTTPRequest::~HTTPRequest()
 
 bool HTTPRequest::supports_http_1_1()
 {
-    return version_.eq("HTTP/1.1");
+    return version_.eq("HTTP/1.1"_s);
+}
+
+Query *HTTPRequest::get_arguments()
+{
+    if (arguments_ == nullptr) {
+        arguments_ = Query::parse(query_);
+    }
+    return arguments_;
+}
+
+Str HTTPRequest::get_argument(const Str& name, const Str& default_value)
+{
+    return get_arguments()->get(name, default_value);
 }
 
 Cookie *HTTPRequest::get_cookies()
 {
     if (cookies_ == nullptr) {
         cookies_ = new Cookie();
-        if (headers_->has("Cookie")) {
-            cookies_->load(headers_->get("Cookie"));
+        if (headers_->has("Cookie"_s)) {
+            cookies_->load(headers_->get("Cookie"_s));
         }
     }
     return cookies_;
 }
 
+Str HTTPRequest::get_cookie(const Str& name, const Str& default_value)
+{
+    CookieMorsel *morsel;
+    Str value;
+
+    if (cookies_ != nullptr) {
+        morsel = cookies_->get(name);
+        return morsel != nullptr ? morsel->value_ : default_value;
+    }
+    if (headers_->has("Cookie"_s) &&
+            Cookie::lookup(headers_->get("Cookie"_s), name, &value))
+        return value;
+    return default_value;
+}
+
 void HTTPRequest::write(const Str& chunk, cb_t callback)
 {
     connection_->write(chunk, callback);
 }
 
+void HTTPRequest::write(Buffer *chunks, cb_t callback)
+{
+    connection_->write(chunks, callback);
+}
+
+void HTTPRequest::write_file(Buffer *chunks, int fd, off_t offset,
+        size_t count, cb_t done, cb_t callback)
+{
+    connection_->write_file(chunks, fd, offset, count, done, callback);
+}
+
 void HTTPRequest::finish()
 {
-    connection_->finish();
+    // the request is freed once the connection is done with it
     finish_time_ = msec_now();
+    connection_->finish();
 }
 
 Str HTTPRequest::full_url()
 {
-    return Str::sprintf("%S://%S%S", &protocol_, &host_, &uri_);
+    return str_format("%S://%S%S", protocol_, host_, uri_);
 }
 
 int64_t HTTPRequest::request_time()
@@ -326,4 +628,631 @@ int64_t HTTPRequest::request_time()
         return finish_time_ - start_time_;
 }
 
+#define REPLACE_CONTENT_TYPE      0x01
+#define REPLACE_SERVER            0x02
+#define REPLACE_DATE              0x04
+#define REPLACE_CONTENT_LENGTH    0x08
+#define REPLACE_CONNECTION        0x10
+
+static const char _default_headers[] =
+    "Content-Type: " HTTP_DEFAULT_CONTENT_TYPE "\r\n"
+    "Server: " HTTP_SERVER_NAME "\r\n";
+
+#define DEFAULT_CONTENT_TYPE_LEN  (sizeof("Content-Type: " \
+                                    HTTP_DEFAULT_CONTENT_TYPE "\r\n") - 1)
+#define DEFAULT_SERVER_LEN        (sizeof("Server: " HTTP_SERVER_NAME "\r\n") - 1)
+
+static inline char *_append(char *p, const char *s, size_t n)
+{
+    memcpy(p, s, n);
+    return p + n;
+}
+
+HTTPResponse::HTTPResponse(HTTPRequest *request, int code)
+{
+    request_ = request;
+    code_ = 200;
+    compute_etag_ = true;
+    last_modified_ = -1;
+    replaced_ = 0;
+    file_fd_ = -1;
+    file_offset_ = 0;
+    file_count_ = 0;
+    file_done_ = nullptr;
+
+    set_status(code);
+}
+
+HTTPResponse::~HTTPResponse()
+{
+    release_file();
+}
+
+void HTTPResponse::set_status(int code)
+{
+    if (!is_valid_response_code(code))
+        throw ValueError("unknown status code");
+
+    code_ = code;
+}
+
+void HTTPResponse::add_header(const Str& name, const Str& value)
+{
+    if (value.len() > 0 &&
+            (memchr(value.data(), '\r', value.len()) != nullptr ||
+             memchr(value.data(), '\n', value.len()) != nullptr))
+        throw ValueError("unsafe header value");
+
+    switch (Symbol::lookup(name)) {
+    case SYM_CONTENT_TYPE:
+        replaced_ |= REPLACE_CONTENT_TYPE;
+        break;
+    case SYM_SERVER:
+        replaced_ |= REPLACE_SERVER;
+        break;
+    case SYM_DATE:
+        replaced_ |= REPLACE_DATE;
+        break;
+    case SYM_CONTENT_LENGTH:
+        replaced_ |= REPLACE_CONTENT_LENGTH;
+        break;
+    case SYM_CONNECTION:
+        replaced_ |= REPLACE_CONNECTION;
+        break;
+    case SYM_ETAG:
+        etag_ = value;
+        break;
+    case SYM_LAST_MODIFIED:
+        last_modified_ = parse_http_date(value);
+        break;
+    }
+    headers_.push_back(make_pair(name, value));
+}
+
+void HTTPResponse::set_etag(const Str& etag)
+{
+    if (etag.starts_with("\"") || etag.starts_with("W/\""))
+        add_header("Etag", etag);
+    else
+        add_header("Etag", str_format("\"%S\"", etag));
+}
+
+void HTTPResponse::set_last_modified(int64_t timestamp)
+{
+    add_header("Last-Modified", format_http_date(timestamp));
+}
+
+bool HTTPResponse::check_not_modified()
+{
+    Str header;
+    int64_t since;
+    bool matched;
+
+    if (code_ != 200 || (request_->method_id_ != SYM_GET &&
+                request_->method_id_ != SYM_HEAD))
+        return false;
+
+    //
+    // If-None-Match takes precedence, If-Modified-Since is ignored
+    // when it is present, RFC 7232 section 3.3.
+    //
+    header = request_->headers_->get("If-None-Match"_s);
+    if (!header.null()) {
+        matched = !etag_.null() && match_etag(header, etag_);
+    }
+    else {
+        header = request_->headers_->get("If-Modified-Since"_s);
+        if (header.null() || last_modified_ < 0)
+            return false;
+
+        since = parse_http_date(header);
+        matched = since >= 0 && last_modified_ <= since;
+    }
+
+    if (matched) {
+        code_ = 304;
+        body_.clear();
+    }
+    return matched;
+}
+
+void HTTPResponse::write(const Str& chunk)
+{
+    if (chunk.len() > 0)
+        body_.push(chunk);
+}
+
+void HTTPResponse::send_file(int fd, off_t offset, size_t count, cb_t done)
+{
+    release_file();
+
+    file_fd_ = fd;
+    file_offset_ = offset;
+    file_count_ = count;
+    file_done_ = done;
+}
+
+void HTTPResponse::finish(cb_t callback)
+{
+    Buffer out;
+    HTTPRequest *request;
+    int fd;
+    cb_t done;
+
+    ASSERT(request_ != nullptr);
+
+    if (etag_.null() && compute_etag_ && code_ == 200 &&
+            body_.size() > 0 && file_fd_ < 0 &&
+            (request_->method_id_ == SYM_GET ||
+             request_->method_id_ == SYM_HEAD)) {
+        set_etag(compute_etag());
+    }
+    check_not_modified();
+
+    out.push(head());
+    if (has_body() && request_->method_id_ != SYM_HEAD)
+        out.merge(&body_);
+    else
+        release_file();
+
+    //
+    // The request is freed once finished if the stream has been written.
+    //
+    request = request_;
+    request_ = nullptr;
+
+    if (file_fd_ >= 0) {
+        fd = file_fd_;
+        done = file_done_;
+        file_fd_ = -1;
+        file_done_ = nullptr;
+        request->write_file(&out, fd, file_offset_, file_count_,
+                done, callback);
+    }
+    else {
+        request->write(&out, callback);
+    }
+    request->finish();
+}
+
+Str HTTPResponse::head()
+{
+    str_buffer_t *buffer;
+    char *p, length[UINT64_MAXLEN], *q;
+    size_t n, ui;
+    bool http_1_1, body, keep_alive;
+    const char *connection;
+    size_t connection_len;
+    const Str *status, *date;
+
+    http_1_1 = request_->supports_http_1_1();
+    body = has_body();
+    keep_alive = request_->connection_ != nullptr &&
+        request_->connection_->keep_alive();
+
+    status = &get_response_status_line(code_, http_1_1);
+    date = &date_line();
+
+    // Content-Length digits, backwards
+    q = length + UINT64_MAXLEN;
+    ui = body_.size() + file_count_;
+    do {
+        *--q = ui % 10 + '0';
+    } while (ui /= 10);
+
+    if (!keep_alive) {
+        connection = "Connection: close\r\n";
+    }
+    else if (!http_1_1) {
+        connection = "Connection: Keep-Alive\r\n";
+    }
+    else {
+        connection = "";
+    }
+    connection_len = strlen(connection);
+
+    //
+    // Measure, then copy into a single buffer
+    //
+    n = status->len() + 2;
+    for (auto& kv : headers_) {
+        n += kv.first.len() + kv.second.len() + 4;
+    }
+    if (!(replaced_ & REPLACE_CONTENT_TYPE) && body)
+        n += DEFAULT_CONTENT_TYPE_LEN;
+    if (!(replaced_ & REPLACE_SERVER))
+        n += DEFAULT_SERVER_LEN;
+    if (!(replaced_ & REPLACE_DATE))
+        n += date->len();
+    if (!(replaced_ & REPLACE_CONTENT_LENGTH) && body)
+        n += sizeof("Content-Length: \r\n") - 1 + (length + UINT64_MAXLEN - q);
+    if (!(replaced_ & REPLACE_CONNECTION))
+        n += connection_len;
+
+    buffer = Str::alloc(n);
+    p = buffer->data;
+
+    p = _append(p, status->data(), status->len());
+    if (!(replaced_ & REPLACE_CONTENT_TYPE) && body)
+        p = _append(p, _default_headers, DEFAULT_CONTENT_TYPE_LEN);
+    if (!(replaced_ & REPLACE_SERVER))
+        p = _append(p, _default_headers + DEFAULT_CONTENT_TYPE_LEN,
+                DEFAULT_SERVER_LEN);
+    if (!(replaced_ & REPLACE_DATE))
+        p = _append(p, date->data(), date->len());
+    if (!(replaced_ & REPLACE_CONTENT_LENGTH) && body) {
+        p = _append(p, "Content-Length: ", 16);
+        p = _append(p, q, length + UINT64_MAXLEN - q);
+        p = _append(p, "\r\n", 2);
+    }
+    if (!(replaced_ & REPLACE_CONNECTION))
+        p = _append(p, connection, connection_len);
+
+    for (auto& kv : headers_) {
+        p = _append(p, kv.first.data(), kv.first.len());
+        p = _append(p, ": ", 2);
+        p = _append(p, kv.second.data(), kv.second.len());
+        p = _append(p, "\r\n", 2);
+    }
+    p = _append(p, "\r\n", 2);
+
+    ASSERT(p == buffer->data + n);
+
+    return Str(buffer, n);
+}
+
+const Str& HTTPResponse::date_line()
+{
+    static thread_local int64_t second = 0;
+    static thread_local Str line;
+    str_buffer_t *buffer;
+    int64_t now;
+
+    now = sec_now();
+    if (now != second) {
+        second = now;
+
+        buffer = Str::alloc(6 + HTTP_DATE_LEN + 2);
+        memcpy(buffer->data, "Date: ", 6);
+        format_http_date(buffer->data + 6, now);
+        memcpy(buffer->data + 6 + HTTP_DATE_LEN, "\r\n", 2);
+        line = Str(buffer, 6 + HTTP_DATE_LEN + 2);
+    }
+    return line;
+}
+
+//
+// Strong ETag of the body, the SHA-1 in hex, quoted
+//
+Str HTTPResponse::compute_etag()
+{
+    str_buffer_t *buffer;
+    sha1_t ctx;
+    uint8_t digest[SHA1_LEN];
+    Str chunk;
+    size_t i;
+
+    sha1_init(&ctx);
+    for (i = 0; i < body_.chunks(); i++) {
+        chunk = body_.chunk(i);
+        sha1_update(&ctx, reinterpret_cast<const uint8_t *>(chunk.data()),
+                chunk.len());
+    }
+    sha1_final(digest, &ctx);
+
+    buffer = Str::alloc(SHA1_LEN * 2 + 2);
+    buffer->data[0] = '"';
+    hexlify(reinterpret_cast<uint8_t *>(buffer->data + 1), SHA1_LEN * 2,
+            digest, SHA1_LEN);
+    buffer->data[SHA1_LEN * 2 + 1] = '"';
+
+    return Str(buffer, SHA1_LEN * 2 + 2);
+}
+
+//
+// Weak comparison of the entity tags of If-None-Match with etag, a
+// list like  W/"xyzzy", "r2d2xxxx"  or "*"
+//
+bool HTTPResponse::match_etag(const Str& header, const Str& etag)
+{
+    const char *p, *end, *q, *e;
+    size_t elen;
+
+    e = etag.data();
+    elen = etag.len();
+    if (elen >= 2 && e[0] == 'W' && e[1] == '/') {
+        e += 2;
+        elen -= 2;
+    }
+
+    p = header.data();
+    end = p + header.len();
+
+    while (p < end) {
+        if (*p == ' ' || *p == '\t' || *p == ',') {
+            p++;
+            continue;
+        }
+        if (*p == '*')
+            return true;
+
+        if (end - p >= 2 && p[0] == 'W' && p[1] == '/')
+            p += 2;
+        if (p == end || *p != '"')
+            return false;
+
+        q = static_cast<const char *>(memchr(p + 1, '"', end - p - 1));
+        if (q == nullptr)
+            return false;
+        q++;
+
+        if (static_cast<size_t>(q - p) == elen && memcmp(p, e, elen) == 0)
+            return true;
+        p = q;
+    }
+    return false;
+}
+
+void HTTPResponse::release_file()
+{
+    cb_t done;
+
+    if (file_fd_ < 0)
+        return;
+
+    done = file_done_;
+    file_fd_ = -1;
+    file_count_ = 0;
+    file_done_ = nullptr;
+    if (done != nullptr)
+        done();
+}
+
+//
+// 1xx, 204 and 304 responses have no body
+//
+bool HTTPResponse::has_body()
+{
+    return code_ >= 200 && code_ != 204 && code_ != 304;
+}
+
+GZipContentEncoding::GZipContentEncoding(HTTPRequest *request,
+        size_t min_length, int compress_level)
+{
+    Str accept_encoding;
+
+    min_length_ = min_length;
+    compress_level_ = compress_level;
+
+    accept_encoding = request->headers_->get("Accept-Encoding"_s);
+    accept_gzip_ = request->method_id_ != SYM_HEAD &&
+        !accept_encoding.null() && accepts_encoding(accept_encoding, "gzip");
+    chunked_ok_ = request->supports_http_1_1();
+    chunking_ = false;
+    compressor_ = nullptr;
+}
+
+GZipContentEncoding::~GZipContentEncoding()
+{
+    if (compressor_ != nullptr)
+        delete compressor_;
+}
+
+Str GZipContentEncoding::transform_first_chunk(const Str& chunk)
+{
+    int pos, code;
+    size_t length;
+    bool known_length, whole;
+    Str head, body, content_type, vary, output;
+    StrList lines, out;
+
+    pos = chunk.find("\r\n\r\n");
+    if (pos < 0) {
+        log_verb("response head is not in the first chunk, not compressed");
+        return chunk;
+    }
+    head = chunk.substr(0, pos);
+    body = chunk.substr(pos + 4, -1);
+
+    lines = head.split("\r\n");
+    auto strs = lines.front().split(' ');
+    code = strs.size() >= 2 ? (*++strs.begin()).toi() : 0;
+
+    //
+    // Responses without a body, with an encoding of their own or with
+    // a type not worth compressing are written as they are.
+    //
+    if (code < 200 || code == 204 || code == 304)
+        return chunk;
+
+    known_length = false;
+    length = 0;
+
+    for (auto it = ++lines.begin(); it != lines.end(); it++) {
+        auto kv = (*it).split_pair(':');
+        if (kv.second.null())
+            continue;
+
+        switch (Symbol::lookup(kv.first.strip())) {
+        case SYM_CONTENT_ENCODING:
+        case SYM_TRANSFER_ENCODING:
+            return chunk;
+        case SYM_CONTENT_TYPE:
+            content_type = kv.second.strip();
+            break;
+        case SYM_CONTENT_LENGTH:
+            known_length = true;
+            length = kv.second.strip().toi();
+            break;
+        case SYM_VARY:
+            vary = kv.second.strip();
+            break;
+        }
+    }
+
+    if (!compressible_type(content_type))
+        return chunk;
+
+    whole = known_length && body.len() >= length;
+
+    //
+    // The response varies on Accept-Encoding from here on, even if this
+    // one is left uncompressed.
+    //
+    if (!accept_gzip_ ||
+        (known_length && length < min_length_) ||
+        (!whole && !chunked_ok_)) {
+
+        if (!vary.null() && vary.lower().find("accept-encoding") >= 0)
+            return chunk;
+
+        for (auto& line : lines) {
+            if (!line.istarts_with("vary:"))
+                out.push_back(line);
+        }
+        out.push_back(vary.empty() ? Str("Vary: Accept-Encoding") :
+                str_format("Vary: %S, Accept-Encoding", vary));
+        out.push_back("");
+        out.push_back(body);
+
+        return Str::join("\r\n", out);
+    }
+
+    if (whole) {
+        output = gzip_compress(body.substr(0, length), choose_level(length));
+    }
+    else {
+        compressor_ = new GZipCompressor(choose_level(SIZE_MAX));
+        compressor_->compress(body);
+        compressor_->flush();
+        output = take_output();
+        chunking_ = true;
+    }
+
+    //
+    // A strong ETag names the uncompressed bytes, the compressed body
+    // only keeps it as a weak one.
+    //
+    for (auto& line : lines) {
+        if (line.istarts_with("etag: \"")) {
+            out.push_back(str_format("Etag: W/%S", line.substr(6, -1)));
+        }
+        else if (!line.istarts_with("content-length:") &&
+                !line.istarts_with("vary:")) {
+            out.push_back(line);
+        }
+    }
+    out.push_back("Content-Encoding: gzip");
+    out.push_back(vary.empty() ? Str("Vary: Accept-Encoding") :
+            str_format("Vary: %S, Accept-Encoding", vary));
+
+    if (whole) {
+        out.push_back(str_format("Content-Length: %uz", output.len()));
+        out.push_back("");
+        out.push_back(output);
+    }
+    else {
+        out.push_back("Transfer-Encoding: chunked");
+        out.push_back("");
+        out.push_back(output.empty() ? Str("") :
+                str_format("%uxz\r\n%S\r\n", output.len(), output));
+    }
+    return Str::join("\r\n", out);
+}
+
+Str GZipContentEncoding::transform_chunk(const Str& chunk)
+{
+    Str output;
+
+    if (!chunking_ || chunk.empty())
+        return chunk;
+
+    compressor_->compress(chunk);
+    compressor_->flush();
+    output = take_output();
+
+    return str_format("%uxz\r\n%S\r\n", output.len(), output);
+}
+
+Str GZipContentEncoding::finish()
+{
+    Str output;
+
+    if (!chunking_)
+        return "";
+
+    compressor_->close();
+    output = take_output();
+    chunking_ = false;
+
+    return str_format("%uxz\r\n%S\r\n0\r\n\r\n", output.len(), output);
+}
+
+bool GZipContentEncoding::compressible_type(const Str& content_type)
+{
+    Str type;
+
+    if (content_type.null())
+        return false;
+
+    type = content_type.split_pair(';').first.strip().lower();
+
+    return type.starts_with("text/") ||
+        type.eq("application/json") ||
+        type.eq("application/javascript") ||
+        type.eq("application/x-javascript") ||
+        type.eq("application/xml") ||
+        type.eq("image/svg+xml") ||
+        type.ends_with("+json") ||
+        type.ends_with("+xml");
+}
+
+int GZipContentEncoding::choose_level(size_t length)
+{
+    int level;
+    double load;
+
+    level = compress_level_;
+
+    if (length > GZIP_LARGE_LENGTH)
+        level = min(level, GZIP_FAST_LEVEL + 2);
+
+    load = cpu_load();
+    if (load >= 1.0)
+        level = GZIP_FAST_LEVEL;
+    else if (load >= 0.75)
+        level = min(level, GZIP_FAST_LEVEL + 2);
+
+    return level;
+}
+
+Str GZipContentEncoding::take_output()
+{
+    Str output;
+
+    output = compressor_->get_value();
+    compressor_->clear();
+
+    return output.null() ? Str("") : output;
+}
+
+double GZipContentEncoding::cpu_load()
+{
+    static double load = 0;
+    static int64_t last_check = 0;
+    static long cpus = 0;
+    double avg;
+    int64_t now;
+
+    now = sec_now();
+    if (now != last_check) {
+        last_check = now;
+        if (cpus == 0)
+            cpus = max(sysconf(_SC_NPROCESSORS_ONLN), 1L);
+        if (getloadavg(&avg, 1) == 1)
+            load = avg / cpus;
+    }
+    return load;
+}
+
 } // namespace
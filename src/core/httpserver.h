@@ -21,6 +21,8 @@
 
 namespace ctornado {
 
+class GZipContentEncoding;
+
 //
 // A non-blocking, single-threaded HTTP server.
 //
@@ -46,15 +48,40 @@ namespace ctornado {
 // These headers are useful when running Tornado behind a reverse proxy or
 // load balancer.
 //
+// Request bodies larger than max_body_size are refused.  Other than
+// multipart/form-data bodies, which are parsed as they arrive, a body
+// is also limited by the max_buffer_size of the IOStream.  Uploaded
+// files larger than spool_threshold are written to temporary files
+// rather than kept in memory, see MultipartParser.
+//
+// Request bodies with Content-Encoding: gzip are decompressed as they
+// arrive, see HTTPConnection.  The decompressed body is limited like an
+// uncompressed one, and the body is refused if it expands more than
+// GZIP_MAX_RATIO times.
+//
+// If gzip is True, responses are compressed with gzip content-encoding
+// when the client accepts it, see GZipContentEncoding.
+//
+// If parse_body is False, request bodies are not decompressed nor parsed
+// into arguments and files, the raw body is kept in HTTPRequest.body,
+// e.g. to be forwarded by a ReverseProxy.
+//
 class HTTPServer : public TCPServer
 {
 public:
     HTTPServer(cb_req_t request_callback, IOLoop *ioloop=nullptr,
-            bool no_keep_alive=false, bool xheaders=false)
+            bool no_keep_alive=false, bool xheaders=false,
+            size_t max_body_size=104857600,
+            size_t spool_threshold=MULTIPART_SPOOL_THRESHOLD,
+            bool gzip=false, bool parse_body=true)
         : TCPServer(ioloop)
         , request_callback_(request_callback)
         , no_keep_alive_(no_keep_alive)
-        , xheaders_(xheaders) {}
+        , xheaders_(xheaders)
+        , max_body_size_(max_body_size)
+        , spool_threshold_(spool_threshold)
+        , gzip_(gzip)
+        , parse_body_(parse_body) {}
     virtual ~HTTPServer() {}
 
     virtual void handle_stream(IOStream *stream, const Str& address);
@@ -62,6 +89,10 @@ public:
     cb_req_t request_callback_;
     bool no_keep_alive_;
     bool xheaders_;
+    size_t max_body_size_;
+    size_t spool_threshold_;
+    bool gzip_;
+    bool parse_body_;
 };
 
 //
@@ -75,7 +106,10 @@ class HTTPConnection
 public:
     HTTPConnection(IOStream *stream,
             const Str& address, cb_req_t request_callback,
-            bool no_keep_alive=false, bool xheaders=false);
+            bool no_keep_alive=false, bool xheaders=false,
+            size_t max_body_size=104857600,
+            size_t spool_threshold=MULTIPART_SPOOL_THRESHOLD,
+            bool gzip=false, bool parse_body=true);
     ~HTTPConnection();
 
     static void free(HTTPConnection *connection);
@@ -87,6 +121,26 @@ public:
     //
     void write(const Str& chunk, cb_t callback=nullptr);
 
+    //
+    // Writes the chunks of output to the stream with one gather write,
+    // the buffer is emptied.
+    //
+    void write(Buffer *chunks, cb_t callback=nullptr);
+
+    //
+    // Writes the chunks, then count bytes of the file at offset with
+    // sendfile.  The gzip transform is not applied.  done is called once
+    // the file descriptor is no longer used.
+    //
+    void write_file(Buffer *chunks, int fd, off_t offset, size_t count,
+            cb_t done=nullptr, cb_t callback=nullptr);
+
+    //
+    // Returns true if the connection is kept open after the current
+    // request, from HTTPServer.no_keep_alive and the request.
+    //
+    bool keep_alive();
+
     //
     // Finishes the request.
     //
@@ -97,17 +151,41 @@ public:
     cb_req_t request_callback_;
     bool no_keep_alive_;
     bool xheaders_;
+    size_t max_body_size_;
+    size_t spool_threshold_;
+    bool gzip_;
+    bool parse_body_;
 
 private:
     HTTPRequest *request_;
     bool request_finished_;
     cb_stream_t header_callback_;
     cb_t write_callback_;
+    MultipartParser *body_parser_;
+    GZipDecompressor *body_decoder_;
+    GZipContentEncoding *transform_;
 
     void on_write_complete();
     void finish_request();
     void on_headers(const Str& data);
     void on_request_body(const Str& data);
+    void on_multipart_chunk(const Str& data);
+    void on_multipart_body(const Str& data);
+    void on_gzip_chunk(const Str& data);
+    void on_gzip_body(const Str& data);
+    void feed_decoded_body();
+
+    //
+    // Answers 400, or code, to a request with a malformed or too large
+    // body, then closes.
+    //
+    void bad_request(int code=400);
+
+    //
+    // Drops the gzip body which failed to decompress with error, and
+    // answers code.
+    //
+    void bad_gzip_body(const char *error, int code);
 };
 
 //
@@ -116,7 +194,8 @@ private:
 // All attributes are type Str unless otherwise noted.
 //
 //  method
-//      HTTP request method, e.g. "GET" or "POST"
+//      HTTP request method, e.g. "GET" or "POST".  method_id_ is its
+//      symbol, e.g. SYM_GET, or SYM_NONE for an unknown method.
 //
 //  uri
 //      The requested uri.
@@ -135,7 +214,10 @@ private:
 //      with methods for repeated headers.
 //
 //  body
-//      Request body.
+//      Request body.  Left empty for multipart/form-data bodies, which
+//      are parsed into arguments and files as they arrive.  A gzip
+//      encoded body is decompressed, and its Content-Encoding header
+//      moved to X-Consumed-Content-Encoding.
 //
 //  remote_ip
 //      Client's IP address as a string.  If HTTPServer.xheaders is set,
@@ -151,9 +233,9 @@ private:
 //      The requested hostname, usually taken from the Host header.
 //
 //  arguments
-//      GET/POST arguments are available in the arguments property, which
-//      maps arguments names to lists of values (to support multiple values
-//      for individual names).
+//      GET/POST arguments are available with get_arguments, which maps
+//      arguments names to lists of values (to support multiple values
+//      for individual names).  The query string is parsed on first access.
 //
 //  files
 //      File uploads are available in the files property, which maps file
@@ -180,16 +262,45 @@ public:
     //
     bool supports_http_1_1();
 
+    //
+    // Get the query arguments, parsed on the first call.  The body
+    // arguments of a form are added to them as the body is read.
+    //
+    Query *get_arguments();
+
+    //
+    // Get the first value of the argument with the given name.
+    //
+    Str get_argument(const Str& name, const Str& default_value=nullstr);
+
     //
     // Get Cookie object, keeps a map of Cookie.Morsel objects.
     //
     Cookie *get_cookies();
 
+    //
+    // Get the value of the cookie with the given name, scanning the
+    // Cookie header if the cookies are not loaded yet.
+    //
+    Str get_cookie(const Str& name, const Str& default_value=nullstr);
+
     //
     // Writes the given chunk to the response stream.
     //
     void write(const Str& chunk, cb_t callback=nullptr);
 
+    //
+    // Writes the given chunks to the response stream, see HTTPResponse.
+    //
+    void write(Buffer *chunks, cb_t callback=nullptr);
+
+    //
+    // Writes the chunks then a region of a file to the response stream,
+    // see HTTPConnection::write_file.
+    //
+    void write_file(Buffer *chunks, int fd, off_t offset, size_t count,
+            cb_t done=nullptr, cb_t callback=nullptr);
+
     //
     // Finishes this HTTP request on the open connection.
     //
@@ -207,6 +318,7 @@ public:
 
     HTTPConnection *connection_;
     Str method_;
+    int method_id_;
     Str uri_;
     Str version_;
     HTTPHeaders *headers_;
@@ -216,15 +328,201 @@ public:
     Str body_;
     Str path_;
     Str query_;
-    Query *arguments_;
     FileMMap *files_;
 
 private:
+    Query *arguments_;
     int64_t start_time_;
     int64_t finish_time_;
     Cookie *cookies_;
 };
 
+#define HTTP_DEFAULT_CONTENT_TYPE   "text/html; charset=UTF-8"
+#define HTTP_SERVER_NAME            "ctornado/" VERSION
+
+//
+// A response to an HTTPRequest.
+//
+// Set the status and the headers, write the body, and finish() writes
+// the whole response to the connection at once and finishes the request.
+//
+// The status line is one of the lines precomputed for every code, the
+// Date header is formatted once per second per thread (thus per IOLoop),
+// Content-Length is the length of the body, and Connection tells an
+// HTTP/1.0 client that the connection is kept alive or an HTTP/1.1 one
+// that it is closed.  Building a response makes no formatting call: the
+// head is copied into one buffer, and it is written with the body chunks,
+// which are not copied, as a chained buffer in one writev.
+//
+// Conditional GET: a response to GET or HEAD carries the ETag set by the
+// handler or, if compute_etag is true, the SHA-1 of its body.  When the
+// ETag matches If-None-Match, or without If-None-Match the Last-Modified
+// time is not after If-Modified-Since, a 304 Not Modified is sent with
+// no body.  A handler that knows its validators up front calls
+// check_not_modified() before generating the body.
+//
+// A region of a file may follow the body chunks, it is sent with
+// sendfile and never copied to user space.
+//
+class HTTPResponse
+{
+public:
+    HTTPResponse(HTTPRequest *request, int code=200);
+    ~HTTPResponse();
+
+    //
+    // Sets the status code of the response.  Throws ValueError for an
+    // unknown code.
+    //
+    void set_status(int code);
+
+    //
+    // Adds a response header.  A Content-Type or Server header replaces
+    // the default one, a Date, Content-Length or Connection header the
+    // one generated.  Throws ValueError if the value holds a line break.
+    //
+    void add_header(const Str& name, const Str& value);
+
+    //
+    // Sets the ETag validator, quoted if it is not, or the Last-Modified
+    // time.  Same as adding the Etag or Last-Modified header.
+    //
+    void set_etag(const Str& etag);
+    void set_last_modified(int64_t timestamp);
+
+    //
+    // Returns true, and turns the response into a 304 Not Modified
+    // without body, if the validators set so far match the conditional
+    // headers of a GET or HEAD request.
+    //
+    bool check_not_modified();
+
+    //
+    // Appends a chunk to the response body, the chunk is not copied.
+    //
+    void write(const Str& chunk);
+
+    //
+    // Appends count bytes of the file at offset to the response body.
+    // The descriptor is not closed: done is called once it is no longer
+    // used, after the region is sent or if it is not.
+    //
+    void send_file(int fd, off_t offset, size_t count, cb_t done=nullptr);
+
+    //
+    // Returns true if a file region follows the body chunks.
+    //
+    bool sends_file() const { return file_fd_ >= 0; }
+
+    //
+    // Returns the strong ETag of the body chunks: the SHA-1 in hex,
+    // quoted.
+    //
+    Str compute_etag();
+
+    //
+    // Writes the response and finishes the request.  The response may
+    // not be used afterwards.
+    //
+    void finish(cb_t callback=nullptr);
+
+    //
+    // Returns the response head, up to and including the empty line.
+    //
+    Str head();
+
+    //
+    // Returns the Date header line of the current second.
+    //
+    static const Str& date_line();
+
+    HTTPRequest *request_;
+    int code_;
+    StrStrVector headers_;
+    Buffer body_;
+    bool compute_etag_;
+    Str etag_;
+    int64_t last_modified_;
+
+private:
+    uint32_t replaced_;
+    int file_fd_;
+    off_t file_offset_;
+    size_t file_count_;
+    cb_t file_done_;
+
+    bool has_body();
+    void release_file();
+
+    static bool match_etag(const Str& header, const Str& etag);
+};
+
+#define GZIP_MIN_LENGTH         1024
+#define GZIP_LARGE_LENGTH       1048576
+#define GZIP_FAST_LEVEL         1
+
+//
+// Applies the gzip content-encoding to a response.
+//
+// Responses are written as raw HTTP, so the first chunk of a response
+// must hold the whole response head.  A response is compressed if the
+// client accepts gzip, its content type is text or structured text
+// (already compressed types like images and archives are left alone),
+// and it is not known to be shorter than min_length.
+//
+// A response whose body is complete in the first chunk is compressed at
+// once and keeps its Content-Length.  Otherwise the body is streamed in
+// chunked encoding, one flushed gzip chunk per write, which needs an
+// HTTP/1.1 client.
+//
+// The compression level is lowered from compress_level for large or
+// streamed responses and when the CPUs are busy.  A strong ETag of a
+// compressed response is made weak.
+//
+class GZipContentEncoding
+{
+public:
+    GZipContentEncoding(HTTPRequest *request,
+            size_t min_length=GZIP_MIN_LENGTH,
+            int compress_level=GZIP_DEFAULT_LEVEL);
+    ~GZipContentEncoding();
+
+    //
+    // Returns the first chunk of the response to write, with the
+    // response head rewritten if the body is compressed.
+    //
+    Str transform_first_chunk(const Str& chunk);
+
+    //
+    // Returns the following chunks of the response to write.
+    //
+    Str transform_chunk(const Str& chunk);
+
+    //
+    // Returns the end of the response to write when it finishes.
+    //
+    Str finish();
+
+    //
+    // Returns true if the content type is worth compressing.
+    //
+    static bool compressible_type(const Str& content_type);
+
+    size_t min_length_;
+    int compress_level_;
+
+private:
+    bool accept_gzip_;
+    bool chunked_ok_;
+    bool chunking_;
+    GZipCompressor *compressor_;
+
+    int choose_level(size_t length);
+    Str take_output();
+
+    static double cpu_load();
+};
+
 } // namespace
 
 #endif // __HTTPSERVER_H
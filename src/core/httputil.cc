@@ -75,7 +75,7 @@ void HTTPHeaders::add(const Str& name, const Str& value)
     norm_name = normalize_name(name);
 
     if (map_.find(norm_name) != map_.end()) {
-        map_[norm_name] = Str::sprintf("%S,%S", &map_[norm_name], &value);
+        map_[norm_name] = str_format("%S,%S", map_[norm_name], value);
     }
     else {
         map_[norm_name] = value;
@@ -86,12 +86,26 @@ void HTTPHeaders::add(const Str& name, const Str& value)
 
 Str HTTPHeaders::get(const Str& name, const Str& deft)
 {
-    try {
-        return map_.at(normalize_name(name));
-    }
-    catch (out_of_range) {
-        return deft;
-    }
+    auto it = map_.find(normalize_name(name));
+
+    return it != map_.end() ? it->second : deft;
+}
+
+bool HTTPHeaders::has(const StrLit& name)
+{
+    return map_.find(normalize_name(name)) != map_.end();
+}
+
+Str HTTPHeaders::get(const StrLit& name, const Str& deft)
+{
+    auto it = map_.find(normalize_name(name));
+
+    return it != map_.end() ? it->second : deft;
+}
+
+void HTTPHeaders::remove(const Str& name)
+{
+    map_.erase(normalize_name(name));
 }
 
 StrStrMap *HTTPHeaders::get_all()
@@ -102,23 +116,35 @@ StrStrMap *HTTPHeaders::get_all()
 Str HTTPHeaders::normalize_name(const Str& name)
 {
     Str normalized;
+    RegexMatch m;
+    int id;
 
-    try {
-        return normalized_headers_.at(name);
-    }
-    catch (out_of_range) {
-        RegexMatch *m = normalized_header_re_->exec(name, 1);
+    id = Symbol::lookup(name);
+    if (Symbol::is_header(id))
+        return Symbol::str(id);
 
-        if (!m->empty())
-            normalized = name;
-        else
-            normalized = name.capitalize_each('-');
+    auto it = normalized_headers_.find(name);
+    if (it != normalized_headers_.end())
+        return it->second;
 
-        delete m;
+    if (normalized_header_re_->search(name, &m))
+        normalized = name;
+    else
+        normalized = name.capitalize_each('-');
 
-        normalized_headers_[name] = normalized;
-        return normalized;
-    }
+    normalized_headers_[name] = normalized;
+    return normalized;
+}
+
+Str HTTPHeaders::normalize_name(const StrLit& name)
+{
+    int id;
+
+    id = Symbol::lookup(name);
+    if (Symbol::is_header(id))
+        return Symbol::str(id);
+
+    return normalize_name(Str(name));
 }
 
 static int _parse_param(const Str& str)
@@ -175,35 +201,158 @@ static Str _parse_header(const Str& line, StrStrMap *pdict)
 void parse_body_arguments(const Str& content_type, const Str& body,
         Query *arguments, FileMMap *files)
 {
-    bool found;
+    Str boundary;
 
     if (content_type.starts_with("application/x-www-form-urlencoded")) {
         arguments->parse_extend(body);
     }
     else if (content_type.starts_with("multipart/form-data")) {
-        found = false;
+        boundary = parse_multipart_boundary(content_type);
+
+        if (!boundary.null())
+            parse_multipart_form_data(boundary, body, arguments, files);
+        else
+            log_warn("Invalid multipart/form-data");
+    }
+}
 
-        for (auto& field : content_type.split(';')) {
-            auto kv = field.strip().split_pair('=');
+Str parse_multipart_boundary(const Str& content_type)
+{
+    if (!content_type.starts_with("multipart/form-data"))
+        return nullstr;
 
-            if (kv.first.eq("boundary") && !kv.second.null()) {
-                parse_multipart_form_data(kv.second, body, arguments, files);
-                found = true;
-                break;
-            }
+    for (auto& field : content_type.split(';')) {
+        auto kv = field.strip().split_pair('=');
+
+        if (kv.first.eq("boundary") && !kv.second.empty())
+            return kv.second;
+    }
+    return nullstr;
+}
+
+bool accepts_encoding(const Str& accept_encoding, const Str& coding)
+{
+    Str name;
+    bool accepted, wildcard, refused;
+
+    accepted = false;
+    wildcard = false;
+
+    for (auto& field : accept_encoding.split(',')) {
+        auto kv = field.split_pair(';');
+        name = kv.first.strip();
+
+        refused = false;
+        if (!kv.second.null()) {
+            auto param = kv.second.strip().split_pair('=');
+            if (param.first.strip().ieq("q") && !param.second.null())
+                refused = atof(param.second.strip().tos().c_str()) <= 0;
+        }
+
+        if (name.ieq(coding)) {
+            if (refused)
+                return false;
+            accepted = true;
+        }
+        else if (name.eq("*")) {
+            wildcard = !refused;
         }
-        if (!found)
-            log_warn("Invalid multipart/form-data");
     }
+    return accepted || wildcard;
+}
+
+bool parse_chunk_size(const Str& line, size_t *size)
+{
+    size_t length, i;
+    int c, digits;
+
+    length = 0;
+    digits = 0;
+
+    for (i = 0; i < line.len(); i++) {
+        c = line[i];
+        if (c >= '0' && c <= '9')
+            c -= '0';
+        else if (c >= 'a' && c <= 'f')
+            c -= 'a' - 10;
+        else if (c >= 'A' && c <= 'F')
+            c -= 'A' - 10;
+        else
+            break;
+
+        if (++digits > 8)
+            return false;
+        length = length * 16 + c;
+    }
+    if (digits == 0 || i == line.len() ||
+            (line[i] != '\r' && line[i] != ';' && line[i] != ' '))
+        return false;
+
+    *size = length;
+    return true;
 }
 
 void parse_multipart_form_data(const Str& boundary, const Str& data,
         Query *arguments, FileMMap *files)
+{
+    MultipartParser parser(boundary, arguments, files);
+
+    parser.feed(data);
+
+    if (!parser.finish()) {
+        log_warn("Invalid multipart/form-data");
+    }
+}
+
+HTTPFile::HTTPFile(HTTPFile&& file)
+    : filename_(file.filename_)
+    , body_(file.body_)
+    , content_type_(file.content_type_)
+    , fd_(file.fd_)
+    , size_(file.size_)
+    , map_(file.map_)
+{
+    file.fd_ = -1;
+    file.map_ = nullptr;
+}
+
+HTTPFile::~HTTPFile()
+{
+    if (map_ != nullptr)
+        munmap(map_, size_);
+    if (fd_ >= 0)
+        ::close(fd_);
+}
+
+bool HTTPFile::spooled()
+{
+    return fd_ >= 0;
+}
+
+Str HTTPFile::body()
+{
+    if (fd_ < 0 || map_ != nullptr)
+        return body_;
+
+    if (size_ == 0)
+        return "";
+
+    map_ = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd_, 0);
+    if (map_ == MAP_FAILED) {
+        log_error("mmap spooled file fd(%d) failed: %s", fd_, strerror(errno));
+        map_ = nullptr;
+        return nullstr;
+    }
+    body_ = Str(reinterpret_cast<const char *>(map_), size_);
+
+    return body_;
+}
+
+MultipartParser::MultipartParser(const Str& boundary,
+        Query *arguments, FileMMap *files,
+        size_t spool_threshold, const char *spool_dir)
 {
     Str bound;
-    int final_boundary_index, eoh;
-    HTTPHeaders *headers;
-    StrStrMap disp_params;
 
     //
     // The standard allows for the boundary to be quoted in the header,
@@ -212,69 +361,339 @@ void parse_multipart_form_data(const Str& boundary, const Str& data,
     // here but I'll save that until we see a client that uses them
     // in the wild.
     //
-    if (boundary[0] == '"' && boundary[-1] == '"') {
+    if (boundary.len() >= 2 && boundary[0] == '"' && boundary[-1] == '"') {
         bound = boundary.substr(1, boundary.len() - 1);
     }
     else {
         bound = boundary;
     }
 
-    final_boundary_index = data.rfind(Str::sprintf("--%S--", &bound));
-    if (final_boundary_index == -1) {
-        log_warn("Invalid multipart/form-data: no final boundary");
+    arguments_ = arguments;
+    files_ = files;
+    spool_threshold_ = spool_threshold;
+    spool_dir_ = spool_dir;
+
+    if (spool_dir_ == nullptr)
+        spool_dir_ = getenv("TMPDIR");
+    if (spool_dir_ == nullptr || *spool_dir_ == '\0')
+        spool_dir_ = P_tmpdir;
+
+    delimiter_ = str_format("\r\n--%S", bound);
+    //
+    // The first delimiter is not preceded by CRLF if there is no preamble,
+    // pretend we have seen one.
+    //
+    tail_ = "\r\n";
+    state_ = PREAMBLE;
+
+    dashes_ = 0;
+    fd_ = -1;
+    size_ = 0;
+}
+
+MultipartParser::~MultipartParser()
+{
+    if (fd_ >= 0)
+        ::close(fd_);
+}
+
+void MultipartParser::feed(const Str& chunk)
+{
+    Str data = chunk;
+
+    while (!data.empty()) {
+        switch (state_) {
+        case PREAMBLE:
+        case BODY:
+            consume_body(&data);
+            break;
+        case DELIMITER:
+            consume_delimiter(&data);
+            break;
+        case HEADERS:
+            if (!consume_headers(&data))
+                state_ = INVALID;
+            break;
+        case EPILOGUE:
+        case INVALID:
+            return;
+        }
+    }
+}
+
+bool MultipartParser::finish()
+{
+    if (state_ != EPILOGUE) {
+        part_.clear();
+        if (fd_ >= 0) {
+            ::close(fd_);
+            fd_ = -1;
+        }
+        return false;
+    }
+    return true;
+}
+
+//
+// Data up to the next delimiter belongs to the current part.  The last
+// (delimiter length - 1) bytes of a chunk may be the beginning of a
+// delimiter, so they are held back in tail_ and checked together with
+// the head of the next chunk.
+//
+void MultipartParser::consume_body(Str *data)
+{
+    size_t dlen, n, safe;
+    int pos;
+    Str bridge;
+
+    dlen = delimiter_.len();
+
+    if (!tail_.empty()) {
+        n = min(data->len(), dlen - 1);
+        bridge = tail_.concat(data->substr(0, n));
+        pos = bridge.find(delimiter_);
+
+        if (pos != -1) {
+            write_part(bridge.substr(0, pos));
+            data->remove_prefix(pos + dlen - tail_.len());
+            tail_ = nullstr;
+            end_part();
+            return;
+        }
+        if (n == data->len()) {
+            safe = bridge.len() >= dlen ? bridge.len() - (dlen - 1) : 0;
+            write_part(bridge.substr(0, safe));
+            data->remove_prefix(n);
+            tail_ = bridge.substr(safe, -1);
+            return;
+        }
+        write_part(tail_);
+        tail_ = nullstr;
+    }
+
+    pos = data->find(delimiter_);
+
+    if (pos != -1) {
+        write_part(data->substr(0, pos));
+        data->remove_prefix(pos + dlen);
+        end_part();
         return;
     }
+    n = min(data->len(), dlen - 1);
+    write_part(data->substr(0, data->len() - n));
+    tail_ = data->substr(data->len() - n, -1).copy();
+    data->remove_prefix(data->len());
+}
 
-    auto parts = data.substr(0, final_boundary_index).split(
-            Str::sprintf("--%S\r\n", &bound));
+//
+// A delimiter is followed by "--" if it is the close delimiter, or by
+// optional linear whitespace and CRLF otherwise.
+//
+void MultipartParser::consume_delimiter(Str *data)
+{
+    char c;
 
-    for (auto& part : parts) {
-        if (part.empty())
-            continue;
+    while (!data->empty()) {
+        c = *data->data();
+        data->remove_prefix(1);
 
-        eoh = part.find("\r\n\r\n");
-        if (eoh == -1) {
-            log_warn("multipart/form-data missing headers");
-            continue;
+        if (c == '-') {
+            if (++dashes_ == 2) {
+                state_ = EPILOGUE;
+                return;
+            }
+        }
+        else if (c == '\n') {
+            //
+            // Keep the CRLF so that an empty header block can be found
+            // by searching for CRLFCRLF as well.
+            //
+            headers_ = "\r\n";
+            state_ = HEADERS;
+            return;
         }
+    }
+}
+
+bool MultipartParser::consume_headers(Str *data)
+{
+    size_t n, old_len;
+    int eoh;
+
+    old_len = headers_.len();
+    n = min(data->len(), static_cast<size_t>(MULTIPART_MAX_HEADER_SIZE));
+    headers_ = headers_.concat(data->substr(0, n));
+    eoh = headers_.find("\r\n\r\n");
+
+    if (eoh != -1) {
+        data->remove_prefix(eoh + 4 - old_len);
+        if (!begin_part(headers_.substr(0, eoh)))
+            return false;
+        headers_ = nullstr;
+        state_ = BODY;
+        return true;
+    }
+    data->remove_prefix(n);
 
-        headers = HTTPHeaders::parse(part.substr(0, eoh));
-        Str disp_header = headers->get("Content-Disposition", "");
-        Str disposition = _parse_header(disp_header, &disp_params);
+    if (headers_.len() >= MULTIPART_MAX_HEADER_SIZE) {
+        log_warn("Invalid multipart/form-data: headers too long");
+        return false;
+    }
+    return true;
+}
 
-        if (!disposition.eq("form-data") || !part.ends_with("\r\n")) {
-            log_warn("Invalid multipart/form-data");
-            delete headers;
-            continue;
-        }
-        auto it = disp_params.find("name");
-        if (it == disp_params.end()) {
-            log_warn("multipart/form-data value missing name");
-            delete headers;
-            continue;
+bool MultipartParser::begin_part(const Str& str)
+{
+    HTTPHeaders *headers;
+    StrStrMap disp_params;
+
+    headers = HTTPHeaders::parse(str);
+    Str disp_header = headers->get("Content-Disposition", "");
+    Str disposition = _parse_header(disp_header, &disp_params);
+
+    name_ = nullstr;
+    filename_ = nullstr;
+    content_type_ = nullstr;
+
+    if (!disposition.eq("form-data")) {
+        log_warn("Invalid multipart/form-data");
+        delete headers;
+        return false;
+    }
+    auto it = disp_params.find("name");
+    if (it == disp_params.end()) {
+        log_warn("multipart/form-data value missing name");
+        delete headers;
+        return false;
+    }
+    name_ = it->second;
+
+    it = disp_params.find("filename");
+    if (it != disp_params.end()) {
+        filename_ = it->second;
+        content_type_ = headers->get("Content-Type", "application/unknown");
+    }
+    delete headers;
+
+    return true;
+}
+
+void MultipartParser::write_part(const Str& data)
+{
+    if (state_ != BODY || data.empty())
+        return;
+
+    if (fd_ >= 0) {
+        spool(data);
+        return;
+    }
+    if (!filename_.null() && part_.size() + data.len() > spool_threshold_) {
+        fd_ = open_spool_file();
+        size_ = 0;
+
+        log_verb("spool file part (%s, %s) to fd(%d)",
+                name_.tos().c_str(), filename_.tos().c_str(), fd_);
+
+        while (part_.size() > 0) {
+            spool(part_.pop());
         }
+        spool(data);
+        return;
+    }
+    part_.push(data);
+}
+
+void MultipartParser::end_part()
+{
+    Str value;
 
-        Str name = it->second;
-        Str value = part.substr(eoh + 4, part.len() - 2);    // exclude \r\n
+    if (state_ == BODY) {
+        if (filename_.null()) {
+            part_.merge_prefix(part_.size());
+            value = part_.top();
 
-        it  = disp_params.find("filename");
-        if (it == disp_params.end()) {
-            arguments->add(name, value);
+            arguments_->add(name_, value);
             log_verb("body arguments add (%s, %s)",
-                    name.tos().c_str(), value.tos().c_str());
+                    name_.tos().c_str(), value.tos().c_str());
+        }
+        else if (fd_ >= 0) {
+            files_->emplace(name_,
+                    HTTPFile(filename_, fd_, size_, content_type_));
+            fd_ = -1;
+            log_verb("body arguments add spooled file (%s, %s, %s, %zu)",
+                    name_.tos().c_str(),
+                    filename_.tos().c_str(),
+                    content_type_.tos().c_str(), size_);
         }
         else {
-            Str ctype = headers->get("Content-Type", "application/unknown");
-            files->insert({ name, HTTPFile(it->second, value, ctype) });
+            part_.merge_prefix(part_.size());
+            value = part_.top();
+
+            files_->emplace(name_, HTTPFile(filename_, value, content_type_));
             log_verb("body arguments add file (%s, %s, %s)",
-                    name.tos().c_str(),
-                    it->second.tos().c_str(),
-                    ctype.tos().c_str());
+                    name_.tos().c_str(),
+                    filename_.tos().c_str(),
+                    content_type_.tos().c_str());
         }
-        delete headers;
+    }
+    part_.clear();
+    size_ = 0;
+    headers_ = nullstr;
+    dashes_ = 0;
+    state_ = DELIMITER;
+}
 
-        disp_params.clear();
+void MultipartParser::spool(const Str& data)
+{
+    const char *pos;
+    size_t remaining;
+    ssize_t n;
+
+    pos = data.data();
+    remaining = data.len();
+
+    while (remaining > 0) {
+        n = ::write(fd_, pos, remaining);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            log_error("write spool file fd(%d) failed: %s",
+                    fd_, strerror(errno));
+            throw IOError(errno);
+        }
+        pos += n;
+        remaining -= n;
+    }
+    size_ += data.len();
+}
+
+int MultipartParser::open_spool_file()
+{
+    char path[PATH_MAX];
+    int fd;
+
+#ifdef O_TMPFILE
+    //
+    // An unnamed file in spool_dir, which is freed automatically when
+    // the descriptor is closed.  Falls back to mkstemp+unlink if the
+    // kernel or file system does not support it.
+    //
+    fd = open(spool_dir_, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+    if (fd >= 0)
+        return fd;
+#endif
+
+    scnprintf(path, sizeof(path), "%s/ctornado-XXXXXX", spool_dir_);
+
+    fd = mkostemp(path, O_CLOEXEC);
+    if (fd < 0) {
+        log_error("create spool file in '%s' failed: %s",
+                spool_dir_, strerror(errno));
+        throw IOError(errno);
     }
+    unlink(path);
+
+    return fd;
 }
 
 } // namespace
@@ -60,15 +60,29 @@ public:
     //
     Str get(const Str& name, const Str& deft=nullstr);
 
+    //
+    // Same as has and get, for a literal name written "Content-Length"_s.
+    // The header names known as symbols are found without hashing.
+    //
+    bool has(const StrLit& name);
+    Str get(const StrLit& name, const Str& deft=nullstr);
+
+    //
+    // Removes the given key.
+    //
+    void remove(const Str& name);
+
     //
     // Returns map of all (name, value) pairs.
     //
     StrStrMap *get_all();
 
     //
-    // Converts a name to Http-Header-Case.
+    // Converts a name to Http-Header-Case.  The names of symbols are
+    // returned as the shared symbol.
     //
     Str normalize_name(const Str& name);
+    Str normalize_name(const StrLit& name);
 
 private:
     StrStrMap map_;
@@ -83,16 +97,115 @@ private:
 // The content_type comes from the provided HTTP header and should not be
 // trusted outright given that it can be easily forged.
 //
+// Small uploads keep their content in body_.  Uploads spooled to disk by
+// MultipartParser keep an anonymous temporary file in fd_ instead, and
+// body_ stays empty until body() maps the file into memory.
+//
 class HTTPFile
 {
 public:
     HTTPFile(const Str& filename, const Str& body, const Str& content_type)
-        : filename_(filename), body_(body), content_type_(content_type) {}
-    ~HTTPFile() {}
+        : filename_(filename), body_(body), content_type_(content_type)
+        , fd_(-1), size_(body.len()), map_(nullptr) {}
+    HTTPFile(const Str& filename, int fd, size_t size, const Str& content_type)
+        : filename_(filename), content_type_(content_type)
+        , fd_(fd), size_(size), map_(nullptr) {}
+    HTTPFile(HTTPFile&& file);
+    HTTPFile(const HTTPFile& file) = delete;
+    ~HTTPFile();
+
+    //
+    // Returns true if the content is kept in a temporary file.
+    //
+    bool spooled();
+
+    //
+    // Returns the content, mapping the temporary file (read-only) into
+    // memory on first access if the file was spooled.  The returned Str
+    // is valid as long as this HTTPFile is alive.
+    //
+    Str body();
 
     Str filename_;
     Str body_;
     Str content_type_;
+    int fd_;
+    size_t size_;
+
+private:
+    void *map_;
+};
+
+#define MULTIPART_MAX_HEADER_SIZE   16384
+#define MULTIPART_SPOOL_THRESHOLD   1048576
+
+//
+// An incremental multipart/form-data parser.
+//
+// The body is fed in chunks as they arrive from the connection, so the
+// whole body never needs to be held in memory.  Delimiters are found even
+// when they straddle two chunks.  Form fields are collected in memory and
+// added to arguments; file parts are collected in memory until they grow
+// beyond spool_threshold bytes, and are then written to an anonymous
+// temporary file (O_TMPFILE where supported) under spool_dir.
+//
+class MultipartParser
+{
+public:
+    MultipartParser(const Str& boundary, Query *arguments, FileMMap *files,
+            size_t spool_threshold=MULTIPART_SPOOL_THRESHOLD,
+            const char *spool_dir=nullptr);
+    ~MultipartParser();
+
+    //
+    // Feeds a chunk of the body.
+    //
+    void feed(const Str& chunk);
+
+    //
+    // Finishes parsing, returns false if the final boundary was not seen
+    // or a part has oversized or malformed headers.  The rest of the
+    // body is then ignored.
+    //
+    bool finish();
+
+private:
+    enum {
+        PREAMBLE,
+        DELIMITER,
+        HEADERS,
+        BODY,
+        EPILOGUE,
+        INVALID,
+    };
+
+    Query *arguments_;
+    FileMMap *files_;
+    size_t spool_threshold_;
+    const char *spool_dir_;
+    Str delimiter_;
+    Str tail_;
+    int state_;
+
+    Str headers_;
+    int dashes_;
+    Str name_;
+    Str filename_;
+    Str content_type_;
+    Buffer part_;
+    int fd_;
+    size_t size_;
+
+    void consume_body(Str *data);
+    void consume_delimiter(Str *data);
+    bool consume_headers(Str *data);
+
+    bool begin_part(const Str& headers);
+    void write_part(const Str& data);
+    void end_part();
+
+    void spool(const Str& data);
+    int open_spool_file();
 };
 
 //
@@ -104,11 +217,32 @@ public:
 void parse_body_arguments(const Str& content_type, const Str& body,
         Query *arguments, FileMMap *files);
 
+//
+// Returns the boundary of a "multipart/form-data" content type,
+// or nullstr if content_type is not multipart/form-data.
+//
+Str parse_multipart_boundary(const Str& content_type);
+
+//
+// Returns true if the Accept-Encoding header value accepts the given
+// content-coding, e.g. "gzip".  Codings with q=0 are refused, and "*"
+// matches any coding not listed explicitly.
+//
+bool accepts_encoding(const Str& accept_encoding, const Str& coding);
+
+//
+// Parses the size line of a chunk of a chunked body, "1a3f\r\n", or with
+// chunk extensions "1a3f;name=value\r\n", which are ignored.  Returns
+// false if the line is malformed or the size over 8 hex digits.
+//
+bool parse_chunk_size(const Str& line, size_t *size);
+
 //
 // Parses a multipart/form-data body.
 //
 // The arguments and files parameters will be updated with the contents
-// of the body.
+// of the body.  A shortcut of MultipartParser for a body already held
+// in memory.
 //
 void parse_multipart_form_data(const Str& boundary, const Str& data,
         Query *arguments, FileMMap *files);
@@ -18,6 +18,8 @@
 
 namespace ctornado {
 
+using namespace std::placeholders;
+
 // Global lock for creating global IOLoop instance
 pthread_mutex_t _ioloop_instance_lock = PTHREAD_MUTEX_INITIALIZER;
 
@@ -34,6 +36,12 @@ IOLoop::IOLoop(bool edge_triggered)
     edge_triggered_ = edge_triggered;
     running_ = false;
     stopped_ = false;
+
+    waker_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (waker_fd_ == -1)
+        throw IOError(errno);
+
+    add_handler(waker_fd_, bind(&IOLoop::read_waker, this, _1, _2), READ);
 }
 
 IOLoop *IOLoop::instance()
@@ -63,6 +71,9 @@ void IOLoop::close(bool all_fds)
             }
         }
     }
+    else {
+        ::close(waker_fd_);
+    }
     poll_.close();
 }
 
@@ -141,7 +152,9 @@ void IOLoop::start()
                     delete timeout;
                 }
                 else if (timeout->deadline_ <= now) {
+                    timeouts_.pop();
                     run_callback(timeout->callback_);
+                    delete timeout;
                 }
                 else {
                     msecs = timeout->deadline_ - now;
@@ -150,11 +163,16 @@ void IOLoop::start()
                 }
             }
         }
-        if (!callbacks_.empty()) {
-            // If any callbacks or timeouts called add_callback,
-            // we don't want to wait in poll() before we run them.
+        //
+        // If any callbacks or timeouts called add_callback, we don't
+        // want to wait in poll() before we run them.  Other threads
+        // add callbacks too, the list is only read under the lock.
+        //
+        pthread_mutex_lock(&callback_lock_);
+        if (!callbacks_.empty())
             poll_timeout = 0;
-        }
+        pthread_mutex_unlock(&callback_lock_);
+
         if (!running_)
             break;
 
@@ -175,10 +193,10 @@ void IOLoop::start()
         //
         while (!events_.empty()) {
             auto it = events_.begin();
-            events_.erase(it);
-
             fd = it->first;
             events = it->second;
+            events_.erase(it);
+
             handler = handlers_[fd];
 
             log_verb("run handler on fd(%d) with events(%s)",
@@ -223,9 +241,30 @@ void IOLoop::remove_timeout(Timeout *timeout)
 
 void IOLoop::add_callback(cb_t callback)
 {
+    uint64_t one = 1;
+    bool wake;
+
     pthread_mutex_lock(&callback_lock_);
+    wake = callbacks_.empty();
     callbacks_.push_back(callback);
     pthread_mutex_unlock(&callback_lock_);
+    //
+    // The loop only waits in poll with no callbacks pending, so
+    // wake it up for the first one.
+    //
+    if (wake && ::write(waker_fd_, &one, sizeof(one)) == -1 &&
+        errno != EAGAIN) {
+        log_debug("error waking up ioloop: %s", strerror(errno));
+    }
+}
+
+void IOLoop::read_waker(int fd, uint32_t events)
+{
+    uint64_t count;
+
+    if (::read(fd, &count, sizeof(count)) == -1 && errno != EAGAIN) {
+        log_debug("error reading ioloop waker: %s", strerror(errno));
+    }
 }
 
 void IOLoop::run_callback(cb_t callback)
@@ -248,7 +287,7 @@ PeriodicCallback::PeriodicCallback(cb_t callback, int64_t callback_time,
 {
     callback_ = callback;
     callback_time_ = callback_time;
-    ioloop = ioloop != nullptr ? ioloop : IOLoop::instance();
+    ioloop_ = ioloop != nullptr ? ioloop : IOLoop::instance();
     running_ = false;
     timeout_ = nullptr;
     next_timeout_ = 0;
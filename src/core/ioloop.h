@@ -37,10 +37,13 @@ public:
     cb_t callback_;
 };
 
+//
+// Puts the earliest deadline on top of a priority_queue
+//
 struct TimeoutLess
 {
     bool operator()(Timeout *t1, Timeout *t2) const
-    { return *t1 < *t2; }
+    { return *t2 < *t1; }
 };
 
 //
@@ -137,7 +140,9 @@ public:
     //
     // Cancels a pending timeout.
     //
-    // The argument is a handle as returned by add_timeout.
+    // The argument is a handle as returned by add_timeout.  The handle
+    // is freed once the timeout has run, so a timeout that fired must
+    // not be removed: clear the handle in the callback.
     //
     void remove_timeout(Timeout *timeout);
 
@@ -148,7 +153,8 @@ public:
     // Note that this is the only method in IOLoop that makes this
     // guarantee; all other interaction with the IOLoop must be done
     // from that IOLoop's thread.  add_callback() may be used to transfer
-    // control from other threads to the IOLoop's thread.
+    // control from other threads to the IOLoop's thread.  A loop waiting
+    // in poll is woken up through an eventfd.
     //
     void add_callback(cb_t callback);
 
@@ -175,11 +181,13 @@ private:
     map<int, uint32_t> events_;
     list<cb_t> callbacks_;
     pthread_mutex_t callback_lock_;
+    int waker_fd_;
     priority_queue<Timeout *, vector<Timeout *>, TimeoutLess> timeouts_;
     bool running_;
     bool stopped_;
 
     void run_callback(cb_t callback);
+    void read_waker(int fd, uint32_t events);
 };
 
 //
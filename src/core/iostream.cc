@@ -29,29 +29,64 @@ IOStream::IOStream(Socket *socket, IOLoop *ioloop,
     max_buffer_size_ = max_buffer_size;
     read_chunk_size_ = read_chunk_size;
     error_ = nullptr;
-    write_buffer_frozen_ = false;
-    read_delimiter_ = nullptr;
+    read_delimiter_ = nullstr;
     read_regex_ = nullptr;
+    read_scanner_ = nullptr;
     read_bytes_ = 0;
+    reading_bytes_ = false;
     read_until_close_ = false;
     read_callback_ = nullptr;
     streaming_callback_ = nullptr;
     write_callback_ = nullptr;
+    write_files_before_ = 0;
     close_callback_ = nullptr;
     connect_callback_ = nullptr;
     connecting_ = false;
     state_ = 0;
     pending_callbacks_ = 0;
+    relay_ = nullptr;
+    relay_dest_ = nullptr;
+    relay_pipe_[0] = relay_pipe_[1] = -1;
+    relay_splicing_ = false;
+    relay_paused_ = false;
+    bytes_read_ = 0;
+    relay_bytes_ = 0;
+    relay_piped_ = 0;
+    relay_callback_ = nullptr;
+}
+
+IOStream::~IOStream()
+{
+    release_write_files();
+    delete read_scanner_;
+    delete error_;
+    close_relay_pipe();
 }
 
 void IOStream::connect(const char *host, int port, cb_t callback)
 {
+    sockinfo_t si;
+
     log_verb("connect to %s:%d", host, port);
 
+    if (socket_resolve(&si, socket_->family_, host, port) != 0) {
+        log_warn("connect to %s:%d failed: cannot resolve", host, port);
+        if (error_ != nullptr)
+            delete error_;
+        error_ = new SocketError("Cannot resolve address");
+        close();
+        return;
+    }
+    connect(&si, callback);
+}
+
+void IOStream::connect(const sockinfo_t *si, cb_t callback)
+{
     connecting_ = true;
 
     try {
-        socket_->connect(host, port);
+        socket_->connect(reinterpret_cast<const struct sockaddr *>(&si->addr),
+                si->addrlen);
     }
     catch (SocketError& e) {
         //
@@ -80,16 +115,20 @@ void IOStream::read_until_regex(const char *regex, cb_stream_t callback)
 #endif
 
     set_read_callback(callback);
-    if (read_regex_ != nullptr)
-        delete read_regex_;
-    read_regex_ = Regex::compile(regex);
+    read_regex_ = Regex::cached(regex);
+
+    if (read_scanner_ == nullptr)
+        read_scanner_ = new RegexScanner(read_regex_);
+    else
+        read_scanner_->reset(read_regex_);
+
     try_inline_read();
 }
 
-void IOStream::read_until(const char *delimiter, cb_stream_t callback)
+void IOStream::read_until(const Str& delimiter, cb_stream_t callback)
 {
 #ifdef DEBUG_LOG
-    log_verb("read until '%s'", Str(delimiter).escape().tos().c_str());
+    log_verb("read until '%s'", delimiter.escape().tos().c_str());
 #endif
 
     set_read_callback(callback);
@@ -104,6 +143,7 @@ void IOStream::read_bytes(size_t num_bytes, cb_stream_t callback,
 
     set_read_callback(callback);
     read_bytes_ = num_bytes;
+    reading_bytes_ = true;
     streaming_callback_ = streaming_callback;
     try_inline_read();
 }
@@ -138,17 +178,312 @@ void IOStream::write(const Str& data, cb_t callback)
     if (data.len() > 0) {
         write_buffer_.push(data);
     }
+    start_write(callback);
+}
+
+void IOStream::write(Buffer *data, cb_t callback)
+{
+    check_closed();
+
+    log_verb("write %zu bytes in %zu chunks to buffer",
+            data->size(), data->chunks());
+
+    write_buffer_.merge(data);
+    start_write(callback);
+}
+
+void IOStream::write_file(Buffer *data, int fd, off_t offset, size_t count,
+        cb_t done, cb_t callback)
+{
+    write_file_t file;
+
+    check_closed();
+
+    log_verb("write %zu bytes of file fd(%d) to buffer", count, fd);
+
+    if (data != nullptr)
+        write_buffer_.merge(data);
+
+    if (count > 0) {
+        file.fd = fd;
+        file.offset = offset;
+        file.count = count;
+        file.before = write_buffer_.size() - write_files_before_;
+        file.done = done;
+
+        write_files_before_ += file.before;
+        write_files_.push_back(file);
+    }
+    else if (done != nullptr) {
+        done();
+    }
+    start_write(callback);
+}
+
+void IOStream::release_write_files()
+{
+    cb_t done;
+
+    while (!write_files_.empty()) {
+        done = write_files_.front().done;
+        write_files_.pop_front();
+        if (done != nullptr)
+            done();
+    }
+    write_files_before_ = 0;
+}
+
+void IOStream::start_write(cb_t callback)
+{
     write_callback_ = callback;
 
     if (!connecting_) {
         handle_write();
-        if (write_buffer_.size()) {
+        if (writing()) {
             add_io_state(IOLoop::WRITE);
         }
         maybe_add_error_listener();
     }
 }
 
+void IOStream::relay(IOStream *dest, size_t num_bytes, cb_t callback)
+{
+    check_closed();
+    dest->check_closed();
+
+    log_verb("relay %zu bytes from fd(%d) to fd(%d)",
+            num_bytes, socket_->fd_, dest->socket_->fd_);
+
+    relay_ = this;
+    dest->relay_ = this;
+    relay_dest_ = dest;
+    relay_bytes_ = num_bytes;
+    relay_callback_ = callback;
+
+    start_relay();
+}
+
+void IOStream::start_relay()
+{
+    IOStream *dest;
+    size_t n;
+
+    dest = relay_dest_;
+
+    //
+    // The data buffered goes first, and what dest has yet to write
+    // before it.  Nothing more is read meanwhile, so a slow dest does
+    // not make the data pile up in the buffers.
+    //
+    n = min(read_buffer_.size(), relay_bytes_);
+    if (n > 0 || dest->writing()) {
+        relay_bytes_ -= n;
+        pause_relay();
+        dest->write(consume(n), bind(&IOStream::start_relay, this));
+        return;
+    }
+    resume_relay();
+
+    if (relay_bytes_ == 0) {
+        end_relay(true);
+        return;
+    }
+
+    //
+    // The pipe is kept for the next relays from this stream
+    //
+    if (relay_pipe_[0] < 0 &&
+            pipe2(relay_pipe_, O_NONBLOCK | O_CLOEXEC) == -1) {
+        log_warn("pipe for relay failed: %s, relay through buffers",
+                strerror(errno));
+        read_bytes(relay_bytes_, bind(&IOStream::relay_end, this, _1),
+                bind(&IOStream::relay_chunk, this, _1));
+        return;
+    }
+
+    //
+    // Take the events of both sockets over from the streams
+    //
+    if (state_ != 0) {
+        ioloop_->remove_handler(socket_->fd_);
+        state_ = 0;
+    }
+    if (dest->state_ != 0) {
+        ioloop_->remove_handler(dest->socket_->fd_);
+        dest->state_ = 0;
+    }
+    ioloop_->add_handler(socket_->fd_,
+            bind(&IOStream::handle_relay, this, _1, _2), IOLoop::ERROR);
+    ioloop_->add_handler(dest->socket_->fd_,
+            bind(&IOStream::handle_relay, this, _1, _2), IOLoop::ERROR);
+    relay_splicing_ = true;
+
+    relay_piped_ = 0;
+    handle_relay(-1, 0);
+}
+
+//
+// Fills the pipe from this socket and drains it to dest in turn, waiting
+// for the socket which would block.  Only one socket is waited for at a
+// time, so neither is polled while the other is the bottleneck.
+//
+void IOStream::handle_relay(int fd, uint32_t events)
+{
+    IOStream *dest;
+    ssize_t n;
+    int flags;
+
+    if (events & IOLoop::ERROR) {
+        log_warn("error on fd(%d) while relaying", fd);
+        end_relay(false);
+        return;
+    }
+    dest = relay_dest_;
+
+    while (true) {
+        if (relay_piped_ == 0) {
+            if (relay_bytes_ == 0) {
+                end_relay(true);
+                return;
+            }
+            n = ::splice(socket_->fd_, nullptr, relay_pipe_[1], nullptr,
+                    min(relay_bytes_, static_cast<size_t>(IOSTREAM_RELAY_SIZE)),
+                    SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (n > 0) {
+                relay_bytes_ -= n;
+                relay_piped_ += n;
+                bytes_read_ += n;
+                continue;
+            }
+            if (n == -1 && errno == EINTR)
+                continue;
+            if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                ioloop_->update_handler(socket_->fd_,
+                        IOLoop::ERROR | IOLoop::READ);
+                ioloop_->update_handler(dest->socket_->fd_, IOLoop::ERROR);
+                return;
+            }
+            log_warn("relay read on fd(%d) failed: %s", socket_->fd_,
+                    n == 0 ? "connection closed" : strerror(errno));
+            end_relay(false);
+            return;
+        }
+
+        flags = SPLICE_F_MOVE | SPLICE_F_NONBLOCK;
+        if (relay_bytes_ > 0)
+            flags |= SPLICE_F_MORE;
+
+        n = ::splice(relay_pipe_[0], nullptr, dest->socket_->fd_, nullptr,
+                relay_piped_, flags);
+        if (n > 0) {
+            relay_piped_ -= n;
+            continue;
+        }
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            ioloop_->update_handler(socket_->fd_, IOLoop::ERROR);
+            ioloop_->update_handler(dest->socket_->fd_,
+                    IOLoop::ERROR | IOLoop::WRITE);
+            return;
+        }
+        log_warn("relay write on fd(%d) failed: %s", dest->socket_->fd_,
+                strerror(errno));
+        end_relay(false);
+        return;
+    }
+}
+
+void IOStream::relay_chunk(const Str& data)
+{
+    IOStream *dest;
+
+    dest = relay_dest_;
+    if (dest == nullptr || dest->closed())
+        return;
+
+    //
+    // Stop reading while dest has over a relay size to write, until it
+    // is written
+    //
+    if (relay_paused_ ||
+            dest->write_buffer_.size() + data.len() > IOSTREAM_RELAY_SIZE) {
+        pause_relay();
+        dest->write(data, bind(&IOStream::resume_relay, this));
+    }
+    else {
+        dest->write(data);
+    }
+}
+
+void IOStream::pause_relay()
+{
+    if (!relay_paused_) {
+        relay_paused_ = true;
+        if (state_ & IOLoop::READ) {
+            state_ &= ~IOLoop::READ;
+            ioloop_->update_handler(socket_->fd_, state_);
+        }
+    }
+}
+
+void IOStream::resume_relay()
+{
+    if (relay_paused_) {
+        relay_paused_ = false;
+        add_io_state(IOLoop::READ);
+    }
+}
+
+void IOStream::relay_end(const Str& data)
+{
+    if (relay_dest_ != nullptr && !relay_dest_->closed())
+        relay_dest_->write(data, bind(&IOStream::end_relay, this, true));
+}
+
+void IOStream::end_relay(bool done)
+{
+    IOStream *dest;
+    cb_t callback;
+
+    dest = relay_dest_;
+    callback = relay_callback_;
+
+    if (relay_splicing_) {
+        ioloop_->remove_handler(socket_->fd_);
+        ioloop_->remove_handler(dest->socket_->fd_);
+        relay_splicing_ = false;
+    }
+    resume_relay();
+    relay_ = nullptr;
+    dest->relay_ = nullptr;
+    relay_dest_ = nullptr;
+    relay_callback_ = nullptr;
+
+    if (done) {
+        log_verb("relay to fd(%d) done", dest->socket_->fd_);
+
+        dest->maybe_add_error_listener();
+        if (callback != nullptr)
+            run_callback(callback);
+        else
+            maybe_add_error_listener();
+    }
+    else {
+        dest->close();
+        close();
+    }
+}
+
+void IOStream::close_relay_pipe()
+{
+    if (relay_pipe_[0] >= 0) {
+        ::close(relay_pipe_[0]);
+        ::close(relay_pipe_[1]);
+        relay_pipe_[0] = relay_pipe_[1] = -1;
+    }
+}
+
 void IOStream::set_close_callback(cb_t callback)
 {
     close_callback_ = callback;
@@ -160,10 +495,15 @@ void IOStream::close()
 
     log_verb("close stream[%p]", this);
 
+    if (relay_ != nullptr) {
+        relay_->end_relay(false);
+        return;
+    }
     if (socket_ != nullptr) {
-        if (errno) {
-            if (error_ != nullptr)
-                delete error_;
+        //
+        // Keep the error the stream was closed for, if known
+        //
+        if (errno && error_ == nullptr) {
             error_ = new Error(errno);
         }
         if (read_until_close_) {
@@ -179,11 +519,10 @@ void IOStream::close()
         socket_->close();
         delete socket_;
         socket_ = nullptr;
+        close_relay_pipe();
     }
-    if (read_regex_ != nullptr) {
-        delete read_regex_;
-        read_regex_ = nullptr;
-    }
+    release_write_files();
+    read_regex_ = nullptr;
     maybe_run_close_callback();
 }
 
@@ -210,7 +549,7 @@ bool IOStream::reading()
 
 bool IOStream::writing()
 {
-    return write_buffer_.size() > 0;
+    return write_buffer_.size() > 0 || !write_files_.empty();
 }
 
 bool IOStream::closed()
@@ -266,6 +605,9 @@ void IOStream::handle_events(int fd, uint32_t events)
         if (state == IOLoop::ERROR) {
             state |= IOLoop::READ;
         }
+        if (relay_paused_) {
+            state &= ~IOLoop::READ;
+        }
         if (state != state_) {
             ASSERT(state_ != 0);
             state_ = state;
@@ -438,6 +780,7 @@ int IOStream::read_to_buffer()
 
     log_verb("read %zu bytes data (socket -> buffer)", chunk.len());
     read_buffer_.push(chunk);
+    bytes_read_ += chunk.len();
 
     if (read_buffer_.size() >= max_buffer_size_) {
         log_error("reached maximum read buffer size");
@@ -452,7 +795,7 @@ bool IOStream::read_from_buffer()
     Str str;
     size_t bytes_to_consume, num_bytes;
     int pos, delimiter_len;
-    RegexMatch *m;
+    ssize_t end;
     cb_stream_t callback;
 
     log_verb("consume data from buffer");
@@ -460,24 +803,31 @@ bool IOStream::read_from_buffer()
     if (streaming_callback_ != nullptr && read_buffer_.size() > 0) {
         bytes_to_consume = read_buffer_.size();
 
-        if (read_bytes_ != 0) {
+        if (reading_bytes_) {
             bytes_to_consume = min(read_bytes_, bytes_to_consume);
             read_bytes_ -= bytes_to_consume;
         }
-        run_callback(streaming_callback_, consume(bytes_to_consume));
+        if (bytes_to_consume > 0) {
+            run_callback(streaming_callback_, consume(bytes_to_consume));
+        }
     }
-    if (read_bytes_ != 0 && read_buffer_.size() >= read_bytes_) {
+    //
+    // With a streaming callback read_bytes_ may drop to 0 here, the final
+    // callback is still due then (with empty data).
+    //
+    if (reading_bytes_ && read_buffer_.size() >= read_bytes_) {
         num_bytes = read_bytes_;
         callback = read_callback_;
 
         read_callback_ = nullptr;
         streaming_callback_ = nullptr;
         read_bytes_ = 0;
+        reading_bytes_ = false;
 
         run_callback(callback, consume(num_bytes));
         return true;
     }
-    else if (read_delimiter_ != nullptr) {
+    else if (!read_delimiter_.null()) {
         //
         // Multi-byte delimiters (e.g. '\r\n') may straddle two
         // chunks in the read buffer, so we can't easily find them
@@ -495,16 +845,16 @@ bool IOStream::read_from_buffer()
 
                 if (pos != -1) {
                     callback = read_callback_;
-                    delimiter_len = strlen(read_delimiter_);
+                    delimiter_len = read_delimiter_.len();
 
                     read_callback_ = nullptr;
                     streaming_callback_ = nullptr;
-                    read_delimiter_ = nullptr;
+                    read_delimiter_ = nullstr;
 
                     run_callback(callback, consume(pos + delimiter_len));
                     return true;
                 }
-                if (read_buffer_.size() == 1) {
+                if (read_buffer_.chunks() == 1) {
                     break;
                 }
                 read_buffer_.double_prefix();
@@ -512,41 +862,30 @@ bool IOStream::read_from_buffer()
         }
     }
     else if (read_regex_ != nullptr) {
+        //
+        // The scanner resumes where the previous call stopped, so each
+        // chunk is matched about once and the buffer is merged only by
+        // consume() when the match is found.
+        //
         if (read_buffer_.size() > 0) {
-            m = nullptr;
-
-            while (true) {
-                if (m != nullptr)
-                    delete m;
-
-                str = read_buffer_.top();
-                try {
-                    m = read_regex_->exec(str, 1);
-                }
-                catch (Error& e) {
-                    log_verb("IOStream read_regex exec error: %s", e.what());
-                    break;
-                }
+            try {
+                end = read_scanner_->scan(&read_buffer_);
+            }
+            catch (Error& e) {
+                log_verb("IOStream read_regex exec error: %s", e.what());
+                end = -1;
+            }
 
-                if (!m->empty()) {
-                    callback = read_callback_;
+            if (end != -1) {
+                callback = read_callback_;
 
-                    read_callback_ = nullptr;
-                    streaming_callback_ = nullptr;
-                    delete read_regex_;
-                    read_regex_ = nullptr;
+                read_callback_ = nullptr;
+                streaming_callback_ = nullptr;
+                read_regex_ = nullptr;
 
-                    run_callback(callback, consume(m->get(0).end));
-                    delete m;
-                    return true;
-                }
-                if (read_buffer_.size() == 1) {
-                    break;
-                }
-                read_buffer_.double_prefix();
+                run_callback(callback, consume(end));
+                return true;
             }
-            if (m != nullptr)
-                delete m;
         }
     }
     return false;
@@ -581,26 +920,68 @@ void IOStream::handle_connect()
     connecting_ = false;
 }
 
+//
+// The buffered chunks are written in place with a gather write, so a
+// response built of several chunks goes out in one system call and is
+// never merged.  Queued file regions go out with sendfile once the
+// buffered data before them is written.
+//
 void IOStream::handle_write()
 {
-    Str chunk;
-    int num_bytes;
+    struct iovec iov[IOSTREAM_IOV_MAX];
+    int i, iovcnt, flags;
+    size_t limit;
+    ssize_t num_bytes;
+    write_file_t *file;
     cb_t callback;
 
     log_verb("write data (buffer -> socket)");
 
-    while (write_buffer_.size() > 0) {
-        if (!write_buffer_frozen_) {
-            write_buffer_.merge_prefix(1048576);
-        }
-        chunk = write_buffer_.top();
+    while (writing()) {
+        file = write_files_.empty() ? nullptr : &write_files_.front();
 
         try {
-            num_bytes = socket_->send(chunk.data(), chunk.len());
+            if (file != nullptr && file->before == 0) {
+                num_bytes = socket_->sendfile(file->fd, &file->offset,
+                        file->count);
+                if (num_bytes == 0) {
+                    log_warn("file fd(%d) truncated while sending on fd(%d)",
+                            file->fd, socket_->fd_);
+                    close();
+                    return;
+                }
+                file->count -= num_bytes;
+                if (file->count == 0) {
+                    callback = file->done;
+                    write_files_.pop_front();
+                    if (callback != nullptr)
+                        callback();
+                }
+                continue;
+            }
+
+            iovcnt = write_buffer_.peek(iov, IOSTREAM_IOV_MAX);
+            flags = 0;
+            if (file != nullptr) {
+                //
+                // The file follows at once, don't let the head go out
+                // in a packet of its own
+                //
+                flags = MSG_MORE;
+                limit = file->before;
+                for (i = 0; i < iovcnt; i++) {
+                    if (iov[i].iov_len >= limit) {
+                        iov[i].iov_len = limit;
+                        iovcnt = i + 1;
+                        break;
+                    }
+                    limit -= iov[i].iov_len;
+                }
+            }
+            num_bytes = socket_->sendv(iov, iovcnt, flags);
         }
         catch (SocketError& e) {
             if (e.no() == EWOULDBLOCK || e.no() == EAGAIN) {
-                write_buffer_frozen_ = true;
                 break;
             }
             else {
@@ -610,13 +991,15 @@ void IOStream::handle_write()
             }
         }
         if (num_bytes == 0) {
-            write_buffer_frozen_ = true;
             break;
         }
-        write_buffer_frozen_ = false;
         write_buffer_.remove_prefix(num_bytes);
+        if (file != nullptr) {
+            file->before -= num_bytes;
+            write_files_before_ -= num_bytes;
+        }
     }
-    if (write_buffer_.size() == 0 && write_callback_ != nullptr) {
+    if (!writing() && write_callback_ != nullptr) {
         callback = write_callback_;
         write_callback_ = nullptr;
         run_callback(callback);
@@ -655,6 +1038,17 @@ void IOStream::add_io_state(uint32_t state)
         // connection has been closed, so there can be no future events
         return;
 
+    if (relay_ != nullptr && relay_->relay_splicing_)
+        // the events are taken over by a relay
+        return;
+
+    if (relay_paused_) {
+        // reading waits for the relay destination
+        state &= ~IOLoop::READ;
+        if (state == 0)
+            return;
+    }
+
     log_verb("add IO state(%s) to fd(%d)", strevent(state), socket_->fd_);
 
     if (state_ == 0) {
@@ -668,4 +1062,9 @@ void IOStream::add_io_state(uint32_t state)
     }
 }
 
+void free_stream_later(IOStream *stream)
+{
+    stream->ioloop_->add_callback([stream]() { delete stream; });
+}
+
 } // namespace
@@ -21,6 +21,21 @@
 
 namespace ctornado {
 
+#define IOSTREAM_IOV_MAX    64
+#define IOSTREAM_RELAY_SIZE 65536
+
+//
+// A file region queued for writing, sent after the given number of
+// bytes of the write buffer.
+//
+typedef struct {
+    int fd;
+    off_t offset;
+    size_t count;
+    size_t before;
+    cb_t done;
+} write_file_t;
+
 //
 // A utility class to write to and read from a non-blocking socket.
 //
@@ -42,7 +57,7 @@ class IOStream
 public:
     IOStream(Socket *socket, IOLoop *ioloop=nullptr,
             size_t max_buffer_size=104857600, size_t read_chunk_size=4096);
-    virtual ~IOStream() {}
+    virtual ~IOStream();
 
     //
     // Connects the socket to a remote address without blocking.
@@ -58,15 +73,25 @@ public:
     //
     void connect(const char *host, int port, cb_t callback=nullptr);
 
+    //
+    // Connects the socket to the resolved address si without blocking,
+    // like connect above.  The host name given there is resolved while
+    // blocking, this one may be resolved ahead, see ConnectionPool.
+    //
+    void connect(const sockinfo_t *si, cb_t callback=nullptr);
+
     //
     // Call callback when we read the given regex pattern.
     //
+    // The compiled pattern is taken from Regex.cached, so repeated
+    // reads with the same pattern compile it once.
+    //
     void read_until_regex(const char *regex, cb_stream_t callback);
 
     //
     // Call callback when we read the given delimiter.
     //
-    void read_until(const char *delimiter, cb_stream_t callback);
+    void read_until(const Str& delimiter, cb_stream_t callback);
 
     //
     // Call callback when we read the given number of bytes.
@@ -101,6 +126,35 @@ public:
     //
     void write(const Str& data, cb_t callback=nullptr);
 
+    //
+    // Write the chunks of the given buffer to this stream, the buffer is
+    // emptied.  The chunks are sent with gather writes, not merged.
+    //
+    void write(Buffer *data, cb_t callback=nullptr);
+
+    //
+    // Write the data, if any, then count bytes of the file at offset to
+    // this stream with sendfile, in order with the other writes.  The
+    // data is sent with the start of the file where possible.  The
+    // descriptor is not closed: done is called once it is no longer
+    // used, the region is written or the stream closed.
+    //
+    void write_file(Buffer *data, int fd, off_t offset, size_t count,
+            cb_t done=nullptr, cb_t callback=nullptr);
+
+    //
+    // Relays num_bytes read from this stream to dest, and calls callback
+    // once they are written.
+    //
+    // The bytes already buffered are written first.  The others are
+    // moved from socket to socket with splice through a pipe, never
+    // copied to user space, or read and written through the buffers if
+    // no pipe can be made.  Neither stream may be used until callback is
+    // called.  If either stream fails or is closed meanwhile, both are
+    // closed.
+    //
+    void relay(IOStream *dest, size_t num_bytes, cb_t callback);
+
     //
     // Call the given callback when the stream is closed.
     //
@@ -132,6 +186,11 @@ public:
     size_t read_chunk_size_;
     Error *error_;
 
+    //
+    // The number of bytes read from the socket, the relayed ones too
+    //
+    uint64_t bytes_read_;
+
 private:
     void maybe_run_close_callback();
 
@@ -181,6 +240,18 @@ private:
     void handle_connect();
     void handle_write();
 
+    void start_write(cb_t callback);
+    void release_write_files();
+
+    void start_relay();
+    void handle_relay(int fd, uint32_t events);
+    void relay_chunk(const Str& data);
+    void pause_relay();
+    void resume_relay();
+    void relay_end(const Str& data);
+    void end_relay(bool done);
+    void close_relay_pipe();
+
     Str consume(int loc);
 
     void check_closed();
@@ -212,10 +283,13 @@ private:
 
     Buffer read_buffer_;
     Buffer write_buffer_;
-    bool write_buffer_frozen_;
-    const char *read_delimiter_;
+    deque<write_file_t> write_files_;
+    size_t write_files_before_;
+    Str read_delimiter_;
     Regex *read_regex_;
+    RegexScanner *read_scanner_;
     size_t read_bytes_;
+    bool reading_bytes_;
     bool read_until_close_;
     cb_stream_t read_callback_;
     cb_stream_t streaming_callback_;
@@ -225,8 +299,29 @@ private:
     bool connecting_;
     uint32_t state_;
     int pending_callbacks_;
+
+    //
+    // relay_ is the stream relaying from or to this one, which owns the
+    // events of both sockets while splicing.  The pipe of a stream
+    // relaying from its socket is kept until it is closed.  Relaying
+    // through the buffers, the source stops reading while relay_paused_.
+    //
+    IOStream *relay_;
+    IOStream *relay_dest_;
+    int relay_pipe_[2];
+    bool relay_splicing_;
+    bool relay_paused_;
+    size_t relay_bytes_;
+    size_t relay_piped_;
+    cb_t relay_callback_;
 };
 
+//
+// Deletes stream on the next IOLoop iteration: a stream may not be
+// deleted from one of its own callbacks.
+//
+void free_stream_later(IOStream *stream);
+
 } // namespace
 
 #endif // __IOSTREAM_H
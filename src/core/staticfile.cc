@@ -0,0 +1,571 @@
+//
+// Copyright (C) 2013 Yeolar <yeolar@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "ctornado.h"
+
+namespace ctornado {
+
+using namespace std::placeholders;
+
+#define INOTIFY_MASK    (IN_ATTRIB | IN_MODIFY | IN_CLOSE_WRITE | IN_CREATE | \
+                         IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | \
+                         IN_DELETE_SELF | IN_MOVE_SELF)
+
+StaticFileCache::StaticFileCache(IOLoop *ioloop, size_t capacity)
+{
+    ioloop_ = ioloop != nullptr ? ioloop : IOLoop::instance();
+    capacity_ = max(capacity, static_cast<size_t>(1));
+
+    inotify_fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_fd_ < 0) {
+        log_warn("inotify unavailable (%s), revalidate files every %d msec",
+                strerror(errno), STATIC_FILE_TTL);
+    }
+    else {
+        ioloop_->add_handler(inotify_fd_,
+                bind(&StaticFileCache::handle_events, this, _1, _2),
+                IOLoop::READ);
+    }
+}
+
+StaticFileCache::~StaticFileCache()
+{
+    clear();
+
+    if (inotify_fd_ >= 0) {
+        ioloop_->remove_handler(inotify_fd_);
+        close(inotify_fd_);
+    }
+}
+
+StaticFile *StaticFileCache::acquire(const Str& path)
+{
+    StaticFileMap::iterator it;
+    StaticFile *file;
+    int64_t now;
+
+    it = files_.find(path);
+    if (it != files_.end()) {
+        file = it->second;
+        now = msec_now();
+        if (now - file->checked_ < STATIC_FILE_TTL || unchanged(file)) {
+            file->checked_ = now;
+            lru_.splice(lru_.begin(), lru_, file->pos_);
+            file->refs_++;
+            return file;
+        }
+        drop(file);
+    }
+
+    file = new StaticFile();
+    file->path_ = path;
+    file->err_ = 0;
+    file->fd_ = open(path.tos().c_str(), O_RDONLY | O_CLOEXEC);
+    if (file->fd_ < 0) {
+        file->err_ = errno;
+        memset(&file->st_, 0, sizeof(file->st_));
+    }
+    else if (fstat(file->fd_, &file->st_) < 0) {
+        file->err_ = errno;
+        memset(&file->st_, 0, sizeof(file->st_));
+        close(file->fd_);
+        file->fd_ = -1;
+    }
+    else if (!S_ISREG(file->st_.st_mode)) {
+        file->err_ = S_ISDIR(file->st_.st_mode) ? 0 : EACCES;
+        close(file->fd_);
+        file->fd_ = -1;
+    }
+
+    log_verb("open static file %s fd(%d)", path.tos().c_str(), file->fd_);
+
+    file->refs_ = 1;
+    file->stale_ = false;
+    file->wd_ = watch(path);
+    file->checked_ = msec_now();
+
+    files_[path] = file;
+    lru_.push_front(file);
+    file->pos_ = lru_.begin();
+
+    while (files_.size() > capacity_) {
+        drop(lru_.back());
+    }
+    return file;
+}
+
+void StaticFileCache::release(StaticFile *file)
+{
+    file->refs_--;
+    if (file->stale_ && file->refs_ == 0) {
+        if (file->fd_ >= 0)
+            close(file->fd_);
+        delete file;
+    }
+}
+
+void StaticFileCache::invalidate(const Str& path)
+{
+    StaticFileMap::iterator it;
+
+    it = files_.find(path);
+    if (it != files_.end())
+        drop(it->second);
+}
+
+void StaticFileCache::clear()
+{
+    while (!lru_.empty()) {
+        drop(lru_.back());
+    }
+}
+
+//
+// Removes the file from the cache, it is closed once released
+//
+void StaticFileCache::drop(StaticFile *file)
+{
+    files_.erase(file->path_);
+    lru_.erase(file->pos_);
+
+    if (file->wd_ >= 0) {
+        unwatch(file->wd_);
+        file->wd_ = -1;
+    }
+
+    file->stale_ = true;
+    file->refs_++;
+    release(file);
+}
+
+//
+// Stats the path of the file again: the file is the same if the path
+// still leads to the same inode, not modified, or to no file for the
+// same reason
+//
+bool StaticFileCache::unchanged(StaticFile *file)
+{
+    struct stat st;
+
+    if (stat(file->path_.tos().c_str(), &st) < 0)
+        return file->fd_ < 0 && file->err_ == errno;
+
+    return st.st_dev == file->st_.st_dev &&
+           st.st_ino == file->st_.st_ino &&
+           st.st_mode == file->st_.st_mode &&
+           st.st_size == file->st_.st_size &&
+           st.st_mtim.tv_sec == file->st_.st_mtim.tv_sec &&
+           st.st_mtim.tv_nsec == file->st_.st_mtim.tv_nsec &&
+           st.st_ctim.tv_sec == file->st_.st_ctim.tv_sec &&
+           st.st_ctim.tv_nsec == file->st_.st_ctim.tv_nsec;
+}
+
+//
+// Watches the directory of path, returns the watch descriptor or -1
+//
+int StaticFileCache::watch(const Str& path)
+{
+    map<Str, dir_watch_t, StrLess>::iterator it;
+    Str dir;
+    int pos, wd;
+
+    if (inotify_fd_ < 0)
+        return -1;
+
+    pos = path.rfind('/');
+    if (pos < 0)
+        return -1;
+    dir = pos == 0 ? Str("/") : path.substr(0, pos);
+
+    it = dirs_.find(dir);
+    if (it != dirs_.end()) {
+        it->second.files++;
+        return it->second.wd;
+    }
+
+    wd = inotify_add_watch(inotify_fd_, dir.tos().c_str(), INOTIFY_MASK);
+    if (wd < 0) {
+        log_verb("can't watch %s: %s", dir.tos().c_str(), strerror(errno));
+        return -1;
+    }
+    dir = dir.copy();
+    watches_[wd] = dir;
+    dirs_[dir] = { wd, 1 };
+
+    return wd;
+}
+
+//
+// Removes the watch of a directory once it has no file in the cache, so
+// a large tree does not run out of watches
+//
+void StaticFileCache::unwatch(int wd)
+{
+    map<int, Str>::iterator it;
+    map<Str, dir_watch_t, StrLess>::iterator dir;
+
+    it = watches_.find(wd);
+    if (it == watches_.end())
+        return;
+    dir = dirs_.find(it->second);
+    if (--dir->second.files > 0)
+        return;
+
+    //
+    // Fails if the directory is gone, the watch was removed already
+    //
+    inotify_rm_watch(inotify_fd_, wd);
+    dirs_.erase(dir);
+    watches_.erase(it);
+}
+
+//
+// A change in a directory drops the file of the event name, a watch
+// removed (the directory is gone) or an event queue overflow drops all.
+//
+void StaticFileCache::handle_events(int fd, uint32_t events)
+{
+    char buf[4096]
+        __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    const struct inotify_event *event;
+    map<int, Str>::iterator it;
+    ssize_t n;
+    char *p;
+
+    while ((n = read(inotify_fd_, buf, sizeof(buf))) > 0) {
+        for (p = buf; p < buf + n; p += sizeof(*event) + event->len) {
+            event = reinterpret_cast<const struct inotify_event *>(p);
+
+            if (event->mask & IN_Q_OVERFLOW) {
+                log_warn("inotify queue overflow, drop all static files");
+                clear();
+                continue;
+            }
+
+            it = watches_.find(event->wd);
+            if (it == watches_.end())
+                continue;
+
+            //
+            // The watches are removed with the last file of their
+            // directory, this one with the others
+            //
+            if (event->mask & (IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF)) {
+                clear();
+            }
+            else if (event->len > 0) {
+                log_verb("static file %s/%s changed",
+                        it->second.tos().c_str(), event->name);
+                invalidate(str_format("%S/%s", it->second, event->name));
+            }
+        }
+    }
+}
+
+typedef struct {
+    const char *ext;
+    const char *type;
+} mime_type_t;
+
+static const mime_type_t _mime_types[] = {
+    { "html",   "text/html; charset=UTF-8" },
+    { "htm",    "text/html; charset=UTF-8" },
+    { "css",    "text/css; charset=UTF-8" },
+    { "js",     "application/javascript" },
+    { "json",   "application/json" },
+    { "xml",    "application/xml" },
+    { "txt",    "text/plain; charset=UTF-8" },
+    { "csv",    "text/csv; charset=UTF-8" },
+    { "md",     "text/markdown; charset=UTF-8" },
+    { "svg",    "image/svg+xml" },
+    { "png",    "image/png" },
+    { "jpg",    "image/jpeg" },
+    { "jpeg",   "image/jpeg" },
+    { "gif",    "image/gif" },
+    { "webp",   "image/webp" },
+    { "ico",    "image/x-icon" },
+    { "woff",   "font/woff" },
+    { "woff2",  "font/woff2" },
+    { "ttf",    "font/ttf" },
+    { "wasm",   "application/wasm" },
+    { "pdf",    "application/pdf" },
+    { "mp3",    "audio/mpeg" },
+    { "mp4",    "video/mp4" },
+    { "webm",   "video/webm" },
+    { "zip",    "application/zip" },
+    { "gz",     "application/gzip" },
+    { "tar",    "application/x-tar" },
+};
+
+StaticFileHandler::StaticFileHandler(const Str& root, IOLoop *ioloop,
+        size_t cache_size)
+    : cache_(ioloop, cache_size)
+{
+    root_ = root.rstrip("/");
+}
+
+void StaticFileHandler::handle(HTTPRequest *request)
+{
+    handle(request, request->path_);
+}
+
+void StaticFileHandler::handle(HTTPRequest *request, const Str& path)
+{
+    Str rel, fullpath, type, accept;
+    StaticFile *file, *gz;
+    HTTPResponse *response;
+    int64_t mtime;
+    off_t start, end;
+    int err, range;
+    bool compressible;
+
+    if (request->method_id_ != SYM_GET && request->method_id_ != SYM_HEAD) {
+        response = new HTTPResponse(request, 405);
+        response->add_header("Allow", "GET, HEAD");
+        response->finish();
+        delete response;
+        return;
+    }
+
+    rel = unquote(path);
+    if (!rel.starts_with("/") || rel.find("/../") >= 0 ||
+            rel.ends_with("/..") ||
+            memchr(rel.data(), '\0', rel.len()) != nullptr) {
+        send_error(request, 403);
+        return;
+    }
+
+    fullpath = str_format("%S%S", root_, rel);
+    file = cache_.acquire(fullpath);
+
+    if (file->fd_ < 0 && file->err_ == 0 && rel.ends_with("/")) {
+        cache_.release(file);
+        fullpath = str_format("%Sindex.html", fullpath);
+        file = cache_.acquire(fullpath);
+    }
+    if (file->fd_ < 0) {
+        err = file->err_;
+        cache_.release(file);
+
+        if (err == 0 && !rel.ends_with("/")) {
+            response = new HTTPResponse(request, 301);
+            response->add_header("Location", request->query_.empty()
+                    ? str_format("%S/", request->path_)
+                    : str_format("%S/?%S", request->path_, request->query_));
+            response->finish();
+            delete response;
+        }
+        else {
+            send_error(request,
+                    err == 0 || err == ENOENT || err == ENOTDIR ? 404 : 403);
+        }
+        return;
+    }
+
+    mtime = file->st_.st_mtime;
+    type = guess_type(fullpath);
+    compressible = GZipContentEncoding::compressible_type(type);
+    gz = nullptr;
+
+    //
+    // The precompressed variant, if not outdated by the original
+    //
+    if (compressible) {
+        accept = request->headers_->get("Accept-Encoding"_s);
+        if (!accept.null() && accepts_encoding(accept, "gzip")) {
+            gz = cache_.acquire(str_format("%S.gz", fullpath));
+            if (gz->fd_ >= 0 && gz->st_.st_mtime >= mtime) {
+                cache_.release(file);
+                file = gz;
+            }
+            else {
+                cache_.release(gz);
+                gz = nullptr;
+            }
+        }
+    }
+
+    response = new HTTPResponse(request);
+    response->add_header("Content-Type", type);
+    if (compressible)
+        response->add_header("Vary", "Accept-Encoding");
+    if (gz != nullptr)
+        response->add_header("Content-Encoding", "gzip");
+    response->add_header("Accept-Ranges", "bytes");
+    response->set_etag(str_format("\"%xL-%xL\"",
+                static_cast<int64_t>(file->st_.st_mtime),
+                static_cast<int64_t>(file->st_.st_size)));
+    response->set_last_modified(mtime);
+
+    start = 0;
+    end = file->st_.st_size;
+    range = 0;
+
+    if (!response->check_not_modified()) {
+        range = parse_range(response, file->st_.st_size, &start, &end);
+        if (range > 0) {
+            response->set_status(206);
+            response->add_header("Content-Range",
+                    str_format("bytes %L-%L/%L", static_cast<int64_t>(start),
+                        static_cast<int64_t>(end - 1),
+                        static_cast<int64_t>(file->st_.st_size)));
+        }
+        else if (range < 0) {
+            response->set_status(416);
+            response->add_header("Content-Range", str_format("bytes */%L",
+                        static_cast<int64_t>(file->st_.st_size)));
+        }
+    }
+
+    if (range >= 0) {
+        response->send_file(file->fd_, start, end - start,
+                bind(&StaticFileCache::release, &cache_, file));
+    }
+    else {
+        cache_.release(file);
+    }
+    response->finish();
+    delete response;
+}
+
+Str StaticFileHandler::guess_type(const Str& path)
+{
+    Str ext;
+    int dot;
+    size_t i;
+
+    dot = path.rfind('.');
+    if (dot < 0 || path.find('/', dot) >= 0)
+        return "application/octet-stream";
+
+    ext = path.substr(dot + 1, -1);
+    for (i = 0; i < sizeof(_mime_types) / sizeof(_mime_types[0]); i++) {
+        if (ext.ieq(_mime_types[i].ext))
+            return _mime_types[i].type;
+    }
+    return "application/octet-stream";
+}
+
+void StaticFileHandler::send_error(HTTPRequest *request, int code)
+{
+    HTTPResponse *response;
+    const Str *status;
+
+    // "HTTP/1.1 404 Not Found\r\n"
+    status = &get_response_status_line(code);
+
+    response = new HTTPResponse(request, code);
+    response->add_header("Content-Type", "text/plain; charset=UTF-8");
+    response->write(str_format("%d: %S\n", code,
+                status->substr(13, status->len() - 2)));
+    response->finish();
+    delete response;
+}
+
+static bool _parse_offset(const Str& s, int64_t *value)
+{
+    const char *p;
+    int64_t n;
+
+    if (s.empty() || s.len() > 18)
+        return false;
+
+    n = 0;
+    for (p = s.begin(); p < s.end(); p++) {
+        if (*p < '0' || *p > '9')
+            return false;
+        n = n * 10 + (*p - '0');
+    }
+    *value = n;
+    return true;
+}
+
+//
+// Returns 1 and the range [start, end) if a single satisfiable byte
+// range applies, -1 if it is not satisfiable, 0 if the whole file is sent:
+// no Range, an invalid or multiple one, or If-Range not matching.
+//
+int StaticFileHandler::parse_range(HTTPResponse *response, off_t size,
+        off_t *start, off_t *end)
+{
+    HTTPRequest *request;
+    Str header, spec, first, last;
+    int64_t a, b;
+    int dash;
+
+    request = response->request_;
+    if (request->method_id_ != SYM_GET)
+        return 0;
+
+    header = request->headers_->get("Range"_s);
+    if (header.null() || !header.starts_with("bytes="))
+        return 0;
+
+    spec = header.substr(6, -1).strip();
+    if (spec.find(',') >= 0)
+        return 0;
+    dash = spec.find('-');
+    if (dash < 0)
+        return 0;
+    first = spec.substr(0, dash).strip();
+    last = spec.substr(dash + 1, -1).strip();
+
+    //
+    // If-Range is an entity tag compared strongly, or a date compared
+    // exactly with Last-Modified
+    //
+    header = request->headers_->get("If-Range"_s);
+    if (!header.null()) {
+        if (header.starts_with("\"") || header.starts_with("W/")) {
+            if (!header.eq(response->etag_))
+                return 0;
+        }
+        else if (response->last_modified_ < 0 ||
+                parse_http_date(header) != response->last_modified_) {
+            return 0;
+        }
+    }
+
+    if (first.empty()) {
+        // suffix range, the last n bytes
+        if (!_parse_offset(last, &b))
+            return 0;
+        if (b == 0)
+            return -1;
+        *start = size > b ? size - b : 0;
+        *end = size;
+        return 1;
+    }
+
+    if (!_parse_offset(first, &a))
+        return 0;
+    if (last.empty()) {
+        b = size;
+    }
+    else {
+        if (!_parse_offset(last, &b) || b < a)
+            return 0;
+        b = min(b + 1, static_cast<int64_t>(size));
+    }
+    if (a >= size)
+        return -1;
+
+    *start = a;
+    *end = b;
+    return 1;
+}
+
+} // namespace ctornado
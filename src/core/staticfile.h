@@ -0,0 +1,166 @@
+//
+// Copyright (C) 2013 Yeolar <yeolar@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef __STATICFILE_H
+#define __STATICFILE_H
+
+#include "ctornado.h"
+
+namespace ctornado {
+
+#define STATIC_FILE_CACHE_SIZE      1024
+#define STATIC_FILE_TTL             1000
+
+//
+// An open file of the cache, or the error to open it.
+//
+// fd_ is -1 for a directory or a file that could not be opened, err_ is
+// the errno then (0 for a directory).  The descriptor stays open while
+// the file is referenced, even if it is dropped from the cache.
+//
+class StaticFile
+{
+public:
+    Str path_;
+    int fd_;
+    int err_;
+    struct stat st_;
+
+    int refs_;
+    bool stale_;
+    int wd_;
+    int64_t checked_;
+    list<StaticFile *>::iterator pos_;
+};
+
+typedef map<Str, StaticFile *, StrLess> StaticFileMap;
+
+//
+// An LRU cache of open file descriptors and their stat results.
+//
+// Files are looked up by path, missing files are cached as well.  The
+// directory of every cached path is watched with inotify on the IOLoop,
+// as long as it has files in the cache, and a file is dropped as soon as
+// it, or its directory, changes.
+//
+// inotify misses some changes, e.g. a symlink higher up the path swapped
+// to deploy a new release, and is not always available (no inotify, or
+// out of watches): every file is also stat'ed again by path once
+// STATIC_FILE_TTL msec old, and dropped unless it is the same.
+//
+class StaticFileCache
+{
+public:
+    StaticFileCache(IOLoop *ioloop=nullptr,
+            size_t capacity=STATIC_FILE_CACHE_SIZE);
+    ~StaticFileCache();
+
+    StaticFileCache(const StaticFileCache&) = delete;
+    StaticFileCache& operator=(const StaticFileCache&) = delete;
+
+    //
+    // Returns the file at path, opened and stat'ed if not cached.  The
+    // file is referenced and must be released.
+    //
+    StaticFile *acquire(const Str& path);
+
+    //
+    // Releases a file returned by acquire.
+    //
+    void release(StaticFile *file);
+
+    //
+    // Drops the file at path, or every file, from the cache.
+    //
+    void invalidate(const Str& path);
+    void clear();
+
+    size_t size() const { return files_.size(); }
+
+    IOLoop *ioloop_;
+    size_t capacity_;
+
+private:
+    //
+    // A watched directory, and the number of its files in the cache
+    //
+    typedef struct {
+        int wd;
+        size_t files;
+    } dir_watch_t;
+
+    StaticFileMap files_;
+    list<StaticFile *> lru_;
+    int inotify_fd_;
+    map<int, Str> watches_;
+    map<Str, dir_watch_t, StrLess> dirs_;
+
+    bool unchanged(StaticFile *file);
+    int watch(const Str& path);
+    void unwatch(int wd);
+    void drop(StaticFile *file);
+    void handle_events(int fd, uint32_t events);
+};
+
+//
+// Serves the files under a root directory.
+//
+// GET and HEAD only.  The body is sent from the cached descriptor with
+// sendfile, and never read by the server.
+//
+//  - A directory is redirected to the path with a trailing slash, which
+//    serves its index.html.
+//  - Content-Type is guessed from the file extension.
+//  - If the client accepts gzip and the type is compressible, a .gz
+//    sibling of the file not older than it is served instead, with
+//    Content-Encoding: gzip.
+//  - ETag (from the mtime and size of the file sent) and Last-Modified
+//    answer conditional requests with 304.
+//  - A single byte range is answered with 206 Partial Content, if the
+//    If-Range validator, if any, still matches; an unsatisfiable range
+//    with 416.  Multiple ranges are answered with the whole file.
+//
+class StaticFileHandler
+{
+public:
+    StaticFileHandler(const Str& root, IOLoop *ioloop=nullptr,
+            size_t cache_size=STATIC_FILE_CACHE_SIZE);
+    ~StaticFileHandler() {}
+
+    //
+    // Serves the file at the path of the request, or at path, relative
+    // to the root.  The request is finished.
+    //
+    void handle(HTTPRequest *request);
+    void handle(HTTPRequest *request, const Str& path);
+
+    //
+    // Returns the content type for the extension of path.
+    //
+    static Str guess_type(const Str& path);
+
+    Str root_;
+    StaticFileCache cache_;
+
+private:
+    void send_error(HTTPRequest *request, int code);
+    int parse_range(HTTPResponse *response, off_t size,
+            off_t *start, off_t *end);
+};
+
+} // namespace ctornado
+
+#endif // __STATICFILE_H
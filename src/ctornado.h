@@ -25,15 +25,21 @@
 #include "lib/util.h"
 #include "lib/string.h"
 #include "lib/string-inl.h"
+#include "lib/symbol.h"
+#include "lib/format.h"
 #include "lib/buffer.h"
 #include "lib/timer.h"
 #include "lib/datetime.h"
 #include "lib/socket.h"
 #include "lib/epoll.h"
+#include "lib/binascii/codec.h"
 #include "lib/binascii.h"
+#include "lib/hash/hwcaps.h"
 #include "lib/hash/md5.h"
 #include "lib/hash/sha1.h"
+#include "lib/hash/sha256.h"
 #include "lib/hash.h"
+#include "lib/threadpool.h"
 #include "lib/gzip.h"
 #include "lib/pregex.h"
 #include "lib/urllib.h"
@@ -44,6 +50,13 @@
 #include "core/tcpserver.h"
 #include "core/httputil.h"
 #include "core/httpserver.h"
+#include "core/httpclient.h"
+#include "core/httpproxy.h"
+#include "core/connpool.h"
+#include "core/staticfile.h"
+#include "web/routing.h"
+#include "web/cache.h"
+#include "web/web.h"
 
 #endif // __CTORNADO_H
 
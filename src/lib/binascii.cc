@@ -57,7 +57,13 @@ Str unhexlify(const Str& str)
     return Str(buffer, n);
 }
 
-Str base64_encode(const Str& str)
+//
+// Shared by the standard and URL-safe wrappers.
+//
+typedef ssize_t (*b64_codec_t)(uint8_t *, size_t, const uint8_t *, size_t);
+typedef size_t (*b64_decode_len_t)(const uint8_t *, size_t);
+
+static Str _base64_encode(const Str& str, b64_codec_t encode)
 {
     str_buffer_t *buffer;
     size_t n;
@@ -65,7 +71,7 @@ Str base64_encode(const Str& str)
     n = base64_encode_len(str.len());
     buffer = Str::alloc(n);
 
-    if (base64_encode(
+    if (encode(
             reinterpret_cast<uint8_t *>(buffer->data), n,
             reinterpret_cast<const uint8_t *>(str.data()), str.len()) == -1) {
         log_error("failed to base64 encode '%s'", str.tos().c_str());
@@ -74,16 +80,17 @@ Str base64_encode(const Str& str)
     return Str(buffer, n);
 }
 
-Str base64_decode(const Str& str)
+static Str _base64_decode(const Str& str,
+        b64_codec_t decode, b64_decode_len_t decode_len)
 {
     str_buffer_t *buffer;
     size_t n;
 
-    n = base64_decode_len(
+    n = decode_len(
             reinterpret_cast<const uint8_t *>(str.data()), str.len());
     buffer = Str::alloc(n);
 
-    if (base64_decode(
+    if (decode(
             reinterpret_cast<uint8_t *>(buffer->data), n,
             reinterpret_cast<const uint8_t *>(str.data()), str.len()) == -1) {
         log_error("failed to base64 decode '%s'", str.tos().c_str());
@@ -92,4 +99,125 @@ Str base64_decode(const Str& str)
     return Str(buffer, n);
 }
 
+Str base64_encode(const Str& str)
+{
+    return _base64_encode(str, base64_encode);
+}
+
+Str base64_decode(const Str& str)
+{
+    return _base64_decode(str, base64_decode, base64_decode_len);
+}
+
+Str base64_urlsafe_encode(const Str& str)
+{
+    return _base64_encode(str, base64_urlsafe_encode);
+}
+
+Str base64_urlsafe_decode(const Str& str)
+{
+    return _base64_decode(str, base64_urlsafe_decode,
+            base64_urlsafe_decode_len);
+}
+
+Base64Encoder::Base64Encoder(bool urlsafe)
+    : urlsafe_(urlsafe), left_len_(0)
+{
+}
+
+void Base64Encoder::encode(const Str& data)
+{
+    b64_codec_t codec = base64_encode;
+    const uint8_t *in = reinterpret_cast<const uint8_t *>(data.data());
+    size_t in_len = data.len();
+    str_buffer_t *buffer;
+    uint8_t *out;
+    size_t n;
+
+    if (urlsafe_)
+        codec = base64_urlsafe_encode;
+
+    if (left_len_ + in_len < 3) {
+        memcpy(left_ + left_len_, in, in_len);
+        left_len_ += in_len;
+        return;
+    }
+    // whole groups of 3 bytes, with the bytes left from the last call
+    n = (left_len_ + in_len) / 3 * 4;
+    buffer = Str::alloc(n);
+    out = reinterpret_cast<uint8_t *>(buffer->data);
+
+    if (left_len_ > 0) {
+        memcpy(left_ + left_len_, in, 3 - left_len_);
+        in += 3 - left_len_;
+        in_len -= 3 - left_len_;
+        codec(out, 4, left_, 3);
+        out += 4;
+    }
+    left_len_ = in_len % 3;
+    in_len -= left_len_;
+    codec(out, in_len / 3 * 4, in, in_len);
+    memcpy(left_, in + in_len, left_len_);
+
+    buffer_.push(Str(buffer, n));
+}
+
+void Base64Encoder::encode(Buffer *buffer)
+{
+    for (size_t i = 0; i < buffer->chunks(); i++)
+        encode(buffer->chunk(i));
+}
+
+void Base64Encoder::close()
+{
+    b64_codec_t codec = base64_encode;
+    str_buffer_t *buffer;
+
+    if (urlsafe_)
+        codec = base64_urlsafe_encode;
+
+    if (left_len_ > 0) {
+        buffer = Str::alloc(4);
+        codec(reinterpret_cast<uint8_t *>(buffer->data), 4, left_, left_len_);
+        buffer_.push(Str(buffer, 4));
+        left_len_ = 0;
+    }
+}
+
+Base64Decoder::Base64Decoder(bool urlsafe)
+{
+    base64_decode_init(&state_, urlsafe);
+}
+
+void Base64Decoder::decode(const Str& data)
+{
+    str_buffer_t *buffer;
+    Str decoded;
+    size_t n;
+
+    // up to 2 bytes are pending from the last call
+    n = (data.len() + 3) / 4 * 3 + 2;
+    buffer = Str::alloc(n);
+
+    n = base64_decode_update(&state_,
+            reinterpret_cast<uint8_t *>(buffer->data), n,
+            reinterpret_cast<const uint8_t *>(data.data()), data.len());
+
+    decoded = Str(buffer, n);
+    if (n > 0)
+        buffer_.push(decoded);
+}
+
+void Base64Decoder::decode(Buffer *buffer)
+{
+    for (size_t i = 0; i < buffer->chunks(); i++)
+        decode(buffer->chunk(i));
+}
+
+void Base64Decoder::close()
+{
+    if (base64_decode_final(&state_) == -1)
+        throw ValueError("Incorrect padding");
+}
+
 } // namespace
@@ -39,6 +39,13 @@ size_t base64_decode_len(const uint8_t *s, size_t len);
 ssize_t base64_decode(uint8_t *out, size_t out_len,
         const uint8_t *in, size_t in_len);
 
+ssize_t base64_urlsafe_encode(uint8_t *out, size_t out_len,
+        const uint8_t *in, size_t in_len);
+
+size_t base64_urlsafe_decode_len(const uint8_t *s, size_t len);
+ssize_t base64_urlsafe_decode(uint8_t *out, size_t out_len,
+        const uint8_t *in, size_t in_len);
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
@@ -70,6 +77,68 @@ Str base64_encode(const Str& str);
 //
 Str base64_decode(const Str& str);
 
+//
+// Encode string str using the URL-safe alphabet, which substitutes
+// - instead of + and _ instead of / in the standard Base64 alphabet.
+//
+Str base64_urlsafe_encode(const Str& str);
+
+//
+// Decode string str using the URL-safe alphabet.
+//
+Str base64_urlsafe_decode(const Str& str);
+
+//
+// Incremental Base64 encoding, the data may be split anywhere.
+//
+// The encoded output of each call is pushed to the buffer as one Str,
+// the last 1 or 2 bytes are kept until more data or close.
+//
+class Base64Encoder : public BufferIO
+{
+public:
+    Base64Encoder(bool urlsafe=false);
+    virtual ~Base64Encoder() {}
+
+    void encode(const Str& data);
+
+    //
+    // Encode all the chunks of buffer, without merging them.
+    //
+    void encode(Buffer *buffer);
+
+    void close();
+
+private:
+    bool urlsafe_;
+    uint8_t left_[3];
+    size_t left_len_;
+};
+
+//
+// Incremental Base64 decoding, the data may be split anywhere.
+//
+// close throws a ValueError if the data ended within a quad.
+//
+class Base64Decoder : public BufferIO
+{
+public:
+    Base64Decoder(bool urlsafe=false);
+    virtual ~Base64Decoder() {}
+
+    void decode(const Str& data);
+
+    //
+    // Decode all the chunks of buffer, without merging them.
+    //
+    void decode(Buffer *buffer);
+
+    void close();
+
+private:
+    base64_state_t state_;
+};
+
 } // namespace
 
 #endif // __BINASCII_H
@@ -14,14 +14,40 @@
  * limitations under the License.
  */
 
+
+/*
+ * The vector codecs follow Wojciech Muła and Daniel Lemire, "Faster
+ * Base64 Encoding and Decoding Using AVX2 Instructions".  They handle
+ * whole blocks of valid input, everything else (the padding, line
+ * breaks, invalid characters) is left to the scalar code.
+ */
+
 #include <stddef.h>
 #include <stdint.h>
 #include <sys/types.h>
+#include "codec.h"
 
-static uint8_t b64_enc_table[] =
-    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+#ifdef BINASCII_X86
+#include <immintrin.h>
+#endif
+
+typedef struct {
+    const uint8_t *enc;
+    const signed char *dec;
+    uint8_t c62;
+    uint8_t c63;
+    /* a character is invalid if lut_lo[lo nibble] & lut_hi[hi nibble] */
+    uint8_t lut_lo[16];
+    /* value - character, by hi nibble, except for c63 */
+    int8_t roll[16];
+} b64_alphabet_t;
+
+static const uint8_t b64_lut_hi[16] = {
+    0x01,0x02,0x04,0x08, 0x10,0x20,0x40,0x80,
+    0xff,0xff,0xff,0xff, 0xff,0xff,0xff,0xff
+};
 
-static char b64_dec_table[] = {
+static const signed char b64_dec_table[] = {
     -1,-1,-1,-1, -1,-1,-1,-1, -1,-1,-1,-1, -1,-1,-1,-1,
     -1,-1,-1,-1, -1,-1,-1,-1, -1,-1,-1,-1, -1,-1,-1,-1,
     -1,-1,-1,-1, -1,-1,-1,-1, -1,-1,-1,62, -1,-1,-1,63,
@@ -32,19 +58,47 @@ static char b64_dec_table[] = {
     41,42,43,44, 45,46,47,48, 49,50,51,-1, -1,-1,-1,-1
 };
 
+static const signed char b64_urlsafe_dec_table[] = {
+    -1,-1,-1,-1, -1,-1,-1,-1, -1,-1,-1,-1, -1,-1,-1,-1,
+    -1,-1,-1,-1, -1,-1,-1,-1, -1,-1,-1,-1, -1,-1,-1,-1,
+    -1,-1,-1,-1, -1,-1,-1,-1, -1,-1,-1,-1, -1,62,-1,-1,
+    52,53,54,55, 56,57,58,59, 60,61,-1,-1, -1, 0,-1,-1, /* Note PAD->0 */
+    -1, 0, 1, 2,  3, 4, 5, 6,  7, 8, 9,10, 11,12,13,14,
+    15,16,17,18, 19,20,21,22, 23,24,25,-1, -1,-1,-1,63,
+    -1,26,27,28, 29,30,31,32, 33,34,35,36, 37,38,39,40,
+    41,42,43,44, 45,46,47,48, 49,50,51,-1, -1,-1,-1,-1
+};
+
+static const b64_alphabet_t b64_standard = {
+    (const uint8_t *)
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/",
+    b64_dec_table, '+', '/',
+    { 0x57,0x07,0x07,0x07, 0x07,0x07,0x07,0x07,
+      0x07,0x07,0x0f,0xab, 0xaf,0xaf,0xaf,0xab },
+    { 0, 0, 62 - '+', 52 - '0', 0 - 'A', 0 - 'A', 26 - 'a', 26 - 'a',
+      0, 0, 0, 0, 0, 0, 0, 0 }
+};
+
+static const b64_alphabet_t b64_urlsafe = {
+    (const uint8_t *)
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_",
+    b64_urlsafe_dec_table, '-', '_',
+    { 0x57,0x07,0x07,0x07, 0x07,0x07,0x07,0x07,
+      0x07,0x07,0x0f,0xaf, 0xaf,0xab,0xaf,0x8f },
+    { 0, 0, 62 - '-', 52 - '0', 0 - 'A', 0 - 'A', 26 - 'a', 26 - 'a',
+      0, 0, 0, 0, 0, 0, 0, 0 }
+};
+
 #define BASE64_PAD      '='
 
-/*
- * Find and return the next valid character for base64, or -1 if none
- */
-static int _find_valid(uint8_t *s, size_t len)
+static int _find_valid(const uint8_t *s, size_t len, const signed char *dec)
 {
     int ret = -1;
     uint8_t c;
 
     while (len > 0 && ret == -1) {
         c = *s++;
-        if (c <= 0x7f && b64_dec_table[c & 0x7f] != -1) {
+        if (c <= 0x7f && dec[c] != -1) {
             ret = c;
         }
         len--;
@@ -52,15 +106,203 @@ static int _find_valid(uint8_t *s, size_t len)
     return ret;
 }
 
+#ifdef BINASCII_X86
+
+/*
+ * Spread 12 bytes to the 16 6-bit indices, and map them to characters
+ * with the offset of their range: 0..25, 26..51, 52..61, 62 and 63.
+ */
+#define ENCODE_BLOCK(V, S, in, a)                                           \
+    do {                                                                    \
+        __m##S##i t0, t1, t2, t3, r, lut;                                   \
+        in = V##_shuffle_epi8(in, V##_set_epi8(V##_REP(                    \
+                10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1)));       \
+        t0 = V##_and_si##S(in, V##_set1_epi32(0x0fc0fc00));                 \
+        t1 = V##_mulhi_epu16(t0, V##_set1_epi32(0x04000040));               \
+        t2 = V##_and_si##S(in, V##_set1_epi32(0x003f03f0));                 \
+        t3 = V##_mullo_epi16(t2, V##_set1_epi32(0x01000010));               \
+        in = V##_or_si##S(t1, t3);                                          \
+        r = V##_subs_epu8(in, V##_set1_epi8(51));                           \
+        r = V##_or_si##S(r, V##_and_si##S(                                  \
+                V##_cmpgt_epi8(V##_set1_epi8(26), in), V##_set1_epi8(13))); \
+        lut = V##_set_epi8(V##_REP(0, 0, 'A', (a)->c63 - 63,                \
+                (a)->c62 - 62, '0' - 52, '0' - 52, '0' - 52, '0' - 52,      \
+                '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,           \
+                '0' - 52, 'a' - 26));                                       \
+        in = V##_add_epi8(in, V##_shuffle_epi8(lut, r));                    \
+    } while (0)
+
+/*
+ * Check that the 16 characters are in the alphabet, map them to their
+ * values, and pack the 6-bit values to 12 bytes in 32-bit lanes.
+ */
+#define DECODE_BLOCK(V, S, in, a, lut_lo, lut_hi, roll, ok)                 \
+    do {                                                                    \
+        __m##S##i hi, lo, eq63, off;                                        \
+        hi = V##_and_si##S(V##_srli_epi32(in, 4), V##_set1_epi8(0x0f));     \
+        lo = V##_and_si##S(in, V##_set1_epi8(0x0f));                        \
+        lo = V##_and_si##S(V##_shuffle_epi8(lut_lo, lo),                    \
+                V##_shuffle_epi8(lut_hi, hi));                              \
+        ok = V##_movemask_epi8(V##_cmpeq_epi8(lo, V##_setzero_si##S()));    \
+        eq63 = V##_cmpeq_epi8(in, V##_set1_epi8((a)->c63));                 \
+        off = V##_shuffle_epi8(roll, hi);                                   \
+        off = V##_or_si##S(V##_andnot_si##S(eq63, off),                     \
+                V##_and_si##S(eq63, V##_set1_epi8(63 - (a)->c63)));         \
+        in = V##_add_epi8(in, off);                                         \
+        in = V##_maddubs_epi16(in, V##_set1_epi32(0x01400140));             \
+        in = V##_madd_epi16(in, V##_set1_epi32(0x00011000));                \
+        in = V##_shuffle_epi8(in, V##_set_epi8(V##_REP(                     \
+                -1, -1, -1, -1, 12, 13, 14, 8, 9, 10, 4, 5, 6, 0, 1, 2)));  \
+    } while (0)
+
+#define _mm_REP(...)        __VA_ARGS__
+#define _mm256_REP(...)     __VA_ARGS__, __VA_ARGS__
+
+__attribute__((target("ssse3")))
+static size_t encode_ssse3(uint8_t *out, const uint8_t *in, size_t in_len,
+        const b64_alphabet_t *a)
+{
+    const uint8_t *p = in;
+    __m128i v;
+
+    /* 12 bytes are used of the 16 loaded */
+    while (in_len - (p - in) >= 16) {
+        v = _mm_loadu_si128((const __m128i *)p);
+        ENCODE_BLOCK(_mm, 128, v, a);
+        _mm_storeu_si128((__m128i *)out, v);
+        p += 12;
+        out += 16;
+    }
+    return p - in;
+}
+
+__attribute__((target("avx2")))
+static size_t encode_avx2(uint8_t *out, const uint8_t *in, size_t in_len,
+        const b64_alphabet_t *a)
+{
+    const uint8_t *p = in;
+    __m256i v;
+
+    /* 12 bytes in each 128-bit lane */
+    while (in_len - (p - in) >= 28) {
+        v = _mm256_inserti128_si256(_mm256_castsi128_si256(
+                    _mm_loadu_si128((const __m128i *)p)),
+                _mm_loadu_si128((const __m128i *)(p + 12)), 1);
+        ENCODE_BLOCK(_mm256, 256, v, a);
+        _mm256_storeu_si256((__m256i *)out, v);
+        p += 24;
+        out += 32;
+    }
+    return p - in;
+}
+
+/*
+ * Decode blocks of valid characters, return the number of characters
+ * used.  out must have room for 4 bytes more than the decoded data.
+ */
+__attribute__((target("ssse3")))
+static size_t decode_ssse3(uint8_t *out, size_t out_len,
+        const uint8_t *in, size_t in_len, const b64_alphabet_t *a)
+{
+    const uint8_t *p = in;
+    __m128i v, lut_lo, lut_hi, roll;
+    int ok;
+
+    lut_lo = _mm_loadu_si128((const __m128i *)a->lut_lo);
+    lut_hi = _mm_loadu_si128((const __m128i *)b64_lut_hi);
+    roll = _mm_loadu_si128((const __m128i *)a->roll);
+
+    while (in_len - (p - in) >= 16 && out_len >= 16) {
+        v = _mm_loadu_si128((const __m128i *)p);
+        DECODE_BLOCK(_mm, 128, v, a, lut_lo, lut_hi, roll, ok);
+        if (ok != 0xffff)
+            break;
+        _mm_storeu_si128((__m128i *)out, v);
+        p += 16;
+        out += 12;
+        out_len -= 12;
+    }
+    return p - in;
+}
+
+__attribute__((target("avx2")))
+static size_t decode_avx2(uint8_t *out, size_t out_len,
+        const uint8_t *in, size_t in_len, const b64_alphabet_t *a)
+{
+    const uint8_t *p = in;
+    __m256i v, lut_lo, lut_hi, roll;
+    int ok;
+
+    lut_lo = _mm256_broadcastsi128_si256(
+            _mm_loadu_si128((const __m128i *)a->lut_lo));
+    lut_hi = _mm256_broadcastsi128_si256(
+            _mm_loadu_si128((const __m128i *)b64_lut_hi));
+    roll = _mm256_broadcastsi128_si256(
+            _mm_loadu_si128((const __m128i *)a->roll));
+
+    while (in_len - (p - in) >= 32 && out_len >= 32) {
+        v = _mm256_loadu_si256((const __m256i *)p);
+        DECODE_BLOCK(_mm256, 256, v, a, lut_lo, lut_hi, roll, ok);
+        if (ok != -1)
+            break;
+        /* join the 12 bytes of each lane */
+        v = _mm256_permutevar8x32_epi32(v, _mm256_setr_epi32(
+                    0, 1, 2, 4, 5, 6, 7, 7));
+        _mm256_storeu_si256((__m256i *)out, v);
+        p += 32;
+        out += 24;
+        out_len -= 24;
+    }
+    return p - in;
+}
+
+#endif /* BINASCII_X86 */
+
+static size_t encode_fast(uint8_t *out, const uint8_t *in, size_t in_len,
+        const b64_alphabet_t *a)
+{
+#ifdef BINASCII_X86
+    int caps = binascii_hwcaps();
+    size_t n = 0;
+
+    if (caps & BINASCII_HW_AVX2)
+        n = encode_avx2(out, in, in_len, a);
+    if (caps & BINASCII_HW_SSSE3)
+        n += encode_ssse3(out + n / 3 * 4, in + n, in_len - n, a);
+    return n;
+#else
+    return 0;
+#endif
+}
+
+static size_t decode_fast(uint8_t *out, size_t out_len,
+        const uint8_t *in, size_t in_len, const b64_alphabet_t *a)
+{
+#ifdef BINASCII_X86
+    int caps = binascii_hwcaps();
+    size_t n = 0;
+
+    if (caps & BINASCII_HW_AVX2)
+        n = decode_avx2(out, out_len, in, in_len, a);
+    if (caps & BINASCII_HW_SSSE3)
+        n += decode_ssse3(out + n / 4 * 3, out_len - n / 4 * 3,
+                in + n, in_len - n, a);
+    return n;
+#else
+    return 0;
+#endif
+}
+
 size_t base64_encode_len(size_t len)
 {
     return len > 0 ? (len + 2) / 3 * 4 : 0;
 }
 
-ssize_t base64_encode(uint8_t *out, size_t out_len,
-        const uint8_t *in, size_t in_len)
+static ssize_t _encode(uint8_t *out, size_t out_len,
+        const uint8_t *in, size_t in_len, const b64_alphabet_t *a)
 {
     ssize_t len;
+    size_t n;
     unsigned int leftchar = 0;
     int leftbits = 0;
 
@@ -69,6 +311,11 @@ ssize_t base64_encode(uint8_t *out, size_t out_len,
     if (out_len < len)
         return -1;
 
+    n = encode_fast(out, in, in_len, a);
+    out += n / 3 * 4;
+    in += n;
+    in_len -= n;
+
     for (; in_len > 0; in_len--, in++) {
         /* shift the data into buffer */
         leftchar = (leftchar << 8) | *in;
@@ -77,29 +324,42 @@ ssize_t base64_encode(uint8_t *out, size_t out_len,
         /* see if there are 6-bit groups ready */
         while (leftbits >= 6) {
             leftbits -= 6;
-            *out++ = b64_enc_table[(leftchar >> leftbits) & 0x3f];
+            *out++ = a->enc[(leftchar >> leftbits) & 0x3f];
         }
     }
     if (leftbits == 2) {
-        *out++ = b64_enc_table[(leftchar & 0x3) << 4];
+        *out++ = a->enc[(leftchar & 0x3) << 4];
         *out++ = BASE64_PAD;
         *out++ = BASE64_PAD;
     }
     else if (leftbits == 4) {
-        *out++ = b64_enc_table[(leftchar & 0xf) << 2];
+        *out++ = a->enc[(leftchar & 0xf) << 2];
         *out++ = BASE64_PAD;
     }
     return len;
 }
 
-size_t base64_decode_len(const uint8_t *s, size_t len)
+ssize_t base64_encode(uint8_t *out, size_t out_len,
+        const uint8_t *in, size_t in_len)
+{
+    return _encode(out, out_len, in, in_len, &b64_standard);
+}
+
+ssize_t base64_urlsafe_encode(uint8_t *out, size_t out_len,
+        const uint8_t *in, size_t in_len)
+{
+    return _encode(out, out_len, in, in_len, &b64_urlsafe);
+}
+
+static size_t _decode_len(const uint8_t *s, size_t len,
+        const signed char *dec)
 {
     const uint8_t *t = s;
 
     if (len == 0)
         return 0;
 
-    while (len > 0 && b64_dec_table[*t] != -1 && *t != BASE64_PAD) {
+    while (len > 0 && *t <= 0x7f && dec[*t] != -1 && *t != BASE64_PAD) {
         t++;
         len--;
     }
@@ -108,15 +368,45 @@ size_t base64_decode_len(const uint8_t *s, size_t len)
     return (len + 3) / 4 * 3 - (4 - len % 4) % 4;
 }
 
-ssize_t base64_decode(uint8_t *out, size_t out_len, uint8_t *in, size_t in_len)
+size_t base64_decode_len(const uint8_t *s, size_t len)
+{
+    return _decode_len(s, len, b64_dec_table);
+}
+
+size_t base64_urlsafe_decode_len(const uint8_t *s, size_t len)
 {
-    ssize_t len = 0;
+    return _decode_len(s, len, b64_urlsafe_dec_table);
+}
+
+void base64_decode_init(base64_state_t *state, int urlsafe)
+{
+    state->leftchar = 0;
+    state->leftbits = 0;
+    state->quad_pos = 0;
+    state->pad = 0;
+    state->done = 0;
+    state->urlsafe = urlsafe;
+}
+
+size_t base64_decode_update(base64_state_t *state,
+        uint8_t *out, size_t out_len, const uint8_t *in, size_t in_len)
+{
+    const b64_alphabet_t *a = state->urlsafe ? &b64_urlsafe : &b64_standard;
+    size_t len = 0, n;
     uint8_t c;
-    unsigned int leftchar = 0;
-    int leftbits = 0;
-    int quad_pos = 0;
+    int v;
 
-    for (; in_len > 0; in_len--, in++) {
+    for (; in_len > 0 && !state->done; in_len--, in++) {
+        /* whole quads of valid characters go to the vector code */
+        if (state->quad_pos == 0 && in_len >= 16) {
+            n = decode_fast(out, out_len - len, in, in_len, a);
+            out += n / 4 * 3;
+            len += n / 4 * 3;
+            in += n;
+            in_len -= n;
+            if (in_len == 0)
+                break;
+        }
         c = *in;
 
         if (c > 0x7f || c == '\r' || c == '\n' || c == ' ')
@@ -124,42 +414,76 @@ ssize_t base64_decode(uint8_t *out, size_t out_len, uint8_t *in, size_t in_len)
 
         /* check for pad sequences and ignore the invalid ones */
         if (c == BASE64_PAD) {
-            if (quad_pos < 2 ||
-                    (quad_pos == 2 &&
-                     _find_valid(in + 1, in_len - 1) != BASE64_PAD))
+            if (state->quad_pos < 2)
                 continue;
-            else {
-                /* a pad sequence means no more input.
-                 * we've already interpreted the data
-                 * from the quad at this point.
-                 */
-                leftbits = 0;
-                break;
+            if (state->quad_pos == 2 && !state->pad) {
+                v = _find_valid(in + 1, in_len - 1, a->dec);
+                /* the second pad may be in the next input */
+                if (v == -1)
+                    state->pad = 1;
+                if (v != BASE64_PAD)
+                    continue;
             }
+            /* a pad sequence means no more input.
+             * we've already interpreted the data
+             * from the quad at this point.
+             */
+            state->leftbits = 0;
+            state->done = 1;
+            break;
         }
-        c = b64_dec_table[*in];
+        c = a->dec[c];
         if (c == (uint8_t) -1)
             continue;
 
         /* shift it in on the low end, and see if there's
          * a byte ready for output.
          */
-        quad_pos = (quad_pos + 1) & 0x3;
-        leftchar = (leftchar << 6) | c;
-        leftbits += 6;
+        state->pad = 0;
+        state->quad_pos = (state->quad_pos + 1) & 0x3;
+        state->leftchar = (state->leftchar << 6) | c;
+        state->leftbits += 6;
 
-        if (leftbits >= 8) {
+        if (state->leftbits >= 8) {
             if (len == out_len)
                 break;
-            leftbits -= 8;
-            *out++ = (leftchar >> leftbits) & 0xff;
+            state->leftbits -= 8;
+            *out++ = (state->leftchar >> state->leftbits) & 0xff;
             len++;
-            leftchar &= (1 << leftbits) - 1;
+            state->leftchar &= (1 << state->leftbits) - 1;
         }
     }
-    if (leftbits != 0)
+    return len;
+}
+
+int base64_decode_final(base64_state_t *state)
+{
+    return state->leftbits != 0 ? -1 : 0;
+}
+
+static ssize_t _decode(uint8_t *out, size_t out_len,
+        const uint8_t *in, size_t in_len, int urlsafe)
+{
+    base64_state_t state;
+    size_t len;
+
+    base64_decode_init(&state, urlsafe);
+    len = base64_decode_update(&state, out, out_len, in, in_len);
+
+    if (base64_decode_final(&state) == -1)
         return -1;
 
     return len;
 }
 
+ssize_t base64_decode(uint8_t *out, size_t out_len,
+        const uint8_t *in, size_t in_len)
+{
+    return _decode(out, out_len, in, in_len, 0);
+}
+
+ssize_t base64_urlsafe_decode(uint8_t *out, size_t out_len,
+        const uint8_t *in, size_t in_len)
+{
+    return _decode(out, out_len, in, in_len, 1);
+}
@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2013 Yeolar <yeolar@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * The features are detected once, with cpuid.  AVX2 also needs the OS
+ * to save the YMM registers, which is checked with xgetbv.
+ */
+
+#include "codec.h"
+
+#ifdef BINASCII_X86
+#include <cpuid.h>
+#endif
+
+static int detected = -1;
+static int allowed = BINASCII_HW_ALL;
+
+static int detect(void)
+{
+    int caps = 0;
+#ifdef BINASCII_X86
+    unsigned int eax, ebx, ecx, edx, xcr0;
+    int osxsave;
+
+    if (__get_cpuid_max(0, NULL) < 1)
+        return 0;
+
+    __cpuid(1, eax, ebx, ecx, edx);
+    osxsave = (ecx & bit_OSXSAVE) != 0;
+
+    if (ecx & bit_SSSE3)
+        caps |= BINASCII_HW_SSSE3;
+
+    if (__get_cpuid_max(0, NULL) < 7 || !osxsave)
+        return caps;
+
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+
+    if (ebx & bit_AVX2) {
+        __asm__ ("xgetbv" : "=a" (xcr0), "=d" (edx) : "c" (0));
+        if ((xcr0 & 6) == 6)
+            caps |= BINASCII_HW_AVX2;
+    }
+#endif
+    return caps;
+}
+
+int binascii_hwcaps(void)
+{
+    if (detected < 0)
+        detected = detect();
+    return detected & allowed;
+}
+
+void binascii_set_hwcaps(int caps)
+{
+    allowed = caps;
+}
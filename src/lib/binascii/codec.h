@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2013 Yeolar <yeolar@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef __BINASCII_CODEC_H
+#define __BINASCII_CODEC_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#define BINASCII_X86
+#endif
+
+#define BINASCII_HW_SSSE3   0x1     /* 16 bytes at a time */
+#define BINASCII_HW_AVX2    0x2     /* 32 bytes at a time */
+#define BINASCII_HW_ALL     (BINASCII_HW_SSSE3 | BINASCII_HW_AVX2)
+
+/*
+ * The vector instructions detected on this CPU, and not disabled.
+ */
+int binascii_hwcaps(void);
+
+/*
+ * Restrict the instructions used to caps, 0 is the scalar code.
+ */
+void binascii_set_hwcaps(int caps);
+
+/*
+ * State of an incremental base64 decoding, the input may be split
+ * anywhere, even within a quad or between the pad characters.
+ */
+typedef struct {
+    unsigned int leftchar;
+    int leftbits;
+    int quad_pos;
+    int pad;        /* a '=' at the third position of the last quad */
+    int done;       /* the pad sequence is seen, no more input */
+    int urlsafe;
+} base64_state_t;
+
+void base64_decode_init(base64_state_t *state, int urlsafe);
+
+/*
+ * Decode in to out, and return the number of bytes written.
+ * Decoding stops when out_len bytes are written.
+ */
+size_t base64_decode_update(base64_state_t *state,
+        uint8_t *out, size_t out_len, const uint8_t *in, size_t in_len);
+
+/*
+ * Return -1 if the input ended within a quad, 0 otherwise.
+ */
+int base64_decode_final(base64_state_t *state);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* __BINASCII_CODEC_H */
@@ -18,6 +18,11 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <sys/types.h>
+#include "codec.h"
+
+#ifdef BINASCII_X86
+#include <immintrin.h>
+#endif
 
 static uint8_t _hex[] = "0123456789abcdef";
 
@@ -51,17 +56,133 @@ static uint8_t _xctoi(uint8_t c)
     return 0;
 }
 
+#ifdef BINASCII_X86
+
+/*
+ * The nibbles are mapped to digits with a shuffle of "0123456789abcdef",
+ * and interleaved high nibble first.
+ */
+__attribute__((target("ssse3")))
+static size_t hexlify_ssse3(uint8_t *out, const uint8_t *in, size_t in_len)
+{
+    const __m128i digits = _mm_loadu_si128((const __m128i *)_hex);
+    const __m128i mask = _mm_set1_epi8(0x0f);
+    __m128i v, hi, lo;
+    size_t n;
+
+    for (n = 0; n + 16 <= in_len; n += 16) {
+        v = _mm_loadu_si128((const __m128i *)(in + n));
+        hi = _mm_shuffle_epi8(digits, _mm_and_si128(_mm_srli_epi16(v, 4), mask));
+        lo = _mm_shuffle_epi8(digits, _mm_and_si128(v, mask));
+        _mm_storeu_si128((__m128i *)(out + n * 2), _mm_unpacklo_epi8(hi, lo));
+        _mm_storeu_si128((__m128i *)(out + n * 2 + 16), _mm_unpackhi_epi8(hi, lo));
+    }
+    return n;
+}
+
+__attribute__((target("avx2")))
+static size_t hexlify_avx2(uint8_t *out, const uint8_t *in, size_t in_len)
+{
+    const __m256i digits = _mm256_broadcastsi128_si256(
+            _mm_loadu_si128((const __m128i *)_hex));
+    const __m256i mask = _mm256_set1_epi8(0x0f);
+    __m256i v, hi, lo, a, b;
+    size_t n;
+
+    for (n = 0; n + 32 <= in_len; n += 32) {
+        v = _mm256_loadu_si256((const __m256i *)(in + n));
+        hi = _mm256_shuffle_epi8(digits, _mm256_and_si256(_mm256_srli_epi16(v, 4), mask));
+        lo = _mm256_shuffle_epi8(digits, _mm256_and_si256(v, mask));
+        /* unpack works within the 128-bit lanes */
+        a = _mm256_unpacklo_epi8(hi, lo);
+        b = _mm256_unpackhi_epi8(hi, lo);
+        _mm256_storeu_si256((__m256i *)(out + n * 2),
+                _mm256_permute2x128_si256(a, b, 0x20));
+        _mm256_storeu_si256((__m256i *)(out + n * 2 + 32),
+                _mm256_permute2x128_si256(a, b, 0x31));
+    }
+    return n;
+}
+
+/*
+ * Map the digits to nibbles, '0' ~ '9' by subtraction and the letters
+ * by subtraction after folding them to lower case.  Blocks with other
+ * characters are left to the scalar code.
+ */
+#define UNHEX_BLOCK(V, S, in, ok)                                           \
+    do {                                                                    \
+        __m##S##i d, x, is_d, is_x;                                         \
+        d = V##_sub_epi8(in, V##_set1_epi8('0'));                           \
+        x = V##_sub_epi8(V##_or_si##S(in, V##_set1_epi8(0x20)),             \
+                V##_set1_epi8('a'));                                        \
+        is_d = V##_cmpeq_epi8(V##_min_epu8(d, V##_set1_epi8(9)), d);        \
+        is_x = V##_cmpeq_epi8(V##_min_epu8(x, V##_set1_epi8(5)), x);        \
+        ok = V##_movemask_epi8(V##_or_si##S(is_d, is_x));                   \
+        in = V##_or_si##S(V##_and_si##S(is_d, d), V##_and_si##S(is_x,       \
+                    V##_add_epi8(x, V##_set1_epi8(10))));                   \
+        in = V##_maddubs_epi16(in, V##_set1_epi16(0x0110));                 \
+        in = V##_packus_epi16(in, in);                                      \
+    } while (0)
+
+__attribute__((target("ssse3")))
+static size_t unhexlify_ssse3(uint8_t *out, const uint8_t *in, size_t in_len)
+{
+    __m128i v;
+    size_t n;
+    int ok;
+
+    for (n = 0; n + 16 <= in_len; n += 16) {
+        v = _mm_loadu_si128((const __m128i *)(in + n));
+        UNHEX_BLOCK(_mm, 128, v, ok);
+        if (ok != 0xffff)
+            break;
+        _mm_storel_epi64((__m128i *)(out + n / 2), v);
+    }
+    return n;
+}
+
+__attribute__((target("avx2")))
+static size_t unhexlify_avx2(uint8_t *out, const uint8_t *in, size_t in_len)
+{
+    __m256i v;
+    size_t n;
+    int ok;
+
+    for (n = 0; n + 32 <= in_len; n += 32) {
+        v = _mm256_loadu_si256((const __m256i *)(in + n));
+        UNHEX_BLOCK(_mm256, 256, v, ok);
+        if (ok != -1)
+            break;
+        /* the 8 bytes of each lane are in its low half */
+        v = _mm256_permute4x64_epi64(v, 0x08);
+        _mm_storeu_si128((__m128i *)(out + n / 2), _mm256_castsi256_si128(v));
+    }
+    return n;
+}
+
+#endif /* BINASCII_X86 */
+
 ssize_t hexlify(uint8_t *out, size_t out_len,
         const uint8_t *in, size_t in_len)
 {
     uint8_t c;
-    size_t len;
+    size_t len, n = 0;
 
     len = in_len * 2;
 
     if (out_len < len)
         return -1;
 
+#ifdef BINASCII_X86
+    if (binascii_hwcaps() & BINASCII_HW_AVX2)
+        n = hexlify_avx2(out, in, in_len);
+    if (binascii_hwcaps() & BINASCII_HW_SSSE3)
+        n += hexlify_ssse3(out + n * 2, in + n, in_len - n);
+#endif
+    out += n * 2;
+    in += n;
+    in_len -= n;
+
     while (in_len-- > 0) {
         c = *in++;
         *out++ = _hex[(c >> 4) & 0xf];
@@ -74,7 +195,7 @@ ssize_t unhexlify(uint8_t *out, size_t out_len,
         const uint8_t *in, size_t in_len)
 {
     uint8_t c1, c2;
-    size_t len;
+    size_t len, n = 0;
 
     if (in_len % 2 != 0)
         return -1;
@@ -84,6 +205,16 @@ ssize_t unhexlify(uint8_t *out, size_t out_len,
     if (out_len < len)
         return -1;
 
+#ifdef BINASCII_X86
+    if (binascii_hwcaps() & BINASCII_HW_AVX2)
+        n = unhexlify_avx2(out, in, in_len);
+    if (binascii_hwcaps() & BINASCII_HW_SSSE3)
+        n += unhexlify_ssse3(out + n / 2, in + n, in_len - n);
+#endif
+    out += n / 2;
+    in += n;
+    in_len -= n;
+
     while (in_len > 0) {
         c1 = *in++;
         c2 = *in++;
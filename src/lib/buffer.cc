@@ -20,8 +20,12 @@ namespace ctornado {
 
 void Buffer::merge(Buffer *buffer)
 {
-    while (buffer->size() > 0) {
-        push(buffer->pop());
+    Str chunk;
+
+    while (buffer->chunks() > 0) {
+        chunk = buffer->pop();
+        if (chunk.len() > 0)
+            push(chunk);
     }
 }
 
@@ -149,6 +153,31 @@ size_t Buffer::size()
     return size_;
 }
 
+size_t Buffer::chunks()
+{
+    return chunk_dq_.size();
+}
+
+Str Buffer::chunk(size_t i)
+{
+    ASSERT(i < chunk_dq_.size());
+
+    return chunk_dq_[i];
+}
+
+int Buffer::peek(struct iovec *iov, int n)
+{
+    int i;
+
+    n = min(n, static_cast<int>(chunk_dq_.size()));
+
+    for (i = 0; i < n; i++) {
+        iov[i].iov_base = const_cast<char *>(chunk_dq_[i].data());
+        iov[i].iov_len = chunk_dq_[i].len();
+    }
+    return n;
+}
+
 void Buffer::clear()
 {
     chunk_dq_.clear();
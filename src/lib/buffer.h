@@ -39,6 +39,19 @@ public:
     size_t size();
     void clear();
 
+    //
+    // Number of chunks and the i-th chunk, to scan the buffer without
+    // merging it.
+    //
+    size_t chunks();
+    Str chunk(size_t i);
+
+    //
+    // Point at most n iovecs to the leading chunks, for a gather write
+    // without merging.  Returns the number of iovecs filled.
+    //
+    int peek(struct iovec *iov, int n);
+
 private:
     deque<Str> chunk_dq_;
     size_t size_;
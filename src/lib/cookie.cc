@@ -18,6 +18,9 @@
 
 namespace ctornado {
 
+//
+// The Cookie header is split by hand in one pass, following the pattern
+// used by Python's Cookie module:
 //
 //  "([\w\d!#%&'~_`><@,:/\$\*\+\-\.\^\|\)\(\?\}\{\=]+?)"
 //  "\s*=\s*"
@@ -28,15 +31,136 @@ namespace ctornado {
 //  "[\w\d!#%&'~_`><@,:/\$\*\+\-\.\^\|\)\(\?\}\{\=]*)"
 //  "\s*;?"
 //
-static Regex *_cookie_pattern = Regex::compile(
-    "([\\w\\d!#%&'~_`><@,:/\\$\\*\\+\\-\\.\\^\\|\\)\\(\\?\\}\\{\\=]+?)"
-    "\\s*=\\s*"
-    "(\"(?:[^\\\"]|\\.)*\""
-    "|"
-    "\\w{3},\\s[\\s\\w\\d-]{9,11}\\s[\\d:]{8}\\sGMT"
-    "|"
-    "[\\w\\d!#%&'~_`><@,:/\\$\\*\\+\\-\\.\\^\\|\\)\\(\\?\\}\\{\\=]*)"
-    "\\s*;?");
+static int _key_chars[] = {
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,1,0,1,1,1,1,1,1,1,1,1,1,1,1,1,    // !#$%&'()*+,-./
+    1,1,1,1,1,1,1,1,1,1,1,0,1,1,1,1,    // 0-9:<=>?
+    1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,    // @A-O
+    1,1,1,1,1,1,1,1,1,1,1,0,0,0,1,1,    // P-Z^_
+    1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,    // `a-o
+    1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,0,    // p-z{|}~
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+};
+
+#define _is_key_char(c)     _key_chars[static_cast<uint8_t>(c)]
+#define _is_space(c)        ((c) == ' ' || ((c) >= '\t' && (c) <= '\r'))
+#define _is_word_char(c)    (isalnum(static_cast<uint8_t>(c)) || (c) == '_')
+
+//
+// Length of an expires date like "Wed, 09 Jun 2021 10:18:14 GMT" at p,
+// or 0.
+//
+static size_t _date_len(const char *p, const char *end)
+{
+    const char *q;
+    size_t n;
+    int i;
+
+    if (end - p < 4 + 1 + 9 + 1 + 8 + 1 + 3)
+        return 0;
+    if (!_is_word_char(p[0]) || !_is_word_char(p[1]) ||
+            !_is_word_char(p[2]) || p[3] != ',' || !_is_space(p[4]))
+        return 0;
+
+    for (n = 11; n >= 9; n--) {
+        q = p + 5;
+        if (q + n + 1 + 8 + 1 + 3 > end)
+            continue;
+
+        for (i = 0; i < static_cast<int>(n); i++) {
+            if (!_is_space(q[i]) && !_is_word_char(q[i]) && q[i] != '-')
+                break;
+        }
+        if (i < static_cast<int>(n))
+            continue;
+        q += n;
+        if (!_is_space(*q++))
+            continue;
+
+        for (i = 0; i < 8; i++) {
+            if (!isdigit(static_cast<uint8_t>(q[i])) && q[i] != ':')
+                break;
+        }
+        if (i < 8)
+            continue;
+        q += 8;
+        if (!_is_space(*q++) || memcmp(q, "GMT", 3) != 0)
+            continue;
+
+        return q + 3 - p;
+    }
+    return 0;
+}
+
+bool CookieTokenizer::next(Str *key, Str *value)
+{
+    const char *begin, *end, *p, *q, *k, *v;
+    size_t n;
+
+    begin = data_.data();
+    end = begin + data_.len();
+    p = begin + pos_;
+
+    while (p < end) {
+        if (!_is_key_char(*p)) {
+            p++;
+            continue;
+        }
+
+        // The shortest key followed by '='
+        k = p;
+        q = p + 1;
+        while (q < end && _is_key_char(*q) && *q != '=')
+            q++;
+        p = q;
+        while (p < end && _is_space(*p))
+            p++;
+        if (p == end || *p != '=') {
+            p = q;
+            continue;
+        }
+        *key = data_.substr(k - begin, q - begin);
+
+        p++;
+        while (p < end && _is_space(*p))
+            p++;
+        v = p;
+
+        if (p < end && *p == '"') {
+            for (q = p + 1; q < end && *q != '"'; q++) {
+                if (*q == '\\' && q + 1 < end)
+                    q++;
+            }
+            if (q < end)
+                p = q + 1;
+        }
+        if (p == v && (n = _date_len(p, end)) > 0)
+            p += n;
+        if (p == v) {
+            while (p < end && _is_key_char(*p))
+                p++;
+        }
+        *value = data_.substr(v - begin, p - begin);
+
+        while (p < end && _is_space(*p))
+            p++;
+        if (p < end && *p == ';')
+            p++;
+
+        pos_ = p - begin;
+        return true;
+    }
+    pos_ = data_.len();
+    return false;
+}
 
 //
 // These quoting routines conform to the RFC2109 specification, which in
@@ -169,6 +293,11 @@ static Str _unquote(const Str& str)
         return str;
 
     sub = str.substr(1, str.len() - 1);
+
+    // Nothing escaped, the value is a view of str.
+    if (sub.find('\\') == -1)
+        return sub;
+
     pos = sub.begin();
     end = sub.end();
 
@@ -224,10 +353,29 @@ StrStrMap _reserved_init()
 
 static StrStrMap _reserved(_reserved_init());
 
+//
+// Same as finding key.lower() in _reserved, without the allocation.
+//
+static bool _is_reserved(const Str& key)
+{
+    static const char *names[] = {
+        "expires", "path", "comment", "domain",
+        "max-age", "secure", "httponly", "version" };
+
+    if (key.len() < 4 || key.len() > 8)
+        return false;
+
+    for (size_t i = 0; i < NELEMS(names); i++) {
+        if (strlen(names[i]) == key.len() &&
+                strncasecmp(names[i], key.data(), key.len()) == 0)
+            return true;
+    }
+    return false;
+}
+
 void CookieMorsel::set(const Str& key, const Str& value, const Str& coded_value)
 {
-    if (_reserved.find(key.lower()) == _reserved.end() &&
-            key.all(_is_legal_char)) {
+    if (!_is_reserved(key) && key.all(_is_legal_char)) {
         key_ = key;
         value_ = value;
         coded_value_ = coded_value;
@@ -257,7 +405,7 @@ Str CookieMorsel::output()
 {
     StrList result;
 
-    result.push_back(Str::sprintf("%S=%S", &key_, &coded_value_));
+    result.push_back(str_format("%S=%S", key_, coded_value_));
 
     for (auto& kv : attributes_) {
         if (kv.second.eq(""))
@@ -267,19 +415,13 @@ Str CookieMorsel::output()
             result.push_back(_reserved[kv.first]);
         }
         else {
-            result.push_back(Str::sprintf("%S=%S",
-                        &_reserved[kv.first], &kv.second));
+            result.push_back(str_format("%S=%S",
+                        _reserved[kv.first], kv.second));
         }
     }
     return Str::join("; ", result);
 }
 
-Cookie::~Cookie()
-{
-    for (auto& kv : map_)
-        delete kv.second;
-}
-
 Str Cookie::value_encode(const Str& value)
 {
     return _quote(value);
@@ -297,12 +439,9 @@ bool Cookie::has(const Str& key)
 
 CookieMorsel *Cookie::get(const Str& key)
 {
-    try {
-        return map_.at(key);
-    }
-    catch (out_of_range) {
-        return nullptr;
-    }
+    auto it = map_.find(key);
+
+    return it != map_.end() ? &it->second : nullptr;
 }
 
 void Cookie::set(const Str& key, const Str& value)
@@ -312,37 +451,16 @@ void Cookie::set(const Str& key, const Str& value)
 
 void Cookie::__set(const Str& key, const Str& value, const Str& coded_value)
 {
-    if (map_.find(key) == map_.end()) {
-        map_[key] = new CookieMorsel();
-    }
-    map_[key]->set(key, value, coded_value);
+    map_[key].set(key, value, coded_value);
 }
 
 void Cookie::load(const Str& data)
 {
+    CookieTokenizer tokenizer(data);
     CookieMorsel *cm = nullptr;
-    RegexMatch *m = nullptr;
-    Str key, value, tmp = data;
-
-    while (!tmp.empty()) {
-        if (m != nullptr)
-            delete m;
-
-        try {
-            m = _cookie_pattern->exec(tmp);
-        }
-        catch (Error& e) {
-            log_vverb("Cookie regex exec error: %s", e.what());
-            break;
-        }
-        if (m->size() == 0)      // no more cookies
-            break;
-
-        key = m->substr(1);
-        value = m->substr(2);
-
-        tmp.remove_prefix(m->get(0).end);
+    Str key, value;
 
+    while (tokenizer.next(&key, &value)) {
         // Parse the key and value in case it's metainfo
         if (key[0] == '$') {
             //
@@ -353,17 +471,36 @@ void Cookie::load(const Str& data)
             if (cm)
                 cm->set_attribute(key, value);
         }
-        else if (_reserved.find(key.lower()) != _reserved.end()) {
+        else if (_is_reserved(key)) {
             if (cm)
                 cm->set_attribute(key, _unquote(value));
         }
         else {
             __set(key, _unquote(value), value);
-            cm = map_[key];
+            cm = &map_[key];
+        }
+    }
+}
+
+bool Cookie::lookup(const Str& data, const Str& key, Str *value)
+{
+    CookieTokenizer tokenizer(data);
+    Str k, v, found;
+    bool has = false;
+
+    //
+    // As in load, a later cookie of the same name wins.  Only that one
+    // is decoded.
+    //
+    while (tokenizer.next(&k, &v)) {
+        if (k.eq(key)) {
+            found = v;
+            has = true;
         }
     }
-    if (m != nullptr)
-        delete m;
+    if (has)
+        *value = _unquote(found);
+    return has;
 }
 
 Str Cookie::output()
@@ -371,7 +508,7 @@ Str Cookie::output()
     StrList lines;
 
     for (auto& kv : map_) {
-        lines.push_back(Str("Set-Cookie: ").concat(kv.second->output()));
+        lines.push_back(Str("Set-Cookie: ").concat(kv.second.output()));
     }
     return Str::join("\r\n", lines);
 }
@@ -76,11 +76,31 @@ private:
     StrStrMap attributes_;
 };
 
+//
+// Splits a Cookie header into key/value pairs in a single pass.  The
+// keys and values are views into the header, and the values are given
+// as sent: quoted values are left to Cookie::value_decode.
+//
+class CookieTokenizer
+{
+public:
+    CookieTokenizer(const Str& data) : data_(data), pos_(0) {}
+
+    //
+    // Set key and value to the next pair, return false at the end.
+    //
+    bool next(Str *key, Str *value);
+
+private:
+    Str data_;
+    size_t pos_;
+};
+
 class Cookie
 {
 public:
     Cookie() {}
-    ~Cookie();
+    ~Cookie() {}
 
     //
     // Return an encoded value.
@@ -113,13 +133,19 @@ public:
     //
     void load(const Str& data);
 
+    //
+    // Find the decoded value of the cookie key in data, an HTTP_COOKIE,
+    // without loading the Morsels.  Return false if not found.
+    //
+    static bool lookup(const Str& data, const Str& key, Str *value);
+
     //
     // Return a string representation suitable to be sent as HTTP headers.
     //
     Str output();
 
 private:
-    map<Str, CookieMorsel *, StrLess> map_;
+    map<Str, CookieMorsel, StrLess> map_;
 
     void __set(const Str& key, const Str& value, const Str& coded_value);
 };
@@ -62,7 +62,315 @@ Str format_date(int64_t timestamp, const char *fmt)
 
 Str format_email_date(int64_t timestamp)
 {
-    return format_date(timestamp, "%a, %d %b %Y %H:%M:%S GMT");
+    return format_http_date(timestamp);
+}
+
+static const char _wdays[] = "SunMonTueWedThuFriSat";
+static const char _months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+
+static const char _digits[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+#define SECS_PER_DAY    86400
+
+static inline int64_t _floor_div(int64_t a, int64_t b)
+{
+    return a / b - (a % b < 0);
+}
+
+//
+// Days since 1970-01-01 of a proleptic Gregorian date, and the reverse,
+// with the 400 years eras starting on March 1st, so that leap days are
+// the last ones of an era year.
+//
+static int64_t _days_from_civil(int64_t y, int m, int d)
+{
+    int64_t era, yoe, doy, doe;
+
+    y -= m <= 2;
+    era = _floor_div(y, 400);
+    yoe = y - era * 400;
+    doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+    doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+
+    return era * 146097 + doe - 719468;
+}
+
+static void _civil_from_days(int64_t z, int64_t *year, int *month, int *day)
+{
+    int64_t era, doe, yoe, doy, mp;
+
+    z += 719468;
+    era = _floor_div(z, 146097);
+    doe = z - era * 146097;
+    yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    mp = (5 * doy + 2) / 153;
+
+    *day = doy - (153 * mp + 2) / 5 + 1;
+    *month = mp < 10 ? mp + 3 : mp - 9;
+    *year = yoe + era * 400 + (*month <= 2);
+}
+
+static inline char *_put2(char *p, int v)
+{
+    memcpy(p, _digits + v * 2, 2);
+    return p + 2;
+}
+
+struct http_date_cache_t
+{
+    int64_t second;
+    int64_t day;
+    char date[HTTP_DATE_LEN];
+};
+
+char *format_http_date(char *buf, int64_t timestamp)
+{
+    static thread_local http_date_cache_t cache = { INT64_MIN, INT64_MIN, {} };
+    int64_t day, year;
+    int month, mday, secs;
+    char *p;
+
+    if (timestamp == cache.second) {
+        memcpy(buf, cache.date, HTTP_DATE_LEN);
+        return buf + HTTP_DATE_LEN;
+    }
+
+    day = _floor_div(timestamp, SECS_PER_DAY);
+    secs = timestamp - day * SECS_PER_DAY;
+
+    if (day != cache.day) {
+        _civil_from_days(day, &year, &month, &mday);
+        if (year < 0 || year > 9999) {
+            year = year < 0 ? 0 : 9999;
+        }
+
+        // "Sun, 06 Nov 1994 "
+        p = cache.date;
+        // 1970-01-01 is a Thursday
+        memcpy(p, _wdays + (day + 4 - _floor_div(day + 4, 7) * 7) * 3, 3);
+        p[3] = ',';
+        p[4] = ' ';
+        _put2(p + 5, mday);
+        p[7] = ' ';
+        memcpy(p + 8, _months + (month - 1) * 3, 3);
+        p[11] = ' ';
+        _put2(p + 12, year / 100);
+        _put2(p + 14, year % 100);
+        p[16] = ' ';
+        memcpy(p + 25, " GMT", 4);
+
+        cache.day = day;
+    }
+
+    // "08:49:37"
+    p = cache.date + 17;
+    _put2(p, secs / 3600);
+    p[2] = ':';
+    _put2(p + 3, secs / 60 % 60);
+    p[5] = ':';
+    _put2(p + 6, secs % 60);
+
+    cache.second = timestamp;
+
+    memcpy(buf, cache.date, HTTP_DATE_LEN);
+    return buf + HTTP_DATE_LEN;
+}
+
+Str format_http_date(int64_t timestamp)
+{
+    str_buffer_t *buffer;
+
+    buffer = Str::alloc(HTTP_DATE_LEN);
+    format_http_date(buffer->data, timestamp);
+
+    return Str(buffer, HTTP_DATE_LEN);
+}
+
+//
+// Month 1 ~ 12 of the name at p, ignoring the case, or 0
+//
+static int _parse_month(const char *p)
+{
+    uint32_t key;
+
+    key = (static_cast<uint32_t>(p[0] | 0x20) << 16) |
+          (static_cast<uint32_t>(p[1] | 0x20) << 8) |
+          static_cast<uint32_t>(p[2] | 0x20);
+
+#define MONTH_KEY(a, b, c)  ((a << 16) | (b << 8) | c)
+    switch (key) {
+    case MONTH_KEY('j', 'a', 'n'): return 1;
+    case MONTH_KEY('f', 'e', 'b'): return 2;
+    case MONTH_KEY('m', 'a', 'r'): return 3;
+    case MONTH_KEY('a', 'p', 'r'): return 4;
+    case MONTH_KEY('m', 'a', 'y'): return 5;
+    case MONTH_KEY('j', 'u', 'n'): return 6;
+    case MONTH_KEY('j', 'u', 'l'): return 7;
+    case MONTH_KEY('a', 'u', 'g'): return 8;
+    case MONTH_KEY('s', 'e', 'p'): return 9;
+    case MONTH_KEY('o', 'c', 't'): return 10;
+    case MONTH_KEY('n', 'o', 'v'): return 11;
+    case MONTH_KEY('d', 'e', 'c'): return 12;
+    default: return 0;
+    }
+#undef MONTH_KEY
+}
+
+//
+// Parse at least min_digits and at most max_digits digits at *pp
+//
+static bool _parse_num(const char **pp, const char *end,
+        int min_digits, int max_digits, int *value)
+{
+    const char *p;
+    int v, n;
+
+    p = *pp;
+    v = 0;
+    for (n = 0; n < max_digits && p < end &&
+            static_cast<unsigned>(*p - '0') < 10; n++) {
+        v = v * 10 + (*p++ - '0');
+    }
+    *pp = p;
+    *value = v;
+
+    return n >= min_digits;
+}
+
+static bool _parse_time(const char **pp, const char *end,
+        int *hour, int *min, int *sec)
+{
+    const char *p;
+
+    if (end - *pp < 8)
+        return false;
+
+    p = *pp;
+    if (p[2] != ':' || p[5] != ':')
+        return false;
+
+    *hour = (p[0] - '0') * 10 + (p[1] - '0');
+    *min = (p[3] - '0') * 10 + (p[4] - '0');
+    *sec = (p[6] - '0') * 10 + (p[7] - '0');
+    *pp = p + 8;
+
+    return static_cast<unsigned>(p[0] - '0') < 10 &&
+           static_cast<unsigned>(p[1] - '0') < 10 &&
+           static_cast<unsigned>(p[3] - '0') < 10 &&
+           static_cast<unsigned>(p[4] - '0') < 10 &&
+           static_cast<unsigned>(p[6] - '0') < 10 &&
+           static_cast<unsigned>(p[7] - '0') < 10;
+}
+
+int64_t parse_http_date(const char *s, size_t n)
+{
+    static const int mdays[] = {
+        31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31
+    };
+    const char *p, *end, *q;
+    int year, month, day, hour, min, sec, digits;
+
+    p = s;
+    end = s + n;
+
+    while (p < end && *p == ' ') {
+        p++;
+    }
+    // the day of week is not checked
+    while (p < end && (*p | 0x20) >= 'a' && (*p | 0x20) <= 'z') {
+        p++;
+    }
+    if (p == end)
+        return -1;
+
+    if (*p == ',') {
+        // RFC 1123 "06 Nov 1994" or RFC 850 "06-Nov-94"
+        p++;
+        while (p < end && *p == ' ') {
+            p++;
+        }
+        if (!_parse_num(&p, end, 1, 2, &day) || end - p < 5 ||
+                (*p != ' ' && *p != '-'))
+            return -1;
+        month = _parse_month(p + 1);
+        if (p[4] != p[0])
+            return -1;
+        p += 5;
+
+        q = p;
+        if (!_parse_num(&p, end, 2, 4, &year) || p == end || *p != ' ')
+            return -1;
+        digits = p - q;
+        if (digits == 2) {
+            year += year < 69 ? 2000 : 1900;
+        }
+        else if (digits != 4) {
+            return -1;
+        }
+        p++;
+
+        if (!_parse_time(&p, end, &hour, &min, &sec))
+            return -1;
+        if (end - p < 4 || memcmp(p, " GMT", 4) != 0)
+            return -1;
+        p += 4;
+    }
+    else if (*p == ' ') {
+        // asctime() "Nov  6 08:49:37 1994"
+        p++;
+        if (end - p < 4 || p[3] != ' ')
+            return -1;
+        month = _parse_month(p);
+        p += 4;
+        if (p < end && *p == ' ') {
+            p++;
+        }
+        if (!_parse_num(&p, end, 1, 2, &day) || p == end || *p++ != ' ')
+            return -1;
+        if (!_parse_time(&p, end, &hour, &min, &sec))
+            return -1;
+        if (p == end || *p++ != ' ' || !_parse_num(&p, end, 4, 4, &year))
+            return -1;
+    }
+    else {
+        return -1;
+    }
+
+    while (p < end && *p == ' ') {
+        p++;
+    }
+    if (p != end)
+        return -1;
+
+    // no date before the epoch, so -1 is never a timestamp
+    if (year < 1970 || month == 0 || day < 1 || day > mdays[month - 1] ||
+            hour > 23 || min > 59 || sec > 60)
+        return -1;
+    if (month == 2 && day == 29 &&
+            (year % 4 != 0 || (year % 100 == 0 && year % 400 != 0)))
+        return -1;
+
+    return _days_from_civil(year, month, day) * SECS_PER_DAY +
+        hour * 3600 + min * 60 + sec;
+}
+
+int64_t parse_http_date(const Str& s)
+{
+    if (s.len() == 0)
+        return -1;
+
+    return parse_http_date(s.data(), s.len());
 }
 
 } // namespace
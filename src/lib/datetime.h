@@ -33,6 +33,33 @@ Str format_date(int64_t timestamp, const char *fmt);
 //
 Str format_email_date(int64_t timestamp);
 
+#define HTTP_DATE_LEN   29
+
+//
+// Format the timestamp as an RFC 1123 HTTP-date in UTC, like
+// "Sun, 06 Nov 1994 08:49:37 GMT", into HTTP_DATE_LEN bytes at buf, and
+// return the end.  No libc time function is called: the civil date is
+// computed from the day number, and the last date formatted is cached
+// per thread, so the same second is a copy and the same day only writes
+// the time of day.
+//
+char *format_http_date(char *buf, int64_t timestamp);
+Str format_http_date(int64_t timestamp);
+
+//
+// Parse an HTTP-date in any of the formats of RFC 7231:
+//
+//    Sun, 06 Nov 1994 08:49:37 GMT     RFC 1123
+//    Sunday, 06-Nov-94 08:49:37 GMT    RFC 850, obsolete
+//    Sun Nov  6 08:49:37 1994          ANSI C asctime()
+//
+// Also accepted are the "06-Nov-1994" dates of cookie expires.  Nothing
+// but spaces may follow the date.  Returns the timestamp, or -1 if the
+// date is invalid; dates before 1970 are invalid, so -1 is only an error.
+//
+int64_t parse_http_date(const char *s, size_t n);
+int64_t parse_http_date(const Str& s);
+
 } // namespace
 
 #endif // __DATETIME_H
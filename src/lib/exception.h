@@ -117,6 +117,16 @@ public:
     GZipError(int err, const char *msg) : Error(err, msg) {}
 };
 
+//
+// Error for gzip data over the size or ratio limits of a decompressor,
+// inherits from GZipError
+//
+class GZipLimitError : public GZipError
+{
+public:
+    GZipLimitError(int err, const char *msg) : GZipError(err, msg) {}
+};
+
 //
 // Error for any value errors
 //
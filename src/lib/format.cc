@@ -0,0 +1,322 @@
+//
+// Copyright (C) 2013 Yeolar <yeolar@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "ctornado.h"
+
+namespace ctornado {
+
+static const char _hex[] = "0123456789abcdef";
+static const char _HEX[] = "0123456789ABCDEF";
+
+static const char _digits[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+Str Formatter::str()
+{
+    str_buffer_t *buffer;
+    size_t n;
+
+    n = len();
+
+    if (heap_ != nullptr) {
+        buffer = heap_;
+        heap_ = nullptr;
+    }
+    else {
+        buffer = Str::alloc(n);
+        memcpy(buffer->data, buf_, n);
+    }
+
+    buf_ = stack_;
+    pos_ = stack_;
+    end_ = stack_ + FORMAT_STACK_SIZE;
+
+    return Str(buffer, n);
+}
+
+//
+// Spill to a heap Str buffer, so that str() could hand it over without
+// copying again
+//
+void Formatter::_grow(size_t n)
+{
+    str_buffer_t *buffer;
+    size_t len, size;
+
+    len = pos_ - buf_;
+    size = max(static_cast<size_t>(end_ - buf_) * 2, len + n);
+
+    buffer = Str::alloc(size);
+    memcpy(buffer->data, buf_, len);
+
+    if (heap_ != nullptr) {
+        FREE(heap_);
+    }
+    heap_ = buffer;
+    buf_ = buffer->data;
+    pos_ = buf_ + len;
+    end_ = buf_ + size;
+}
+
+//
+// Copy the literal text and the specs without argument, stop at the next
+// argument consumer (the conversion or '*') or at the end of format
+//
+const char *Formatter::_next(const char *fmt, fmt_spec_t *spec)
+{
+    const char *p;
+
+    for ( ;; ) {
+        if (spec->star) {
+            // continue the spec after '*'
+            spec->star = false;
+        }
+        else {
+            //
+            // The literal text is most of a format, strchrnul scans it
+            // a word or a vector at a time
+            //
+#ifdef _GNU_SOURCE
+            p = strchrnul(fmt, '%');
+#else
+            p = fmt;
+            while (*p != '\0' && *p != '%') {
+                p++;
+            }
+#endif
+            if (p != fmt) {
+                append(fmt, p - fmt);
+            }
+
+            if (*p == '\0') {
+                return p;
+            }
+            fmt = p + 1;
+
+            spec->zero = (*fmt == '0') ? '0' : ' ';
+            spec->width = 0;
+            spec->frac_width = 0;
+            spec->slen = SIZE_MAX;
+            spec->hex = 0;
+            spec->sign = true;
+
+            while (*fmt >= '0' && *fmt <= '9') {
+                spec->width = spec->width * 10 + (*fmt++ - '0');
+            }
+        }
+
+        for ( ;; ) {
+            switch (*fmt) {
+            case 'u':
+                spec->sign = false;
+                fmt++;
+                continue;
+            case 'X':
+                spec->hex = 2;
+                spec->sign = false;
+                fmt++;
+                continue;
+            case 'x':
+                spec->hex = 1;
+                spec->sign = false;
+                fmt++;
+                continue;
+            case '.':
+                fmt++;
+                while (*fmt >= '0' && *fmt <= '9') {
+                    spec->frac_width = spec->frac_width * 10 + (*fmt++ - '0');
+                }
+                break;
+            default:
+                break;
+            }
+            break;
+        }
+
+        if (*fmt == '\0' || _fmt_consumes(*fmt)) {
+            return fmt;
+        }
+
+        switch (*fmt) {
+        case 'Z':
+            append('\0');
+            break;
+        case 'N':
+            append('\n');
+            break;
+        default:
+            append(*fmt);
+            break;
+        }
+        fmt++;
+    }
+}
+
+void Formatter::_put_num(uint64_t ui64, fmt_spec_t *spec)
+{
+    char temp[UINT64_MAXLEN], *p;
+    const char *hex;
+    uint32_t ui32, d;
+    size_t len;
+
+    p = temp + UINT64_MAXLEN;
+
+    if (spec->hex == 0) {
+        //
+        // Two digits per division, and 32-bit division once the value
+        // fits, which is an inlined multiplication and shifts on x86.
+        //
+        while (ui64 > UINT32_MAX) {
+            d = (ui64 % 100) * 2;
+            ui64 /= 100;
+            *--p = _digits[d + 1];
+            *--p = _digits[d];
+        }
+        ui32 = ui64;
+        while (ui32 >= 100) {
+            d = (ui32 % 100) * 2;
+            ui32 /= 100;
+            *--p = _digits[d + 1];
+            *--p = _digits[d];
+        }
+        if (ui32 >= 10) {
+            d = ui32 * 2;
+            *--p = _digits[d + 1];
+            *--p = _digits[d];
+        }
+        else {
+            *--p = '0' + ui32;
+        }
+    }
+    else {
+        hex = spec->hex == 1 ? _hex : _HEX;
+        do {
+            *--p = hex[ui64 & 0xf];
+        } while (ui64 >>= 4);
+    }
+
+    len = temp + UINT64_MAXLEN - p;
+
+    // zero or space padding
+    while (len < static_cast<size_t>(spec->width)) {
+        append(spec->zero);
+        spec->width--;
+    }
+    append(p, len);
+}
+
+void Formatter::_put(char c, fmt_spec_t *spec, double f)
+{
+    uint64_t ui64, frac, scale;
+    int width, k;
+
+    if (c != 'f') {
+        _mismatch(c);
+    }
+
+    if (f < 0) {
+        append('-');
+        f = -f;
+    }
+    ui64 = f;
+    frac = 0;
+    if (spec->frac_width) {
+        scale = 1;
+        for (k = spec->frac_width; k; k--) {
+            scale *= 10;
+        }
+        frac = (f - ui64) * scale + 0.5;
+        if (frac == scale) {
+            ui64++;
+            frac = 0;
+        }
+    }
+    width = spec->frac_width;
+    spec->hex = 0;
+    _put_num(ui64, spec);
+    if (width) {
+        append('.');
+        spec->zero = '0';
+        spec->width = width;
+        _put_num(frac, spec);
+    }
+}
+
+void Formatter::_put(char c, fmt_spec_t *spec, const char *s)
+{
+    if (c == 'p') {
+        _put(c, spec, static_cast<const void *>(s));
+    }
+    else if (c != 's') {
+        _mismatch(c);
+    }
+    else if (spec->slen == SIZE_MAX) {
+        append(s, strlen(s));
+    }
+    else {
+        append(s, spec->slen);
+    }
+}
+
+void Formatter::_put(char c, fmt_spec_t *spec, const Str& s)
+{
+    if (c != 'S') {
+        _mismatch(c);
+    }
+    if (s.len() > 0) {
+        append(s.data(), s.len());
+    }
+}
+
+void Formatter::_put(char c, fmt_spec_t *spec, const Str *s)
+{
+    _put(c, spec, *s);
+}
+
+void Formatter::_put(char c, fmt_spec_t *spec, const StrLit& s)
+{
+    if (c != 'S') {
+        _mismatch(c);
+    }
+    append(s.data_, s.len_);
+}
+
+void Formatter::_put(char c, fmt_spec_t *spec, const void *p)
+{
+    if (c != 'p') {
+        _mismatch(c);
+    }
+    spec->hex = 2;
+    spec->zero = '0';
+    spec->width = PTR_SIZE * 2;
+    _put_num(reinterpret_cast<uintptr_t>(p), spec);
+}
+
+void Formatter::_mismatch(char c)
+{
+    throw ValueError("format argument does not match the conversion");
+}
+
+} // namespace ctornado
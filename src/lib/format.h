@@ -0,0 +1,303 @@
+//
+// Copyright (C) 2013 Yeolar <yeolar@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef __FORMAT_H
+#define __FORMAT_H
+
+#include "ctornado.h"
+
+namespace ctornado {
+
+//
+// Single-pass, type-safe formatter.
+//
+// The format syntax is the one of vslprintf, but the argument types are
+// known to the compiler, so the length modifiers (d/z/l/D/L/T) only select
+// "an integer" and the value is formatted from its real type:
+//
+//    %[0][width][u][x|X]{d|z|l|D|L|T}  any integral type
+//    %[0][width][.width]f              float/double
+//    %p                                any pointer
+//    %S                                Str, StrLit, Str *
+//    %s                                null-terminated string
+//    %*s                               length and string
+//    %c                                char (any integral type)
+//    %Z, %N, %%                        '\0', '\n', '%'
+//
+// Use the str_format() macro with a string literal format, the conversions
+// are checked against the argument types at compile time. Str::format()
+// accepts a runtime format and throws ValueError on mismatch.
+//
+
+#define FORMAT_STACK_SIZE   256
+
+enum {
+    FMT_NONE,
+    FMT_INT,
+    FMT_FLOAT,
+    FMT_CSTR,
+    FMT_STR,
+    FMT_PTR,
+};
+
+template <class T>
+struct FormatKind
+{
+    static constexpr int value =
+        std::is_floating_point<T>::value ? FMT_FLOAT :
+        std::is_integral<T>::value || std::is_enum<T>::value ? FMT_INT :
+        std::is_pointer<T>::value ? FMT_PTR : FMT_NONE;
+};
+
+template <> struct FormatKind<char *>       { static constexpr int value = FMT_CSTR; };
+template <> struct FormatKind<const char *> { static constexpr int value = FMT_CSTR; };
+template <> struct FormatKind<Str>          { static constexpr int value = FMT_STR; };
+template <> struct FormatKind<Str *>        { static constexpr int value = FMT_STR; };
+template <> struct FormatKind<const Str *>  { static constexpr int value = FMT_STR; };
+template <> struct FormatKind<StrLit>       { static constexpr int value = FMT_STR; };
+
+//
+// Compile time format checking, C++11 constexpr functions are single
+// expressions so every step is a recursion.
+//
+constexpr bool _fmt_flag(char c)
+{
+    return (c >= '0' && c <= '9') || c == 'u' || c == 'x' || c == 'X'
+        || c == '.';
+}
+
+constexpr bool _fmt_consumes(char c)
+{
+    return c == '*' || c == 'S' || c == 's' || c == 'T' || c == 'z'
+        || c == 'd' || c == 'l' || c == 'D' || c == 'L' || c == 'f'
+        || c == 'p' || c == 'c';
+}
+
+constexpr bool _fmt_accepts(char c, int kind)
+{
+    return c == 'S' ? kind == FMT_STR
+         : c == 's' ? kind == FMT_CSTR
+         : c == 'f' ? kind == FMT_FLOAT
+         : c == 'p' ? kind == FMT_PTR || kind == FMT_CSTR
+         : kind == FMT_INT;
+}
+
+constexpr const char *_fmt_skip(const char *f)
+{
+    return _fmt_flag(*f) ? _fmt_skip(f + 1) : f;
+}
+
+constexpr const char *_fmt_arg(const char *f);
+
+//
+// the next argument consumer inside a spec, f is past '%' or '*'
+//
+constexpr const char *_fmt_spec(const char *f)
+{
+    return _fmt_consumes(*_fmt_skip(f)) || *_fmt_skip(f) == '\0'
+        ? _fmt_skip(f) : _fmt_arg(_fmt_skip(f) + 1);
+}
+
+//
+// the next argument consumer in the format, or the terminating '\0'
+//
+constexpr const char *_fmt_arg(const char *f)
+{
+    return *f == '\0' ? f
+         : *f == '%' ? _fmt_spec(f + 1)
+         : _fmt_arg(f + 1);
+}
+
+constexpr const char *_fmt_after(const char *f)
+{
+    return *f == '*' ? _fmt_spec(f + 1) : _fmt_arg(f + 1);
+}
+
+constexpr bool _fmt_check(const char *f)
+{
+    return *f == '\0';
+}
+
+template <class... Kinds>
+constexpr bool _fmt_check(const char *f, int kind, Kinds... kinds)
+{
+    return *f != '\0' && _fmt_accepts(*f, kind)
+        && _fmt_check(_fmt_after(f), kinds...);
+}
+
+template <class... Args>
+struct FormatCheck
+{
+    static constexpr bool check(const char *fmt)
+    {
+        return _fmt_check(_fmt_arg(fmt),
+                FormatKind<typename std::decay<Args>::type>::value...);
+    }
+};
+
+template <class... Args>
+FormatCheck<Args...> _fmt_types(const Args&... args);
+
+#define str_format(_fmt, ...)                                               \
+    ::ctornado::Str::format<decltype(                                       \
+        ::ctornado::_fmt_types(__VA_ARGS__))::check(_fmt)>(_fmt, ##__VA_ARGS__)
+
+typedef struct {
+    int width;
+    int frac_width;
+    size_t slen;
+    char zero;
+    char hex;
+    bool sign;
+    bool star;
+} fmt_spec_t;
+
+class Formatter
+{
+public:
+    Formatter()
+        : buf_(stack_), pos_(stack_), end_(stack_ + FORMAT_STACK_SIZE),
+          heap_(nullptr) {}
+
+    ~Formatter()
+    {
+        if (heap_ != nullptr) {
+            FREE(heap_);
+        }
+    }
+
+    Formatter(const Formatter&) = delete;
+    Formatter& operator=(const Formatter&) = delete;
+
+    template <class... Args>
+    void format(const char *fmt, const Args&... args)
+    {
+        fmt_spec_t spec;
+
+        spec.star = false;
+        _format(fmt, &spec, args...);
+    }
+
+    void append(const char *s, size_t n)
+    {
+        if (static_cast<size_t>(end_ - pos_) < n) {
+            _grow(n);
+        }
+        memcpy(pos_, s, n);
+        pos_ += n;
+    }
+
+    void append(char c)
+    {
+        if (pos_ == end_) {
+            _grow(1);
+        }
+        *pos_++ = c;
+    }
+
+    const char *data() const { return buf_; }
+    size_t len() const { return pos_ - buf_; }
+
+    void clear() { pos_ = buf_; }
+
+    //
+    // Move the result out to a Str, the formatter is cleared
+    //
+    Str str();
+
+private:
+    void _format(const char *fmt, fmt_spec_t *spec)
+    {
+        if (*_next(fmt, spec) != '\0') {
+            throw ValueError("not enough arguments for format string");
+        }
+    }
+
+    template <class T, class... Args>
+    void _format(const char *fmt, fmt_spec_t *spec,
+                 const T& arg, const Args&... args)
+    {
+        fmt = _next(fmt, spec);
+        if (*fmt == '\0') {
+            throw ValueError("not all arguments converted during formatting");
+        }
+        _put(*fmt, spec, arg);
+        _format(fmt + 1, spec, args...);
+    }
+
+    template <class T>
+    typename std::enable_if<std::is_integral<T>::value
+        || std::is_enum<T>::value>::type
+    _put(char c, fmt_spec_t *spec, T arg)
+    {
+        typedef typename std::conditional<std::is_enum<T>::value
+            || std::is_same<T, bool>::value, int, T>::type I;
+        typedef typename std::make_unsigned<I>::type U;
+
+        I i = static_cast<I>(arg);
+
+        if (c == '*') {
+            spec->slen = static_cast<size_t>(i);
+            spec->star = true;
+        }
+        else if (c == 'c') {
+            append(static_cast<char>(i));
+        }
+        else if (!_fmt_accepts(c, FMT_INT)) {
+            _mismatch(c);
+        }
+        else if (spec->sign && i < 0) {
+            append('-');
+            _put_num(0 - static_cast<uint64_t>(static_cast<int64_t>(i)), spec);
+        }
+        else {
+            _put_num(static_cast<U>(i), spec);
+        }
+    }
+
+    void _put(char c, fmt_spec_t *spec, double arg);
+    void _put(char c, fmt_spec_t *spec, const char *arg);
+    void _put(char c, fmt_spec_t *spec, const Str& arg);
+    void _put(char c, fmt_spec_t *spec, const Str *arg);
+    void _put(char c, fmt_spec_t *spec, const StrLit& arg);
+    void _put(char c, fmt_spec_t *spec, const void *arg);
+
+    const char *_next(const char *fmt, fmt_spec_t *spec);
+    void _put_num(uint64_t ui64, fmt_spec_t *spec);
+    void _mismatch(char c);
+    void _grow(size_t n);
+
+    char *buf_;
+    char *pos_;
+    char *end_;
+    str_buffer_t *heap_;
+    char stack_[FORMAT_STACK_SIZE];
+};
+
+template <bool Checked, class... Args>
+Str Str::format(const char *fmt, const Args&... args)
+{
+    static_assert(Checked, "format string does not match the arguments");
+
+    Formatter formatter;
+
+    formatter.format(fmt, args...);
+    return formatter.str();
+}
+
+} // namespace ctornado
+
+#endif // __FORMAT_H
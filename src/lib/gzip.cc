@@ -18,7 +18,22 @@
 
 namespace ctornado {
 
-#define BLOCK_SIZE      STR_BUF_1K
+#define GZIP_HEADER_SIZE        10
+#define GZIP_TRAILER_SIZE       8
+
+static char *gz_write_header(char *pos)
+{
+    memcpy(pos, "\x1f\x8b", 2);             // magic header
+    pos += 2;
+    *pos++ = 0x08;                          // compression method
+    *pos++ = 0x00;                          // flag
+    memsetu(pos, sec_now(), 4);             // timestamp
+    pos += 4;
+    *pos++ = 0x02;
+    *pos++ = 0xff;
+
+    return pos;
+}
 
 int gz_compress_init(z_stream *stream, int compress_level)
 {
@@ -83,15 +98,11 @@ int gz_compress_flush(z_stream *stream, Bytef *out, uInt *out_len,
     if (err == Z_OK && stream->avail_out == 0)
         return Z_OK;
 
-    if (err == Z_STREAM_END && flush_mode == Z_FINISH) {
-        err = deflateEnd(stream);
-        if (err != Z_OK) {
-            log_vverb("gzip compress end error: %s", zError(err));
-        }
-        else
-            err = Z_STREAM_END;
-    }
-    else if (err != Z_OK && err != Z_BUF_ERROR) {
+    //
+    // The stream is not ended at Z_STREAM_END, it goes back to
+    // ZStreamPool for reuse.
+    //
+    if (err != Z_OK && err != Z_BUF_ERROR && err != Z_STREAM_END) {
         log_vverb("gzip compress flush error: %s", zError(err));
     }
     return err;
@@ -150,30 +161,117 @@ int gz_decompress_flush(z_stream *stream, Bytef *out, uInt *out_len)
     if ((err == Z_OK || err == Z_BUF_ERROR) && stream->avail_out == 0)
         return err;
 
-    if (err == Z_STREAM_END) {
-        err = inflateEnd(stream);
-        if (err != Z_OK) {
-            log_vverb("gzip decompress end error: %s", zError(err));
-        }
-        else
-            err = Z_STREAM_END;
-    }
-    else if (err != Z_OK && err != Z_BUF_ERROR) {
+    if (err != Z_OK && err != Z_BUF_ERROR && err != Z_STREAM_END) {
         log_vverb("gzip decompress flush error: %s", zError(err));
     }
     return err;
 }
 
-GZipCompressor::GZipCompressor(int compress_level)
+ZStreamPool::~ZStreamPool()
+{
+    for (auto stream : deflates_) {
+        deflateEnd(stream);
+        delete stream;
+    }
+    for (auto stream : inflates_) {
+        inflateEnd(stream);
+        delete stream;
+    }
+}
+
+ZStreamPool *ZStreamPool::local()
+{
+    static thread_local ZStreamPool pool;
+
+    return &pool;
+}
+
+z_stream *ZStreamPool::get_deflate(int compress_level)
+{
+    z_stream *stream;
+    int err;
+
+    if (!deflates_.empty()) {
+        stream = deflates_.back();
+        deflates_.pop_back();
+        //
+        // Nothing is compressed since the reset, so changing the
+        // parameters does not flush.
+        //
+        err = deflateParams(stream, compress_level, Z_DEFAULT_STRATEGY);
+        if (err == Z_OK)
+            return stream;
+
+        log_vverb("gzip compress params error: %s", zError(err));
+        deflateEnd(stream);
+        delete stream;
+    }
+
+    stream = new z_stream;
+    err = gz_compress_init(stream, compress_level);
+    if (err != Z_OK) {
+        delete stream;
+        throw GZipError(err, zError(err));
+    }
+    return stream;
+}
+
+void ZStreamPool::put_deflate(z_stream *stream)
+{
+    if (deflates_.size() < GZIP_POOL_SIZE && deflateReset(stream) == Z_OK) {
+        deflates_.push_back(stream);
+        return;
+    }
+    deflateEnd(stream);
+    delete stream;
+}
+
+z_stream *ZStreamPool::get_inflate()
+{
+    z_stream *stream;
+    int err;
+
+    if (!inflates_.empty()) {
+        stream = inflates_.back();
+        inflates_.pop_back();
+        return stream;
+    }
+
+    stream = new z_stream;
+    err = gz_decompress_init(stream);
+    if (err != Z_OK) {
+        delete stream;
+        throw GZipError(err, zError(err));
+    }
+    return stream;
+}
+
+void ZStreamPool::put_inflate(z_stream *stream)
+{
+    if (inflates_.size() < GZIP_POOL_SIZE && inflateReset(stream) == Z_OK) {
+        inflates_.push_back(stream);
+        return;
+    }
+    inflateEnd(stream);
+    delete stream;
+}
+
+GZipCompressor::GZipCompressor(int compress_level, size_t block_size)
 {
     crc_ = crc32(0, Z_NULL, 0) & 0xffffffff;
     size_ = 0;
-    tmp_buf_ = Str::alloc(BLOCK_SIZE);
+    block_size_ = max(block_size, static_cast<size_t>(16));
+    tmp_buf_ = Str::alloc(block_size_);
     tmp_len_ = 0;
+    err_ = Z_OK;
 
-    err_ = gz_compress_init(&stream_, compress_level);
-    if (err_ != Z_OK)
-        throw GZipError(err_, zError(err_));
+    try {
+        stream_ = ZStreamPool::local()->get_deflate(compress_level);
+    }
+    catch (GZipError&) {
+        FREE(tmp_buf_);
+        throw;
+    }
 
     write_gzip_header();
 }
@@ -182,24 +280,14 @@ GZipCompressor::~GZipCompressor()
 {
     if (tmp_buf_ != nullptr)
         FREE(tmp_buf_);
+    if (stream_ != nullptr)
+        ZStreamPool::local()->put_deflate(stream_);
 }
 
 void GZipCompressor::write_gzip_header()
 {
-    char *pos;
-
-    pos = tmp_buf_->data + tmp_len_;
-
-    memcpy(pos, "\x1f\x8b", 2);             // magic header
-    pos += 2;
-    *pos++ = 0x08;                          // compression method
-    *pos++ = 0x00;                          // flag
-    memsetu(pos, sec_now(), 4);             // timestamp
-    pos += 4;
-    *pos++ = 0x02;
-    *pos++ = 0xff;
-
-    tmp_len_ += 10;
+    gz_write_header(tmp_buf_->data + tmp_len_);
+    tmp_len_ += GZIP_HEADER_SIZE;
 }
 
 void GZipCompressor::compress(const Str& data)
@@ -213,27 +301,27 @@ void GZipCompressor::compress(const Str& data)
         size_ += data.len();
         crc_ = crc32(crc_, in, data.len()) & 0xffffffff;
 
-        stream_.next_in = in;
-        stream_.avail_in = data.len();
+        stream_->next_in = in;
+        stream_->avail_in = data.len();
 
         do {
-            if (tmp_len_ == BLOCK_SIZE) {
+            if (tmp_len_ == block_size_) {
                 if (tmp_buf_ != nullptr) {
                     buffer_.push(Str(tmp_buf_, tmp_len_));
                 }
-                tmp_buf_ = Str::alloc(BLOCK_SIZE);
+                tmp_buf_ = Str::alloc(block_size_);
                 tmp_len_ = 0;
             }
             out = reinterpret_cast<Bytef *>(tmp_buf_->data + tmp_len_);
-            out_len = BLOCK_SIZE - tmp_len_;
+            out_len = block_size_ - tmp_len_;
 
-            err_ = gz_compress(&stream_, out, &out_len);
+            err_ = gz_compress(stream_, out, &out_len);
             tmp_len_ += out_len;
 
             if (err_ != Z_OK)   // break on error
                 break;
 
-        } while (stream_.avail_out == 0);
+        } while (stream_->avail_out == 0);
 
         if (err_ != Z_OK && err_ != Z_BUF_ERROR)
             throw GZipError(err_, zError(err_));
@@ -246,28 +334,28 @@ void GZipCompressor::flush(int flush_mode)
     uInt out_len;
 
     do {
-        if (tmp_len_ == BLOCK_SIZE) {
+        if (tmp_len_ == block_size_) {
             if (tmp_buf_ != nullptr) {
                 buffer_.push(Str(tmp_buf_, tmp_len_));
             }
-            tmp_buf_ = Str::alloc(BLOCK_SIZE);
+            tmp_buf_ = Str::alloc(block_size_);
             tmp_len_ = 0;
         }
         out = reinterpret_cast<Bytef *>(tmp_buf_->data + tmp_len_);
-        out_len = BLOCK_SIZE - tmp_len_;
+        out_len = block_size_ - tmp_len_;
 
-        err_ = gz_compress_flush(&stream_, out, &out_len, flush_mode);
+        err_ = gz_compress_flush(stream_, out, &out_len, flush_mode);
         tmp_len_ += out_len;
 
         if (err_ != Z_OK)   // break at end or on error
             break;
 
-    } while (stream_.avail_out == 0);
+    } while (stream_->avail_out == 0);
 
     if (tmp_len_ != 0) {
         buffer_.push(Str(tmp_buf_, tmp_len_));
         tmp_buf_ = nullptr;
-        tmp_len_ = BLOCK_SIZE;      // fake full block
+        tmp_len_ = block_size_;      // fake full block
     }
 
     if (err_ != Z_OK && err_ != Z_STREAM_END && err_ != Z_BUF_ERROR)
@@ -280,6 +368,9 @@ void GZipCompressor::close()
 
     flush(Z_FINISH);
 
+    ZStreamPool::local()->put_deflate(stream_);
+    stream_ = nullptr;
+
     str_buf = Str::alloc(8);
     memsetu(str_buf->data, crc_, 4);
     memsetu(str_buf->data + 4, size_, 4);
@@ -287,37 +378,85 @@ void GZipCompressor::close()
     buffer_.push(Str(str_buf, 8));
 }
 
-GZipDecompressor::GZipDecompressor()
+GZipDecompressor::GZipDecompressor(size_t block_size,
+        size_t max_size, size_t max_ratio)
 {
-    err_ = gz_decompress_init(&stream_);
-    if (err_ != Z_OK)
-        throw GZipError(err_, zError(err_));
+    block_size_ = max(block_size, static_cast<size_t>(16));
+    max_size_ = max_size;
+    max_ratio_ = max_ratio;
+    tmp_buf_ = nullptr;
+    tmp_len_ = block_size_;
+    stream_ = ZStreamPool::local()->get_inflate();
+    err_ = Z_OK;
+}
+
+GZipDecompressor::~GZipDecompressor()
+{
+    if (tmp_buf_ != nullptr)
+        FREE(tmp_buf_);
+    if (stream_ != nullptr)
+        ZStreamPool::local()->put_inflate(stream_);
+}
+
+void GZipDecompressor::next_block()
+{
+    if (tmp_len_ == block_size_) {
+        if (tmp_buf_ != nullptr) {
+            buffer_.push(Str(tmp_buf_, tmp_len_));
+        }
+        tmp_buf_ = Str::alloc(block_size_);
+        tmp_len_ = 0;
+    }
+}
+
+void GZipDecompressor::push_block()
+{
+    if (tmp_len_ != 0 && tmp_buf_ != nullptr) {
+        buffer_.push(Str(tmp_buf_, tmp_len_));
+        tmp_buf_ = nullptr;
+        tmp_len_ = block_size_;     // fake full block
+    }
+}
+
+void GZipDecompressor::check_limits()
+{
+    //
+    // Checked after every block of output, so a bomb is stopped
+    // before it takes more than a block over the limits.
+    //
+    if (max_size_ != 0 && stream_->total_out > max_size_) {
+        throw GZipLimitError(Z_DATA_ERROR, "gzip data too large");
+    }
+    if (max_ratio_ != 0 && stream_->total_out > GZIP_RATIO_MIN_SIZE &&
+        stream_->total_out / max<uLong>(stream_->total_in, 1) >= max_ratio_) {
+        throw GZipLimitError(Z_DATA_ERROR, "gzip expansion ratio too high");
+    }
 }
 
 void GZipDecompressor::decompress(const Str& data)
 {
-    str_buffer_t *str_buf;
     Bytef *in, *out;
     uInt out_len;
 
     in = reinterpret_cast<Bytef *>(const_cast<char *>(data.data()));
 
     if (data.len() > 0) {
-        stream_.next_in = in;
-        stream_.avail_in = data.len();
+        stream_->next_in = in;
+        stream_->avail_in = data.len();
 
         do {
-            str_buf = Str::alloc(BLOCK_SIZE);
-            out = reinterpret_cast<Bytef *>(str_buf->data);
-            out_len = BLOCK_SIZE;
+            next_block();
+            out = reinterpret_cast<Bytef *>(tmp_buf_->data + tmp_len_);
+            out_len = block_size_ - tmp_len_;
 
-            err_ = gz_decompress(&stream_, out, &out_len);
-            buffer_.push(Str(str_buf, out_len));
+            err_ = gz_decompress(stream_, out, &out_len);
+            tmp_len_ += out_len;
+            check_limits();
 
             if (err_ != Z_OK)   // break at end or on error
                 break;
 
-        } while (stream_.avail_out == 0);
+        } while (stream_->avail_out == 0);
 
         if (err_ != Z_OK && err_ != Z_STREAM_END && err_ != Z_BUF_ERROR)
             throw GZipError(err_, zError(err_));
@@ -326,27 +465,342 @@ void GZipDecompressor::decompress(const Str& data)
 
 void GZipDecompressor::flush()
 {
-    str_buffer_t *str_buf;
     Bytef *out;
     uInt out_len;
 
     do {
-        str_buf = Str::alloc(BLOCK_SIZE);
-        out = reinterpret_cast<Bytef *>(str_buf->data);
-        out_len = BLOCK_SIZE;
+        next_block();
+        out = reinterpret_cast<Bytef *>(tmp_buf_->data + tmp_len_);
+        out_len = block_size_ - tmp_len_;
 
-        err_ = gz_decompress_flush(&stream_, out, &out_len);
-        buffer_.push(Str(str_buf, out_len));
+        err_ = gz_decompress_flush(stream_, out, &out_len);
+        tmp_len_ += out_len;
+        check_limits();
 
         if (err_ != Z_OK && err_ != Z_BUF_ERROR)    // break at end or on error
             break;
 
-    } while (stream_.avail_out == 0);
+    } while (stream_->avail_out == 0);
+
+    push_block();
 
     if (err_ != Z_OK && err_ != Z_STREAM_END && err_ != Z_BUF_ERROR)
         throw GZipError(err_, zError(err_));
 }
 
-void GZipDecompressor::close() {}
+bool GZipDecompressor::finished()
+{
+    return err_ == Z_STREAM_END;
+}
+
+void GZipDecompressor::close()
+{
+    push_block();
+
+    if (stream_ != nullptr) {
+        ZStreamPool::local()->put_inflate(stream_);
+        stream_ = nullptr;
+    }
+}
+
+#ifdef USE_LIBDEFLATE
+
+//
+// libdeflate compressors of each level, allocated
+// on first use and kept per thread like ZStreamPool.
+//
+struct LibdeflatePool
+{
+    struct libdeflate_compressor *compressors[13] = {};
+
+    ~LibdeflatePool()
+    {
+        for (auto compressor : compressors) {
+            if (compressor != nullptr)
+                libdeflate_free_compressor(compressor);
+        }
+    }
+
+    static LibdeflatePool *local()
+    {
+        static thread_local LibdeflatePool pool;
+
+        return &pool;
+    }
+};
+
+static struct libdeflate_compressor *libdeflate_compressor(int level)
+{
+    struct libdeflate_compressor **compressor;
+
+    if (level < 0 || level > 12)
+        level = GZIP_DEFAULT_LEVEL;
+
+    compressor = &LibdeflatePool::local()->compressors[level];
+    if (*compressor == nullptr) {
+        *compressor = libdeflate_alloc_compressor(level);
+        if (*compressor == nullptr)
+            throw GZipError(Z_MEM_ERROR, "libdeflate alloc error");
+    }
+    return *compressor;
+}
+
+#endif
+
+const char *gzip_backend()
+{
+#ifdef USE_LIBDEFLATE
+    return "libdeflate";
+#else
+    return "zlib";
+#endif
+}
+
+Str gzip_compress(const Str& data, int compress_level)
+{
+    str_buffer_t *str_buf;
+    size_t bound, n;
+    Str output;
+
+#ifdef USE_LIBDEFLATE
+    struct libdeflate_compressor *compressor;
+
+    compressor = libdeflate_compressor(compress_level);
+
+    bound = libdeflate_gzip_compress_bound(compressor, data.len());
+    str_buf = Str::alloc(bound);
+
+    n = libdeflate_gzip_compress(compressor, data.data(), data.len(),
+            str_buf->data, bound);
+    if (n == 0) {
+        FREE(str_buf);
+        throw GZipError(Z_BUF_ERROR, "libdeflate compress error");
+    }
+#else
+    z_stream *stream;
+    Bytef *in;
+    char *pos;
+    uint32_t crc;
+    int err;
+
+    in = reinterpret_cast<Bytef *>(const_cast<char *>(data.data()));
+    stream = ZStreamPool::local()->get_deflate(compress_level);
+
+    bound = GZIP_HEADER_SIZE + deflateBound(stream, data.len()) +
+        GZIP_TRAILER_SIZE;
+    str_buf = Str::alloc(bound);
+    pos = gz_write_header(str_buf->data);
+
+    stream->next_in = in;
+    stream->avail_in = data.len();
+    stream->next_out = reinterpret_cast<Bytef *>(pos);
+    stream->avail_out = bound - GZIP_HEADER_SIZE - GZIP_TRAILER_SIZE;
+
+    err = deflate(stream, Z_FINISH);
+    pos += stream->total_out;
+    ZStreamPool::local()->put_deflate(stream);
+
+    if (err != Z_STREAM_END) {
+        FREE(str_buf);
+        throw GZipError(err, zError(err));
+    }
+
+    crc = crc32(crc32(0, Z_NULL, 0), in, data.len()) & 0xffffffff;
+    memsetu(pos, crc, 4);
+    memsetu(pos + 4, data.len(), 4);
+    n = pos + GZIP_TRAILER_SIZE - str_buf->data;
+#endif
+
+    output = Str(str_buf, n);
+    //
+    // The bound is about the size of the input, don't hold on to it
+    // if the output is much smaller.
+    //
+    return n < bound / 2 ? output.copy() : output;
+}
+
+Str gzip_decompress(const Str& data, size_t max_size)
+{
+    GZipDecompressor decompressor(GZIP_BLOCK_SIZE, max_size);
+
+    decompressor.decompress(data);
+    decompressor.close();
+
+    if (!decompressor.finished())
+        throw GZipError(Z_DATA_ERROR, "truncated gzip stream");
+
+    return decompressor.get_value();
+}
+
+struct GZipBlock
+{
+    size_t offset;
+    size_t len;
+    str_buffer_t *out;
+    size_t out_len;
+    uint32_t crc;
+    int err;
+};
+
+//
+// A compression shared by the IOLoop thread and the workers.  Workers
+// only read the data and write their own block.
+//
+struct GZipJob
+{
+    Str data;
+    int compress_level;
+    vector<GZipBlock> blocks;
+    std::atomic<size_t> pending;
+    cb_stream_t callback;
+    IOLoop *ioloop;
+};
+
+static void finish_gzip_job(GZipJob *job)
+{
+    str_buffer_t *str_buf;
+    char *pos;
+    size_t n;
+    uint32_t crc;
+    int err;
+
+    str_buf = nullptr;
+    n = GZIP_HEADER_SIZE + GZIP_TRAILER_SIZE;
+    crc = crc32(0, Z_NULL, 0);
+    err = Z_OK;
+
+    for (auto& block : job->blocks) {
+        if (block.err != Z_OK)
+            err = block.err;
+        n += block.out_len;
+        crc = crc32_combine(crc, block.crc, block.len);
+    }
+
+    if (err == Z_OK) {
+        str_buf = Str::alloc(n);
+        pos = gz_write_header(str_buf->data);
+
+        for (auto& block : job->blocks) {
+            memcpy(pos, block.out->data, block.out_len);
+            pos += block.out_len;
+        }
+        memsetu(pos, crc & 0xffffffff, 4);
+        memsetu(pos + 4, job->data.len(), 4);
+    }
+    else {
+        log_warn("gzip parallel compress error: %s", zError(err));
+    }
+
+    for (auto& block : job->blocks) {
+        if (block.out != nullptr)
+            FREE(block.out);
+    }
+
+    try {
+        job->callback(err == Z_OK ? Str(str_buf, n) : Str());
+    }
+    catch (...) {
+        delete job;
+        throw;
+    }
+    delete job;
+}
+
+static void compress_gzip_block(GZipJob *job, size_t i)
+{
+    GZipBlock *block;
+    z_stream *stream;
+    Bytef *in;
+    size_t dict_len, bound;
+    bool last;
+
+    block = &job->blocks[i];
+    in = reinterpret_cast<Bytef *>(
+            const_cast<char *>(job->data.data())) + block->offset;
+    last = (i == job->blocks.size() - 1);
+
+    block->crc = crc32(crc32(0, Z_NULL, 0), in, block->len);
+
+    try {
+        stream = ZStreamPool::local()->get_deflate(job->compress_level);
+    }
+    catch (GZipError& e) {
+        stream = nullptr;
+        block->err = e.no();
+    }
+
+    if (stream != nullptr) {
+        dict_len = min(block->offset, static_cast<size_t>(GZIP_WINDOW_SIZE));
+        if (dict_len > 0)
+            deflateSetDictionary(stream, in - dict_len, dict_len);
+        //
+        // A sync flush ends the block on a byte boundary with an empty
+        // stored block, the last block finishes the deflate stream.
+        //
+        bound = deflateBound(stream, block->len) + 16;
+        block->out = Str::alloc(bound);
+
+        stream->next_in = in;
+        stream->avail_in = block->len;
+        stream->next_out = reinterpret_cast<Bytef *>(block->out->data);
+        stream->avail_out = bound;
+
+        block->err = deflate(stream, last ? Z_FINISH : Z_SYNC_FLUSH);
+        block->out_len = bound - stream->avail_out;
+
+        if ((last && block->err == Z_STREAM_END) ||
+            (!last && block->err == Z_OK && stream->avail_in == 0)) {
+            block->err = Z_OK;
+        }
+        else if (block->err == Z_OK) {
+            block->err = Z_BUF_ERROR;
+        }
+        ZStreamPool::local()->put_deflate(stream);
+    }
+
+    if (--job->pending == 0)
+        job->ioloop->add_callback(bind(finish_gzip_job, job));
+}
+
+ParallelGZipCompressor::ParallelGZipCompressor(int compress_level,
+        size_t block_size, ThreadPool *pool, IOLoop *ioloop)
+{
+    compress_level_ = compress_level;
+    block_size_ = max(block_size, static_cast<size_t>(GZIP_WINDOW_SIZE));
+    pool_ = (pool != nullptr) ? pool : ThreadPool::instance();
+    ioloop_ = (ioloop != nullptr) ? ioloop : IOLoop::instance();
+}
+
+void ParallelGZipCompressor::compress(const Str& data, cb_stream_t callback)
+{
+    GZipJob *job;
+    GZipBlock block;
+    size_t offset, i;
+
+    job = new GZipJob();
+    job->data = data;
+    job->compress_level = compress_level_;
+    job->callback = callback;
+    job->ioloop = ioloop_;
+
+    offset = 0;
+    do {
+        block.offset = offset;
+        block.len = min(block_size_, data.len() - offset);
+        block.out = nullptr;
+        block.out_len = 0;
+        block.crc = 0;
+        block.err = Z_OK;
+        job->blocks.push_back(block);
+
+        offset += block.len;
+    } while (offset < data.len());
+
+    job->pending = job->blocks.size();
+
+    for (i = 0; i < job->blocks.size(); i++) {
+        pool_->submit(bind(compress_gzip_block, job, i));
+    }
+}
 
 } // namespace
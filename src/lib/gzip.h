@@ -25,6 +25,14 @@
 
 namespace ctornado {
 
+#define GZIP_DEFAULT_LEVEL      6
+#define GZIP_BLOCK_SIZE         STR_BUF_4K
+#define GZIP_POOL_SIZE          16
+#define GZIP_PARALLEL_BLOCK     131072
+#define GZIP_WINDOW_SIZE        32768
+#define GZIP_RATIO_MIN_SIZE     65536
+#define GZIP_MAX_RATIO          100
+
 int gz_compress_init(z_stream *stream, int compress_level);
 int gz_compress(z_stream *stream, Bytef *out, uInt *out_len);
 int gz_compress_flush(z_stream *stream, Bytef *out, uInt *out_len,
@@ -34,10 +42,44 @@ int gz_decompress_init(z_stream *stream);
 int gz_decompress(z_stream *stream, Bytef *out, uInt *out_len);
 int gz_decompress_flush(z_stream *stream, Bytef *out, uInt *out_len);
 
+//
+// A per-thread pool of zlib streams.
+//
+// Initializing a deflate stream allocates about 256K of state, which
+// costs more than compressing a small response.  Streams put back are
+// reset and handed out again on the same thread, at most GZIP_POOL_SIZE
+// idle streams of each kind are kept.
+//
+class ZStreamPool
+{
+public:
+    ZStreamPool() {}
+    ~ZStreamPool();
+
+    //
+    // Returns the pool of the calling thread.
+    //
+    static ZStreamPool *local();
+
+    z_stream *get_deflate(int compress_level);
+    void put_deflate(z_stream *stream);
+
+    z_stream *get_inflate();
+    void put_inflate(z_stream *stream);
+
+private:
+    vector<z_stream *> deflates_;
+    vector<z_stream *> inflates_;
+};
+
+//
+// Compressed output is kept in Str blocks of block_size bytes.
+//
 class GZipCompressor : public BufferIO
 {
 public:
-    GZipCompressor(int compress_level=Z_BEST_COMPRESSION);
+    GZipCompressor(int compress_level=GZIP_DEFAULT_LEVEL,
+            size_t block_size=GZIP_BLOCK_SIZE);
     virtual ~GZipCompressor();
 
     void compress(const Str& data);
@@ -47,27 +89,98 @@ public:
 private:
     uint32_t crc_;
     size_t size_;
-    z_stream stream_;
+    z_stream *stream_;
     str_buffer_t *tmp_buf_;
     uInt tmp_len_;
+    uInt block_size_;
     int err_;
 
     void write_gzip_header();
 };
 
+//
+// Decompressed output is kept in Str blocks of block_size bytes, only
+// full blocks are in the buffer until flush or close.
+//
+// To guard against decompression bombs, a GZipLimitError is thrown as
+// soon as the output gets over max_size bytes, or over max_ratio times
+// the input once it is larger than GZIP_RATIO_MIN_SIZE.  0 means no
+// limit.
+//
 class GZipDecompressor : public BufferIO
 {
 public:
-    GZipDecompressor();
-    virtual ~GZipDecompressor() {}
+    GZipDecompressor(size_t block_size=GZIP_BLOCK_SIZE,
+            size_t max_size=0, size_t max_ratio=0);
+    virtual ~GZipDecompressor();
 
     void decompress(const Str& data);
     void flush();
     void close();
 
+    //
+    // Returns true if the end of the gzip stream has been reached.
+    //
+    bool finished();
+
 private:
-    z_stream stream_;
+    z_stream *stream_;
+    str_buffer_t *tmp_buf_;
+    uInt tmp_len_;
+    uInt block_size_;
+    size_t max_size_;
+    size_t max_ratio_;
     int err_;
+
+    void next_block();
+    void push_block();
+    void check_limits();
+};
+
+//
+// One-shot gzip compression and decompression of a whole buffer.
+//
+// Faster than GZipCompressor when all the data is at hand: the output
+// is a single Str, and with USE_LIBDEFLATE=yes the work is done by
+// libdeflate.  zlib is used otherwise, and always to decompress, which
+// throws GZipError if the output would grow beyond max_size (0 for no
+// limit) or the stream is corrupt or truncated.
+//
+Str gzip_compress(const Str& data, int compress_level=GZIP_DEFAULT_LEVEL);
+Str gzip_decompress(const Str& data, size_t max_size=0);
+
+//
+// Returns the name of the one-shot compression backend, "libdeflate"
+// or "zlib".
+//
+const char *gzip_backend();
+
+//
+// Compresses large bodies on a ThreadPool, like pigz.
+//
+// The data is split in blocks of block_size, each compressed as raw
+// deflate on a worker thread with the previous 32K of data as its
+// dictionary, so the ratio stays close to that of a single stream.
+// The blocks end on byte boundaries and are joined with the gzip
+// header and a trailer of the combined CRC on the IOLoop thread,
+// where the callback is run with the gzip stream.  The data is
+// shared with the workers and must not be modified until then.
+//
+// If compression fails, the callback is run with a null Str.
+//
+class ParallelGZipCompressor
+{
+public:
+    ParallelGZipCompressor(int compress_level=GZIP_DEFAULT_LEVEL,
+            size_t block_size=GZIP_PARALLEL_BLOCK,
+            ThreadPool *pool=nullptr, IOLoop *ioloop=nullptr);
+
+    void compress(const Str& data, cb_stream_t callback);
+
+    int compress_level_;
+    size_t block_size_;
+    ThreadPool *pool_;
+    IOLoop *ioloop_;
 };
 
 } // namespace
@@ -60,41 +60,291 @@ uint8_t _hmac_trans_36[] =
     "\xd6\xd7\xd4\xd5\xd2\xd3\xd0\xd1\xde\xdf\xdc\xdd\xda\xdb\xd8\xd9"
     "\xc6\xc7\xc4\xc5\xc2\xc3\xc0\xc1\xce\xcf\xcc\xcd\xca\xcb\xc8\xc9";
 
+const char *hash_backend()
+{
+    int caps = hash_hwcaps();
+
+    if (caps & HASH_HW_SHA)
+        return "sha-ni";
+    if (caps & HASH_HW_AVX2)
+        return "avx2";
+    return "scalar";
+}
+
 //
 // Based on HMAC algorithm described by RFC 2104
 //
-Str create_signature(const Str& secret, const StrList& parts)
+HMAC::HMAC(const Str& key, int digest)
 {
-    sha1_t ctx;
-    str_buffer_t *key_buf, *res_buf;
-    Str key, k1, k2;
+    // Both SHA1 and SHA256 have 64 byte blocks.
+    uint8_t k[SHA256_BLOCK_SIZE], pad[SHA256_BLOCK_SIZE];
+    size_t i;
+
+    ASSERT(digest == SHA1 || digest == SHA256);
 
-    key_buf = Str::alloc(SHA1_BLOCK_SIZE);
-    res_buf = Str::alloc(SHA1_LEN);
+    digest_ = digest;
 
-    if (secret.len() > SHA1_BLOCK_SIZE) {
-        sha1(reinterpret_cast<uint8_t *>(key_buf->data),
-                reinterpret_cast<const uint8_t *>(secret.data()), secret.len());
+    memset(k, 0, sizeof(k));
+
+    if (key.len() > sizeof(k)) {
+        if (digest_ == SHA1)
+            sha1(k, reinterpret_cast<const uint8_t *>(key.data()), key.len());
+        else
+            sha256(k, reinterpret_cast<const uint8_t *>(key.data()), key.len());
     }
     else {
-        memset(key_buf->data, 0, SHA1_BLOCK_SIZE);
-        memcpy(key_buf->data, secret.data(), secret.len());
+        memcpy(k, key.data(), key.len());
     }
 
-    key = Str(key_buf, SHA1_BLOCK_SIZE);
-    k1 = key.translate(_hmac_trans_5c);
-    k2 = key.translate(_hmac_trans_36);
+    for (i = 0; i < sizeof(k); i++)
+        pad[i] = _hmac_trans_36[k[i]];
+
+    if (digest_ == SHA1)
+        sha1_init(&inner_.sha1);
+    else
+        sha256_init(&inner_.sha256);
+    update(&inner_, pad, sizeof(pad));
+
+    for (i = 0; i < sizeof(k); i++)
+        pad[i] = _hmac_trans_5c[k[i]];
+
+    if (digest_ == SHA1)
+        sha1_init(&outer_.sha1);
+    else
+        sha256_init(&outer_.sha256);
+    update(&outer_, pad, sizeof(pad));
+
+    memset(k, 0, sizeof(k));
+    memset(pad, 0, sizeof(pad));
+}
+
+size_t HMAC::size()
+{
+    return digest_ == SHA1 ? SHA1_LEN : SHA256_LEN;
+}
+
+void HMAC::update(hash_t *ctx, const void *data, size_t len)
+{
+    if (digest_ == SHA1)
+        sha1_update(&ctx->sha1, static_cast<const uint8_t *>(data), len);
+    else
+        sha256_update(&ctx->sha256, static_cast<const uint8_t *>(data), len);
+}
+
+size_t HMAC::finish(uint8_t *out, hash_t *ctx)
+{
+    if (digest_ == SHA1)
+        sha1_final(out, &ctx->sha1);
+    else
+        sha256_final(out, &ctx->sha256);
+
+    return size();
+}
+
+size_t HMAC::digest(uint8_t *out, const Str& msg)
+{
+    hash_t ctx;
+    uint8_t inner[HMAC_MAX_LEN];
+    size_t n;
 
-    sha1_init(&ctx);
-    sha1_update(&ctx, reinterpret_cast<const uint8_t *>(k1.data()), k1.len());
-    sha1_update(&ctx, reinterpret_cast<const uint8_t *>(k2.data()), k2.len());
+    ctx = inner_;
+    update(&ctx, msg.data(), msg.len());
+    n = finish(inner, &ctx);
 
+    ctx = outer_;
+    update(&ctx, inner, n);
+
+    return finish(out, &ctx);
+}
+
+size_t HMAC::digest(uint8_t *out, const StrList& parts)
+{
+    hash_t ctx;
+    uint8_t inner[HMAC_MAX_LEN];
+    size_t n;
+
+    ctx = inner_;
     for (auto& p : parts) {
-        sha1_update(&ctx, reinterpret_cast<const uint8_t *>(p.data()), p.len());
+        update(&ctx, p.data(), p.len());
+    }
+    n = finish(inner, &ctx);
+
+    ctx = outer_;
+    update(&ctx, inner, n);
+
+    return finish(out, &ctx);
+}
+
+Str HMAC::hexdigest(const Str& msg)
+{
+    uint8_t out[HMAC_MAX_LEN];
+    size_t n;
+
+    n = digest(out, msg);
+
+    return hexlify(Str(reinterpret_cast<char *>(out), n));
+}
+
+Str HMAC::hexdigest(const StrList& parts)
+{
+    uint8_t out[HMAC_MAX_LEN];
+    size_t n;
+
+    n = digest(out, parts);
+
+    return hexlify(Str(reinterpret_cast<char *>(out), n));
+}
+
+bool HMAC::verify(const Str& msg, const Str& signature)
+{
+    uint8_t out[HMAC_MAX_LEN];
+    char hex[HMAC_MAX_LEN * 2];
+    size_t n;
+
+    n = digest(out, msg);
+    hexlify(reinterpret_cast<uint8_t *>(hex), sizeof(hex), out, n);
+
+    return time_independent_equals(Str(hex, n * 2), signature);
+}
+
+bool time_independent_equals(const Str& a, const Str& b)
+{
+    const char *p, *q;
+    uint8_t result = 0;
+
+    if (a.len() != b.len())
+        return false;
+
+    p = a.data();
+    q = b.data();
+
+    for (size_t i = 0; i < a.len(); i++) {
+        result |= p[i] ^ q[i];
+    }
+    return result == 0;
+}
+
+Str create_signature(const Str& secret, const StrList& parts)
+{
+    static thread_local string last_secret;
+    static thread_local HMAC *hmac = nullptr;
+
+    if (hmac == nullptr || last_secret.size() != secret.len() ||
+            memcmp(last_secret.data(), secret.data(), secret.len()) != 0) {
+        delete hmac;
+        hmac = new HMAC(secret, HMAC::SHA1);
+        last_secret.assign(secret.data(), secret.len());
     }
-    sha1_final(reinterpret_cast<uint8_t *>(res_buf->data), &ctx);
+    return hmac->hexdigest(parts);
+}
+
+//
+// Parse a field "<n>:<data>|" at pos, set field to data and move pos
+// after the field.  Return false if malformed.
+//
+static bool _consume_field(const Str& str, size_t *pos, Str *field)
+{
+    const char *p, *end;
+    size_t n = 0;
+
+    p = str.data() + *pos;
+    end = str.data() + str.len();
 
-    return hexlify(Str(res_buf, SHA1_LEN));
+    if (p == end || !isdigit(static_cast<uint8_t>(*p)))
+        return false;
+    while (p < end && isdigit(static_cast<uint8_t>(*p))) {
+        n = n * 10 + (*p++ - '0');
+        if (n > str.len())
+            return false;
+    }
+    if (p == end || *p++ != ':')
+        return false;
+    if (static_cast<size_t>(end - p) < n + 1 || p[n] != '|')
+        return false;
+
+    *field = str.substr(p - str.data(), p - str.data() + n);
+    *pos = p - str.data() + n + 1;
+
+    return true;
+}
+
+static bool _parse_timestamp(const Str& str, int64_t *timestamp)
+{
+    int64_t t = 0;
+
+    if (str.empty() || str.len() > 18)
+        return false;
+
+    for (size_t i = 0; i < str.len(); i++) {
+        if (!isdigit(static_cast<uint8_t>(str[i])))
+            return false;
+        t = t * 10 + (str[i] - '0');
+    }
+    *timestamp = t;
+
+    return true;
+}
+
+Str SignedValue::create(const Str& name, const Str& value, int64_t now)
+{
+    Str timestamp, encoded, to_sign;
+
+    if (now == 0)
+        now = sec_now();
+
+    timestamp = str_format("%L", now);
+    encoded = base64_encode(value);
+
+    to_sign = str_format("2|1:0|%uz:%S|%uz:%S|%uz:%S|",
+            timestamp.len(), timestamp, name.len(), name,
+            encoded.len(), encoded);
+
+    return to_sign.concat(hmac_.hexdigest(to_sign));
+}
+
+Str SignedValue::decode(const Str& name, const Str& signed_value,
+        int64_t max_age, int64_t now)
+{
+    Str key_version, timestamp, field_name, field_value, signature;
+    int64_t t;
+    size_t pos;
+
+    if (!signed_value.starts_with("2|"))
+        return nullstr;
+
+    pos = 2;
+    if (!_consume_field(signed_value, &pos, &key_version) ||
+        !_consume_field(signed_value, &pos, &timestamp) ||
+        !_consume_field(signed_value, &pos, &field_name) ||
+        !_consume_field(signed_value, &pos, &field_value)) {
+        log_warn("Malformed signed value '%.*s'",
+                static_cast<int>(signed_value.len()), signed_value.data());
+        return nullstr;
+    }
+    signature = signed_value.substr(pos, -1);
+
+    if (!hmac_.verify(signed_value.substr(0, pos), signature)) {
+        log_warn("Invalid signature of '%.*s'",
+                static_cast<int>(name.len()), name.data());
+        return nullstr;
+    }
+    if (!field_name.eq(name))
+        return nullstr;
+
+    if (now == 0)
+        now = sec_now();
+
+    if (!_parse_timestamp(timestamp, &t) || t < now - max_age) {
+        log_warn("Expired signed value of '%.*s'",
+                static_cast<int>(name.len()), name.data());
+        return nullstr;
+    }
+    if (t > now + SIGNED_VALUE_MAX_AGE) {
+        log_warn("Signed value of '%.*s' timestamp in the future",
+                static_cast<int>(name.len()), name.data());
+        return nullstr;
+    }
+    return base64_decode(field_value);
 }
 
 } // namespace
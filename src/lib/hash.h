@@ -47,6 +47,7 @@ typedef SHA1_CTX sha1_t;
 #define sha1_init           SHA1Init
 #define sha1_update         SHA1Update
 #define sha1_final          SHA1Final
+#define sha1_multi          SHA1Multi
 
 inline void sha1(uint8_t *result, const uint8_t *key, size_t len)
 {
@@ -57,8 +58,129 @@ inline void sha1(uint8_t *result, const uint8_t *key, size_t len)
     sha1_final(result, &ctx);
 }
 
+typedef SHA256_CTX sha256_t;
+
+#define SHA256_BLOCK_SIZE   64
+#define SHA256_LEN          32
+
+#define sha256_init         SHA256Init
+#define sha256_update       SHA256Update
+#define sha256_final        SHA256Final
+#define sha256_multi        SHA256Multi
+
+inline void sha256(uint8_t *result, const uint8_t *key, size_t len)
+{
+    sha256_t ctx;
+
+    sha256_init(&ctx);
+    sha256_update(&ctx, key, len);
+    sha256_final(result, &ctx);
+}
+
+//
+// SHA1 and SHA256 use the SHA extensions when the CPU has them.
+// sha1_multi hashes eight messages at once with AVX2, and so does
+// sha256_multi without the SHA extensions.  Return the name of the
+// code used for single messages.
+//
+const char *hash_backend();
+
+#define HMAC_MAX_LEN        SHA256_LEN
+
+//
+// A keyed HMAC, RFC 2104.  The hash states after the inner and outer
+// padded keys are computed once by the constructor, so a digest costs
+// only the message and the outer block.
+//
+class HMAC
+{
+public:
+    enum {
+        SHA1,
+        SHA256,
+    };
+
+    HMAC(const Str& key, int digest=SHA1);
+
+    //
+    // Length of the digest in bytes.
+    //
+    size_t size();
+
+    //
+    // Write the digest of the concatenated parts to out, which must
+    // have HMAC_MAX_LEN bytes, and return its length.
+    //
+    size_t digest(uint8_t *out, const Str& msg);
+    size_t digest(uint8_t *out, const StrList& parts);
+
+    Str hexdigest(const Str& msg);
+    Str hexdigest(const StrList& parts);
+
+    //
+    // Return true if signature is the hexdigest of msg, compared in a
+    // time independent of where they differ.
+    //
+    bool verify(const Str& msg, const Str& signature);
+
+private:
+    union hash_t {
+        sha1_t sha1;
+        sha256_t sha256;
+    };
+
+    void update(hash_t *ctx, const void *data, size_t len);
+    size_t finish(uint8_t *out, hash_t *ctx);
+
+    int digest_;
+    hash_t inner_;
+    hash_t outer_;
+};
+
+//
+// Return true if a equals b, the time taken depends only on the length.
+//
+bool time_independent_equals(const Str& a, const Str& b);
+
+//
+// HMAC-SHA1 hexdigest of the concatenated parts.  The HMAC of the last
+// secret is kept per thread.
+//
 Str create_signature(const Str& secret, const StrList& parts);
 
+#define SIGNED_VALUE_MAX_AGE    (31 * 86400)
+
+//
+// Timestamped values signed with HMAC-SHA256 so they can not be forged,
+// in the format of Tornado's secure cookies version 2:
+//
+//   2|1:0|<n>:<timestamp>|<n>:<name>|<n>:<base64 value>|<signature>
+//
+// where every <n> is the length of the field after it, and signature is
+// the hexdigest of all that comes before it.
+//
+class SignedValue
+{
+public:
+    SignedValue(const Str& secret) : hmac_(secret, HMAC::SHA256) {}
+
+    //
+    // Sign value under name, timestamped now (the current time if 0).
+    //
+    Str create(const Str& name, const Str& value, int64_t now=0);
+
+    //
+    // Return the value signed under name, or nullstr if the signature
+    // does not match, or the timestamp is older than max_age seconds or
+    // too far in the future.
+    //
+    Str decode(const Str& name, const Str& signed_value,
+            int64_t max_age=SIGNED_VALUE_MAX_AGE, int64_t now=0);
+
+private:
+    HMAC hmac_;
+};
+
 } // namespace
 
 #endif // __HASH_H
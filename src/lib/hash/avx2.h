@@ -0,0 +1,113 @@
+/*
+Helpers for the AVX2 multi-buffer hash functions
+100% Public Domain
+
+Each 32-bit lane of a __m256i holds a word of a different message.
+*/
+
+#ifndef __HASH_AVX2_H
+#define __HASH_AVX2_H
+
+#include <stdint.h>
+#include <string.h>
+#include <immintrin.h>
+
+#define V_ROR(x, n)     _mm256_or_si256(_mm256_srli_epi32(x, n), _mm256_slli_epi32(x, 32 - (n)))
+#define V_ROL(x, n)     _mm256_or_si256(_mm256_slli_epi32(x, n), _mm256_srli_epi32(x, 32 - (n)))
+#define V_ADD(x, y)     _mm256_add_epi32(x, y)
+#define V_XOR(x, y)     _mm256_xor_si256(x, y)
+
+/* w[0..7] = words 8*half..8*half+7 of the block at p[i] in lane i, big-endian. */
+__attribute__((target("avx2")))
+static inline void hash_load_words_avx2(__m256i w[8], const unsigned char *p[8], int half)
+{
+    const __m256i MASK = _mm256_set_epi64x(
+            0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL,
+            0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    __m256i r[8], t[8];
+    int i;
+
+    for (i = 0; i < 8; i++)
+        r[i] = _mm256_loadu_si256((const __m256i *)(p[i] + half * 32));
+
+    /* Transpose 8x8 words */
+    for (i = 0; i < 8; i += 2) {
+        t[i] = _mm256_unpacklo_epi32(r[i], r[i+1]);
+        t[i+1] = _mm256_unpackhi_epi32(r[i], r[i+1]);
+    }
+    for (i = 0; i < 8; i += 4) {
+        r[i] = _mm256_unpacklo_epi64(t[i], t[i+2]);
+        r[i+1] = _mm256_unpackhi_epi64(t[i], t[i+2]);
+        r[i+2] = _mm256_unpacklo_epi64(t[i+1], t[i+3]);
+        r[i+3] = _mm256_unpackhi_epi64(t[i+1], t[i+3]);
+    }
+    for (i = 0; i < 4; i++) {
+        w[i] = _mm256_permute2x128_si256(r[i], r[i+4], 0x20);
+        w[i+4] = _mm256_permute2x128_si256(r[i], r[i+4], 0x31);
+    }
+    for (i = 0; i < 8; i++)
+        w[i] = _mm256_shuffle_epi8(w[i], MASK);
+}
+
+/*
+ * Pad the last bytes of each message into tail[i] (one or two blocks),
+ * set full[i] to the number of whole blocks in data[i] and total[i] to
+ * all blocks with the padding.  Lanes from n on get no blocks.  Return
+ * the largest total.
+ */
+static inline size_t hash_pad_lanes(unsigned char tail[8][128],
+        size_t full[8], size_t total[8],
+        const unsigned char *data[], const size_t lens[], size_t n)
+{
+    size_t rem, max = 0;
+    uint64_t bits;
+    int i, j;
+
+    for (j = 0; j < 8; j++) {
+        if ((size_t)j >= n) {
+            full[j] = total[j] = 0;
+            continue;
+        }
+        full[j] = lens[j] / 64;
+        rem = lens[j] % 64;
+        bits = (uint64_t)lens[j] << 3;
+
+        memset(tail[j], 0, 128);
+        memcpy(tail[j], data[j] + full[j] * 64, rem);
+        tail[j][rem] = 0x80;
+        total[j] = full[j] + (rem + 9 > 64 ? 2 : 1);
+        for (i = 0; i < 8; i++)
+            tail[j][(total[j] - full[j]) * 64 - 1 - i] = (unsigned char)(bits >> (i * 8));
+
+        if (total[j] > max)
+            max = total[j];
+    }
+    return max;
+}
+
+/*
+ * Point p[i] to block b of lane i, and return the mask of the lanes
+ * which still have blocks.
+ */
+__attribute__((target("avx2")))
+static inline __m256i hash_next_blocks(const unsigned char *p[8], size_t b,
+        unsigned char tail[8][128], const size_t full[8], const size_t total[8],
+        const unsigned char *data[])
+{
+    static const unsigned char zero[64];
+    int j;
+
+    for (j = 0; j < 8; j++) {
+        if (b < full[j])
+            p[j] = data[j] + b * 64;
+        else if (b < total[j])
+            p[j] = tail[j] + (b - full[j]) * 64;
+        else
+            p[j] = zero;
+    }
+    return _mm256_set_epi32(
+            -(b < total[7]), -(b < total[6]), -(b < total[5]), -(b < total[4]),
+            -(b < total[3]), -(b < total[2]), -(b < total[1]), -(b < total[0]));
+}
+
+#endif /* __HASH_AVX2_H */
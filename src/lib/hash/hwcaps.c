@@ -0,0 +1,57 @@
+/*
+Hardware support for the hash functions
+100% Public Domain
+
+The features are detected once, with cpuid.  AVX2 also needs the OS to
+save the YMM registers, which is checked with xgetbv.
+*/
+
+#include <stddef.h>
+#include "hwcaps.h"
+
+#ifdef HASH_X86
+#include <cpuid.h>
+#endif
+
+static int detected = -1;
+static int allowed = HASH_HW_ALL;
+
+static int detect(void)
+{
+    int caps = 0;
+#ifdef HASH_X86
+    unsigned int eax, ebx, ecx, edx, xcr0;
+    int sse41, osxsave;
+
+    if (__get_cpuid_max(0, NULL) < 7)
+        return 0;
+
+    __cpuid(1, eax, ebx, ecx, edx);
+    sse41 = (ecx & bit_SSSE3) && (ecx & bit_SSE4_1);
+    osxsave = (ecx & bit_OSXSAVE) != 0;
+
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+
+    if (sse41 && (ebx & (1 << 29)))
+        caps |= HASH_HW_SHA;
+
+    if (osxsave && (ebx & bit_AVX2)) {
+        __asm__ ("xgetbv" : "=a" (xcr0), "=d" (edx) : "c" (0));
+        if ((xcr0 & 6) == 6)
+            caps |= HASH_HW_AVX2;
+    }
+#endif
+    return caps;
+}
+
+int hash_hwcaps(void)
+{
+    if (detected < 0)
+        detected = detect();
+    return detected & allowed;
+}
+
+void hash_set_hwcaps(int caps)
+{
+    allowed = caps;
+}
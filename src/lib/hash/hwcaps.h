@@ -0,0 +1,31 @@
+/*
+Hardware support for the hash functions
+100% Public Domain
+*/
+
+#ifndef __HWCAPS_H
+#define __HWCAPS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HASH_X86
+#endif
+
+#define HASH_HW_SHA     0x1     /* SHA extensions (SHA-NI) */
+#define HASH_HW_AVX2    0x2     /* AVX2, for the multi-buffer functions */
+#define HASH_HW_ALL     (HASH_HW_SHA | HASH_HW_AVX2)
+
+/* The features detected on this CPU, and not disabled. */
+int hash_hwcaps(void);
+
+/* Restrict the features used to caps, to compare with the scalar code. */
+void hash_set_hwcaps(int caps);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* __HWCAPS_H */
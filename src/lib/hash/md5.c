@@ -42,21 +42,25 @@
 /*
  * The basic MD5 functions.
  *
- * F and G are optimized compared to their RFC 1321 definitions for
- * architectures that lack an AND-NOT instruction, just like in Colin Plumb's
- * implementation.
+ * F is optimized compared to its RFC 1321 definition for architectures
+ * that lack an AND-NOT instruction, just like in Colin Plumb's
+ * implementation.  G is written as a sum of its two disjoint terms, so
+ * the one without x (the word computed by the previous step) can be
+ * added early.
  */
 #define F(x, y, z)          ((z) ^ ((x) & ((y) ^ (z))))
-#define G(x, y, z)          ((y) ^ ((z) & ((x) ^ (y))))
+#define G(x, y, z)          (((x) & (z)) + ((y) & ~(z)))
 #define H(x, y, z)          (((x) ^ (y)) ^ (z))
 #define H2(x, y, z)         ((x) ^ ((y) ^ (z)))
 #define I(x, y, z)          ((y) ^ ((x) | ~(z)))
 
 /*
- * The MD5 transformation for all four rounds.
+ * The MD5 transformation for all four rounds.  The message word and the
+ * constant are added first, they do not wait for the previous step.
  */
 #define STEP(f, a, b, c, d, x, t, s) \
-    (a) += f((b), (c), (d)) + (x) + (t); \
+    (a) += (x) + (t); \
+    (a) += f((b), (c), (d)); \
     (a) = (((a) << (s)) | (((a) & 0xffffffff) >> (32 - (s)))); \
     (a) += (b);
 
@@ -21,6 +21,11 @@ A million repetitions of "a"
 #include <string.h>
 #include <sys/types.h>  /* for u_int*_t */
 #include "sha1.h"
+#include "hwcaps.h"
+
+#ifdef HASH_X86
+#include "avx2.h"
+#endif
 
 #define rol(value, bits) (((value) << (bits)) | ((value) >> (32 - (bits))))
 
@@ -106,6 +111,173 @@ void SHA1Transform(u_int32_t state[5], const unsigned char buffer[64])
 }
 
 
+#ifdef HASH_X86
+
+/*
+ * With the SHA extensions.  Each sha1rnds4 does four rounds, E is
+ * carried by sha1nexte, and sha1msg1/sha1msg2 compute the message
+ * schedule four words at a time.
+ */
+#define NI_LOAD(M, i) \
+    M = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + (i) * 16)), MASK);
+#define NI_ROUNDS4(Ec, Eo, M, f) \
+    Ec = _mm_sha1nexte_epu32(Ec, M); \
+    Eo = ABCD; \
+    ABCD = _mm_sha1rnds4_epu32(ABCD, Ec, f);
+#define NI_MSG1(Mp, Mc)     Mp = _mm_sha1msg1_epu32(Mp, Mc);
+#define NI_MSG2(Mn, Mc)     Mn = _mm_sha1msg2_epu32(Mn, Mc);
+#define NI_XOR(Mpp, Mc)     Mpp = _mm_xor_si128(Mpp, Mc);
+
+__attribute__((target("sha,sse4.1")))
+static void transform_shani(u_int32_t state[5], const unsigned char *data, size_t blocks)
+{
+    __m128i ABCD, ABCD_SAVE, E0, E0_SAVE, E1, M0, M1, M2, M3;
+    const __m128i MASK = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+
+    ABCD = _mm_loadu_si128((const __m128i *)state);
+    E0 = _mm_set_epi32(state[4], 0, 0, 0);
+    ABCD = _mm_shuffle_epi32(ABCD, 0x1B);
+
+    while (blocks--) {
+        ABCD_SAVE = ABCD;
+        E0_SAVE = E0;
+
+        NI_LOAD(M0, 0)
+        E0 = _mm_add_epi32(E0, M0);
+        E1 = ABCD;
+        ABCD = _mm_sha1rnds4_epu32(ABCD, E0, 0);
+
+        NI_LOAD(M1, 1) NI_ROUNDS4(E1, E0, M1, 0) NI_MSG1(M0, M1)
+        NI_LOAD(M2, 2) NI_ROUNDS4(E0, E1, M2, 0) NI_MSG1(M1, M2) NI_XOR(M0, M2)
+        NI_LOAD(M3, 3) NI_MSG2(M0, M3) NI_ROUNDS4(E1, E0, M3, 0) NI_MSG1(M2, M3) NI_XOR(M1, M3)
+        NI_MSG2(M1, M0) NI_ROUNDS4(E0, E1, M0, 0) NI_MSG1(M3, M0) NI_XOR(M2, M0)
+        NI_MSG2(M2, M1) NI_ROUNDS4(E1, E0, M1, 1) NI_MSG1(M0, M1) NI_XOR(M3, M1)
+        NI_MSG2(M3, M2) NI_ROUNDS4(E0, E1, M2, 1) NI_MSG1(M1, M2) NI_XOR(M0, M2)
+        NI_MSG2(M0, M3) NI_ROUNDS4(E1, E0, M3, 1) NI_MSG1(M2, M3) NI_XOR(M1, M3)
+        NI_MSG2(M1, M0) NI_ROUNDS4(E0, E1, M0, 1) NI_MSG1(M3, M0) NI_XOR(M2, M0)
+        NI_MSG2(M2, M1) NI_ROUNDS4(E1, E0, M1, 1) NI_MSG1(M0, M1) NI_XOR(M3, M1)
+        NI_MSG2(M3, M2) NI_ROUNDS4(E0, E1, M2, 2) NI_MSG1(M1, M2) NI_XOR(M0, M2)
+        NI_MSG2(M0, M3) NI_ROUNDS4(E1, E0, M3, 2) NI_MSG1(M2, M3) NI_XOR(M1, M3)
+        NI_MSG2(M1, M0) NI_ROUNDS4(E0, E1, M0, 2) NI_MSG1(M3, M0) NI_XOR(M2, M0)
+        NI_MSG2(M2, M1) NI_ROUNDS4(E1, E0, M1, 2) NI_MSG1(M0, M1) NI_XOR(M3, M1)
+        NI_MSG2(M3, M2) NI_ROUNDS4(E0, E1, M2, 2) NI_MSG1(M1, M2) NI_XOR(M0, M2)
+        NI_MSG2(M0, M3) NI_ROUNDS4(E1, E0, M3, 3) NI_MSG1(M2, M3) NI_XOR(M1, M3)
+        NI_MSG2(M1, M0) NI_ROUNDS4(E0, E1, M0, 3) NI_MSG1(M3, M0) NI_XOR(M2, M0)
+        NI_MSG2(M2, M1) NI_ROUNDS4(E1, E0, M1, 3) NI_XOR(M3, M1)
+        NI_MSG2(M3, M2) NI_ROUNDS4(E0, E1, M2, 3)
+        NI_ROUNDS4(E1, E0, M3, 3)
+
+        E0 = _mm_sha1nexte_epu32(E0, E0_SAVE);
+        ABCD = _mm_add_epi32(ABCD, ABCD_SAVE);
+
+        data += 64;
+    }
+
+    ABCD = _mm_shuffle_epi32(ABCD, 0x1B);
+    _mm_storeu_si128((__m128i *)state, ABCD);
+    state[4] = _mm_extract_epi32(E0, 3);
+}
+
+/*
+ * Eight messages at once with AVX2, one in each 32-bit lane.  The
+ * lanes run the scalar rounds in lockstep; a lane whose message has
+ * no more blocks keeps its state.
+ */
+__attribute__((target("avx2")))
+static void multi_avx2(unsigned char *digests[], const unsigned char *data[],
+        const size_t lens[], size_t n)
+{
+    static const u_int32_t H0[5] = {
+        0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+    static const u_int32_t K[4] = {
+        0x5A827999, 0x6ED9EBA1, 0x8F1BBCDC, 0xCA62C1D6 };
+    unsigned char tail[8][128];
+    const unsigned char *p[8];
+    size_t full[8], total[8], max, b;
+    u_int32_t out[5][8];
+    __m256i s[5], a, bb, c, d, e, f, k, t, w[16], active;
+    int i, j;
+
+    max = hash_pad_lanes(tail, full, total, data, lens, n);
+
+    for (i = 0; i < 5; i++)
+        s[i] = _mm256_set1_epi32((int)H0[i]);
+
+    for (b = 0; b < max; b++) {
+        active = hash_next_blocks(p, b, tail, full, total, data);
+
+        hash_load_words_avx2(w, p, 0);
+        hash_load_words_avx2(w + 8, p, 1);
+
+        a = s[0];
+        bb = s[1];
+        c = s[2];
+        d = s[3];
+        e = s[4];
+
+        for (i = 0; i < 80; i++) {
+            if (i >= 16) {
+                t = V_XOR(V_XOR(w[(i + 13) & 15], w[(i + 8) & 15]),
+                        V_XOR(w[(i + 2) & 15], w[i & 15]));
+                w[i & 15] = V_ROL(t, 1);
+            }
+            if (i < 20) {
+                f = V_XOR(_mm256_and_si256(bb, V_XOR(c, d)), d);
+            }
+            else if (i < 40 || i >= 60) {
+                f = V_XOR(V_XOR(bb, c), d);
+            }
+            else {
+                f = _mm256_or_si256(_mm256_and_si256(bb, c),
+                        _mm256_and_si256(d, _mm256_or_si256(bb, c)));
+            }
+            k = _mm256_set1_epi32((int)K[i / 20]);
+            t = V_ADD(V_ADD(V_ROL(a, 5), f), V_ADD(V_ADD(e, k), w[i & 15]));
+            e = d;
+            d = c;
+            c = V_ROL(bb, 30);
+            bb = a;
+            a = t;
+        }
+
+        s[0] = _mm256_blendv_epi8(s[0], V_ADD(s[0], a), active);
+        s[1] = _mm256_blendv_epi8(s[1], V_ADD(s[1], bb), active);
+        s[2] = _mm256_blendv_epi8(s[2], V_ADD(s[2], c), active);
+        s[3] = _mm256_blendv_epi8(s[3], V_ADD(s[3], d), active);
+        s[4] = _mm256_blendv_epi8(s[4], V_ADD(s[4], e), active);
+    }
+
+    for (i = 0; i < 5; i++)
+        _mm256_storeu_si256((__m256i *)out[i], s[i]);
+
+    for (j = 0; j < (int)n; j++) {
+        for (i = 0; i < 20; i++) {
+            digests[j][i] = (unsigned char)
+             ((out[i>>2][j] >> ((3-(i & 3)) * 8) ) & 255);
+        }
+    }
+}
+
+#endif /* HASH_X86 */
+
+
+/* Hash blocks with SHA-NI when the CPU has it. */
+
+static void transform_blocks(u_int32_t state[5], const unsigned char *data, size_t blocks)
+{
+#ifdef HASH_X86
+    if (hash_hwcaps() & HASH_HW_SHA) {
+        transform_shani(state, data, blocks);
+        return;
+    }
+#endif
+    while (blocks--) {
+        SHA1Transform(state, data);
+        data += 64;
+    }
+}
+
+
 /* SHA1Init - Initialize new context */
 
 void SHA1Init(SHA1_CTX* context)
@@ -133,10 +305,9 @@ void SHA1Update(SHA1_CTX* context, const unsigned char* data, u_int32_t len)
     j = (j >> 3) & 63;
     if ((j + len) > 63) {
         memcpy(&context->buffer[j], data, (i = 64-j));
-        SHA1Transform(context->state, context->buffer);
-        for ( ; i + 63 < len; i += 64) {
-            SHA1Transform(context->state, &data[i]);
-        }
+        transform_blocks(context->state, context->buffer, 1);
+        transform_blocks(context->state, &data[i], (len - i) / 64);
+        i += (len - i) & ~63;
         j = 0;
     }
     else i = 0;
@@ -148,9 +319,9 @@ void SHA1Update(SHA1_CTX* context, const unsigned char* data, u_int32_t len)
 
 void SHA1Final(unsigned char digest[20], SHA1_CTX* context)
 {
-    unsigned i;
+    static const unsigned char pad[64] = { 0200 };
+    unsigned i, j;
     unsigned char finalcount[8];
-    unsigned char c;
 
 #if 0   /* untested "improvement" by DHR */
     /* Convert context->count to a sequence of bytes
@@ -174,12 +345,9 @@ void SHA1Final(unsigned char digest[20], SHA1_CTX* context)
          >> ((3-(i & 3)) * 8) ) & 255);  /* Endian independent */
     }
 #endif
-    c = 0200;
-    SHA1Update(context, &c, 1);
-    while ((context->count[0] & 504) != 448) {
-    c = 0000;
-        SHA1Update(context, &c, 1);
-    }
+    /* Pad with 0200 and zeros up to 56 bytes of the last block. */
+    j = (context->count[0] >> 3) & 63;
+    SHA1Update(context, pad, j < 56 ? 56 - j : 120 - j);
     SHA1Update(context, finalcount, 8);  /* Should cause a SHA1Transform() */
     for (i = 0; i < 20; i++) {
         digest[i] = (unsigned char)
@@ -189,3 +357,29 @@ void SHA1Final(unsigned char digest[20], SHA1_CTX* context)
     memset(context, '\0', sizeof(*context));
     memset(&finalcount, '\0', sizeof(finalcount));
 }
+
+
+/* Hash n independent messages, data[i] of lens[i] bytes to digests[i]. */
+
+void SHA1Multi(unsigned char *digests[], const unsigned char *data[],
+        const size_t lens[], size_t n)
+{
+    SHA1_CTX context;
+    size_t i = 0, k;
+
+#ifdef HASH_X86
+    /* Eight lanes of AVX2 are faster than SHA-NI one message at a time. */
+    if (hash_hwcaps() & HASH_HW_AVX2) {
+        while (n - i >= 2) {
+            k = n - i < 8 ? n - i : 8;
+            multi_avx2(&digests[i], &data[i], &lens[i], k);
+            i += k;
+        }
+    }
+#endif
+    for ( ; i < n; i++) {
+        SHA1Init(&context);
+        SHA1Update(&context, data[i], lens[i]);
+        SHA1Final(digests[i], &context);
+    }
+}
@@ -21,6 +21,8 @@ void SHA1Transform(u_int32_t state[5], const unsigned char buffer[64]);
 void SHA1Init(SHA1_CTX* context);
 void SHA1Update(SHA1_CTX* context, const unsigned char* data, u_int32_t len);
 void SHA1Final(unsigned char digest[20], SHA1_CTX* context);
+void SHA1Multi(unsigned char *digests[], const unsigned char *data[],
+        const size_t lens[], size_t n);
 
 #ifdef __cplusplus
 } /* extern "C" */
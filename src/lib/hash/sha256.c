@@ -0,0 +1,357 @@
+/*
+SHA-256 in C
+100% Public Domain
+
+Test Vectors (from FIPS PUB 180-4)
+"abc"
+  BA7816BF 8F01CFEA 414140DE 5DAE2223 B00361A3 96177A9C B410FF61 F20015AD
+"abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq"
+  248D6A61 D20638B8 E5C02693 0C3E6039 A33CE459 64FF2167 F6ECEDD4 19DB06C1
+A million repetitions of "a"
+  CDC76E5C 9914FB92 81A1C7E2 84D73E67 F1809A48 A497200E 046D39CC C7112CD0
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include "sha256.h"
+#include "hwcaps.h"
+
+#ifdef HASH_X86
+#include "avx2.h"
+#endif
+
+#define ror(value, bits) (((value) >> (bits)) | ((value) << (32 - (bits))))
+
+#define Ch(x,y,z)   (((x) & ((y) ^ (z))) ^ (z))
+#define Maj(x,y,z)  (((x) & (y)) | ((z) & ((x) | (y))))
+#define S0(x)       (ror(x, 2) ^ ror(x,13) ^ ror(x,22))
+#define S1(x)       (ror(x, 6) ^ ror(x,11) ^ ror(x,25))
+#define s0(x)       (ror(x, 7) ^ ror(x,18) ^ ((x) >> 3))
+#define s1(x)       (ror(x,17) ^ ror(x,19) ^ ((x) >> 10))
+
+#define load32(p)   (((uint32_t)(p)[0] << 24) | ((uint32_t)(p)[1] << 16) | \
+                     ((uint32_t)(p)[2] << 8) | (uint32_t)(p)[3])
+
+static const uint32_t H0[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+    0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+static const uint32_t K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+    0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+    0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+    0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+    0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+    0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+
+/* Hash blocks of 512 bits. This is the core of the algorithm. */
+
+static void transform_scalar(uint32_t state[8], const unsigned char *data, size_t blocks)
+{
+    uint32_t a, b, c, d, e, f, g, h, t1, t2;
+    uint32_t w[64];
+    int i;
+
+    while (blocks--) {
+        for (i = 0; i < 16; i++)
+            w[i] = load32(data + i * 4);
+        for (i = 16; i < 64; i++)
+            w[i] = s1(w[i-2]) + w[i-7] + s0(w[i-15]) + w[i-16];
+
+        a = state[0];
+        b = state[1];
+        c = state[2];
+        d = state[3];
+        e = state[4];
+        f = state[5];
+        g = state[6];
+        h = state[7];
+
+        for (i = 0; i < 64; i++) {
+            t1 = h + S1(e) + Ch(e,f,g) + K[i] + w[i];
+            t2 = S0(a) + Maj(a,b,c);
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+        state[5] += f;
+        state[6] += g;
+        state[7] += h;
+
+        data += 64;
+    }
+    /* Wipe variables */
+    memset(w, '\0', sizeof(w));
+}
+
+#ifdef HASH_X86
+
+/*
+ * With the SHA extensions.  The state is kept as ABEF and CDGH, each
+ * sha256rnds2 does two rounds, and sha256msg1/sha256msg2 compute the
+ * message schedule four words at a time.
+ */
+#define NI_ROUNDS4(g, M) \
+    MSG = _mm_add_epi32(M, _mm_loadu_si128((const __m128i *)&K[4 * (g)])); \
+    STATE1 = _mm_sha256rnds2_epu32(STATE1, STATE0, MSG); \
+    MSG = _mm_shuffle_epi32(MSG, 0x0E); \
+    STATE0 = _mm_sha256rnds2_epu32(STATE0, STATE1, MSG);
+#define NI_MSG1(Mp, Mc) \
+    Mp = _mm_sha256msg1_epu32(Mp, Mc);
+#define NI_MSG2(Mn, Mc, Mp) \
+    TMP = _mm_alignr_epi8(Mc, Mp, 4); \
+    Mn = _mm_add_epi32(Mn, TMP); \
+    Mn = _mm_sha256msg2_epu32(Mn, Mc);
+#define NI_LOAD(M, i) \
+    M = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + (i) * 16)), MASK);
+
+__attribute__((target("sha,sse4.1")))
+static void transform_shani(uint32_t state[8], const unsigned char *data, size_t blocks)
+{
+    __m128i STATE0, STATE1, MSG, TMP, M0, M1, M2, M3, ABEF_SAVE, CDGH_SAVE;
+    const __m128i MASK = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+    TMP = _mm_loadu_si128((const __m128i *)&state[0]);
+    STATE1 = _mm_loadu_si128((const __m128i *)&state[4]);
+
+    TMP = _mm_shuffle_epi32(TMP, 0xB1);             /* CDAB */
+    STATE1 = _mm_shuffle_epi32(STATE1, 0x1B);       /* EFGH */
+    STATE0 = _mm_alignr_epi8(TMP, STATE1, 8);       /* ABEF */
+    STATE1 = _mm_blend_epi16(STATE1, TMP, 0xF0);    /* CDGH */
+
+    while (blocks--) {
+        ABEF_SAVE = STATE0;
+        CDGH_SAVE = STATE1;
+
+        NI_LOAD(M0, 0) NI_ROUNDS4(0, M0)
+        NI_LOAD(M1, 1) NI_ROUNDS4(1, M1) NI_MSG1(M0, M1)
+        NI_LOAD(M2, 2) NI_ROUNDS4(2, M2) NI_MSG1(M1, M2)
+        NI_LOAD(M3, 3) NI_ROUNDS4(3, M3) NI_MSG2(M0, M3, M2) NI_MSG1(M2, M3)
+        NI_ROUNDS4( 4, M0) NI_MSG2(M1, M0, M3) NI_MSG1(M3, M0)
+        NI_ROUNDS4( 5, M1) NI_MSG2(M2, M1, M0) NI_MSG1(M0, M1)
+        NI_ROUNDS4( 6, M2) NI_MSG2(M3, M2, M1) NI_MSG1(M1, M2)
+        NI_ROUNDS4( 7, M3) NI_MSG2(M0, M3, M2) NI_MSG1(M2, M3)
+        NI_ROUNDS4( 8, M0) NI_MSG2(M1, M0, M3) NI_MSG1(M3, M0)
+        NI_ROUNDS4( 9, M1) NI_MSG2(M2, M1, M0) NI_MSG1(M0, M1)
+        NI_ROUNDS4(10, M2) NI_MSG2(M3, M2, M1) NI_MSG1(M1, M2)
+        NI_ROUNDS4(11, M3) NI_MSG2(M0, M3, M2) NI_MSG1(M2, M3)
+        NI_ROUNDS4(12, M0) NI_MSG2(M1, M0, M3) NI_MSG1(M3, M0)
+        NI_ROUNDS4(13, M1) NI_MSG2(M2, M1, M0)
+        NI_ROUNDS4(14, M2) NI_MSG2(M3, M2, M1)
+        NI_ROUNDS4(15, M3)
+
+        STATE0 = _mm_add_epi32(STATE0, ABEF_SAVE);
+        STATE1 = _mm_add_epi32(STATE1, CDGH_SAVE);
+
+        data += 64;
+    }
+
+    TMP = _mm_shuffle_epi32(STATE0, 0x1B);          /* FEBA */
+    STATE1 = _mm_shuffle_epi32(STATE1, 0xB1);       /* DCHG */
+    STATE0 = _mm_blend_epi16(TMP, STATE1, 0xF0);    /* DCBA */
+    STATE1 = _mm_alignr_epi8(STATE1, TMP, 8);       /* HGFE */
+
+    _mm_storeu_si128((__m128i *)&state[0], STATE0);
+    _mm_storeu_si128((__m128i *)&state[4], STATE1);
+}
+
+/*
+ * Eight messages at once with AVX2, one in each 32-bit lane.  The
+ * lanes run the scalar rounds in lockstep; a lane whose message has
+ * no more blocks keeps its state.
+ */
+#define V_S0(x)         V_XOR(V_XOR(V_ROR(x, 2), V_ROR(x, 13)), V_ROR(x, 22))
+#define V_S1(x)         V_XOR(V_XOR(V_ROR(x, 6), V_ROR(x, 11)), V_ROR(x, 25))
+#define V_s0(x)         V_XOR(V_XOR(V_ROR(x, 7), V_ROR(x, 18)), _mm256_srli_epi32(x, 3))
+#define V_s1(x)         V_XOR(V_XOR(V_ROR(x, 17), V_ROR(x, 19)), _mm256_srli_epi32(x, 10))
+#define V_CH(x, y, z)   V_XOR(_mm256_and_si256(x, V_XOR(y, z)), z)
+#define V_MAJ(x, y, z)  _mm256_or_si256(_mm256_and_si256(x, y), \
+                            _mm256_and_si256(z, _mm256_or_si256(x, y)))
+
+__attribute__((target("avx2")))
+static void multi_avx2(unsigned char *digests[], const unsigned char *data[],
+        const size_t lens[], size_t n)
+{
+    unsigned char tail[8][128];
+    const unsigned char *p[8];
+    size_t full[8], total[8], max, b;
+    uint32_t out[8][8];
+    __m256i s[8], v[8], w[16], t1, t2, active;
+    int i, j;
+
+    max = hash_pad_lanes(tail, full, total, data, lens, n);
+
+    for (i = 0; i < 8; i++)
+        s[i] = _mm256_set1_epi32((int)H0[i]);
+
+    for (b = 0; b < max; b++) {
+        active = hash_next_blocks(p, b, tail, full, total, data);
+
+        hash_load_words_avx2(w, p, 0);
+        hash_load_words_avx2(w + 8, p, 1);
+
+        for (i = 0; i < 8; i++)
+            v[i] = s[i];
+
+        for (i = 0; i < 64; i++) {
+            if (i >= 16) {
+                w[i & 15] = V_ADD(V_ADD(w[i & 15], V_s0(w[(i + 1) & 15])),
+                        V_ADD(w[(i + 9) & 15], V_s1(w[(i + 14) & 15])));
+            }
+            t1 = V_ADD(V_ADD(v[7], V_S1(v[4])),
+                    V_ADD(V_CH(v[4], v[5], v[6]),
+                        V_ADD(_mm256_set1_epi32((int)K[i]), w[i & 15])));
+            t2 = V_ADD(V_S0(v[0]), V_MAJ(v[0], v[1], v[2]));
+            v[7] = v[6];
+            v[6] = v[5];
+            v[5] = v[4];
+            v[4] = V_ADD(v[3], t1);
+            v[3] = v[2];
+            v[2] = v[1];
+            v[1] = v[0];
+            v[0] = V_ADD(t1, t2);
+        }
+
+        for (i = 0; i < 8; i++)
+            s[i] = _mm256_blendv_epi8(s[i], V_ADD(s[i], v[i]), active);
+    }
+
+    for (i = 0; i < 8; i++)
+        _mm256_storeu_si256((__m256i *)out[i], s[i]);
+
+    for (j = 0; j < (int)n; j++) {
+        for (i = 0; i < 32; i++) {
+            digests[j][i] = (unsigned char)
+             ((out[i>>2][j] >> ((3-(i & 3)) * 8) ) & 255);
+        }
+    }
+}
+
+#endif /* HASH_X86 */
+
+
+void SHA256Transform(uint32_t state[8], const unsigned char *data, size_t blocks)
+{
+#ifdef HASH_X86
+    if (hash_hwcaps() & HASH_HW_SHA) {
+        transform_shani(state, data, blocks);
+        return;
+    }
+#endif
+    transform_scalar(state, data, blocks);
+}
+
+
+/* SHA256Init - Initialize new context */
+
+void SHA256Init(SHA256_CTX* context)
+{
+    /* SHA256 initialization constants */
+    memcpy(context->state, H0, sizeof(H0));
+    context->count = 0;
+}
+
+
+/* Run your data through this. */
+
+void SHA256Update(SHA256_CTX* context, const unsigned char* data, size_t len)
+{
+    size_t i, j, n;
+
+    j = (size_t)(context->count & 63);
+    context->count += len;
+    i = 0;
+
+    if (j + len > 63) {
+        memcpy(&context->buffer[j], data, (i = 64-j));
+        SHA256Transform(context->state, context->buffer, 1);
+        n = (len - i) / 64;
+        if (n > 0) {
+            SHA256Transform(context->state, &data[i], n);
+            i += n * 64;
+        }
+        j = 0;
+    }
+    memcpy(&context->buffer[j], &data[i], len - i);
+}
+
+
+/* Add padding and return the message digest. */
+
+void SHA256Final(unsigned char digest[32], SHA256_CTX* context)
+{
+    uint64_t bits;
+    size_t j;
+    unsigned i;
+
+    bits = context->count << 3;
+    j = (size_t)(context->count & 63);
+
+    context->buffer[j++] = 0x80;
+    if (j > 56) {
+        memset(&context->buffer[j], 0, 64 - j);
+        SHA256Transform(context->state, context->buffer, 1);
+        j = 0;
+    }
+    memset(&context->buffer[j], 0, 56 - j);
+    for (i = 0; i < 8; i++)
+        context->buffer[56 + i] = (unsigned char)(bits >> ((7 - i) * 8));
+    SHA256Transform(context->state, context->buffer, 1);
+
+    for (i = 0; i < 32; i++) {
+        digest[i] = (unsigned char)
+         ((context->state[i>>2] >> ((3-(i & 3)) * 8) ) & 255);
+    }
+    /* Wipe variables */
+    memset(context, '\0', sizeof(*context));
+}
+
+
+/* Hash n independent messages, data[i] of lens[i] bytes to digests[i]. */
+
+void SHA256Multi(unsigned char *digests[], const unsigned char *data[],
+        const size_t lens[], size_t n)
+{
+    SHA256_CTX context;
+    size_t i = 0, k;
+
+#ifdef HASH_X86
+    /* One message with SHA-NI is faster than eight lanes of AVX2. */
+    if ((hash_hwcaps() & (HASH_HW_SHA | HASH_HW_AVX2)) == HASH_HW_AVX2) {
+        while (n - i >= 2) {
+            k = n - i < 8 ? n - i : 8;
+            multi_avx2(&digests[i], &data[i], &lens[i], k);
+            i += k;
+        }
+    }
+#endif
+    for ( ; i < n; i++) {
+        SHA256Init(&context);
+        SHA256Update(&context, data[i], lens[i]);
+        SHA256Final(digests[i], &context);
+    }
+}
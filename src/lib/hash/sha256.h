@@ -0,0 +1,35 @@
+/*
+SHA-256 in C
+100% Public Domain
+
+Follows FIPS PUB 180-4, with the same interface as sha1.h.
+*/
+
+#ifndef __SHA256_H
+#define __SHA256_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    uint32_t state[8];
+    uint64_t count;
+    unsigned char buffer[64];
+} SHA256_CTX;
+
+void SHA256Transform(uint32_t state[8], const unsigned char *data, size_t blocks);
+void SHA256Init(SHA256_CTX* context);
+void SHA256Update(SHA256_CTX* context, const unsigned char* data, size_t len);
+void SHA256Final(unsigned char digest[32], SHA256_CTX* context);
+void SHA256Multi(unsigned char *digests[], const unsigned char *data[],
+        const size_t lens[], size_t n);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* __SHA256_H */
@@ -91,4 +91,52 @@ const char *get_response_w3c_name(int code)
     }
 }
 
+#define STATUS_CODE_MIN     100
+#define STATUS_CODE_MAX     599
+
+class StatusLines
+{
+public:
+    StatusLines()
+    {
+        int code, v;
+
+        for (code = STATUS_CODE_MIN; code <= STATUS_CODE_MAX; code++) {
+            if (!is_valid_response_code(code))
+                continue;
+
+            for (v = 0; v < 2; v++) {
+                text_[v][code - STATUS_CODE_MIN] =
+                    str_format("HTTP/1.%d %d %s\r\n",
+                            v, code, get_response_w3c_name(code)).tos();
+            }
+        }
+        for (code = STATUS_CODE_MIN; code <= STATUS_CODE_MAX; code++) {
+            for (v = 0; v < 2; v++) {
+                const string& text = text_[v][code - STATUS_CODE_MIN];
+                if (!text.empty()) {
+                    lines_[v][code - STATUS_CODE_MIN] =
+                        Str(text.data(), text.size());
+                }
+            }
+        }
+    }
+
+    Str lines_[2][STATUS_CODE_MAX - STATUS_CODE_MIN + 1];
+
+private:
+    string text_[2][STATUS_CODE_MAX - STATUS_CODE_MIN + 1];
+};
+
+const Str& get_response_status_line(int code, bool http_1_1)
+{
+    static const StatusLines table;
+    static const Str none;
+
+    if (code < STATUS_CODE_MIN || code > STATUS_CODE_MAX)
+        return none;
+
+    return table.lines_[http_1_1 ? 1 : 0][code - STATUS_CODE_MIN];
+}
+
 } // namespace
@@ -31,6 +31,14 @@ bool is_valid_response_code(int code);
 //
 const char *get_response_w3c_name(int code);
 
+//
+// Get the status line of the response code, e.g. "HTTP/1.1 200 OK\r\n".
+// The lines of all valid codes are built once, and the Str returned refers
+// to them without a reference count, so it is safe to share by threads.
+// Returns a null Str for an invalid code.
+//
+const Str& get_response_status_line(int code, bool http_1_1=true);
+
 } // namespace
 
 #endif // __HTTPLIB_H
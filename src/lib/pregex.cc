@@ -18,11 +18,36 @@
 
 namespace ctornado {
 
+map<pair<string, int>, Regex *> Regex::cache_;
+pthread_mutex_t Regex::cache_lock_ = PTHREAD_MUTEX_INITIALIZER;
+
+struct JitStack
+{
+    pcre_jit_stack *stack = nullptr;
+
+    ~JitStack()
+    {
+        if (stack != nullptr)
+            pcre_jit_stack_free(stack);
+    }
+};
+
+static pcre_jit_stack *jit_stack_callback(void *data)
+{
+    static thread_local JitStack jit;
+
+    if (jit.stack == nullptr) {
+        jit.stack = pcre_jit_stack_alloc(REGEX_JIT_STACK_MIN,
+                REGEX_JIT_STACK_MAX);
+    }
+    return jit.stack;
+}
+
 Regex::~Regex()
 {
     pcre_free(re_);
     if (extra_ != nullptr)
-        pcre_free(extra_);
+        pcre_free_study(extra_);
 }
 
 Regex *Regex::compile(const char *pattern, int flags)
@@ -56,18 +81,72 @@ Regex *Regex::compile(const char *pattern, int flags)
     // the regex.  The last argument is how one checks for errors (it is nullptr
     // if everything works, and points to an error string otherwise.
     //
+    // Without JIT support in libpcre the JIT flag is ignored.
+    //
+#ifdef PCRE_STUDY_JIT_COMPILE
+    extra = pcre_study(re, PCRE_STUDY_JIT_COMPILE, &err_str);
+#else
     extra = pcre_study(re, 0, &err_str);
+#endif
     if (err_str != nullptr) {
         log_vverb("study '%s' failed: %s", pattern, err_str);
+        pcre_free(re);
         throw RegexError("Regex study failed: %s", err_str);
     }
+#ifdef PCRE_STUDY_JIT_COMPILE
+    if (extra != nullptr)
+        pcre_assign_jit_stack(extra, jit_stack_callback, nullptr);
+#endif
     return new Regex(re, extra, pattern);
 }
 
+Regex *Regex::cached(const char *pattern, int flags)
+{
+    Regex *regex;
+
+    pthread_mutex_lock(&cache_lock_);
+
+    auto key = make_pair(string(pattern), flags);
+    auto it = cache_.find(key);
+
+    if (it != cache_.end()) {
+        regex = it->second;
+    }
+    else {
+        try {
+            regex = compile(pattern, flags);
+        }
+        catch (RegexError&) {
+            pthread_mutex_unlock(&cache_lock_);
+            throw;
+        }
+        cache_[key] = regex;
+    }
+    pthread_mutex_unlock(&cache_lock_);
+
+    return regex;
+}
+
 RegexMatch *Regex::exec(const Str& str, int count, int flags)
 {
-    int n = (count == -1) ? 10 : count;
-    int captures[n * 3];
+    RegexMatch *match;
+
+    match = new RegexMatch();
+    try {
+        search(str, match, flags);
+    }
+    catch (RegexError&) {
+        delete match;
+        throw;
+    }
+    if (count != -1 && match->size_ > static_cast<size_t>(count))
+        match->size_ = count;
+
+    return match;
+}
+
+bool Regex::search(const Str& str, RegexMatch *match, int flags, int start)
+{
     int m;
 
     //
@@ -77,12 +156,14 @@ RegexMatch *Regex::exec(const Str& str, int count, int flags)
     //  PCRE_NOTEOL
     //  PCRE_NOTEMPTY
     //
-    m = pcre_exec(re_, extra_, str.data(), str.len(), 0, flags,
-            captures, n * 3);
+    m = pcre_exec(re_, extra_, str.data(), str.len(), start, flags,
+            match->captures_, REGEX_MAX_CAPTURES * 3);
     if (m < 0) {
         switch (m) {
         case PCRE_ERROR_NOMATCH:
-            return new RegexMatch(str, nullptr, 0);
+            match->str_ = str;
+            match->size_ = 0;
+            return false;
         case PCRE_ERROR_NULL:
             throw RegexError("Something is full");
         case PCRE_ERROR_BADOPTION:
@@ -98,35 +179,119 @@ RegexMatch *Regex::exec(const Str& str, int count, int flags)
         }
     }
     if (m == 0) {
-        if (count == -1)
-            log_warn("too many substrings to fit in RegexMatch object");
-        m = n;
+        log_warn("too many substrings to fit in RegexMatch object");
+        m = REGEX_MAX_CAPTURES;
     }
-    return new RegexMatch(str, captures, m);
+    match->str_ = str;
+    match->size_ = m;
+
+    return true;
 }
 
-RegexMatch::RegexMatch(const Str& str, int *captures, size_t size)
+void RegexScanner::reset(Regex *regex)
 {
-    size_t n;
+    regex_ = regex;
+    chunk_ = 0;
+    chunk_pos_ = 0;
+    pos_ = 0;
+    partial_ = false;
+    partial_start_ = 0;
+    partial_chunk_ = 0;
+    partial_chunk_pos_ = 0;
+    fallback_ = false;
+}
 
-    str_ = str;
-    captures_ = nullptr;
-    size_ = size;
+int RegexScanner::dfa_exec(const Str& chunk, int start, int flags)
+{
+    return pcre_dfa_exec(regex_->re_, regex_->extra_,
+            chunk.data(), chunk.len(), start,
+            flags | PCRE_DFA_SHORTEST | PCRE_PARTIAL_HARD,
+            ovector_, 2, workspace_, REGEX_DFA_WORKSPACE);
+}
 
-    if (captures != nullptr) {
-        n = size * 2;
-        captures_ = new int[n];
+ssize_t RegexScanner::scan_merged(Buffer *buffer)
+{
+    RegexMatch m;
+
+    buffer->merge_prefix(buffer->size());
+
+    if (regex_->search(buffer->top(), &m))
+        return m.get(0).end;
+    return -1;
+}
+
+ssize_t RegexScanner::scan(Buffer *buffer)
+{
+    Str chunk;
+    size_t start;
+    int rc;
 
-        for (size_t i = 0; i < n; i++) {
-            captures_[i] = captures[i];
+    if (fallback_)
+        return scan_merged(buffer);
+
+    while (chunk_ < buffer->chunks()) {
+        chunk = buffer->chunk(chunk_);
+
+        if (partial_) {
+            rc = dfa_exec(chunk, 0, PCRE_DFA_RESTART | PCRE_NOTBOL);
+        }
+        else {
+            start = pos_ - chunk_pos_;
+            if (start >= chunk.len()) {
+                chunk_pos_ += chunk.len();
+                chunk_++;
+                continue;
+            }
+            rc = dfa_exec(chunk, start, chunk_pos_ > 0 ? PCRE_NOTBOL : 0);
+        }
+
+        if (rc >= 0)
+            return chunk_pos_ + ovector_[1];
+
+        if (rc == PCRE_ERROR_PARTIAL) {
+            if (!partial_) {
+                partial_ = true;
+                partial_start_ = chunk_pos_ + ovector_[0];
+                partial_chunk_ = chunk_;
+                partial_chunk_pos_ = chunk_pos_;
+            }
+            chunk_pos_ += chunk.len();
+            chunk_++;
+        }
+        else if (rc == PCRE_ERROR_NOMATCH) {
+            if (partial_) {
+                //
+                // The partial match died in this chunk, so a match may
+                // still start right after where it began.
+                //
+                partial_ = false;
+                pos_ = partial_start_ + 1;
+                chunk_ = partial_chunk_;
+                chunk_pos_ = partial_chunk_pos_;
+            }
+            else {
+                pos_ = chunk_pos_ + chunk.len();
+                chunk_pos_ += chunk.len();
+                chunk_++;
+            }
+        }
+        else {
+            log_verb("regex dfa exec error %d, search merged buffer", rc);
+            fallback_ = true;
+            return scan_merged(buffer);
         }
     }
+    return -1;
 }
 
-RegexMatch::~RegexMatch()
+RegexMatch::RegexMatch(const Str& str, int *captures, size_t size)
 {
-    if (captures_ != nullptr)
-        delete[] captures_;
+    str_ = str;
+    size_ = min(size, static_cast<size_t>(REGEX_MAX_CAPTURES));
+
+    if (captures != nullptr) {
+        memcpy(captures_, captures, size_ * 2 * sizeof(int));
+    }
 }
 
 range_t RegexMatch::get(int i)
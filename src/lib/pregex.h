@@ -21,11 +21,21 @@
 
 namespace ctornado {
 
+#define REGEX_MAX_CAPTURES      16
+#define REGEX_JIT_STACK_MIN     32768
+#define REGEX_JIT_STACK_MAX     1048576
+#define REGEX_DFA_WORKSPACE     256
+
+//
+// Result of a match, the captures are kept in the object itself, so a
+// RegexMatch on the stack can be filled by Regex.search without any
+// allocation.
+//
 class RegexMatch
 {
 public:
+    RegexMatch() : size_(0) {}
     RegexMatch(const Str& str, int *captures, size_t size);
-    ~RegexMatch();
 
     range_t get(int i);
     Str substr(int i);
@@ -33,11 +43,17 @@ public:
     bool empty();
 
 private:
+    friend class Regex;
+
     Str str_;
-    int *captures_;
+    int captures_[REGEX_MAX_CAPTURES * 3];
     size_t size_;
 };
 
+//
+// A compiled regex.  Patterns are studied with the PCRE JIT where it
+// is available, and JIT code runs on a stack kept per thread.
+//
 class Regex
 {
 public:
@@ -46,12 +62,79 @@ public:
     ~Regex();
 
     static Regex *compile(const char *pattern, int flags=0);
+
+    //
+    // Returns the compiled pattern from a cache shared by the process,
+    // keyed by pattern and flags.  It must not be deleted.
+    //
+    static Regex *cached(const char *pattern, int flags=0);
+
     RegexMatch *exec(const Str& str, int count=-1, int flags=0);
 
+    //
+    // Searches str from start and fills match, returns true if found.
+    // Nothing is allocated.
+    //
+    bool search(const Str& str, RegexMatch *match, int flags=0, int start=0);
+
 private:
+    friend class RegexScanner;
+
     pcre *re_;
     pcre_extra *extra_;
     Str pattern_;
+
+    static map<pair<string, int>, Regex *> cache_;
+    static pthread_mutex_t cache_lock_;
+};
+
+//
+// Searches a regex over a Buffer which grows at its end, without
+// merging the chunks.  Each chunk is matched once with the PCRE DFA
+// matcher; a match left partial at the end of a chunk is resumed on
+// the next chunk (PCRE_DFA_RESTART), and if it fails there the search
+// goes on from the byte after where the partial match started.
+//
+// The match is the shortest at the leftmost position where one starts,
+// as pcre_exec finds with lazy quantifiers, whatever the chunks: a
+// partial match is reported as soon as one is left at the end of a
+// chunk (PCRE_PARTIAL_HARD), before looking for a complete match
+// further on, and the DFA matcher stops at the first complete match
+// (PCRE_DFA_SHORTEST).  It does not support back references; for such
+// patterns the scanner falls back to merging the buffer and searching
+// it with pcre_exec.
+// A lookbehind does not see into the previous chunk.
+//
+class RegexScanner
+{
+public:
+    RegexScanner(Regex *regex) { reset(regex); }
+
+    void reset(Regex *regex);
+
+    //
+    // Scans the data pushed to buffer since the last call, and returns
+    // the offset in buffer of the end of the first match, or -1 if
+    // there is none yet.  The front chunks of buffer must not change
+    // between calls.
+    //
+    ssize_t scan(Buffer *buffer);
+
+private:
+    int dfa_exec(const Str& chunk, int start, int flags);
+    ssize_t scan_merged(Buffer *buffer);
+
+    Regex *regex_;
+    size_t chunk_;          // index of the next chunk to match
+    size_t chunk_pos_;      // offset of that chunk in the buffer
+    size_t pos_;            // offset to start the next fresh search
+    bool partial_;
+    size_t partial_start_;
+    size_t partial_chunk_;
+    size_t partial_chunk_pos_;
+    bool fallback_;
+    int ovector_[2];
+    int workspace_[REGEX_DFA_WORKSPACE];
 };
 
 } // namespace
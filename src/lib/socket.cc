@@ -145,6 +145,42 @@ int socket_resolve(sockinfo_t *si, int family, const char *name, int port)
     return _resolve_inet(si, family, name, port);
 }
 
+int socket_resolve_all(vector<sockinfo_t> *addrs, int family,
+        const char *name, int port)
+{
+    struct addrinfo *cai, *ai, hints;
+    char service[UINTMAX_MAXLEN];
+    sockinfo_t si;
+    int status;
+
+    ASSERT(valid_port(port));
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_flags = AI_NUMERICSERV | AI_ADDRCONFIG;
+    hints.ai_family = family;
+    hints.ai_socktype = SOCK_STREAM;
+
+    snprintf(service, UINTMAX_MAXLEN, "%d", port);
+
+    status = getaddrinfo(name, service, &hints, &ai);
+    if (status != 0) {
+        log_vverb("address resolution of %s:%s failed: %s",
+                name, service, gai_strerror(status));
+        return status;
+    }
+
+    for (cai = ai; cai != nullptr; cai = cai->ai_next) {
+        if (cai->ai_addrlen > sizeof(si.addr))
+            continue;
+        si.family = cai->ai_family;
+        si.addrlen = cai->ai_addrlen;
+        memcpy(&si.addr, cai->ai_addr, si.addrlen);
+        addrs->push_back(si);
+    }
+    freeaddrinfo(ai);
+    return 0;
+}
+
 int socket_unresolve_addr(addr_t *unresolve,
         struct sockaddr *addr, socklen_t addrlen)
 {
@@ -292,6 +328,14 @@ void Socket::connect(const char *name, int port)
     }
 }
 
+void Socket::connect(const struct sockaddr *addr, socklen_t addrlen)
+{
+    if (::connect(fd_, addr, addrlen) == -1) {
+        log_vverb("connect fd(%d) failed: %s", fd_, strerror(errno));
+        throw SocketError(errno);
+    }
+}
+
 void Socket::listen(int backlog)
 {
     if (::listen(fd_, backlog) == -1) {
@@ -498,6 +542,41 @@ ssize_t Socket::send(const void *buf, size_t len)
     }
 }
 
+ssize_t Socket::sendv(const struct iovec *iov, int iovcnt, int flags)
+{
+    struct msghdr msg;
+    ssize_t n;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = const_cast<struct iovec *>(iov);
+    msg.msg_iovlen = iovcnt;
+
+    while (true) {
+        n = ::sendmsg(fd_, &msg, flags);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            throw SocketError(errno);
+        }
+        return n;
+    }
+}
+
+ssize_t Socket::sendfile(int in_fd, off_t *offset, size_t count)
+{
+    ssize_t n;
+
+    while (true) {
+        n = ::sendfile(fd_, in_fd, offset, count);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            throw SocketError(errno);
+        }
+        return n;
+    }
+}
+
 ssize_t Socket::recv(void *buf, size_t len)
 {
     ssize_t n;
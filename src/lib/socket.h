@@ -48,6 +48,14 @@ bool valid_port(int port);
 //
 int socket_resolve(sockinfo_t *si, int family, const char *name, int port);
 
+//
+// Resolve a hostname and service to all of its stream socket addresses,
+// in the order of getaddrinfo, and append them to addrs.  Returns 0, or
+// the getaddrinfo error code.  Blocks while the name is looked up.
+//
+int socket_resolve_all(vector<sockinfo_t> *addrs, int family,
+        const char *name, int port);
+
 //
 // Unresolve the socket address by translating it to host and service string
 // and return in unresolve
@@ -98,6 +106,7 @@ public:
     void bind(const struct sockaddr *addr, socklen_t addrlen);
     void bind(const char *name, int port);
     void connect(const char *name, int port);
+    void connect(const struct sockaddr *addr, socklen_t addrlen);
     void listen(int backlog);
     Socket *accept();
     void close();
@@ -116,6 +125,19 @@ public:
     int get_soerror();
 
     ssize_t send(const void *buf, size_t len);
+
+    //
+    // Gather write of iovcnt buffers in one system call, flags as of
+    // send, e.g. MSG_MORE if more data follows at once
+    //
+    ssize_t sendv(const struct iovec *iov, int iovcnt, int flags=0);
+
+    //
+    // Send count bytes of the file at *offset without copying them to
+    // user space, *offset is advanced
+    //
+    ssize_t sendfile(int in_fd, off_t *offset, size_t count);
+
     ssize_t recv(void *buf, size_t len);
 
     int fd_;
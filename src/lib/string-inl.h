@@ -84,6 +84,16 @@ inline Str::Str(const char *str, size_t n)
     }
 }
 
+//
+// construct from a literal, uncopy
+//
+inline Str::Str(const StrLit& str)
+{
+    len_ = str.len_;
+    data_ = str.data_;
+    buffer_ = nullptr;
+}
+
 //
 // construct from another string, shared
 //
@@ -258,6 +268,9 @@ inline bool Str::eq(const Str& str) const
     if (data_ == nullptr || str.data_ == nullptr || len_ != str.len_)
         return false;
 
+    if (data_ == str.data_)     // the same symbol or slice
+        return true;
+
     return memcmp(data_, str.data_, len_) == 0;
 }
 
@@ -16,6 +16,10 @@
 
 #include "ctornado.h"
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 namespace ctornado {
 
 static char _hex[] = "0123456789abcdef";
@@ -834,41 +838,63 @@ Str Str::strip(const char *chars) const
     return share(start, end - start);
 }
 
+//
+// ASCII case conversion, the bytes from first to first + 25 ('A' or 'a')
+// get their 0x20 bit flipped, 16 at a time with SSE2.  Other bytes,
+// UTF-8 included, are kept, unlike with tolower/toupper which depend
+// on the locale.  dst may be src.
+//
+static void _ascii_case(char *dst, const char *src, size_t n, char first)
+{
+#ifdef __SSE2__
+    const __m128i lo = _mm_set1_epi8(first - 1);
+    const __m128i hi = _mm_set1_epi8(first + 26);
+    const __m128i flip = _mm_set1_epi8(0x20);
+    __m128i v, m;
+
+    for (; n >= 16; n -= 16, src += 16, dst += 16) {
+        v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src));
+        m = _mm_and_si128(_mm_cmpgt_epi8(v, lo), _mm_cmplt_epi8(v, hi));
+        v = _mm_xor_si128(v, _mm_and_si128(m, flip));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst), v);
+    }
+#endif
+    for (; n > 0; n--, src++, dst++) {
+        *dst = static_cast<uint8_t>(*src - first) < 26 ? *src ^ 0x20 : *src;
+    }
+}
+
+static inline char _ascii_lower(char c)
+{
+    return static_cast<uint8_t>(c - 'A') < 26 ? c | 0x20 : c;
+}
+
+static inline char _ascii_upper(char c)
+{
+    return static_cast<uint8_t>(c - 'a') < 26 ? c & ~0x20 : c;
+}
+
 Str Str::upper() const
 {
     str_buffer_t *buffer;
-    const char *pos, *end;
-    char *ptr;
 
     ASSERT(data_ != nullptr);
 
     buffer = alloc(len_);
-    pos = data_;
-    end = data_ + len_;
-    ptr = buffer->data;
+    _ascii_case(buffer->data, data_, len_, 'a');
 
-    while (pos != end) {
-        *ptr++ = toupper(*pos++);
-    }
     return Str(buffer, len_);
 }
 
 Str Str::lower() const
 {
     str_buffer_t *buffer;
-    const char *pos, *end;
-    char *ptr;
 
     ASSERT(data_ != nullptr);
 
     buffer = alloc(len_);
-    pos = data_;
-    end = data_ + len_;
-    ptr = buffer->data;
+    _ascii_case(buffer->data, data_, len_, 'A');
 
-    while (pos != end) {
-        *ptr++ = tolower(*pos++);
-    }
     return Str(buffer, len_);
 }
 
@@ -881,42 +907,130 @@ Str Str::capitalize() const
     Str dst = lower();
     pos = const_cast<char *>(dst.data_);
 
-    if (dst.len_ > 0 && isalpha(*pos)) {
-        *pos = toupper(*pos);
+    if (dst.len_ > 0) {
+        *pos = _ascii_upper(*pos);
     }
     return dst;
 }
 
 Str Str::capitalize_each(char sep) const
 {
-    char *pos;
-    const char *end;
-    size_t n;
-
     ASSERT(data_ != nullptr);
 
-    Str dst = lower();
-    pos = const_cast<char *>(dst.data_);
-    end = dst.data_ + dst.len_;
-    n = dst.len_;
+    Str dst = *this;
+    dst.capitalize_each_inplace(sep);
 
-    do {
-        if (n > 0 && isalpha(*pos)) {
-            *pos = toupper(*pos);
-        }
-        pos = const_cast<char *>(strnfind(pos, n, sep));
-        if (pos == nullptr)
-            break;
+    return dst;
+}
+
+bool Str::owned() const
+{
+    return buffer_ != nullptr && buffer_->cnt == 1;
+}
 
-        n = end - pos;
+void Str::lower_inplace()
+{
+    if (data_ == nullptr)
+        return;
+    if (!owned())
+        *this = copy();
 
-        while (*pos == sep) {
-            pos++;
-            n--;
+    _ascii_case(const_cast<char *>(data_), data_, len_, 'A');
+}
+
+void Str::upper_inplace()
+{
+    if (data_ == nullptr)
+        return;
+    if (!owned())
+        *this = copy();
+
+    _ascii_case(const_cast<char *>(data_), data_, len_, 'a');
+}
+
+void Str::capitalize_each_inplace(char sep)
+{
+    char *pos, *end;
+    bool first = true;
+
+    lower_inplace();
+
+    pos = const_cast<char *>(data_);
+    end = pos + len_;
+
+    for (; pos != end; pos++) {
+        if (*pos == sep) {
+            first = true;
+        }
+        else if (first) {
+            *pos = _ascii_upper(*pos);
+            first = false;
         }
-    } while (n != 0);
+    }
+}
 
-    return dst;
+//
+// Compare n bytes ignoring the ASCII case, 16 at a time with SSE2.
+//
+static bool _ascii_ieq(const char *p, const char *q, size_t n)
+{
+#ifdef __SSE2__
+    const __m128i lo = _mm_set1_epi8('A' - 1);
+    const __m128i hi = _mm_set1_epi8('Z' + 1);
+    const __m128i flip = _mm_set1_epi8(0x20);
+    __m128i a, b;
+
+    for (; n >= 16; n -= 16, p += 16, q += 16) {
+        a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+        b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(q));
+        a = _mm_or_si128(a, _mm_and_si128(flip,
+                    _mm_and_si128(_mm_cmpgt_epi8(a, lo), _mm_cmplt_epi8(a, hi))));
+        b = _mm_or_si128(b, _mm_and_si128(flip,
+                    _mm_and_si128(_mm_cmpgt_epi8(b, lo), _mm_cmplt_epi8(b, hi))));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(a, b)) != 0xffff)
+            return false;
+    }
+#endif
+    for (; n > 0; n--, p++, q++) {
+        if (*p != *q && _ascii_lower(*p) != _ascii_lower(*q))
+            return false;
+    }
+    return true;
+}
+
+bool Str::ieq(const Str& str) const
+{
+    if (data_ == nullptr && str.data_ == nullptr)   // nullstr
+        return true;
+
+    if (data_ == nullptr || str.data_ == nullptr || len_ != str.len_)
+        return false;
+
+    if (data_ == str.data_)
+        return true;
+
+    return _ascii_ieq(data_, str.data_, len_);
+}
+
+uint32_t Str::ihash() const
+{
+    uint32_t h = 2166136261u;
+
+    for (const char *pos = data_; pos != data_ + len_; pos++)
+        h = (h ^ static_cast<uint8_t>(_ascii_lower(*pos))) * 16777619u;
+
+    return h;
+}
+
+bool Str::istarts_with(const Str& prefix) const
+{
+    if (data_ == nullptr || prefix.data_ == nullptr)
+        return false;
+
+    if (len_ < prefix.len_)
+        return false;
+
+    return _ascii_ieq(data_, prefix.data_, prefix.len_);
 }
 
 Str Str::translate(uint8_t table[256]) const
@@ -1205,12 +1319,29 @@ Str Str::concat(const Str& str) const
     return Str(buffer, n);
 }
 
+//
+// Format into the stack first, the common short result is done in one
+// pass, and only a truncated one is measured and formatted again.
+//
 Str Str::sprintf(const char *fmt, ...)
 {
     str_buffer_t *buffer;
+    char buf[STR_BUF_1K], *p;
     size_t n;
     va_list args;
 
+    va_start(args, fmt);
+    p = vslprintf(buf, buf + sizeof(buf), fmt, args);
+    va_end(args);
+
+    if (p < buf + sizeof(buf)) {
+        n = p - buf;
+        buffer = alloc(n);
+        memcpy(buffer->data, buf, n);
+
+        return Str(buffer, n);
+    }
+
     va_start(args, fmt);
     n = vslprintf_len(fmt, args);
     va_end(args);
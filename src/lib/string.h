@@ -56,6 +56,39 @@ typedef struct {
 #define STR_BUF_4K      ( 4096 - sizeof(uint16_t))
 #define STR_BUF_16K     (16384 - sizeof(uint16_t))
 
+//
+// FNV-1a hash of n bytes, with 'A' ~ 'Z' folded to lower case, so that
+// names compared ignoring the case have the same hash.  It is usable in
+// constant expressions, Str::ihash is the same at run time.
+//
+constexpr uint32_t str_ihash(const char *s, size_t n, uint32_t h=2166136261u)
+{
+    return n == 0 ? h : str_ihash(s + 1, n - 1,
+            (h ^ static_cast<uint8_t>(s[0] >= 'A' && s[0] <= 'Z' ?
+                                      s[0] | 0x20 : s[0])) * 16777619u);
+}
+
+//
+// A string literal with its length and hash computed at compile time,
+// written "Content-Length"_s.  It converts to an unref Str without a
+// strlen, and looks up symbols without hashing (see Symbol).
+//
+class StrLit
+{
+public:
+    constexpr StrLit(const char *str, size_t n)
+        : data_(str), len_(n), hash_(str_ihash(str, n)) {}
+
+    const char *data_;
+    size_t len_;
+    uint32_t hash_;
+};
+
+constexpr StrLit operator"" _s(const char *str, size_t n)
+{
+    return StrLit(str, n);
+}
+
 //
 // There are three types of Str:
 //
@@ -77,6 +110,7 @@ public:
     Str(Str&& str);
     Str(int i, int base=10);
     Str(const char *str, size_t n=0);
+    Str(const StrLit& str);
     Str(const Str& str, const char *pos, size_t n);
     ~Str();
 
@@ -97,6 +131,7 @@ public:
 
     size_t len() const;
     const char *data() const;
+    uint32_t ihash() const;
 
     string tos() const;
     int toi() const;
@@ -105,6 +140,8 @@ public:
     const char *end() const;
 
     bool eq(const Str& str) const;
+    // Compare ignoring the ASCII case, without allocation
+    bool ieq(const Str& str) const;
     bool all(int isfunc(int)) const;
     bool null() const;
     bool empty() const;
@@ -118,6 +155,7 @@ public:
     int count(const Str& str, int start=0, int end=-1) const;
 
     bool starts_with(const Str& prefix) const;
+    bool istarts_with(const Str& prefix) const;
     bool ends_with(const Str& suffix) const;
 
     void remove_prefix(size_t n);
@@ -131,6 +169,14 @@ public:
     Str lower() const;
     Str capitalize() const;
     Str capitalize_each(char sep=' ') const;
+
+    // In place if the buffer is owned by this Str only, on a copy
+    // otherwise.  The case conversions are ASCII only.
+    bool owned() const;
+    void lower_inplace();
+    void upper_inplace();
+    void capitalize_each_inplace(char sep=' ');
+
     Str translate(uint8_t table[256]) const;
     Str translate(int isfunc(int), char c) const;
     Str remove(int isfunc(int)) const;
@@ -148,6 +194,12 @@ public:
 
     static Str sprintf(const char *fmt, ...);
 
+    //
+    // Type-safe formatting, see lib/format.h and str_format()
+    //
+    template <bool Checked = true, class... Args>
+    static Str format(const char *fmt, const Args&... args);
+
     Str join(const StrList& strs) const;
     static Str join(char c, const StrList& strs);
     static Str join(const char *sep, const StrList& strs);
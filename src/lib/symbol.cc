@@ -0,0 +1,99 @@
+//
+// Copyright (C) 2013 Yeolar <yeolar@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "ctornado.h"
+
+namespace ctornado {
+
+static const StrLit _names[SYM_COUNT] = {
+    ""_s,
+#define SYMBOL_NAME(name, str)  StrLit(str, sizeof(str) - 1),
+    SYMBOL_METHODS(SYMBOL_NAME)
+    ""_s,
+    SYMBOL_HEADERS(SYMBOL_NAME)
+    ""_s,
+    SYMBOL_VALUES(SYMBOL_NAME)
+    ""_s,
+    SYMBOL_VERSIONS(SYMBOL_NAME)
+#undef SYMBOL_NAME
+};
+
+Symbol::Symbol()
+{
+    uint32_t i;
+
+    memset(slots_, 0, sizeof(slots_));
+
+    for (int id = 0; id < SYM_COUNT; id++) {
+        strs_[id] = _names[id];
+        hashes_[id] = _names[id].hash_;
+
+        if (_names[id].len_ == 0)
+            continue;
+
+        for (i = hashes_[id]; slots_[i % SYMBOL_TABLE_SIZE] != 0; i++) {}
+        slots_[i % SYMBOL_TABLE_SIZE] = id;
+    }
+}
+
+Symbol *Symbol::table()
+{
+    static Symbol symbols;
+    return &symbols;
+}
+
+int Symbol::find(const char *data, size_t len, uint32_t hash)
+{
+    uint32_t i;
+    int id;
+    bool icase;
+
+    for (i = hash; (id = slots_[i % SYMBOL_TABLE_SIZE]) != 0; i++) {
+        if (hashes_[id] != hash || strs_[id].len() != len)
+            continue;
+
+        icase = id > SYM_METHODS_END && id < SYM_VALUES_END;
+
+        if (icase ? strs_[id].ieq(Str(data, len))
+                  : memcmp(strs_[id].data(), data, len) == 0)
+            return id;
+    }
+    return SYM_NONE;
+}
+
+int Symbol::lookup(const Str& str)
+{
+    if (str.len() == 0)
+        return SYM_NONE;
+
+    return table()->find(str.data(), str.len(), str.ihash());
+}
+
+int Symbol::lookup(const StrLit& str)
+{
+    if (str.len_ == 0)
+        return SYM_NONE;
+
+    return table()->find(str.data_, str.len_, str.hash_);
+}
+
+const Str& Symbol::str(int id)
+{
+    return table()->strs_[id];
+}
+
+} // namespace
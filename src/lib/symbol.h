@@ -0,0 +1,153 @@
+//
+// Copyright (C) 2013 Yeolar <yeolar@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#ifndef __SYMBOL_H
+#define __SYMBOL_H
+
+#include "ctornado.h"
+
+namespace ctornado {
+
+#define SYMBOL_METHODS(XX)                                          \
+    XX(GET,                         "GET")                          \
+    XX(HEAD,                        "HEAD")                         \
+    XX(POST,                        "POST")                         \
+    XX(PUT,                         "PUT")                          \
+    XX(DELETE,                      "DELETE")                       \
+    XX(PATCH,                       "PATCH")                        \
+    XX(OPTIONS,                     "OPTIONS")
+
+#define SYMBOL_HEADERS(XX)                                          \
+    XX(ACCEPT,                      "Accept")                       \
+    XX(ACCEPT_ENCODING,             "Accept-Encoding")              \
+    XX(ACCEPT_LANGUAGE,             "Accept-Language")              \
+    XX(ACCEPT_RANGES,               "Accept-Ranges")                \
+    XX(AUTHORIZATION,               "Authorization")                \
+    XX(CACHE_CONTROL,               "Cache-Control")                \
+    XX(CONNECTION,                  "Connection")                   \
+    XX(CONTENT_DISPOSITION,         "Content-Disposition")          \
+    XX(CONTENT_ENCODING,            "Content-Encoding")             \
+    XX(CONTENT_LENGTH,              "Content-Length")               \
+    XX(CONTENT_RANGE,               "Content-Range")                \
+    XX(CONTENT_TYPE,                "Content-Type")                 \
+    XX(COOKIE,                      "Cookie")                       \
+    XX(DATE,                        "Date")                         \
+    XX(ETAG,                        "Etag")                         \
+    XX(EXPECT,                      "Expect")                       \
+    XX(EXPIRES,                     "Expires")                      \
+    XX(HOST,                        "Host")                         \
+    XX(IF_MODIFIED_SINCE,           "If-Modified-Since")            \
+    XX(IF_NONE_MATCH,               "If-None-Match")                \
+    XX(IF_RANGE,                    "If-Range")                     \
+    XX(LAST_MODIFIED,               "Last-Modified")                \
+    XX(LOCATION,                    "Location")                     \
+    XX(PRAGMA,                      "Pragma")                       \
+    XX(PROXY_CONNECTION,            "Proxy-Connection")             \
+    XX(RANGE,                       "Range")                        \
+    XX(REFERER,                     "Referer")                      \
+    XX(SERVER,                      "Server")                       \
+    XX(SET_COOKIE,                  "Set-Cookie")                   \
+    XX(TE,                          "Te")                           \
+    XX(TRAILER,                     "Trailer")                      \
+    XX(TRANSFER_ENCODING,           "Transfer-Encoding")            \
+    XX(UPGRADE,                     "Upgrade")                      \
+    XX(USER_AGENT,                  "User-Agent")                   \
+    XX(VARY,                        "Vary")                         \
+    XX(X_CONSUMED_CONTENT_ENCODING, "X-Consumed-Content-Encoding")  \
+    XX(X_FORWARDED_FOR,             "X-Forwarded-For")              \
+    XX(X_FORWARDED_PROTO,           "X-Forwarded-Proto")            \
+    XX(X_REAL_IP,                   "X-Real-Ip")                    \
+    XX(X_SCHEME,                    "X-Scheme")
+
+#define SYMBOL_VALUES(XX)                                           \
+    XX(CLOSE,                       "close")                        \
+    XX(KEEP_ALIVE,                  "keep-alive")                   \
+    XX(CHUNKED,                     "chunked")                      \
+    XX(GZIP,                        "gzip")                         \
+    XX(IDENTITY,                    "identity")                     \
+    XX(100_CONTINUE,                "100-continue")
+
+#define SYMBOL_VERSIONS(XX)                                         \
+    XX(HTTP_1_0,                    "HTTP/1.0")                     \
+    XX(HTTP_1_1,                    "HTTP/1.1")
+
+enum {
+    SYM_NONE = 0,
+#define SYMBOL_ENUM(name, str)  SYM_##name,
+    SYMBOL_METHODS(SYMBOL_ENUM)
+    SYM_METHODS_END,
+    SYMBOL_HEADERS(SYMBOL_ENUM)
+    SYM_HEADERS_END,
+    SYMBOL_VALUES(SYMBOL_ENUM)
+    SYM_VALUES_END,
+    SYMBOL_VERSIONS(SYMBOL_ENUM)
+#undef SYMBOL_ENUM
+    SYM_COUNT
+};
+
+#define SYMBOL_TABLE_SIZE       256     // power of 2, over 2 * SYM_COUNT
+
+//
+// Interned symbols of HTTP: the methods, the header names and some
+// common header values.
+//
+// Each symbol is one unref Str shared by all its uses, so equal symbols
+// compare by pointer, and an id, so that dispatching on a method or a
+// header name is an integer compare.  Header names and values are
+// looked up ignoring the ASCII case, header names are kept in
+// Http-Header-Case.  Methods and versions are case-sensitive.
+//
+class Symbol
+{
+public:
+    //
+    // Returns the id of str, or SYM_NONE if it is not a symbol.
+    //
+    static int lookup(const Str& str);
+
+    //
+    // Same, with the hash of the literal computed at compile time.
+    //
+    static int lookup(const StrLit& str);
+
+    static const Str& str(int id);
+
+    static bool is_method(int id)
+    {
+        return id > SYM_NONE && id < SYM_METHODS_END;
+    }
+
+    static bool is_header(int id)
+    {
+        return id > SYM_METHODS_END && id < SYM_HEADERS_END;
+    }
+
+private:
+    Symbol();
+
+    Str strs_[SYM_COUNT];
+    uint32_t hashes_[SYM_COUNT];
+    uint8_t slots_[SYMBOL_TABLE_SIZE];
+
+    static Symbol *table();
+
+    int find(const char *data, size_t len, uint32_t hash);
+};
+
+} // namespace
+
+#endif // __SYMBOL_H
@@ -0,0 +1,124 @@
+//
+// Copyright (C) 2013 Yeolar <yeolar@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "ctornado.h"
+
+namespace ctornado {
+
+// Global lock for creating global ThreadPool instance
+pthread_mutex_t _threadpool_instance_lock = PTHREAD_MUTEX_INITIALIZER;
+
+ThreadPool *ThreadPool::instance_ = nullptr;
+
+ThreadPool::ThreadPool(int threads)
+{
+    pthread_t thread;
+    int i, err;
+
+    pthread_mutex_init(&lock_, nullptr);
+    pthread_cond_init(&cond_, nullptr);
+    stopped_ = false;
+
+    if (threads <= 0)
+        threads = max(sysconf(_SC_NPROCESSORS_ONLN), 1L);
+
+    for (i = 0; i < threads; i++) {
+        err = pthread_create(&thread, nullptr, &ThreadPool::run, this);
+        if (err != 0)
+            throw Error(err, "thread create failed");
+
+        threads_.push_back(thread);
+    }
+    log_verb("thread pool[%p] started %d threads", this, threads);
+}
+
+ThreadPool::~ThreadPool()
+{
+    pthread_mutex_lock(&lock_);
+    stopped_ = true;
+    pthread_cond_broadcast(&cond_);
+    pthread_mutex_unlock(&lock_);
+
+    for (auto thread : threads_) {
+        pthread_join(thread, nullptr);
+    }
+    pthread_cond_destroy(&cond_);
+    pthread_mutex_destroy(&lock_);
+}
+
+ThreadPool *ThreadPool::instance()
+{
+    if (instance_ == nullptr) {
+        pthread_mutex_lock(&_threadpool_instance_lock);
+        if (instance_ == nullptr) {
+            instance_ = new ThreadPool();
+        }
+        pthread_mutex_unlock(&_threadpool_instance_lock);
+    }
+    return instance_;
+}
+
+void ThreadPool::submit(cb_t task)
+{
+    pthread_mutex_lock(&lock_);
+    tasks_.push_back(task);
+    pthread_cond_signal(&cond_);
+    pthread_mutex_unlock(&lock_);
+}
+
+int ThreadPool::size()
+{
+    return threads_.size();
+}
+
+void *ThreadPool::run(void *arg)
+{
+    ThreadPool *pool;
+    cb_t task;
+
+    pool = static_cast<ThreadPool *>(arg);
+
+    while (true) {
+        pthread_mutex_lock(&pool->lock_);
+        while (pool->tasks_.empty() && !pool->stopped_) {
+            pthread_cond_wait(&pool->cond_, &pool->lock_);
+        }
+        //
+        // Queued tasks are still run after the pool is stopped.
+        //
+        if (pool->tasks_.empty()) {
+            pthread_mutex_unlock(&pool->lock_);
+            break;
+        }
+        task = pool->tasks_.front();
+        pool->tasks_.pop_front();
+        pthread_mutex_unlock(&pool->lock_);
+
+        try {
+            task();
+        }
+        catch (std::exception& e) {
+            log_error("exception in thread pool task: %s", e.what());
+        }
+        catch (...) {
+            log_error("unknown exception in thread pool task");
+        }
+    }
+    return nullptr;
+}
+
+} // namespace
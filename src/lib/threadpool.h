@@ -0,0 +1,71 @@
+//
+// Copyright (C) 2013 Yeolar <yeolar@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#ifndef __THREADPOOL_H
+#define __THREADPOOL_H
+
+#include "ctornado.h"
+
+namespace ctornado {
+
+//
+// A fixed set of worker threads running tasks from a queue.
+//
+// Tasks are run in submit order by whichever worker is free.  They
+// must not share Str objects with other threads, since the reference
+// counts are not atomic: read raw data, write into buffers from
+// Str::alloc, and hand the results back with IOLoop.add_callback.
+//
+class ThreadPool
+{
+public:
+    //
+    // Starts the given number of threads, or one per CPU if 0.
+    //
+    ThreadPool(int threads=0);
+    ~ThreadPool();
+
+    //
+    // Returns a global ThreadPool instance with one thread per CPU.
+    //
+    static ThreadPool *instance();
+
+    //
+    // Queues the task to run on a worker thread.
+    //
+    void submit(cb_t task);
+
+    //
+    // Returns the number of worker threads.
+    //
+    int size();
+
+private:
+    static ThreadPool *instance_;
+
+    vector<pthread_t> threads_;
+    deque<cb_t> tasks_;
+    pthread_mutex_t lock_;
+    pthread_cond_t cond_;
+    bool stopped_;
+
+    static void *run(void *arg);
+};
+
+} // namespace
+
+#endif // __THREADPOOL_H
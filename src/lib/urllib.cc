@@ -16,6 +16,10 @@
 
 #include "ctornado.h"
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 namespace ctornado {
 
 URL URL::split(const Str& url, bool allow_fragments)
@@ -93,18 +97,18 @@ Str URL::unsplit()
                 is_uses_netloc(scheme_) &&
                 !(url.len() >= 2 && url.substr(0, 2).eq("//")))) {
         if (url.len() != 0 && url[0] != '/') {
-            url = Str::sprintf("/%S", &url);
+            url = str_format("/%S", url);
         }
-        url = Str::sprintf("//%S%S", &netloc_, &url);
+        url = str_format("//%S%S", netloc_, url);
     }
     if (scheme_.len() != 0) {
-        url = Str::sprintf("%S:%S", &scheme_, &url);
+        url = str_format("%S:%S", scheme_, url);
     }
     if (query_.len() != 0) {
-        url = Str::sprintf("%S?%S", &url, &query_);
+        url = str_format("%S?%S", url, query_);
     }
     if (fragment_.len() != 0) {
-        url = Str::sprintf("%S#%S", &url, &fragment_);
+        url = str_format("%S#%S", url, fragment_);
     }
     return url;
 }
@@ -250,22 +254,36 @@ Query *Query::parse(const Str& str)
 
 void Query::parse_extend(const Str& str)
 {
-    if (!str.null()) {
-        for (auto& qp : str.split('&')) {
-            auto kv = qp.split_pair('=');
-            if (kv.second.len() == 0)
-                continue;
-            map_.insert(kv);
-        }
+    Str qp;
+    int start, i, n;
+
+    if (str.null())
+        return;
+
+    n = str.len();
+
+    for (start = 0; start <= n; start = i + 1) {
+        i = str.find('&', start);
+        if (i == -1)
+            i = n;
+
+        qp = str.substr(start, i);
+        auto kv = qp.split_pair('=');
+        if (kv.second.len() == 0)
+            continue;
+        args_.push_back({ unquote(kv.first, true), unquote(kv.second, true) });
     }
 }
 
 Str Query::encode()
 {
     StrList qps;
+    Str name, value;
 
-    for (auto& qp : map_) {
-        qps.push_back(Str::sprintf("%S=%S", &qp.first, &qp.second));
+    for (auto& qp : args_) {
+        name = quote(qp.first, true);
+        value = quote(qp.second, true);
+        qps.push_back(str_format("%S=%S", name, value));
     }
 
     if (qps.size() > 0)
@@ -276,17 +294,158 @@ Str Query::encode()
 
 void Query::add(const Str& name, const Str& value)
 {
-    map_.insert({ name, value });
+    args_.push_back({ name, value });
 }
 
 Str Query::get(const Str& name, const Str& deft)
 {
-    auto it = map_.find(name);
+    for (auto& qp : args_) {
+        if (qp.first.eq(name))
+            return qp.second;
+    }
+    return deft;
+}
+
+StrList Query::get_all(const Str& name)
+{
+    StrList values;
 
-    if (it != map_.end())
-        return it->second;
-    else
-        return deft;
+    for (auto& qp : args_) {
+        if (qp.first.eq(name))
+            values.push_back(qp.second);
+    }
+    return values;
+}
+
+size_t Query::size()
+{
+    return args_.size();
+}
+
+//
+// Returns the first '%' (or '+' if plus is true) from p, or end.
+// 16 bytes are compared at a time with SSE2.
+//
+static const char *_find_escape(const char *p, const char *end, bool plus)
+{
+#ifdef __SSE2__
+    const __m128i pct = _mm_set1_epi8('%');
+    const __m128i pls = _mm_set1_epi8(plus ? '+' : '%');
+    __m128i v;
+    int mask;
+
+    while (end - p >= 16) {
+        v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+        mask = _mm_movemask_epi8(_mm_or_si128(
+                    _mm_cmpeq_epi8(v, pct), _mm_cmpeq_epi8(v, pls)));
+        if (mask != 0)
+            return p + __builtin_ctz(mask);
+        p += 16;
+    }
+#endif
+    for (; p < end; p++) {
+        if (*p == '%' || (plus && *p == '+'))
+            return p;
+    }
+    return end;
+}
+
+static int _xdigit(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    c |= 0x20;
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    return -1;
+}
+
+Str unquote(const Str& str, bool plus)
+{
+    str_buffer_t *buffer;
+    const char *p, *q, *end;
+    char *out;
+    int h, l;
+
+    p = str.data();
+    end = p + str.len();
+    q = _find_escape(p, end, plus);
+
+    if (q == end)
+        return str;
+
+    buffer = Str::alloc(str.len());
+    out = buffer->data;
+
+    while (true) {
+        memcpy(out, p, q - p);
+        out += q - p;
+        p = q;
+
+        if (p == end)
+            break;
+
+        if (*p == '+') {
+            *out++ = ' ';
+            p++;
+        }
+        else if (end - p >= 3 &&
+                (h = _xdigit(p[1])) != -1 && (l = _xdigit(p[2])) != -1) {
+            *out++ = (h << 4) | l;
+            p += 3;
+        }
+        else {
+            *out++ = *p++;
+        }
+        q = _find_escape(p, end, plus);
+    }
+    return Str(buffer, out - buffer->data);
+}
+
+static bool _is_safe(uint8_t c, bool plus)
+{
+    return isalnum(c) || c == '_' || c == '.' || c == '-' || c == '~' ||
+        (c == '/' && !plus);
+}
+
+Str quote(const Str& str, bool plus)
+{
+    static const char hex[] = "0123456789ABCDEF";
+    str_buffer_t *buffer;
+    const char *p;
+    char *out;
+    size_t n = 0;
+    bool changed = false;
+    uint8_t c;
+
+    for (p = str.begin(); p != str.end(); p++) {
+        c = *p;
+        if (plus && c == ' ')
+            changed = true;
+        else if (!_is_safe(c, plus))
+            n += 2;
+    }
+    if (n == 0 && !changed)
+        return str;
+
+    buffer = Str::alloc(str.len() + n);
+    out = buffer->data;
+
+    for (p = str.begin(); p != str.end(); p++) {
+        c = *p;
+        if (plus && c == ' ') {
+            *out++ = '+';
+        }
+        else if (!_is_safe(c, plus)) {
+            *out++ = '%';
+            *out++ = hex[c >> 4];
+            *out++ = hex[c & 0xf];
+        }
+        else {
+            *out++ = c;
+        }
+    }
+    return Str(buffer, str.len() + n);
 }
 
 Str url_join(const Str& base, const Str& url, bool allow_fragments)
@@ -381,7 +540,7 @@ Str url_concat(const Str& url, Query *query)
     }
     c = url.find('?') != -1 ? '&' : '?';
 
-    return Str::sprintf("%S%c%S", &url, c, &qs);
+    return str_format("%S%c%S", url, c, qs);
 }
 
 } // namespace
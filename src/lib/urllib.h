@@ -62,6 +62,13 @@ private:
     void get_uphp();
 };
 
+//
+// Arguments of a query string, or of a form body.
+//
+// The arguments are kept in their order in a flat vector, names and
+// values are unquoted.  There are few arguments in a request, so the
+// lookups are linear.
+//
 class Query
 {
 public:
@@ -74,12 +81,42 @@ public:
     Str encode();
 
     void add(const Str& name, const Str& value);
+
+    //
+    // Returns the first value of the argument name.
+    //
     Str get(const Str& name, const Str& deft=nullstr);
 
+    //
+    // Returns all the values of the argument name.
+    //
+    StrList get_all(const Str& name);
+
+    size_t size();
+
 private:
-    StrStrMMap map_;
+    StrStrVector args_;
 };
 
+//
+// Replace %xx escapes by their single-character equivalent, and plus
+// signs by spaces if plus is true, as in query strings.  Invalid
+// escapes are kept.
+//
+// str itself is returned if it has no escapes.
+//
+Str unquote(const Str& str, bool plus=false);
+
+//
+// Replace special characters in str using the %xx escape, letters,
+// digits and the characters '_.-~' are never quoted.  If plus is true,
+// spaces are replaced by plus signs and '/' is quoted, as in query
+// strings.
+//
+// str itself is returned if it has no special characters.
+//
+Str quote(const Str& str, bool plus=false);
+
 //
 // Construct a full (absolute) URL by combining a base URL (base)
 // with another URL (url).
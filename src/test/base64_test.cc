@@ -18,6 +18,12 @@
 
 using namespace ctornado;
 
+#define TOTAL_SIZE  67108864
+
+static uint8_t buf[65536];
+static uint8_t encoded_buf[87384];
+static uint8_t decoded_buf[65536];
+
 void test_encode_decode(const char *data, const char *encoded_ref)
 {
     log_stderr("");
@@ -43,6 +49,103 @@ void test_encode_decode(const char *data, const char *encoded_ref)
     log_stderr("Passed!");
 }
 
+void test_urlsafe()
+{
+    Str data("\xfb\xff\xbf?>~", 6);
+    Str encoded = base64_urlsafe_encode(data);
+
+    log_stderr("");
+    log_stderr("URL-safe:  '%s'", encoded.tos().c_str());
+
+    if (!encoded.eq("-_-_Pz5-") || !base64_urlsafe_decode(encoded).eq(data)
+            || !base64_encode(data).eq("+/+/Pz5+")) {
+        log_stderr("Failed: URL-safe alphabet");
+        return;
+    }
+    log_stderr("Passed!");
+}
+
+void test_streaming()
+{
+    Buffer buffer;
+    Base64Encoder encoder;
+    Base64Decoder decoder;
+    Str data(reinterpret_cast<char *>(buf), 1000);
+    Str encoded;
+
+    // chunks of 1, 2, 3, ... bytes
+    for (size_t i = 0, n = 1; i < data.len(); i += n, n++)
+        buffer.push(data.substr(i, min(i + n, data.len())));
+
+    encoder.encode(&buffer);
+    encoder.close();
+    encoded = encoder.get_value();
+
+    buffer.clear();
+    for (size_t i = 0, n = 1; i < encoded.len(); i += n, n++)
+        buffer.push(encoded.substr(i, min(i + n, encoded.len())));
+
+    decoder.decode(&buffer);
+    decoder.close();
+
+    log_stderr("");
+    log_stderr("Streaming %zu bytes in %zu chunks", data.len(), buffer.chunks());
+
+    if (!encoded.eq(base64_encode(data))
+            || !decoder.get_value().eq(data)) {
+        log_stderr("Failed: streamed data differs from one-shot data");
+        return;
+    }
+    log_stderr("Passed!");
+}
+
+//
+// MB/s of encoding or decoding TOTAL_SIZE bytes in blocks of size bytes.
+//
+double bench(bool encode, size_t size)
+{
+    size_t n = base64_encode_len(size);
+    ClockTimer timer;
+
+    base64_encode(encoded_buf, sizeof(encoded_buf), buf, size);
+
+    timer.start();
+    for (size_t i = 0; i < TOTAL_SIZE; i += size) {
+        if (encode)
+            base64_encode(encoded_buf, sizeof(encoded_buf), buf, size);
+        else
+            base64_decode(decoded_buf, sizeof(decoded_buf), encoded_buf, n);
+    }
+    timer.stop();
+
+    return TOTAL_SIZE / timer.seconds() / 1048576;
+}
+
+void test_performance()
+{
+    const size_t sizes[] = { 48, 256, 4096, 65536 };
+    int caps = binascii_hwcaps();
+
+    log_stderr("");
+    log_stderr("test performance (MB/s, scalar / ssse3 / avx2):");
+
+    for (int encode = 1; encode >= 0; encode--) {
+        for (size_t i = 0; i < NELEMS(sizes); i++) {
+            double scalar, ssse3, avx2;
+
+            binascii_set_hwcaps(0);
+            scalar = bench(encode, sizes[i]);
+            binascii_set_hwcaps(caps & BINASCII_HW_SSSE3);
+            ssse3 = bench(encode, sizes[i]);
+            binascii_set_hwcaps(caps);
+            avx2 = bench(encode, sizes[i]);
+
+            log_stderr("%-6s %6zu bytes: %8.1f / %8.1f / %8.1f",
+                    encode ? "encode" : "decode", sizes[i], scalar, ssse3, avx2);
+        }
+    }
+}
+
 int main()
 {
     struct test {
@@ -67,6 +170,13 @@ int main()
         test_encode_decode(tests[i].data, tests[i].encoded_ref);
     }
 
+    for (size_t i = 0; i < sizeof(buf); i++)
+        buf[i] = i * 7;
+
+    test_urlsafe();
+    test_streaming();
+    test_performance();
+
     return 0;
 }
 
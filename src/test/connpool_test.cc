@@ -0,0 +1,329 @@
+//
+// Copyright (C) 2013 Yeolar <yeolar@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "ctornado.h"
+
+using namespace ctornado;
+using namespace std::placeholders;
+
+IOLoop *ioloop = IOLoop::instance();
+ClockTimer timer;
+bool sick;
+int remaining;
+int in_flight;
+int max_seen;
+
+void next_test();
+
+//
+// A line protocol: PING is answered PONG, or ERR when sick, the other
+// lines are echoed
+//
+class LineServer : public TCPServer
+{
+public:
+    virtual void handle_stream(IOStream *stream, const Str& address)
+    {
+        stream->set_close_callback([stream]() {
+                ioloop->add_callback([stream]() { delete stream; });
+            });
+        read_line(stream);
+    }
+
+    static void read_line(IOStream *stream)
+    {
+        stream->read_until("\r\n", [stream](const Str& line) {
+                if (line.eq("PING\r\n"))
+                    stream->write(sick ? "ERR\r\n" : "PONG\r\n");
+                else
+                    stream->write(line);
+                read_line(stream);
+            });
+    }
+};
+
+//
+// Pings with the PING command of the protocol
+//
+class LinePool : public ConnectionPool
+{
+public:
+    virtual void ping(IOStream *stream, cb_ping_t done)
+    {
+        stream->write("PING\r\n");
+        stream->read_until("\r\n", [done](const Str& reply) {
+                done(reply.eq("PONG\r\n"));
+            });
+    }
+};
+
+LinePool *pool;
+IOStream *first;
+
+sockinfo_t make_addr(const char *ip, int port)
+{
+    sockinfo_t si;
+
+    socket_resolve(&si, AF_UNSPEC, ip, port);
+    return si;
+}
+
+//
+// One round trip on a pooled connection to host
+//
+void call(const char *host, const Str& line, function<void (IOStream *,
+            const Str&)> callback)
+{
+    pool->acquire(host, 8890, [line, callback](IOStream *stream) {
+            if (stream == nullptr) {
+                callback(nullptr, nullstr);
+                return;
+            }
+            stream->write(line);
+            stream->read_until("\r\n", [stream, callback](const Str& reply) {
+                    pool->release(stream);
+                    callback(stream, reply);
+                });
+        });
+}
+
+void print_reply(const char *name, IOStream *stream, const Str& reply)
+{
+    if (stream == nullptr)
+        printf("%s: no connection\n", name);
+    else
+        printf("%s: %.*s", name, static_cast<int>(reply.len()), reply.data());
+    next_test();
+}
+
+//
+// Holds each connection 20 msec, counting the ones given out at once
+//
+void hold(int n)
+{
+    int i;
+
+    remaining = n;
+    in_flight = max_seen = 0;
+
+    for (i = 0; i < n; i++) {
+        pool->acquire("127.0.0.1", 8890, [n](IOStream *stream) {
+                in_flight++;
+                max_seen = max(max_seen, in_flight);
+                ioloop->add_timeout(msec_now() + 20, [n, stream]() {
+                        in_flight--;
+                        pool->release(stream);
+                        if (--remaining > 0)
+                            return;
+                        printf("%d acquires, max_in_flight %d: %d at once, "
+                                "%zu idle\n", n, pool->max_in_flight_,
+                                max_seen, pool->idle_count());
+                        next_test();
+                    });
+            });
+    }
+}
+
+//
+// Round trips one after the other, on pooled connections, or on a new
+// connection each with max_idle_ 0
+//
+void benchmark(const char *name, int n)
+{
+    call("127.0.0.1", "hello\r\n", [name, n](IOStream *stream,
+                const Str& reply) {
+            if (stream == nullptr || !reply.eq("hello\r\n"))
+                log_error("%s: bad reply", name);
+            if (--remaining > 0) {
+                benchmark(name, n);
+                return;
+            }
+            timer.stop();
+            log_stderr("%s: %d round trips, %.0f/s", name, n,
+                    n / timer.seconds());
+            next_test();
+        });
+}
+
+void next_test()
+{
+    static int step = 0;
+    Connector *connector;
+    vector<sockinfo_t> addrs;
+
+    switch (step++) {
+    case 0:
+        call("127.0.0.1", "hello\r\n", [](IOStream *stream, const Str& r) {
+                first = stream;
+                print_reply("first call", stream, r);
+            });
+        break;
+    case 1:
+        call("127.0.0.1", "again\r\n", [](IOStream *stream, const Str& r) {
+                printf("reused: %s\n", stream == first ? "yes" : "no");
+                print_reply("second call", stream, r);
+            });
+        break;
+    case 2:
+        //
+        // Resolved on the ThreadPool
+        //
+        call("localhost", "by name\r\n", bind(print_reply, "localhost", _1, _2));
+        break;
+    case 3:
+        call("no-such-host.invalid", "x\r\n",
+                bind(print_reply, "unknown host", _1, _2));
+        break;
+    case 4:
+        pool->acquire("127.0.0.1", 1, [](IOStream *stream) {
+                printf("refused: %s\n", stream == nullptr ? "nullptr" : "?");
+                next_test();
+            });
+        break;
+    case 5:
+        //
+        // Two IPv6 addresses not answering before the IPv4 one: the
+        // families alternate, so IPv4 is tried after one attempt delay
+        //
+        addrs.push_back(make_addr("::1", 8899));
+        addrs.push_back(make_addr("::1", 8899));
+        addrs.push_back(make_addr("127.0.0.1", 8890));
+        timer.start();
+        connector = new Connector(addrs, [](IOStream *stream) {
+                timer.stop();
+                printf("happy eyeballs: %s, after %s250 msec\n",
+                        stream != nullptr && stream->socket_->family_ ==
+                        AF_INET ? "IPv4" : "?",
+                        timer.seconds() < 0.4 ? "~" : "more than ");
+                stream->close();
+                ioloop->add_callback([stream]() { delete stream; });
+                next_test();
+            });
+        connector->start(250);
+        break;
+    case 6:
+        addrs.push_back(make_addr("::1", 8899));
+        addrs.push_back(make_addr("::1", 1));
+        addrs.push_back(make_addr("127.0.0.1", 1));
+        connector = new Connector(addrs, [](IOStream *stream) {
+                printf("none answering: %s\n",
+                        stream == nullptr ? "nullptr" : "?");
+                next_test();
+            });
+        connector->start(50, 300);
+        break;
+    case 7:
+        pool->max_in_flight_ = 3;
+        hold(12);
+        break;
+    case 8:
+        pool->max_in_flight_ = 0;
+        pool->max_idle_ = 4;
+        hold(12);
+        break;
+    case 9:
+        sick = true;
+        pool->start_health_checks(50);
+        ioloop->add_timeout(msec_now() + 120, []() {
+                printf("failing health checks: %zu idle\n",
+                        pool->idle_count());
+                next_test();
+            });
+        break;
+    case 10:
+        sick = false;
+        hold(4);
+        break;
+    case 11:
+        ioloop->add_timeout(msec_now() + 120, []() {
+                printf("passing health checks: %zu idle\n",
+                        pool->idle_count());
+                next_test();
+            });
+        break;
+    case 12:
+        pool->max_age_ = 50;
+        call("127.0.0.1", "hello\r\n", [](IOStream *stream, const Str& r) {
+                first = stream;
+                ioloop->add_timeout(msec_now() + 100, next_test);
+            });
+        break;
+    case 13:
+        call("127.0.0.1", "old\r\n", [](IOStream *stream, const Str& r) {
+                printf("after max_age: %s\n",
+                        stream != first ? "new connection" : "reused");
+                pool->max_age_ = CONNPOOL_MAX_AGE;
+                next_test();
+            });
+        break;
+    case 14:
+        remaining = 10000;
+        timer.start();
+        benchmark("pooled", 10000);
+        break;
+    case 15:
+        pool->max_idle_ = 0;
+        remaining = 2000;
+        timer.start();
+        benchmark("connection per call", 2000);
+        break;
+    default:
+        ioloop->stop();
+    }
+}
+
+int main()
+{
+    LineServer *server;
+    SocketList *blackhole;
+    Socket *filler;
+    sockinfo_t si;
+
+    Logger::initialize(Logger::INFO);
+
+    server = new LineServer();
+    server->listen(8890, "127.0.0.1");
+
+    //
+    // A listening socket with its backlog full does not answer connects
+    //
+    blackhole = bind_sockets(8899, "::1", AF_INET6, 0);
+    filler = Socket::create(AF_INET6, SOCK_STREAM, 0);
+    filler->set_nonblocking();
+    si = make_addr("::1", 8899);
+    try {
+        filler->connect(reinterpret_cast<struct sockaddr *>(&si.addr),
+                si.addrlen);
+    }
+    catch (SocketError& e) {
+    }
+
+    pool = new LinePool();
+
+    next_test();
+    ioloop->start();
+
+    delete pool;
+    filler->close();
+    delete filler;
+    for (auto sock : *blackhole) {
+        sock->close();
+        delete sock;
+    }
+    delete blackhole;
+
+    return 0;
+}
@@ -18,6 +18,100 @@
 
 using namespace ctornado;
 
+#define LOOP_COUNT  20000
+
+//
+// The old way of Cookie::load: iterate a regex over the header.
+//
+void test_regex_scan(const Str& header)
+{
+    Regex *re;
+    RegexMatch m;
+    Str tmp;
+
+    re = Regex::cached(
+            "([\\w\\d!#%&'~_`><@,:/\\$\\*\\+\\-\\.\\^\\|\\)\\(\\?\\}\\{\\=]+?)"
+            "\\s*=\\s*"
+            "(\"(?:[^\\\"]|\\.)*\""
+            "|"
+            "\\w{3},\\s[\\s\\w\\d-]{9,11}\\s[\\d:]{8}\\sGMT"
+            "|"
+            "[\\w\\d!#%&'~_`><@,:/\\$\\*\\+\\-\\.\\^\\|\\)\\(\\?\\}\\{\\=]*)"
+            "\\s*;?");
+
+    for (int i = 0; i < LOOP_COUNT; i++) {
+        tmp = header;
+        while (!tmp.empty() && re->search(tmp, &m)) {
+            tmp.remove_prefix(m.get(0).end);
+        }
+    }
+}
+
+void test_tokenize(const Str& header)
+{
+    Str key, value;
+
+    for (int i = 0; i < LOOP_COUNT; i++) {
+        CookieTokenizer tokenizer(header);
+        while (tokenizer.next(&key, &value)) {}
+    }
+}
+
+void test_load(const Str& header)
+{
+    for (int i = 0; i < LOOP_COUNT; i++) {
+        Cookie cookie;
+        cookie.load(header);
+    }
+}
+
+void test_lookup(const Str& header)
+{
+    Str value;
+
+    for (int i = 0; i < LOOP_COUNT; i++) {
+        Cookie::lookup(header, "sessionid", &value);
+    }
+}
+
+void test_performance()
+{
+    StrList parts;
+    Str header, value;
+    ClockTimer timer;
+
+    // A 2K header, like one of a logged in user.
+    for (int i = 0; i < 60; i++) {
+        parts.push_back(str_format("_ga%d=GA1.2.%d.1386000000", i, i * 7919));
+    }
+    parts.push_back("sessionid=\"0f1e2d3c4b5a69788796a5b4c3d2e1f0\"");
+    header = Str::join("; ", parts);
+
+    Cookie::lookup(header, "sessionid", &value);
+    log_stderr("test performance (%zu bytes header, sessionid=%s):",
+            header.len(), value.tos().c_str());
+
+    timer.start();
+    test_regex_scan(header);
+    timer.stop();
+    log_stderr("regex scan:  %f seconds.", timer.seconds());
+
+    timer.start();
+    test_tokenize(header);
+    timer.stop();
+    log_stderr("tokenize:    %f seconds.", timer.seconds());
+
+    timer.start();
+    test_load(header);
+    timer.stop();
+    log_stderr("load:        %f seconds.", timer.seconds());
+
+    timer.start();
+    test_lookup(header);
+    timer.stop();
+    log_stderr("lookup:      %f seconds.", timer.seconds());
+}
+
 int main()
 {
     const char *s =
@@ -46,6 +140,9 @@ int main()
     morsel->set_attribute("expires", format_email_date(sec_now()));
 
     log_stderr("Cookie:             %s", cookie->output().escape().tos().c_str());
+    delete cookie;
+
+    test_performance();
 
     return 0;
 }
@@ -20,12 +20,69 @@ using namespace ctornado;
 
 int main()
 {
+    //
+    // The first date formatted on the thread, -1 once missed the cache
+    //
+    log_stderr("format -1:               %s",
+            format_http_date(-1).tos().c_str());
+    log_stderr("");
+
     log_stderr("current microsecond:     %ld", usec_now());
     log_stderr("current millisecond:     %ld", msec_now());
     log_stderr("current second:          %ld", sec_now());
 
     log_stderr("current time (RFC 2822): %s",
             format_email_date(sec_now()).tos().c_str());
+    log_stderr("");
+
+    log_stderr("format 784111777:        %s",
+            format_http_date(784111777).tos().c_str());
+    log_stderr("parse RFC 1123:          %ld",
+            parse_http_date("Sun, 06 Nov 1994 08:49:37 GMT"));
+    log_stderr("parse RFC 850:           %ld",
+            parse_http_date("Sunday, 06-Nov-94 08:49:37 GMT"));
+    log_stderr("parse asctime:           %ld",
+            parse_http_date("Sun Nov  6 08:49:37 1994"));
+    log_stderr("parse invalid:           %ld",
+            parse_http_date("Sun, 31 Nov 1994 08:49:37 GMT"));
+    log_stderr("parse trailing garbage:  %ld",
+            parse_http_date("Sun, 06 Nov 1994 08:49:37 GMTX"));
+    log_stderr("parse asctime garbage:   %ld",
+            parse_http_date("Sun Nov  6 08:49:37 19945"));
+    log_stderr("parse before epoch:      %ld",
+            parse_http_date("Wed, 31 Dec 1969 23:59:59 GMT"));
+    log_stderr("");
+
+    ClockTimer timer;
+    int64_t now;
+    size_t n = 0;
+    int i;
+
+    now = sec_now();
+
+    timer.start();
+    for (i = 0; i < 1000000; i++) {
+        n += format_date(now + i / 1000, "%a, %d %b %Y %H:%M:%S GMT").len();
+    }
+    timer.stop();
+    log_stderr("strftime 1M times:           %f seconds.", timer.seconds());
+
+    timer.start();
+    for (i = 0; i < 1000000; i++) {
+        n += format_http_date(now + i / 1000).len();
+    }
+    timer.stop();
+    log_stderr("format_http_date 1M times:   %f seconds.", timer.seconds());
+
+    timer.start();
+    for (i = 0; i < 1000000; i++) {
+        n += parse_http_date("Sun, 06 Nov 1994 08:49:37 GMT");
+    }
+    timer.stop();
+    log_stderr("parse_http_date 1M times:    %f seconds.", timer.seconds());
+
+    if (n == 0)
+        log_stderr("unreachable");
 
     return 0;
 }
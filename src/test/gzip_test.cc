@@ -18,6 +18,181 @@
 
 using namespace ctornado;
 
+#define RESPONSE_COUNT  20000
+
+//
+// Makes JSON-like responses of 2K to 20K.
+//
+StrList make_responses()
+{
+    StrList responses;
+    Str record;
+    string body;
+    int i;
+
+    srand(0);
+
+    for (i = 0; i < 64; i++) {
+        body = "[";
+        while (body.size() < static_cast<size_t>(2048 + rand() % 18432)) {
+            record = str_format(
+                    "{\"id\": %d, \"name\": \"user%d\", \"score\": %d},",
+                    rand(), rand() % 1000, rand() % 100);
+            body.append(record.data(), record.len());
+        }
+        body.append("]");
+        responses.push_back(Str(body.c_str(), body.size()).copy());
+    }
+    return responses;
+}
+
+//
+// The way before ZStreamPool: a new stream for each response,
+// the best compression level and 1K output blocks.
+//
+size_t compress_new_stream(const Str& data)
+{
+    Buffer buffer;
+    z_stream stream;
+    str_buffer_t *str_buf;
+
+    gz_compress_init(&stream, Z_BEST_COMPRESSION);
+
+    stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data.data()));
+    stream.avail_in = data.len();
+
+    do {
+        str_buf = Str::alloc(STR_BUF_1K);
+        stream.next_out = reinterpret_cast<Bytef *>(str_buf->data);
+        stream.avail_out = STR_BUF_1K;
+        deflate(&stream, Z_FINISH);
+        buffer.push(Str(str_buf, STR_BUF_1K - stream.avail_out));
+    } while (stream.avail_out == 0);
+
+    deflateEnd(&stream);
+    return buffer.size();
+}
+
+size_t compress_pooled(const Str& data)
+{
+    GZipCompressor compressor;
+
+    compressor.compress(data);
+    compressor.close();
+
+    return compressor.get_buffer()->size();
+}
+
+size_t compress_one_shot(const Str& data)
+{
+    return gzip_compress(data).len();
+}
+
+void test_performance()
+{
+    StrList responses;
+    ClockTimer timer;
+    size_t in, out;
+    int i;
+
+    responses = make_responses();
+
+    log_stderr("test performance: %d responses of 2K-20K", RESPONSE_COUNT);
+
+    in = out = 0;
+    timer.start();
+    for (i = 0; i < RESPONSE_COUNT; ) {
+        for (auto& data : responses) {
+            in += data.len();
+            out += compress_new_stream(data);
+            i++;
+        }
+    }
+    timer.stop();
+    log_stderr("new stream, level 9:  %f seconds, ratio %.3f",
+            timer.seconds(), double(out) / in);
+
+    in = out = 0;
+    timer.start();
+    for (i = 0; i < RESPONSE_COUNT; ) {
+        for (auto& data : responses) {
+            in += data.len();
+            out += compress_pooled(data);
+            i++;
+        }
+    }
+    timer.stop();
+    log_stderr("pooled, level %d:      %f seconds, ratio %.3f",
+            GZIP_DEFAULT_LEVEL, timer.seconds(), double(out) / in);
+
+    in = out = 0;
+    timer.start();
+    for (i = 0; i < RESPONSE_COUNT; ) {
+        for (auto& data : responses) {
+            in += data.len();
+            out += compress_one_shot(data);
+            i++;
+        }
+    }
+    timer.stop();
+    log_stderr("one-shot %s, level %d: %f seconds, ratio %.3f, %.1f MB/s",
+            gzip_backend(), GZIP_DEFAULT_LEVEL, timer.seconds(),
+            double(out) / in, in / timer.seconds() / 1048576);
+}
+
+#define PARALLEL_SIZE   (16 * 1048576)
+
+Str parallel_data;
+int64_t parallel_start;
+
+void on_parallel_compressed(const Str& compressed)
+{
+    int64_t elapsed;
+
+    elapsed = usec_now() - parallel_start;
+
+    log_stderr("parallel, %d threads:  %f seconds, ratio %.3f, %s",
+            ThreadPool::instance()->size(), elapsed / 1000000.0,
+            double(compressed.len()) / parallel_data.len(),
+            gzip_decompress(compressed).eq(parallel_data) ? "ok" : "mismatch");
+
+    IOLoop::instance()->stop();
+}
+
+//
+// Compresses a large body in one go on the IOLoop thread, then in
+// blocks on the ThreadPool.  Timed by wall clock.
+//
+void test_parallel()
+{
+    StrList responses;
+    string body;
+    Str compressed;
+    int64_t start;
+
+    responses = make_responses();
+
+    while (body.size() < PARALLEL_SIZE) {
+        for (auto& data : responses) {
+            body.append(data.data(), data.len());
+        }
+    }
+    parallel_data = Str(body.c_str(), body.size()).copy();
+
+    log_stderr("test parallel: %zuM body", parallel_data.len() / 1048576);
+
+    start = usec_now();
+    compressed = gzip_compress(parallel_data);
+    log_stderr("one-shot:              %f seconds, ratio %.3f",
+            (usec_now() - start) / 1000000.0,
+            double(compressed.len()) / parallel_data.len());
+
+    parallel_start = usec_now();
+    ParallelGZipCompressor().compress(parallel_data, on_parallel_compressed);
+
+    IOLoop::instance()->start();
+}
+
 int main()
 {
     const char *raw =
@@ -48,6 +223,52 @@ int main()
 
     delete gzip_decompressor;
 
+    compressed = gzip_compress(raw);
+    log_stderr("GZip one-shot (%s) => %s", gzip_backend(),
+            gzip_decompress(compressed).tos().c_str());
+
+    //
+    // A 16M run of zeros compresses 1000 times, and is stopped by the
+    // ratio limit after the first blocks of output.
+    //
+    string zeros(16 * 1048576, '\0');
+    compressed = gzip_compress(Str(zeros.data(), zeros.size()));
+
+    gzip_decompressor = new GZipDecompressor(GZIP_BLOCK_SIZE,
+            0, GZIP_MAX_RATIO);
+    try {
+        gzip_decompressor->decompress(compressed);
+        log_stderr("GZip bomb => not stopped");
+    }
+    catch (GZipLimitError& e) {
+        log_stderr("GZip bomb (%zu bytes) => %s, after %zu bytes",
+                compressed.len(), e.what(),
+                gzip_decompressor->get_buffer()->size());
+    }
+    delete gzip_decompressor;
+
+    //
+    // The one-shot decompression is capped the same way, and a stream
+    // cut short is an error rather than a short result.
+    //
+    try {
+        gzip_decompress(compressed, 1048576);
+        log_stderr("GZip one-shot bomb => not stopped");
+    }
+    catch (GZipError& e) {
+        log_stderr("GZip one-shot bomb, max 1M => %s", e.what());
+    }
+    try {
+        gzip_decompress(compressed.substr(0, compressed.len() / 2));
+        log_stderr("GZip one-shot truncated => not detected");
+    }
+    catch (GZipError& e) {
+        log_stderr("GZip one-shot truncated => %s", e.what());
+    }
+
+    test_performance();
+    test_parallel();
+
     return 0;
 }
 
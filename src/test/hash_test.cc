@@ -0,0 +1,159 @@
+//
+// Copyright (C) 2013 Yeolar <yeolar@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "ctornado.h"
+
+using namespace ctornado;
+
+#define TOTAL_SIZE  67108864
+#define MULTI_COUNT 8
+
+static uint8_t buf[65536];
+
+//
+// MB/s of hashing TOTAL_SIZE bytes in messages of size bytes.
+//
+double bench(const char *name, size_t size)
+{
+    md5_t md5_ctx;
+    sha1_t sha1_ctx;
+    sha256_t sha256_ctx;
+    uint8_t digest[SHA256_LEN];
+    ClockTimer timer;
+
+    timer.start();
+    for (size_t n = 0; n < TOTAL_SIZE; n += size) {
+        if (strcmp(name, "md5") == 0) {
+            md5_init(&md5_ctx);
+            md5_update(&md5_ctx, buf, size);
+            md5_final(digest, &md5_ctx);
+        }
+        else if (strcmp(name, "sha1") == 0) {
+            sha1_init(&sha1_ctx);
+            sha1_update(&sha1_ctx, buf, size);
+            sha1_final(digest, &sha1_ctx);
+        }
+        else {
+            sha256_init(&sha256_ctx);
+            sha256_update(&sha256_ctx, buf, size);
+            sha256_final(digest, &sha256_ctx);
+        }
+    }
+    timer.stop();
+
+    return TOTAL_SIZE / timer.seconds() / 1048576;
+}
+
+double bench_multi(const char *name, size_t size)
+{
+    uint8_t digests[MULTI_COUNT][SHA256_LEN];
+    uint8_t *out[MULTI_COUNT];
+    const uint8_t *data[MULTI_COUNT];
+    size_t lens[MULTI_COUNT];
+    ClockTimer timer;
+
+    for (int i = 0; i < MULTI_COUNT; i++) {
+        out[i] = digests[i];
+        data[i] = buf + i;
+        lens[i] = size;
+    }
+
+    timer.start();
+    for (size_t n = 0; n < TOTAL_SIZE; n += size * MULTI_COUNT) {
+        if (strcmp(name, "sha1") == 0)
+            sha1_multi(out, data, lens, MULTI_COUNT);
+        else
+            sha256_multi(out, data, lens, MULTI_COUNT);
+    }
+    timer.stop();
+
+    return TOTAL_SIZE / timer.seconds() / 1048576;
+}
+
+void test_performance()
+{
+    const char *names[] = { "md5", "sha1", "sha256" };
+    const size_t sizes[] = { 64, 256, 1024, 4096, 65536 };
+    int caps = hash_hwcaps();
+
+    log_stderr("test performance (MB/s, scalar / %s):", hash_backend());
+
+    for (size_t i = 0; i < NELEMS(names); i++) {
+        for (size_t j = 0; j < NELEMS(sizes); j++) {
+            double scalar, accel;
+
+            hash_set_hwcaps(0);
+            scalar = bench(names[i], sizes[j]);
+            hash_set_hwcaps(caps);
+            accel = bench(names[i], sizes[j]);
+
+            log_stderr("%-6s %6zu bytes: %8.1f / %8.1f",
+                    names[i], sizes[j], scalar, accel);
+        }
+    }
+
+    log_stderr("test multi-buffer (MB/s, %d messages, scalar / avx2 / sha-ni):",
+            MULTI_COUNT);
+
+    for (size_t i = 1; i < NELEMS(names); i++) {
+        for (size_t j = 0; j < NELEMS(sizes) - 1; j++) {
+            double scalar, avx2, shani;
+
+            hash_set_hwcaps(0);
+            scalar = bench_multi(names[i], sizes[j]);
+            hash_set_hwcaps(caps & HASH_HW_AVX2);
+            avx2 = bench_multi(names[i], sizes[j]);
+            hash_set_hwcaps(caps & HASH_HW_SHA);
+            shani = bench_multi(names[i], sizes[j]);
+
+            log_stderr("%-6s %6zu bytes: %8.1f / %8.1f / %8.1f",
+                    names[i], sizes[j], scalar, avx2, shani);
+        }
+    }
+    hash_set_hwcaps(caps);
+}
+
+int main()
+{
+    uint8_t digests[MULTI_COUNT][SHA256_LEN], digest[SHA256_LEN];
+    uint8_t *out[MULTI_COUNT];
+    const uint8_t *data[MULTI_COUNT];
+    size_t lens[MULTI_COUNT];
+    bool same = true;
+
+    Logger::initialize(Logger::INFO);
+
+    for (size_t i = 0; i < sizeof(buf); i++)
+        buf[i] = i;
+
+    // The multi-buffer digests must match one by one.
+    for (int i = 0; i < MULTI_COUNT; i++) {
+        out[i] = digests[i];
+        data[i] = buf;
+        lens[i] = i * 37;
+    }
+    sha256_multi(out, data, lens, MULTI_COUNT);
+    for (int i = 0; i < MULTI_COUNT; i++) {
+        sha256(digest, data[i], lens[i]);
+        same = same && memcmp(digest, digests[i], SHA256_LEN) == 0;
+    }
+    log_stderr("Backend: %s, sha256_multi %s", hash_backend(),
+            same ? "matches" : "differs");
+
+    test_performance();
+
+    return 0;
+}
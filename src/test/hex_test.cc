@@ -18,6 +18,57 @@
 
 using namespace ctornado;
 
+#define TOTAL_SIZE  67108864
+
+static uint8_t buf[65536];
+static uint8_t hex_buf[131072];
+
+//
+// MB/s of hexlifying or unhexlifying TOTAL_SIZE bytes in blocks of size bytes.
+//
+double bench(bool encode, size_t size)
+{
+    ClockTimer timer;
+
+    hexlify(hex_buf, sizeof(hex_buf), buf, size);
+
+    timer.start();
+    for (size_t i = 0; i < TOTAL_SIZE; i += size) {
+        if (encode)
+            hexlify(hex_buf, sizeof(hex_buf), buf, size);
+        else
+            unhexlify(buf, sizeof(buf), hex_buf, size * 2);
+    }
+    timer.stop();
+
+    return TOTAL_SIZE / timer.seconds() / 1048576;
+}
+
+void test_performance()
+{
+    const size_t sizes[] = { 20, 256, 4096, 65536 };
+    int caps = binascii_hwcaps();
+
+    log_stderr("test performance (MB/s, scalar / ssse3 / avx2):");
+
+    for (int encode = 1; encode >= 0; encode--) {
+        for (size_t i = 0; i < NELEMS(sizes); i++) {
+            double scalar, ssse3, avx2;
+
+            binascii_set_hwcaps(0);
+            scalar = bench(encode, sizes[i]);
+            binascii_set_hwcaps(caps & BINASCII_HW_SSSE3);
+            ssse3 = bench(encode, sizes[i]);
+            binascii_set_hwcaps(caps);
+            avx2 = bench(encode, sizes[i]);
+
+            log_stderr("%-9s %6zu bytes: %8.1f / %8.1f / %8.1f",
+                    encode ? "hexlify" : "unhexlify", sizes[i],
+                    scalar, ssse3, avx2);
+        }
+    }
+}
+
 int main()
 {
     const char *s = "0123456789abcdefghijklmnopqrstuvwxyz";
@@ -32,6 +83,16 @@ int main()
     Str unhex_str = unhexlify(hex_str);
     log_stderr("unhexlify:\n  '%s'", unhex_str.tos().c_str());
 
+    if (!unhexlify("0123456789ABCDEFabcdef0123456789").eq(Str(
+                "\x01\x23\x45\x67\x89\xab\xcd\xef\xab\xcd\xef"
+                "\x01\x23\x45\x67\x89", 16)))
+        log_stderr("Failed: upper case digits");
+
+    for (size_t i = 0; i < sizeof(buf); i++)
+        buf[i] = i * 7;
+
+    test_performance();
+
     return 0;
 }
 
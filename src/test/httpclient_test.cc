@@ -0,0 +1,289 @@
+//
+// Copyright (C) 2013 Yeolar <yeolar@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "ctornado.h"
+
+using namespace ctornado;
+using namespace std::placeholders;
+
+IOLoop *ioloop = IOLoop::instance();
+AsyncHTTPClient *client;
+ClockTimer timer;
+int remaining;
+size_t received;
+
+void next_test();
+
+void handle_request(HTTPRequest *request)
+{
+    HTTPResponse *response;
+    Str message, body;
+    int i;
+
+    message = str_format("You requested %S\n", request->uri_);
+
+    if (request->path_.eq("/stream")) {
+        //
+        // Without Content-Length, gzip is streamed in chunked encoding.
+        //
+        request->write("HTTP/1.1 200 OK\r\n"
+                "Content-Type: text/plain\r\n\r\n");
+        for (i = 0; i < 1000; i++) {
+            request->write(message);
+        }
+        request->finish();
+    }
+    else if (request->path_.eq("/truncated")) {
+        //
+        // Half of a gzip stream, the Content-Length is right for it
+        //
+        for (i = 0; i < 100; i++) {
+            body = str_format("%S%S", body, message);
+        }
+        body = gzip_compress(body);
+        body = body.substr(0, body.len() / 2);
+        request->write(str_format("HTTP/1.1 200 OK\r\n"
+                    "Content-Encoding: gzip\r\n"
+                    "Content-Length: %uz\r\n\r\n%S", body.len(), body));
+        request->finish();
+    }
+    else if (request->path_.eq("/slow")) {
+        ioloop->add_timeout(msec_now() + 300, [request]() {
+                request->write("HTTP/1.1 200 OK\r\n"
+                    "Content-Length: 5\r\n\r\nslow\n");
+                request->finish();
+            });
+    }
+    else {
+        response = new HTTPResponse(request);
+        response->compute_etag_ = false;
+        response->add_header("Content-Type", "text/plain");
+        response->write(message);
+        response->finish();
+        delete response;
+    }
+}
+
+void print_response(HTTPClientResponse *response)
+{
+    printf("%.*s -> %d", static_cast<int>(response->request_->url_.len()),
+            response->request_->url_.data(), response->code_);
+
+    if (response->error_ != nullptr) {
+        printf(" %s\n", response->error_->what());
+    }
+    else {
+        printf(" %.*s, %zu bytes", static_cast<int>(response->reason_.len()),
+                response->reason_.data(), response->body_.len());
+        if (response->headers_->has("X-Consumed-Content-Encoding"_s))
+            printf(" (gzip)");
+        printf("\n");
+    }
+    next_test();
+}
+
+void on_streamed(HTTPClientResponse *response)
+{
+    printf("%.*s -> %d, streamed %zu bytes\n",
+            static_cast<int>(response->request_->url_.len()),
+            response->request_->url_.data(), response->code_, received);
+    next_test();
+}
+
+//
+// One request after the other, kept alive or on a new connection each
+//
+void benchmark_sequential(const char *name, bool keep_alive, int n)
+{
+    HTTPClientRequest *request;
+
+    request = new HTTPClientRequest("http://127.0.0.1:8888/");
+    if (!keep_alive)
+        request->headers_.set("Connection", "close");
+
+    client->fetch(request, [name, keep_alive, n](HTTPClientResponse *r) {
+            if (r->code_ != 200)
+                log_error("%s: %d", name, r->code_);
+            if (--remaining > 0) {
+                benchmark_sequential(name, keep_alive, n);
+                return;
+            }
+            timer.stop();
+            log_stderr("%s: %d requests, %.0f req/s", name, n,
+                    n / timer.seconds());
+            next_test();
+        });
+}
+
+//
+// Fan-out: batches of concurrent requests to the same host
+//
+void benchmark_fanout(int batch, int rounds, int round)
+{
+    int i;
+
+    remaining = batch;
+    for (i = 0; i < batch; i++) {
+        client->fetch("http://127.0.0.1:8888/", [batch, rounds, round](
+                    HTTPClientResponse *r) {
+                if (r->code_ != 200)
+                    log_error("fan-out: %d", r->code_);
+                if (--remaining > 0)
+                    return;
+                if (round < rounds) {
+                    benchmark_fanout(batch, rounds, round + 1);
+                    return;
+                }
+                timer.stop();
+                log_stderr("fan-out of %d, %d rounds: %.0f req/s", batch,
+                        rounds, batch * rounds / timer.seconds());
+                next_test();
+            });
+    }
+}
+
+void next_test()
+{
+    static int step = 0;
+    HTTPClientRequest *request;
+    AsyncHTTPClient *other;
+    int i;
+
+    switch (step++) {
+    case 0:
+        client->fetch("http://127.0.0.1:8888/hello?name=ctornado",
+                print_response);
+        break;
+    case 1:
+        client->fetch("http://127.0.0.1:8888/stream", print_response);
+        break;
+    case 2:
+        request = new HTTPClientRequest("http://127.0.0.1:8888/stream");
+        request->streaming_callback_ = [](const Str& chunk) {
+            received += chunk.len();
+        };
+        client->fetch(request, on_streamed);
+        break;
+    case 3:
+        request = new HTTPClientRequest("http://127.0.0.1:8888/stream");
+        request->headers_.set("Accept-Encoding", "gzip");
+        request->decompress_response_ = false;
+        client->fetch(request, print_response);
+        break;
+    case 4:
+        request = new HTTPClientRequest("http://127.0.0.1:8888/echo",
+                "POST", "a=1&b=2");
+        client->fetch(request, print_response);
+        break;
+    case 5:
+        //
+        // Connected to the listening socket, never answered
+        //
+        request = new HTTPClientRequest("http://127.0.0.1:8889/");
+        request->request_timeout_ = 100;
+        client->fetch(request, print_response);
+        break;
+    case 6:
+        client->fetch("http://127.0.0.1:8888/slow", print_response);
+        break;
+    case 7:
+        client->fetch("http://127.0.0.1:1/", print_response);
+        break;
+    case 8:
+        client->fetch("ftp://127.0.0.1/", print_response);
+        break;
+    case 9:
+        client->fetch("http://127.0.0.1:8888/truncated", print_response);
+        break;
+    case 10:
+        //
+        // Resolved on the ThreadPool
+        //
+        client->fetch("http://localhost:8888/hello?name=localhost",
+                print_response);
+        break;
+    case 11:
+        client->fetch("http://no-such-host.invalid/", print_response);
+        break;
+    case 12:
+        //
+        // Two requests sent, one queued, and one resolving
+        //
+        other = new AsyncHTTPClient(ioloop, 2);
+        remaining = 0;
+        for (i = 0; i < 3; i++) {
+            other->fetch(i < 2 ? "http://127.0.0.1:8888/slow" :
+                    "http://127.0.0.1:8888/", [](HTTPClientResponse *r) {
+                        remaining++;
+                    });
+        }
+        ioloop->add_timeout(msec_now() + 100, [other]() {
+                other->fetch("http://localhost:8888/",
+                        [](HTTPClientResponse *r) { remaining++; });
+                delete other;
+            });
+        ioloop->add_timeout(msec_now() + 400, []() {
+                printf("client freed with 4 requests in progress: "
+                        "%d callbacks\n", remaining);
+                next_test();
+            });
+        break;
+    case 13:
+        remaining = 5000;
+        timer.start();
+        benchmark_sequential("keep-alive", true, 5000);
+        break;
+    case 14:
+        remaining = 2000;
+        timer.start();
+        benchmark_sequential("connection per request", false, 2000);
+        break;
+    case 15:
+        timer.start();
+        benchmark_fanout(50, 200, 1);
+        break;
+    default:
+        ioloop->stop();
+    }
+}
+
+int main()
+{
+    HTTPServer *server;
+    SocketList *silent;
+
+    Logger::initialize(Logger::INFO);
+
+    silent = bind_sockets(8889, "127.0.0.1");
+
+    server = new HTTPServer(handle_request);
+    server->gzip_ = true;
+    server->listen(8888);
+
+    client = new AsyncHTTPClient();
+
+    next_test();
+    ioloop->start();
+
+    delete client;
+    for (auto sock : *silent) {
+        sock->close();
+        delete sock;
+    }
+    delete silent;
+
+    return 0;
+}
@@ -0,0 +1,351 @@
+//
+// Copyright (C) 2013 Yeolar <yeolar@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "ctornado.h"
+
+using namespace ctornado;
+using namespace std::placeholders;
+
+#define BIG_SIZE    (4 * 1048576)
+
+IOLoop *ioloop = IOLoop::instance();
+ReverseProxy *proxy;
+AsyncHTTPClient *client;
+ClockTimer timer;
+string big_data(BIG_SIZE, 'x');
+Str big;
+bool sick;
+int remaining;
+map<Str, int, StrLess> counts;
+
+void next_test();
+
+void handle_backend(HTTPRequest *request, int port)
+{
+    HTTPResponse *response;
+    Str chunk;
+    int i;
+
+    if (request->path_.eq("/chunked")) {
+        request->write("HTTP/1.1 200 OK\r\n"
+                "Transfer-Encoding: chunked\r\n\r\n");
+        chunk = str_format("3e8\r\n%S\r\n", big.substr(0, 1000));
+        for (i = 0; i < 100; i++) {
+            request->write(chunk);
+        }
+        request->write("0\r\n\r\n");
+        request->finish();
+        return;
+    }
+    //
+    // Long to send, but never idle for long: in 5 pieces 60 msec apart
+    //
+    if (request->path_.eq("/trickle")) {
+        request->write("HTTP/1.1 200 OK\r\nContent-Length: 100000\r\n\r\n");
+        for (i = 0; i < 5; i++) {
+            ioloop->add_timeout(msec_now() + 60 * i, [request, i]() {
+                    request->write(big.substr(0, 20000));
+                    if (i == 4)
+                        request->finish();
+                });
+        }
+        return;
+    }
+    //
+    // Stops in the middle of the body, and is left so
+    //
+    if (request->path_.eq("/stall")) {
+        request->write("HTTP/1.1 200 OK\r\nContent-Length: 100000\r\n\r\n");
+        request->write(big.substr(0, 20000));
+        return;
+    }
+    if (request->path_.eq("/unlimited")) {
+        request->connection_->no_keep_alive_ = true;
+        request->write("HTTP/1.1 200 OK\r\n\r\n");
+        request->write(big.substr(0, 100000));
+        request->finish();
+        return;
+    }
+
+    response = new HTTPResponse(request);
+    response->compute_etag_ = false;
+    response->add_header("Content-Type", "text/plain");
+    response->add_header("X-Backend", Str(port));
+
+    if (request->path_.eq("/health")) {
+        if (sick && port == 8002)
+            response->set_status(503);
+    }
+    else if (request->path_.eq("/big")) {
+        response->write(big);
+    }
+    else if (request->path_.eq("/echo")) {
+        response->write(request->body_);
+    }
+    else {
+        response->write(str_format("backend %d: %S from %S\n", port,
+                    request->uri_, request->headers_->get("X-Forwarded-For")));
+    }
+    response->finish();
+    delete response;
+}
+
+void print_response(HTTPClientResponse *response)
+{
+    printf("%.*s -> %d", static_cast<int>(response->request_->url_.len()),
+            response->request_->url_.data(), response->code_);
+
+    if (response->error_ != nullptr) {
+        printf(" %s\n", response->error_->what());
+    }
+    else if (response->body_.len() > 200) {
+        printf(", %zu bytes\n", response->body_.len());
+    }
+    else {
+        printf(", %.*s", static_cast<int>(response->body_.len()),
+                response->body_.data());
+    }
+    next_test();
+}
+
+//
+// n requests through the proxy, counting the answering backends
+//
+void spread(const char *name, int n, bool same_uri)
+{
+    int i;
+
+    counts.clear();
+    remaining = n;
+
+    for (i = 0; i < n; i++) {
+        client->fetch(same_uri ? Str("http://127.0.0.1:8888/same") :
+                str_format("http://127.0.0.1:8888/key/%d", i),
+                [name](HTTPClientResponse *r) {
+                    counts[r->code_ == 200 ?
+                        r->headers_->get("X-Backend") : Str(r->code_)]++;
+                    if (--remaining > 0)
+                        return;
+                    printf("%s:", name);
+                    for (auto& kv : counts) {
+                        printf(" %.*s=%d", static_cast<int>(kv.first.len()),
+                                kv.first.data(), kv.second);
+                    }
+                    printf("\n");
+                    next_test();
+                });
+    }
+}
+
+//
+// Keeps the number of requests in flight: every response starts the
+// next request until n are done
+//
+void fetch_loop(const char *name, const char *url, int n, size_t size)
+{
+    client->fetch(url, [name, url, n, size](HTTPClientResponse *r) {
+            if (r->code_ != 200 || (size > 0 && r->body_.len() != size))
+                log_error("%s: %d, %zu bytes", name, r->code_,
+                        r->body_.len());
+            if (--remaining > 0) {
+                if (remaining >= 8)
+                    fetch_loop(name, url, n, size);
+                return;
+            }
+            timer.stop();
+            if (size > 0)
+                log_stderr("%s: %d requests, %.0f MB/s", name, n,
+                        n * (size / 1048576.0) / timer.seconds());
+            else
+                log_stderr("%s: %d requests, %.0f req/s", name, n,
+                        n / timer.seconds());
+            next_test();
+        });
+}
+
+void run_loop(const char *name, const char *url, int n, size_t size)
+{
+    int i;
+
+    remaining = n;
+    timer.start();
+    for (i = 0; i < 8; i++) {
+        fetch_loop(name, url, n, size);
+    }
+}
+
+void next_test()
+{
+    static int step = 0;
+    HTTPClientRequest *request;
+    IOStream *stream;
+    ReverseProxy *named;
+    HTTPServer *server;
+
+    switch (step++) {
+    case 0:
+        client->fetch("http://127.0.0.1:8888/hello", print_response);
+        break;
+    case 1:
+        spread("round-robin (weights 1, 1, 2)", 8, true);
+        break;
+    case 2:
+        proxy->policy_ = ReverseProxy::LEAST_CONNECTIONS;
+        spread("least-connections, 60 concurrent", 60, true);
+        break;
+    case 3:
+        proxy->policy_ = ReverseProxy::CONSISTENT_HASH;
+        spread("consistent-hash, same uri", 20, true);
+        break;
+    case 4:
+        spread("consistent-hash, 1000 uris", 1000, false);
+        break;
+    case 5:
+        proxy->policy_ = ReverseProxy::ROUND_ROBIN;
+        client->fetch("http://127.0.0.1:8888/big", print_response);
+        break;
+    case 6:
+        client->fetch("http://127.0.0.1:8888/chunked", print_response);
+        break;
+    case 7:
+        client->fetch("http://127.0.0.1:8888/unlimited", print_response);
+        break;
+    case 8:
+        request = new HTTPClientRequest("http://127.0.0.1:8888/echo",
+                "POST", "a=1&b=2\n");
+        client->fetch(request, print_response);
+        break;
+    case 9:
+        //
+        // An upstream nothing listens on: its requests go to the others
+        // until it is ejected
+        //
+        proxy->add_upstream("127.0.0.1", 8004);
+        spread("with a dead upstream", 20, false);
+        break;
+    case 10:
+        sick = true;
+        ioloop->add_timeout(msec_now() + 300, next_test);
+        break;
+    case 11:
+        spread("8002 failing health checks", 20, false);
+        break;
+    case 12:
+        sick = false;
+        ioloop->add_timeout(msec_now() + 300, next_test);
+        break;
+    case 13:
+        spread("8002 healthy again", 20, false);
+        break;
+    case 14:
+        run_loop("direct, 4MB bodies", "http://127.0.0.1:8001/big", 200,
+                BIG_SIZE);
+        break;
+    case 15:
+        run_loop("proxied, 4MB bodies", "http://127.0.0.1:8888/big", 200,
+                BIG_SIZE);
+        break;
+    case 16:
+        run_loop("direct, small bodies", "http://127.0.0.1:8001/", 5000, 0);
+        break;
+    case 17:
+        run_loop("proxied, small bodies", "http://127.0.0.1:8888/", 5000, 0);
+        break;
+    case 18:
+        //
+        // The read timeout is between two reads while the body is relayed
+        //
+        proxy->read_timeout_ = 100;
+        client->fetch("http://127.0.0.1:8888/trickle", print_response);
+        break;
+    case 19:
+        client->fetch("http://127.0.0.1:8888/stall", [](HTTPClientResponse *r) {
+                printf("stalled body: %s\n", r->error_ != nullptr ?
+                        "cut" : "?");
+                proxy->read_timeout_ = PROXY_READ_TIMEOUT;
+                next_test();
+            });
+        break;
+    case 20:
+        //
+        // HTTP/1.0 does not know chunked, the body ends with the connection
+        //
+        stream = new IOStream(Socket::create(AF_INET, SOCK_STREAM, 0));
+        stream->connect("127.0.0.1", 8888, [stream]() {
+                stream->write("GET /chunked HTTP/1.0\r\n\r\n");
+                stream->read_until_close([stream](const Str& data) {
+                        int pos = data.find("\r\n\r\n");
+
+                        printf("HTTP/1.0 client, chunked upstream: %s, "
+                                "%zu bytes\n",
+                                data.substr(0, pos).find("chunked") < 0 ?
+                                "dechunked" : "chunked",
+                                pos < 0 ? 0 : data.len() - pos - 4);
+                        ioloop->add_callback([stream]() { delete stream; });
+                        next_test();
+                    });
+            });
+        break;
+    case 21:
+        //
+        // An upstream by name, resolved on the ThreadPool: ::1 first if
+        // localhost has it, which refuses, then 127.0.0.1
+        //
+        named = new ReverseProxy();
+        named->add_upstream("localhost", 8001);
+        server = new HTTPServer(named->callback());
+        server->parse_body_ = false;
+        server->listen(8887, "127.0.0.1");
+        client->fetch("http://127.0.0.1:8887/hello", print_response);
+        break;
+    default:
+        ioloop->stop();
+    }
+}
+
+int main()
+{
+    HTTPServer *backends[3];
+    HTTPServer *server;
+    int i;
+
+    Logger::initialize(Logger::INFO);
+
+    big = Str(big_data.c_str(), BIG_SIZE);
+
+    for (i = 0; i < 3; i++) {
+        backends[i] = new HTTPServer(bind(handle_backend, _1, 8001 + i));
+        backends[i]->listen(8001 + i, "127.0.0.1");
+    }
+
+    proxy = new ReverseProxy();
+    proxy->add_upstream("127.0.0.1", 8001);
+    proxy->add_upstream("127.0.0.1", 8002);
+    proxy->add_upstream("127.0.0.1", 8003, 2);
+    proxy->start_health_checks("/health", 100);
+
+    server = new HTTPServer(proxy->callback());
+    server->parse_body_ = false;
+    server->listen(8888);
+
+    client = new AsyncHTTPClient();
+    client->max_connections_ = 64;
+
+    next_test();
+    ioloop->start();
+
+    return 0;
+}
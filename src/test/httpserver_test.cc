@@ -21,11 +21,45 @@ using namespace ctornado;
 void handle_request(HTTPRequest *request)
 {
     Str message;
+    HTTPResponse *response;
+    int i;
 
-    message = Str::sprintf("You requested %S\n", &request->uri_);
-    request->write(Str::sprintf(
-                "HTTP/1.1 200 OK\r\nContent-Length: %d\r\n\r\n%S",
-                message.len(), &message));
+    message = str_format("You requested %S\n", request->uri_);
+
+    if (request->path_.eq("/stream")) {
+        //
+        // Without Content-Length, gzip is streamed in chunked encoding.
+        //
+        request->write("HTTP/1.1 200 OK\r\n"
+                "Content-Type: text/plain\r\n\r\n");
+        for (i = 0; i < 100; i++) {
+            request->write(message);
+        }
+    }
+    else if (request->path_.eq("/cached")) {
+        //
+        // The validators are known before the body, a revalidation is
+        // answered with 304 without generating it.
+        //
+        response = new HTTPResponse(request);
+        response->set_etag("v1");
+        response->set_last_modified(784111777);
+        if (!response->check_not_modified()) {
+            response->add_header("Content-Type", "text/plain");
+            response->write(message);
+        }
+        response->finish();
+        delete response;
+        return;
+    }
+    else {
+        response = new HTTPResponse(request);
+        response->add_header("Content-Type", "text/plain");
+        response->write(message);
+        response->finish();
+        delete response;
+        return;
+    }
     request->finish();
 }
 
@@ -36,6 +70,7 @@ int main()
     Logger::initialize(Logger::VERB);
 
     server = new HTTPServer(handle_request);
+    server->gzip_ = true;
     server->listen(8888);
 
     IOLoop::instance()->start();
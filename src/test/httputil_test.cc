@@ -100,6 +100,8 @@ int main()
     Query *q;
     FileMMap *m;
     HTTPFile *f;
+    MultipartParser *parser;
+    Str data;
 
     Logger::initialize(Logger::VERB);
 
@@ -114,6 +116,41 @@ int main()
             headers->normalize_name("cache-control").tos().c_str());
     log_stderr("");
 
+    log_stderr("Symbol 'content-length':        %d (SYM_CONTENT_LENGTH %d)",
+            Symbol::lookup(Str("content-length")), SYM_CONTENT_LENGTH);
+    log_stderr("Symbol 'GET':                   %d (SYM_GET %d)",
+            Symbol::lookup(Str("GET")), SYM_GET);
+    log_stderr("Symbol 'get':                   %d (method names are exact)",
+            Symbol::lookup(Str("get")));
+    log_stderr("Symbol 'Keep-Alive':            %d (SYM_KEEP_ALIVE %d)",
+            Symbol::lookup(Str("Keep-Alive")), SYM_KEEP_ALIVE);
+    log_stderr("Normalized name is interned?    %s",
+            headers->normalize_name("user-agent").data()
+            == Symbol::str(SYM_USER_AGENT).data() ? "yes" : "no");
+    log_stderr("");
+
+    ClockTimer timer;
+    size_t hits;
+
+    hits = 0;
+    timer.start();
+    for (int i = 0; i < 1000000; i++) {
+        hits += headers->get("Connection").len();
+    }
+    timer.stop();
+    log_stderr("get(\"Connection\") 1M times:   %f seconds.",
+            timer.seconds());
+
+    hits = 0;
+    timer.start();
+    for (int i = 0; i < 1000000; i++) {
+        hits += headers->get("Connection"_s).len();
+    }
+    timer.stop();
+    log_stderr("get(\"Connection\"_s) 1M times: %f seconds.",
+            timer.seconds());
+    log_stderr("");
+
     q = new Query();
     m = new FileMMap();
 
@@ -127,10 +164,91 @@ int main()
         f = &kv.second;
         log_stderr("  name:         %s", kv.first.tos().c_str());
         log_stderr("  filename:     %s", f->filename_.tos().c_str());
-        log_stderr("  body:         %s", f->body_.tos().c_str());
+        log_stderr("  body:         %s", f->body().tos().c_str());
         log_stderr("  content-type: %s", f->content_type_.tos().c_str());
     }
 
+    delete q;
+    delete m;
+
+    q = new Query();
+    m = new FileMMap();
+
+    //
+    // Feed the body byte by byte so that every delimiter straddles
+    // chunks, and spool files larger than 8 bytes to disk.
+    //
+    log_stderr("");
+    log_stderr("Parse body arguments incrementally (spool threshold 8):");
+    parser = new MultipartParser(parse_multipart_boundary(content_type),
+            q, m, 8);
+    data = body;
+
+    for (size_t i = 0; i < data.len(); i++) {
+        parser->feed(data.substr(i, i + 1));
+    }
+    log_stderr("Final boundary: %s", parser->finish() ? "yes" : "no");
+    delete parser;
+
+    log_stderr("Argument submit-name: %s", q->get("submit-name").tos().c_str());
+    log_stderr("Files:");
+
+    for (auto& kv : *m) {
+        f = &kv.second;
+        log_stderr("  name:         %s", kv.first.tos().c_str());
+        log_stderr("  filename:     %s", f->filename_.tos().c_str());
+        log_stderr("  spooled:      %s", f->spooled() ? "yes" : "no");
+        log_stderr("  size:         %zu", f->size_);
+        log_stderr("  body:         %s", f->body().tos().c_str());
+        log_stderr("  content-type: %s", f->content_type_.tos().c_str());
+    }
+
+    delete q;
+    delete m;
+
+    //
+    // A part with malformed, then oversized headers: the body is invalid
+    // even though the final boundary follows
+    //
+    log_stderr("");
+    q = new Query();
+    m = new FileMMap();
+    parser = new MultipartParser("AaB03x", q, m);
+    parser->feed("--AaB03x\r\nContent-Disposition: attachment\r\n\r\n"
+            "x\r\n--AaB03x--");
+    log_stderr("Malformed part headers valid? %s",
+            parser->finish() ? "yes" : "no");
+    delete parser;
+
+    parser = new MultipartParser("AaB03x", q, m);
+    parser->feed("--AaB03x\r\nContent-Disposition: form-data; name=\"a\"\r\n"
+            "X-Pad: ");
+    parser->feed(string(MULTIPART_MAX_HEADER_SIZE, 'p').c_str());
+    parser->feed("\r\n\r\nx\r\n--AaB03x--");
+    log_stderr("Oversized part headers valid? %s",
+            parser->finish() ? "yes" : "no");
+    delete parser;
+
+    delete q;
+    delete m;
+
+    log_stderr("");
+    const char *chunk_lines[] = {
+        "1a3f\r\n", "1A3F;name=value\r\n", "0\r\n", "\r\n", "x1\r\n",
+        "1a3fx\r\n", "123456789\r\n",
+    };
+    size_t size;
+
+    for (auto line : chunk_lines) {
+        // the lines are printed without their line break
+        if (parse_chunk_size(line, &size))
+            log_stderr("Chunk size of \"%.*s\": %zu",
+                    static_cast<int>(strlen(line) - 2), line, size);
+        else
+            log_stderr("Chunk size of \"%.*s\": invalid",
+                    static_cast<int>(strlen(line) - 2), line);
+    }
+
     return 0;
 }
 
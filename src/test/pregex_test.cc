@@ -18,6 +18,149 @@
 
 using namespace ctornado;
 
+#define LOOP_COUNT  200000
+#define STREAM_SIZE 4194304
+
+//
+// The old way of read_until_regex: compile, exec and free every time.
+//
+void test_compile_exec(const char *pattern, const Str& str)
+{
+    Regex *re;
+    RegexMatch *m;
+
+    for (int i = 0; i < LOOP_COUNT; i++) {
+        re = Regex::compile(pattern);
+        m = re->exec(str, 1);
+        delete m;
+        delete re;
+    }
+}
+
+void test_cached_search(const char *pattern, const Str& str)
+{
+    RegexMatch m;
+
+    for (int i = 0; i < LOOP_COUNT; i++) {
+        Regex::cached(pattern)->search(str, &m);
+    }
+}
+
+void test_performance()
+{
+    const char *pattern = "\r?\n\r?\n";
+    Str str = "GET / HTTP/1.1\r\nHost: localhost\r\n"
+        "User-Agent: curl/7.29.0\r\nAccept: */*\r\n\r\n";
+    ClockTimer timer;
+    int jit;
+
+    jit = 0;
+#ifdef PCRE_CONFIG_JIT
+    pcre_config(PCRE_CONFIG_JIT, &jit);
+#endif
+    log_stderr("test performance (JIT %s):", jit ? "on" : "off");
+
+    timer.start();
+    test_compile_exec(pattern, str);
+    timer.stop();
+    log_stderr("compile and exec: %f seconds.", timer.seconds());
+
+    timer.start();
+    test_cached_search(pattern, str);
+    timer.stop();
+    log_stderr("cached search:    %f seconds.", timer.seconds());
+}
+
+//
+// The old way of read_until_regex on a stream: on each new chunk the
+// buffer is merged gradually and searched from its start.
+//
+ssize_t stream_merge_search(Regex *re, const Str& data, size_t chunk_size)
+{
+    Buffer buffer;
+    RegexMatch m;
+
+    for (size_t pos = 0; pos < data.len(); pos += chunk_size) {
+        buffer.push(data.substr(pos, min(pos + chunk_size, data.len())));
+
+        while (true) {
+            if (re->search(buffer.top(), &m))
+                return m.get(0).end;
+            if (buffer.chunks() == 1)
+                break;
+            buffer.double_prefix();
+        }
+    }
+    return -1;
+}
+
+ssize_t stream_scan(Regex *re, const Str& data, size_t chunk_size)
+{
+    Buffer buffer;
+    RegexScanner scanner(re);
+    ssize_t end;
+
+    for (size_t pos = 0; pos < data.len(); pos += chunk_size) {
+        buffer.push(data.substr(pos, min(pos + chunk_size, data.len())));
+
+        end = scanner.scan(&buffer);
+        if (end != -1)
+            return end;
+    }
+    return -1;
+}
+
+void test_streaming()
+{
+    Regex *re;
+    str_buffer_t *buf;
+    Str data;
+    ClockTimer timer;
+    ssize_t end;
+
+    //
+    // A long header block arriving in 4K chunks, with the terminator
+    // at the very end and a near miss split across every chunk.
+    //
+    buf = Str::alloc(STREAM_SIZE);
+    for (size_t i = 0; i < STREAM_SIZE; i++) {
+        buf->data[i] = (i % STR_BUF_4K == STR_BUF_4K - 2) ? '\r'
+            : (i % STR_BUF_4K == STR_BUF_4K - 1) ? '\n' : 'x';
+    }
+    memcpy(buf->data + STREAM_SIZE - 4, "\r\n\r\n", 4);
+    data = Str(buf, STREAM_SIZE);
+
+    re = Regex::cached("\r?\n\r?\n");
+    log_stderr("test streaming (%zu bytes in %zu byte chunks):",
+            data.len(), STR_BUF_4K);
+
+    timer.start();
+    end = stream_merge_search(re, data, STR_BUF_4K);
+    timer.stop();
+    log_stderr("merge and search: %f seconds, match end %zd.",
+            timer.seconds(), end);
+
+    timer.start();
+    end = stream_scan(re, data, STR_BUF_4K);
+    timer.stop();
+    log_stderr("partial scan:     %f seconds, match end %zd.",
+            timer.seconds(), end);
+
+    //
+    // The match does not depend on where the chunks split the data
+    //
+    re = Regex::cached("a.*?b");
+    data = "aXbYb";
+    log_stderr("a.*?b in aXbYb: whole %zd, \"aXbY\" + \"b\" %zd, "
+            "byte by byte %zd", stream_scan(re, data, data.len()),
+            stream_scan(re, data, 4), stream_scan(re, data, 1));
+
+    re = Regex::cached("a.*?b|X");
+    data = "aXb";
+    log_stderr("a.*?b|X in aXb: whole %zd, \"aX\" + \"b\" %zd",
+            stream_scan(re, data, data.len()), stream_scan(re, data, 2));
+}
+
 int main()
 {
     Regex *re;
@@ -66,5 +209,8 @@ int main()
     }
     delete re;
 
+    test_performance();
+    test_streaming();
+
     return 0;
 }
@@ -0,0 +1,119 @@
+//
+// Copyright (C) 2013 Yeolar <yeolar@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "ctornado.h"
+
+using namespace ctornado;
+
+#define BUF_SIZE    4096
+#define LOOP_COUNT  200000
+
+void print_sha256(uint8_t hash[])
+{
+    size_t i;
+
+    for (i = 0; i < SHA256_LEN; i++)
+        printf("%02x", hash[i]);
+
+    printf("\n");
+}
+
+//
+// The old way of create_signature: set up the padded keys from the
+// secret on every call.
+//
+void test_hmac_setup(const Str& secret, const Str& msg)
+{
+    for (int i = 0; i < LOOP_COUNT; i++) {
+        HMAC hmac(secret, HMAC::SHA256);
+        hmac.verify(msg, "0");
+    }
+}
+
+void test_hmac_cached(const Str& secret, const Str& msg)
+{
+    HMAC hmac(secret, HMAC::SHA256);
+
+    for (int i = 0; i < LOOP_COUNT; i++) {
+        hmac.verify(msg, "0");
+    }
+}
+
+void test_signed_value()
+{
+    SignedValue signer("61oETzKXQAGaYdkL5gEmGeJJFuYh7EQnp2XdTP1o/Vo=");
+    Str signed_value;
+
+    signed_value = signer.create("user", "yeolar", 1386000000);
+    log_stderr("Signed value:   %s", signed_value.tos().c_str());
+    log_stderr("Decoded:        %s", signer.decode("user", signed_value,
+                SIGNED_VALUE_MAX_AGE, 1386000000 + 86400).tos().c_str());
+    log_stderr("Other name:     %s", signer.decode("admin", signed_value,
+                SIGNED_VALUE_MAX_AGE, 1386000000 + 86400).null()
+            ? "rejected" : "accepted");
+    log_stderr("Expired:        %s", signer.decode("user", signed_value,
+                SIGNED_VALUE_MAX_AGE, 1386000000 + 32 * 86400).null()
+            ? "rejected" : "accepted");
+}
+
+void test_performance()
+{
+    Str secret = "61oETzKXQAGaYdkL5gEmGeJJFuYh7EQnp2XdTP1o/Vo=";
+    Str msg = "2|1:0|10:1386000000|4:user|8:eWVvbGFy|";
+    ClockTimer timer;
+
+    log_stderr("test performance (HMAC-SHA256 verify):");
+
+    timer.start();
+    test_hmac_setup(secret, msg);
+    timer.stop();
+    log_stderr("key setup per call: %f seconds.", timer.seconds());
+
+    timer.start();
+    test_hmac_cached(secret, msg);
+    timer.stop();
+    log_stderr("cached key:         %f seconds.", timer.seconds());
+}
+
+int main()
+{
+    sha256_t ctx;
+    uint8_t hash[SHA256_LEN], buf[BUF_SIZE];
+    size_t i;
+
+    Logger::initialize(Logger::INFO);
+
+    for (i = 0; i < BUF_SIZE; i++)
+        buf[i] = i;
+
+    sha256_init(&ctx);
+
+    for (i = 0; i < 1000; i++)
+        sha256_update(&ctx, buf, BUF_SIZE);
+
+    sha256_final(hash, &ctx);
+
+    print_sha256(hash);
+
+    // RFC 4231 test case 2
+    log_stderr("HMAC-SHA256:    %s", HMAC("Jefe", HMAC::SHA256).hexdigest(
+                "what do ya want for nothing?").tos().c_str());
+
+    test_signed_value();
+    test_performance();
+
+    return 0;
+}
@@ -0,0 +1,178 @@
+//
+// Copyright (C) 2013 Yeolar <yeolar@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "ctornado.h"
+
+using namespace ctornado;
+using namespace std::placeholders;
+
+#define ROOT        "/tmp/ctornado_static"
+#define SMALL_SIZE  1024
+#define LARGE_SIZE  (16 * 1048576)
+
+void write_file(const char *path, size_t n)
+{
+    FILE *f;
+    size_t i;
+
+    f = fopen(path, "w");
+    for (i = 0; i < n; i++) {
+        fputc("0123456789abcdef\n"[i % 17], f);
+    }
+    fclose(f);
+}
+
+void make_root()
+{
+    mkdir(ROOT, 0755);
+    mkdir(ROOT "/dir", 0755);
+    write_file(ROOT "/index.html", 100);
+    write_file(ROOT "/dir/index.html", 100);
+    write_file(ROOT "/small.txt", SMALL_SIZE);
+    write_file(ROOT "/large.bin", LARGE_SIZE);
+    system("gzip -kf " ROOT "/small.txt");
+
+    mkdir(ROOT "/releases", 0755);
+    mkdir(ROOT "/releases/1", 0755);
+    mkdir(ROOT "/releases/2", 0755);
+    write_file(ROOT "/releases/1/version.txt", 10);
+    write_file(ROOT "/releases/2/version.txt", 20);
+    unlink(ROOT "/current");
+    symlink("releases/1", ROOT "/current");
+}
+
+//
+// A blocking HTTP/1.1 client on one keep-alive connection, returns the
+// size of the body
+//
+size_t fetch(int fd, const char *path)
+{
+    char buf[65536], *p;
+    size_t length, n, got;
+    ssize_t r;
+
+    n = snprintf(buf, sizeof(buf),
+            "GET %s HTTP/1.1\r\nHost: localhost\r\n\r\n", path);
+    write(fd, buf, n);
+
+    got = 0;
+    while ((p = static_cast<char *>(memmem(buf, got, "\r\n\r\n", 4))) ==
+            nullptr) {
+        r = read(fd, buf + got, sizeof(buf) - got);
+        if (r <= 0)
+            return 0;
+        got += r;
+    }
+    length = strtoul(strcasestr(buf, "Content-Length:") + 15, nullptr, 10);
+    n = got - (p + 4 - buf);
+    while (n < length) {
+        r = read(fd, buf, min(sizeof(buf), length - n));
+        if (r <= 0)
+            return 0;
+        n += r;
+    }
+    return length;
+}
+
+//
+// A new release deployed by swapping a symlink, no inotify event tells:
+// the file is stat'ed again after STATIC_FILE_TTL
+//
+void swap_release(int fd)
+{
+    size_t before, after;
+
+    before = fetch(fd, "/current/version.txt");
+    symlink("releases/2", ROOT "/next");
+    rename(ROOT "/next", ROOT "/current");
+    usleep((STATIC_FILE_TTL + 100) * 1000);
+    after = fetch(fd, "/current/version.txt");
+
+    log_stderr("symlinked release swapped: %zu then %zu bytes", before, after);
+}
+
+void *bench(void *arg)
+{
+    struct sockaddr_in addr;
+    int64_t start;
+    size_t n;
+    int fd, i;
+
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(8888);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    connect(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr));
+
+    start = usec_now();
+    for (i = 0; i < 20000; i++) {
+        n = fetch(fd, "/small.txt");
+        ASSERT(n == SMALL_SIZE);
+    }
+    log_stderr("%d requests of %d bytes: %.0f req/s", i, SMALL_SIZE,
+            i * 1e6 / (usec_now() - start));
+
+    start = usec_now();
+    for (i = 0; i < 50; i++) {
+        n = fetch(fd, "/large.bin");
+        ASSERT(n == LARGE_SIZE);
+    }
+    log_stderr("%d requests of %d bytes: %.0f MB/s", i, LARGE_SIZE,
+            i * (LARGE_SIZE / 1048576) * 1e6 / (usec_now() - start));
+
+    swap_release(fd);
+
+    close(fd);
+    IOLoop::instance()->add_callback(bind(&IOLoop::stop, IOLoop::instance()));
+
+    return nullptr;
+}
+
+int main(int argc, char *argv[])
+{
+    HTTPServer *server;
+    StaticFileHandler *handler;
+    pthread_t thread;
+
+    Logger::initialize(Logger::INFO);
+
+    //
+    // Serve the given directory, or benchmark with the files made in
+    // ROOT, e.g.
+    //
+    //    curl -H 'Range: bytes=-10' http://localhost:8888/small.txt
+    //    curl --compressed -v http://localhost:8888/small.txt
+    //
+    if (argc < 2)
+        make_root();
+
+    handler = new StaticFileHandler(argc < 2 ? ROOT : argv[1]);
+    server = new HTTPServer(bind(
+                static_cast<void (StaticFileHandler::*)(HTTPRequest *)>(
+                    &StaticFileHandler::handle), handler, _1));
+    server->listen(8888);
+
+    if (argc < 2)
+        pthread_create(&thread, nullptr, bench, nullptr);
+
+    IOLoop::instance()->start();
+
+    if (argc < 2)
+        pthread_join(thread, nullptr);
+
+    return 0;
+}
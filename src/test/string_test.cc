@@ -64,6 +64,97 @@ inline void test_my_str()
     }
 }
 
+#define CASE_LOOP   1000000
+
+//
+// The per-byte tolower loop lower used before.
+//
+inline Str tolower_str(const Str& s)
+{
+    str_buffer_t *buffer;
+    const char *pos;
+    char *ptr;
+
+    buffer = Str::alloc(s.len());
+    ptr = buffer->data;
+
+    for (pos = s.begin(); pos != s.end(); pos++) {
+        *ptr++ = tolower(*pos);
+    }
+    return Str(buffer, s.len());
+}
+
+void test_case_performance(const Str& s)
+{
+    ClockTimer timer;
+    Str t;
+    size_t n = 0;
+
+    log_stderr("case conversion of %zu bytes, %d times:", s.len(), CASE_LOOP);
+
+    timer.start();
+    for (int i = 0; i != CASE_LOOP; ++i)
+        n += tolower_str(s).len();
+    timer.stop();
+    log_stderr("  tolower loop:        %f seconds.", timer.seconds());
+
+    timer.start();
+    for (int i = 0; i != CASE_LOOP; ++i)
+        n += s.lower().len();
+    timer.stop();
+    log_stderr("  lower:               %f seconds.", timer.seconds());
+
+    t = s.copy();
+    timer.start();
+    for (int i = 0; i != CASE_LOOP; ++i) {
+        t.lower_inplace();
+        t.upper_inplace();
+    }
+    timer.stop();
+    log_stderr("  lower/upper_inplace: %f seconds.", timer.seconds() / 2);
+
+    timer.start();
+    for (int i = 0; i != CASE_LOOP; ++i)
+        n += tolower_str(s).eq(tolower_str(t));
+    timer.stop();
+    log_stderr("  tolower loop + eq:   %f seconds.", timer.seconds());
+
+    timer.start();
+    for (int i = 0; i != CASE_LOOP; ++i)
+        n += s.ieq(t);
+    timer.stop();
+    log_stderr("  ieq:                 %f seconds.", timer.seconds());
+
+    if (n == 0)
+        log_stderr("unreachable");
+}
+
+void test_format_performance()
+{
+    ClockTimer timer;
+    Str body("You requested /index.html\n");
+    size_t n = 0;
+
+    log_stderr("format a response head, %d times:", CASE_LOOP);
+
+    timer.start();
+    for (int i = 0; i != CASE_LOOP; ++i)
+        n += Str::sprintf("HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\n"
+                "Content-Length: %uz\r\n\r\n%S", body.len(), &body).len();
+    timer.stop();
+    log_stderr("  Str::sprintf:        %f seconds.", timer.seconds());
+
+    timer.start();
+    for (int i = 0; i != CASE_LOOP; ++i)
+        n += str_format("HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\n"
+                "Content-Length: %uz\r\n\r\n%S", body.len(), body).len();
+    timer.stop();
+    log_stderr("  str_format:          %f seconds.", timer.seconds());
+
+    if (n == 0)
+        log_stderr("unreachable");
+}
+
 int main()
 {
     Logger::initialize(Logger::INFO);
@@ -100,6 +191,23 @@ int main()
     log_stderr("test strip:     ' abcdefgabcdefg  ' strip: '%s'",
             Str(" abcdefgabcdefg  ").strip().tos().c_str());
 
+    // test ieq, istarts_with, lower_inplace
+    log_stderr("test ieq:       Keep-Alive %s keep-alive",
+            Str("Keep-Alive").ieq("keep-alive") ? "==" : "!=");
+    log_stderr("test ieq:       Keep-Alive %s keep-alivf",
+            Str("Keep-Alive").ieq("keep-alivf") ? "==" : "!=");
+    log_stderr("test istarts_with: Content-Length: 10 %s content-length:",
+            Str("Content-Length: 10").istarts_with("content-length:") ?
+            "starts with" : "does not start with");
+
+    Str shared("ABC-\xc3\x89t\xc3\xa9");
+    Str owned = shared.copy();
+    Str other = owned;
+
+    owned.lower_inplace();
+    log_stderr("test lower_inplace: %s => %s, shared copy kept: %s",
+            shared.tos().c_str(), owned.tos().c_str(), other.tos().c_str());
+
     // test capitalize, capitalize_each
     log_stderr("test capitalize: abcdefg-abcdefg capitalize: %s",
             Str("abcdefg-abcdefg").capitalize().tos().c_str());
@@ -110,6 +218,12 @@ int main()
     log_stderr("test escape:    abc\\rde\\nf\\r\\ng\\t escape: %s",
             Str("abc\rde\nf\r\ng\t").escape().tos().c_str());
 
+    // test format
+    log_stderr("test format:    %s",
+            str_format("%S=%05d, %uxz, %.2f, %*s",
+                Str("key"), 42, static_cast<size_t>(255), 3.14159,
+                3, "abcdef").tos().c_str());
+
     // test split_lines
     log_stderr("test split_lines: "
             "\\r\\nabcdefg\\r\\nabcdef\\rabcde\\nabcd split:");
@@ -144,5 +258,11 @@ int main()
     timer.stop();
     log_stderr("My strings:  %f seconds.", timer.seconds());
 
+    test_case_performance("Keep-Alive");
+    test_case_performance("Accept-Encoding: gzip, deflate, br; "
+            "User-Agent: Mozilla/5.0 (X11; Linux x86_64)");
+
+    test_format_performance();
+
     return 0;
 }
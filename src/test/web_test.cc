@@ -0,0 +1,274 @@
+//
+// Copyright (C) 2013 Yeolar <yeolar@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "ctornado.h"
+
+using namespace ctornado;
+
+class MainHandler : public RequestHandler
+{
+public:
+    using RequestHandler::RequestHandler;
+
+    void get()
+    {
+        write("Hello, world\n");
+    }
+};
+
+class UserHandler : public RequestHandler
+{
+public:
+    using RequestHandler::RequestHandler;
+
+    void get()
+    {
+        add_header("Content-Type", "text/plain");
+        write(str_format("user %S\n", get_path_argument("id")));
+    }
+
+    void del()
+    {
+        throw HTTPError(403);
+    }
+};
+
+class PostHandler : public RequestHandler
+{
+public:
+    using RequestHandler::RequestHandler;
+
+    void get()
+    {
+        write(str_format("post %S by %S\n", get_path_argument("post"),
+                    get_path_argument("user")));
+    }
+};
+
+class FileHandler : public RequestHandler
+{
+public:
+    using RequestHandler::RequestHandler;
+
+    void get()
+    {
+        write(str_format("file %S\n", get_path_argument("path")));
+    }
+};
+
+class ArchiveHandler : public RequestHandler
+{
+public:
+    using RequestHandler::RequestHandler;
+
+    void get()
+    {
+        write(str_format("archive %S/%S\n", get_path_argument(0),
+                    get_path_argument(1)));
+    }
+};
+
+//
+// Finishes from a timeout, after get() returned
+//
+class SlowHandler : public RequestHandler
+{
+public:
+    using RequestHandler::RequestHandler;
+
+    void get()
+    {
+        auto_finish_ = false;
+        IOLoop::instance()->add_timeout(msec_now() + 100,
+                std::bind(&SlowHandler::on_timeout, this));
+    }
+
+    void on_timeout()
+    {
+        write("slow\n");
+        finish();
+    }
+};
+
+//
+// Takes 100ms to make, cached for 2s: concurrent requests wait for the
+// first one instead of making it again
+//
+class CachedHandler : public RequestHandler
+{
+public:
+    using RequestHandler::RequestHandler;
+
+    int64_t cache_ttl() { return 2000; }
+    StrVector cache_vary() { return StrVector{"Accept-Language"}; }
+
+    void get()
+    {
+        auto_finish_ = false;
+        IOLoop::instance()->add_timeout(msec_now() + 100,
+                std::bind(&CachedHandler::on_timeout, this));
+    }
+
+    void on_timeout()
+    {
+        static int renders = 0;
+
+        write(str_format("rendered %d times\n", ++renders));
+        finish();
+    }
+};
+
+//
+// Cached for 2s but no-store: the concurrent requests waiting for the
+// first one are then made at once, not one after the other
+//
+class NoStoreHandler : public CachedHandler
+{
+public:
+    using CachedHandler::CachedHandler;
+
+    void get()
+    {
+        add_header("Cache-Control", "no-store");
+        CachedHandler::get();
+    }
+};
+
+void test_routing()
+{
+    Router router;
+    StrStrVector args;
+    const char *paths[] = {
+        "/", "/users", "/users/42", "/users/bob", "/users/42/posts/7",
+        "/static/css/site.css", "/static/", "/archive/2013/05", "/nope",
+        "/users/42/", "/userss",
+    };
+    int route;
+
+    router.add("/", 0);
+    router.add("/users", 1);
+    router.add("/users/{id:[0-9]+}", 2);
+    router.add("/users/{name}", 3);
+    router.add("/users/{user}/posts/{post}", 4);
+    router.add("/static/{path*}", 5);
+    router.add("^/archive/([0-9]{4})/([0-9]{2})", 6);
+
+    try {
+        router.add("/users/{name}", 7);
+    }
+    catch (ValueError& e) {
+        printf("duplicate: %s\n", e.what());
+    }
+    try {
+        router.add("/file-{id}.html", 7);
+    }
+    catch (ValueError& e) {
+        printf("invalid: %s\n", e.what());
+    }
+
+    for (auto& path : paths) {
+        route = router.match(path, &args);
+        printf("%-24s -> %d", path, route);
+        for (auto& kv : args) {
+            printf(" %.*s=%.*s", static_cast<int>(kv.first.len()),
+                    kv.first.data(), static_cast<int>(kv.second.len()),
+                    kv.second.data());
+        }
+        printf("\n");
+    }
+}
+
+//
+// Hundreds of endpoints: the tree against trying one regex per route in
+// order, as Tornado does
+//
+void test_routing_performance()
+{
+    Router router;
+    vector<Regex *> regexes;
+    StrStrVector args;
+    vector<Str> paths;
+    RegexMatch m;
+    ClockTimer t;
+    int i, j, k, routes, found;
+    size_t n;
+
+    routes = 500;
+    for (i = 0; i < routes; i++) {
+        router.add(str_format("/api/v1/resource%d/{id}/items/{item}", i), i);
+        regexes.push_back(Regex::cached(str_format(
+                        "^/api/v1/resource%d/([^/]+)/items/([^/]+)$", i)
+                    .tos().c_str()));
+        paths.push_back(str_format("/api/v1/resource%d/12345/items/678", i));
+    }
+
+    n = 200000;
+    found = 0;
+    t.start();
+    for (k = 0; k < static_cast<int>(n); k++) {
+        found += router.match(paths[k % routes], &args) >= 0;
+    }
+    t.stop();
+    log_stderr("%d routes, radix tree: %.3f us/match (%d found)",
+            routes, t.seconds() * 1e6 / n, found);
+
+    n = 20000;
+    found = 0;
+    t.start();
+    for (k = 0; k < static_cast<int>(n); k++) {
+        for (j = 0; j < routes; j++) {
+            if (regexes[j]->search(paths[k % routes], &m)) {
+                found++;
+                break;
+            }
+        }
+    }
+    t.stop();
+    log_stderr("%d routes, regex list: %.3f us/match (%d found)",
+            routes, t.seconds() * 1e6 / n, found);
+}
+
+int main(int argc, char *argv[])
+{
+    Application application;
+    ResponseCache cache;
+    HTTPServer *server;
+
+    Logger::initialize(Logger::INFO);
+
+    test_routing();
+    test_routing_performance();
+
+    if (argc > 1 && strcmp(argv[1], "--no-serve") == 0)
+        return 0;
+
+    application.add_handler<MainHandler>("/");
+    application.add_handler<UserHandler>("/users/{id:[0-9]+}");
+    application.add_handler<PostHandler>("/users/{user}/posts/{post}");
+    application.add_handler<FileHandler>("/files/{path*}");
+    application.add_handler<ArchiveHandler>("^/archive/([0-9]{4})/([0-9]{2})");
+    application.add_handler<SlowHandler>("/slow");
+    application.add_handler<CachedHandler>("/cached");
+    application.add_handler<NoStoreHandler>("/no-store");
+    application.cache_ = &cache;
+
+    server = new HTTPServer(application.callback());
+    server->listen(8888);
+
+    IOLoop::instance()->start();
+
+    return 0;
+}
@@ -0,0 +1,194 @@
+//
+// Copyright (C) 2013 Yeolar <yeolar@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "ctornado.h"
+
+namespace ctornado {
+
+ResponseCache::ResponseCache(size_t capacity, IOLoop *ioloop)
+{
+    ioloop_ = ioloop != nullptr ? ioloop : IOLoop::instance();
+    capacity_ = capacity;
+    size_ = 0;
+}
+
+ResponseCache::~ResponseCache()
+{
+    clear();
+}
+
+Str ResponseCache::make_key(HTTPRequest *request, const StrVector& vary)
+{
+    Str key, value;
+
+    if (request->query_.empty())
+        key = str_format("%S %S", request->method_, request->path_);
+    else
+        key = str_format("%S %S?%S", request->method_, request->path_,
+                request->query_);
+
+    for (auto& name : vary) {
+        value = request->headers_->get(name);
+        key = str_format("%S\n%S: %S", key, name,
+                value.null() ? Str("") : value);
+    }
+    return key;
+}
+
+bool ResponseCache::get(const Str& key, HTTPResponse *response)
+{
+    CachedResponseMap::iterator it;
+    CachedResponse *entry;
+
+    it = entries_.find(key);
+    if (it == entries_.end())
+        return false;
+
+    entry = it->second;
+    if (entry->expires_ <= msec_now()) {
+        drop(entry);
+        return false;
+    }
+    lru_.splice(lru_.begin(), lru_, entry->pos_);
+
+    response->set_status(entry->code_);
+    for (auto& kv : entry->headers_) {
+        response->add_header(kv.first, kv.second);
+    }
+    for (auto& chunk : entry->body_) {
+        response->write(chunk);
+    }
+    return true;
+}
+
+bool ResponseCache::put(const Str& key, HTTPResponse *response, int64_t ttl)
+{
+    CachedResponse *entry;
+    size_t size, i;
+
+    if (ttl <= 0 || !cacheable(response))
+        return false;
+
+    //
+    // The ETag is computed once for all the hits
+    //
+    if (response->etag_.null() && response->compute_etag_ &&
+            response->body_.size() > 0)
+        response->set_etag(response->compute_etag());
+
+    size = RESPONSE_CACHE_ENTRY_COST + key.len() + response->body_.size();
+    for (auto& kv : response->headers_) {
+        size += kv.first.len() + kv.second.len();
+    }
+    if (size > capacity_ / 8)
+        return false;
+
+    erase(key);
+
+    entry = new CachedResponse();
+    entry->key_ = key;
+    entry->code_ = response->code_;
+    entry->headers_ = response->headers_;
+    for (i = 0; i < response->body_.chunks(); i++) {
+        entry->body_.push_back(response->body_.chunk(i));
+    }
+    entry->size_ = size;
+    entry->expires_ = msec_now() + ttl;
+
+    entries_[key] = entry;
+    lru_.push_front(entry);
+    entry->pos_ = lru_.begin();
+    size_ += size;
+
+    while (size_ > capacity_) {
+        drop(lru_.back());
+    }
+    return true;
+}
+
+bool ResponseCache::pending(const Str& key)
+{
+    return pending_.find(key) != pending_.end();
+}
+
+void ResponseCache::begin(const Str& key)
+{
+    pending_[key];
+}
+
+void ResponseCache::wait(const Str& key, cb_wait_t callback)
+{
+    pending_[key].push_back(callback);
+}
+
+void ResponseCache::end(const Str& key, bool stored)
+{
+    map<Str, vector<cb_wait_t>, StrLess>::iterator it;
+
+    it = pending_.find(key);
+    if (it == pending_.end())
+        return;
+
+    for (auto& callback : it->second) {
+        ioloop_->add_callback(bind(callback, stored));
+    }
+    pending_.erase(it);
+}
+
+void ResponseCache::erase(const Str& key)
+{
+    CachedResponseMap::iterator it;
+
+    it = entries_.find(key);
+    if (it != entries_.end())
+        drop(it->second);
+}
+
+void ResponseCache::clear()
+{
+    while (!lru_.empty()) {
+        drop(lru_.back());
+    }
+}
+
+bool ResponseCache::cacheable(HTTPResponse *response)
+{
+    if (response->code_ != 200 || response->sends_file())
+        return false;
+
+    for (auto& kv : response->headers_) {
+        switch (Symbol::lookup(kv.first)) {
+        case SYM_SET_COOKIE:
+            return false;
+        case SYM_CACHE_CONTROL:
+            if (kv.second.find("no-store") >= 0 ||
+                    kv.second.find("private") >= 0)
+                return false;
+            break;
+        }
+    }
+    return true;
+}
+
+void ResponseCache::drop(CachedResponse *entry)
+{
+    entries_.erase(entry->key_);
+    lru_.erase(entry->pos_);
+    size_ -= entry->size_;
+    delete entry;
+}
+
+} // namespace ctornado
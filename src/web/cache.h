@@ -0,0 +1,125 @@
+//
+// Copyright (C) 2013 Yeolar <yeolar@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef __CACHE_H
+#define __CACHE_H
+
+#include "ctornado.h"
+
+namespace ctornado {
+
+#define RESPONSE_CACHE_SIZE         (64 * 1048576)
+#define RESPONSE_CACHE_ENTRY_COST   128
+
+//
+// A cached response: the status, the headers and the body chunks, which
+// are shared with the response they were written to.
+//
+class CachedResponse
+{
+public:
+    Str key_;
+    int code_;
+    StrStrVector headers_;
+    StrVector body_;
+    size_t size_;
+    int64_t expires_;
+    list<CachedResponse *>::iterator pos_;
+};
+
+typedef map<Str, CachedResponse *, StrLess> CachedResponseMap;
+typedef function<void (bool)> cb_wait_t;
+
+//
+// An in-memory cache of complete responses, bounded in bytes, with an
+// expiry time per response and LRU eviction.
+//
+// Responses are keyed on the method, the path and query, and the values
+// of the headers the response varies on.  A hit replays the status and
+// headers into a new HTTPResponse, and the body chunks are written as
+// they were stored, without copying.  The ETag is computed once when a
+// response is stored, a conditional request hitting the cache gets a 304.
+//
+// Only 200 responses without Set-Cookie, Cache-Control private or
+// no-store, or a file region are stored.
+//
+// Misses are coalesced: while the response of a key is being made, the
+// other requests for it wait, and are resumed on the IOLoop once it is
+// stored (or not, then each makes its own, without waiting again).
+//
+// The body chunks are refcounted Strs, which may not be shared across
+// threads: use one cache per IOLoop.
+//
+class ResponseCache
+{
+public:
+    ResponseCache(size_t capacity=RESPONSE_CACHE_SIZE, IOLoop *ioloop=nullptr);
+    ~ResponseCache();
+
+    ResponseCache(const ResponseCache&) = delete;
+    ResponseCache& operator=(const ResponseCache&) = delete;
+
+    //
+    // Returns the cache key of the request, the response varying on the
+    // given request headers.
+    //
+    static Str make_key(HTTPRequest *request, const StrVector& vary);
+
+    //
+    // Fills response from the cached response of key, returns false if
+    // there is none or it expired.
+    //
+    bool get(const Str& key, HTTPResponse *response);
+
+    //
+    // Stores response for ttl msec, before it is finished, if cacheable.
+    // Returns true if stored.
+    //
+    bool put(const Str& key, HTTPResponse *response, int64_t ttl);
+
+    //
+    // Request coalescing: begin() marks the response of key as being
+    // made, wait() queues a callback until end() is called for it, and
+    // the callback is given whether the response was stored.  pending()
+    // returns true in between.
+    //
+    bool pending(const Str& key);
+    void begin(const Str& key);
+    void wait(const Str& key, cb_wait_t callback);
+    void end(const Str& key, bool stored);
+
+    void erase(const Str& key);
+    void clear();
+
+    size_t size() const { return size_; }
+    size_t count() const { return entries_.size(); }
+
+    IOLoop *ioloop_;
+    size_t capacity_;
+
+private:
+    CachedResponseMap entries_;
+    list<CachedResponse *> lru_;
+    size_t size_;
+    map<Str, vector<cb_wait_t>, StrLess> pending_;
+
+    bool cacheable(HTTPResponse *response);
+    void drop(CachedResponse *entry);
+};
+
+} // namespace ctornado
+
+#endif // __CACHE_H
@@ -0,0 +1,288 @@
+//
+// Copyright (C) 2013 Yeolar <yeolar@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "ctornado.h"
+
+namespace ctornado {
+
+RouteNode::~RouteNode()
+{
+    for (auto& child : children_) {
+        delete child;
+    }
+    for (auto& param : params_) {
+        delete param;
+    }
+    delete catch_all_;
+}
+
+Router::Router()
+{
+    root_ = new RouteNode(RouteNode::STATIC, "");
+}
+
+Router::~Router()
+{
+    delete root_;
+}
+
+void Router::add(const Str& pattern, int route)
+{
+    Regex *regex;
+
+    if (pattern.starts_with("^")) {
+        regex = Regex::cached(pattern.ends_with("$")
+                ? pattern.tos().c_str()
+                : str_format("%S$", pattern).tos().c_str());
+        regexes_.push_back(make_pair(regex, route));
+        return;
+    }
+    if (!pattern.starts_with("/"))
+        throw ValueError("route pattern must start with '/' or '^'");
+
+    insert(root_, pattern, 0, route);
+}
+
+//
+// Inserts the pattern from pos under node, static text up to the next
+// parameter at once
+//
+void Router::insert(RouteNode *node, const Str& pattern, int pos, int route)
+{
+    RouteNode *child;
+    Str name, constraint;
+    int end, close, depth, type;
+    size_t i;
+
+    if (pos == static_cast<int>(pattern.len())) {
+        if (node->route_ >= 0)
+            throw ValueError("duplicate route pattern");
+        node->route_ = route;
+        return;
+    }
+
+    if (pattern[pos] != '{') {
+        end = pattern.find('{', pos);
+        if (end < 0)
+            end = pattern.len();
+        child = insert_static(node, pattern.substr(pos, end));
+        insert(child, pattern, end, route);
+        return;
+    }
+
+    // the closing brace, a constraint may hold braces like {4}
+    depth = 0;
+    for (close = pos + 1; close < static_cast<int>(pattern.len()); close++) {
+        if (pattern[close] == '{') {
+            depth++;
+        }
+        else if (pattern[close] == '}') {
+            if (depth == 0)
+                break;
+            depth--;
+        }
+    }
+    if (close == static_cast<int>(pattern.len()))
+        throw ValueError("unclosed path parameter");
+
+    name = pattern.substr(pos + 1, close);
+    end = name.find(':');
+    if (end >= 0) {
+        constraint = name.substr(end + 1, -1).copy();
+        name = name.substr(0, end);
+    }
+    type = RouteNode::PARAM;
+    if (name.ends_with("*")) {
+        type = RouteNode::CATCH_ALL;
+        name = name.substr(0, name.len() - 1);
+    }
+    if (name.empty())
+        throw ValueError("unnamed path parameter");
+    name = name.copy();
+
+    if (type == RouteNode::CATCH_ALL) {
+        if (close + 1 != static_cast<int>(pattern.len()) ||
+                !constraint.null())
+            throw ValueError("catch-all parameter must end the pattern");
+        if (node->catch_all_ != nullptr)
+            throw ValueError("duplicate route pattern");
+
+        node->catch_all_ = new RouteNode(RouteNode::CATCH_ALL, name);
+        node->catch_all_->route_ = route;
+        return;
+    }
+
+    if (close + 1 < static_cast<int>(pattern.len()) &&
+            pattern[close + 1] != '/')
+        throw ValueError("path parameter must end a segment");
+
+    child = nullptr;
+    for (i = 0; i < node->params_.size(); i++) {
+        if (node->params_[i]->label_.eq(name) &&
+                (constraint.null() ? node->params_[i]->constraint_.null()
+                 : node->params_[i]->constraint_.eq(constraint))) {
+            child = node->params_[i];
+            break;
+        }
+    }
+    if (child == nullptr) {
+        child = new RouteNode(RouteNode::PARAM, name);
+        if (!constraint.null()) {
+            child->constraint_ = constraint;
+            child->regex_ = Regex::cached(
+                    str_format("^(?:%S)\\z", constraint).tos().c_str());
+            // constrained parameters are tried first
+            for (i = 0; i < node->params_.size(); i++) {
+                if (node->params_[i]->regex_ == nullptr)
+                    break;
+            }
+            node->params_.insert(node->params_.begin() + i, child);
+        }
+        else {
+            node->params_.push_back(child);
+        }
+    }
+    insert(child, pattern, close + 1, route);
+}
+
+//
+// Returns the node for text under node, splitting an edge on a common
+// prefix
+//
+RouteNode *Router::insert_static(RouteNode *node, const Str& text)
+{
+    RouteNode *child, *mid;
+    Str rest;
+    size_t i, n, k;
+
+    rest = text;
+
+    while (true) {
+        i = node->indices_.find(rest[0]);
+        if (i == string::npos) {
+            child = new RouteNode(RouteNode::STATIC, rest.copy());
+            node->indices_.push_back(rest[0]);
+            node->children_.push_back(child);
+            return child;
+        }
+
+        child = node->children_[i];
+        n = min(child->label_.len(), rest.len());
+        for (k = 0; k < n && child->label_[k] == rest[k]; k++) {
+        }
+
+        if (k < child->label_.len()) {
+            mid = new RouteNode(RouteNode::STATIC, child->label_.substr(0, k));
+            child->label_ = child->label_.substr(k, -1);
+            mid->indices_.push_back(child->label_[0]);
+            mid->children_.push_back(child);
+            node->children_[i] = mid;
+            child = mid;
+        }
+        if (k == rest.len())
+            return child;
+
+        node = child;
+        rest = rest.substr(k, -1);
+    }
+}
+
+int Router::match(const Str& path, StrStrVector *args)
+{
+    RegexMatch m;
+    int route;
+    size_t i;
+
+    args->clear();
+
+    route = lookup(root_, path, 0, args);
+    if (route >= 0)
+        return route;
+
+    for (auto& kv : regexes_) {
+        if (kv.first->search(path, &m, PCRE_ANCHORED)) {
+            for (i = 1; i < m.size(); i++) {
+                args->push_back(make_pair(Str(""), m.substr(i)));
+            }
+            return kv.second;
+        }
+    }
+    return -1;
+}
+
+//
+// The label of node is matched up to pos.  Static children first, then
+// the parameters, then the catch-all, back tracking on a dead end.
+//
+int Router::lookup(RouteNode *node, const Str& path, size_t pos,
+        StrStrVector *args)
+{
+    RouteNode *child;
+    const char *p, *slash;
+    size_t end, n;
+    Str segment;
+    RegexMatch m;
+    int route;
+
+    p = path.data();
+    n = path.len();
+
+    if (pos == n) {
+        if (node->route_ >= 0)
+            return node->route_;
+    }
+    else {
+        slash = static_cast<const char *>(memchr(node->indices_.data(),
+                    p[pos], node->indices_.size()));
+        if (slash != nullptr) {
+            child = node->children_[slash - node->indices_.data()];
+            if (n - pos >= child->label_.len() &&
+                    memcmp(p + pos, child->label_.data(),
+                        child->label_.len()) == 0) {
+                route = lookup(child, path, pos + child->label_.len(), args);
+                if (route >= 0)
+                    return route;
+            }
+        }
+
+        if (!node->params_.empty()) {
+            slash = static_cast<const char *>(memchr(p + pos, '/', n - pos));
+            end = slash != nullptr ? slash - p : n;
+            if (end > pos) {
+                segment = path.substr(pos, end);
+                for (auto& param : node->params_) {
+                    if (param->regex_ != nullptr &&
+                            !param->regex_->search(segment, &m))
+                        continue;
+                    args->push_back(make_pair(param->label_, segment));
+                    route = lookup(param, path, end, args);
+                    if (route >= 0)
+                        return route;
+                    args->pop_back();
+                }
+            }
+        }
+    }
+
+    if (node->catch_all_ != nullptr) {
+        args->push_back(make_pair(node->catch_all_->label_,
+                    path.substr(pos, -1)));
+        return node->catch_all_->route_;
+    }
+    return -1;
+}
+
+} // namespace ctornado
@@ -0,0 +1,107 @@
+//
+// Copyright (C) 2013 Yeolar <yeolar@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef __ROUTING_H
+#define __ROUTING_H
+
+#include "ctornado.h"
+
+namespace ctornado {
+
+//
+// A node of the radix tree.  The label is static text, matched as a
+// whole; a parameter node matches a non-empty path segment and a
+// catch-all node the rest of the path.
+//
+class RouteNode
+{
+public:
+    enum {
+        STATIC,
+        PARAM,
+        CATCH_ALL,
+    };
+
+    RouteNode(int type, const Str& label)
+        : type_(type), label_(label), regex_(nullptr), route_(-1)
+        , catch_all_(nullptr) {}
+    ~RouteNode();
+
+    int type_;
+    Str label_;             // static text, or parameter name
+    Str constraint_;        // parameter regex, as given
+    Regex *regex_;          // parameter regex, anchored
+    int route_;
+
+    string indices_;        // first bytes of the static children
+    vector<RouteNode *> children_;
+    vector<RouteNode *> params_;
+    RouteNode *catch_all_;
+};
+
+//
+// Maps request paths to route ids.
+//
+// Patterns are compiled into a radix tree of their static text, so a
+// lookup walks the path once, whatever the number of routes:
+//
+//    /users                  static
+//    /users/{id}             a parameter, a non-empty segment
+//    /users/{id:[0-9]+}      a parameter the segment must fully match
+//    /static/{path*}         catch-all, the rest of the path
+//
+// Static text is preferred over a parameter, a constrained parameter
+// over an unconstrained one, and a parameter over a catch-all.  A
+// parameter ends at a '/' or at the end of the pattern.
+//
+// A pattern starting with '^' is a regex in the Tornado style, its
+// groups are the (unnamed) arguments.  Regex routes are tried in order,
+// only if the tree has no match.
+//
+// The arguments are slices of the path, not copied.
+//
+class Router
+{
+public:
+    Router();
+    ~Router();
+
+    Router(const Router&) = delete;
+    Router& operator=(const Router&) = delete;
+
+    //
+    // Adds a route, throws ValueError for an invalid or duplicate pattern.
+    //
+    void add(const Str& pattern, int route);
+
+    //
+    // Returns the route of path, or -1, and sets the arguments.
+    //
+    int match(const Str& path, StrStrVector *args);
+
+private:
+    RouteNode *root_;
+    vector<pair<Regex *, int>> regexes_;
+
+    void insert(RouteNode *node, const Str& pattern, int pos, int route);
+    RouteNode *insert_static(RouteNode *node, const Str& text);
+    int lookup(RouteNode *node, const Str& path, size_t pos,
+            StrStrVector *args);
+};
+
+} // namespace ctornado
+
+#endif // __ROUTING_H
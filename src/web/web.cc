@@ -0,0 +1,283 @@
+//
+// Copyright (C) 2013 Yeolar <yeolar@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "ctornado.h"
+
+namespace ctornado {
+
+using namespace std::placeholders;
+
+RequestHandler::RequestHandler(Application *application, HTTPRequest *request)
+{
+    application_ = application;
+    request_ = request;
+    response_ = new HTTPResponse(request);
+    auto_finish_ = true;
+    finished_ = false;
+    executing_ = false;
+    cache_ttl_ = 0;
+}
+
+RequestHandler::~RequestHandler()
+{
+    end_cache();
+    delete response_;
+}
+
+void RequestHandler::get()     { throw HTTPError(405); }
+void RequestHandler::head()    { throw HTTPError(405); }
+void RequestHandler::post()    { throw HTTPError(405); }
+void RequestHandler::put()     { throw HTTPError(405); }
+void RequestHandler::del()     { throw HTTPError(405); }
+void RequestHandler::patch()   { throw HTTPError(405); }
+void RequestHandler::options() { throw HTTPError(405); }
+
+Str RequestHandler::get_path_argument(const Str& name,
+        const Str& default_value)
+{
+    for (auto& kv : path_args_) {
+        if (kv.first.eq(name))
+            return kv.second;
+    }
+    return default_value;
+}
+
+Str RequestHandler::get_path_argument(size_t n, const Str& default_value)
+{
+    return n < path_args_.size() ? path_args_[n].second : default_value;
+}
+
+Str RequestHandler::get_argument(const Str& name, const Str& default_value)
+{
+    return request_->get_argument(name, default_value);
+}
+
+void RequestHandler::set_status(int code)
+{
+    response_->set_status(code);
+}
+
+void RequestHandler::add_header(const Str& name, const Str& value)
+{
+    response_->add_header(name, value);
+}
+
+void RequestHandler::write(const Str& chunk)
+{
+    if (finished_)
+        throw IOError("Cannot write() after finish()");
+
+    response_->write(chunk);
+}
+
+void RequestHandler::finish()
+{
+    if (finished_)
+        throw IOError("finish() called twice");
+
+    finished_ = true;
+    on_finish();
+    application_->log_request(this);
+
+    if (!cache_key_.null())
+        end_cache(application_->cache_->put(cache_key_, response_, cache_ttl_));
+
+    //
+    // The request may be freed once the response is written.
+    //
+    response_->finish();
+    request_ = nullptr;
+
+    if (!executing_)
+        delete this;
+}
+
+void RequestHandler::redirect(const Str& url, bool permanent)
+{
+    set_status(permanent ? 301 : 302);
+    add_header("Location", url);
+    finish();
+}
+
+void RequestHandler::send_error(int code)
+{
+    if (finished_) {
+        log_warn("Cannot send error response after finish");
+        return;
+    }
+
+    delete response_;
+    response_ = new HTTPResponse(request_,
+            is_valid_response_code(code) ? code : 500);
+
+    write_error(response_->code_);
+    finish();
+}
+
+void RequestHandler::write_error(int code)
+{
+    const char *reason;
+
+    reason = get_response_w3c_name(code);
+
+    write(str_format("<html><title>%d: %s</title>"
+                "<body>%d: %s</body></html>", code, reason, code, reason));
+}
+
+void RequestHandler::execute()
+{
+    executing_ = true;
+
+    try {
+        prepare();
+
+        if (!finished_) {
+            switch (request_->method_id_) {
+            case SYM_GET:
+                get();
+                break;
+            case SYM_HEAD:
+                head();
+                break;
+            case SYM_POST:
+                post();
+                break;
+            case SYM_PUT:
+                put();
+                break;
+            case SYM_DELETE:
+                del();
+                break;
+            case SYM_PATCH:
+                patch();
+                break;
+            case SYM_OPTIONS:
+                options();
+                break;
+            default:
+                throw HTTPError(405);
+            }
+        }
+        if (!finished_ && auto_finish_)
+            finish();
+    }
+    catch (HTTPError& e) {
+        send_error(e.no());
+    }
+    catch (Error& e) {
+        log_error("Uncaught exception %.*s: %s",
+                static_cast<int>(request_->uri_.len()),
+                request_->uri_.data(), e.what());
+        send_error(500);
+    }
+
+    executing_ = false;
+    if (finished_)
+        delete this;
+}
+
+void RequestHandler::end_cache(bool stored)
+{
+    if (!cache_key_.null()) {
+        application_->cache_->end(cache_key_, stored);
+        cache_key_ = nullstr;
+    }
+}
+
+void Application::add_handler(const Str& pattern, handler_factory_t factory)
+{
+    router_.add(pattern, handlers_.size());
+    handlers_.push_back(factory);
+}
+
+void Application::execute(HTTPRequest *request)
+{
+    run(request, true);
+}
+
+void Application::run(HTTPRequest *request, bool coalesce)
+{
+    RequestHandler *handler;
+    StrStrVector args;
+    Str key;
+    int64_t ttl;
+    int route;
+
+    route = router_.match(request->path_, &args);
+    if (route < 0) {
+        handler = new RequestHandler(this, request);
+        handler->send_error(404);
+        return;
+    }
+
+    handler = handlers_[route](this, request);
+    handler->path_args_.swap(args);
+
+    if (cache_ != nullptr && (request->method_id_ == SYM_GET ||
+                request->method_id_ == SYM_HEAD) &&
+            (ttl = handler->cache_ttl()) > 0) {
+        key = ResponseCache::make_key(request, handler->cache_vary());
+
+        if (cache_->get(key, handler->response_)) {
+            handler->finish();
+            return;
+        }
+        //
+        // Only one request makes the response, the others are run again
+        // once it is cached, or if it is not, without coalescing: they
+        // would wait for one another in turn.
+        //
+        if (!coalesce) {
+            handler->execute();
+            return;
+        }
+        if (cache_->pending(key)) {
+            cache_->wait(key, [this, request](bool stored) {
+                    run(request, stored);
+                });
+            delete handler;
+            return;
+        }
+        cache_->begin(key);
+        handler->cache_key_ = key;
+        handler->cache_ttl_ = ttl;
+    }
+    handler->execute();
+}
+
+cb_req_t Application::callback()
+{
+    return bind(&Application::execute, this, _1);
+}
+
+void Application::log_request(RequestHandler *handler)
+{
+    HTTPRequest *request;
+    int code;
+
+    request = handler->request_;
+    code = handler->response_->code_;
+
+    log(code < 400 ? Logger::INFO : Logger::WARN, __FILE__, __LINE__,
+            "%d %.*s %.*s (%.*s) %lldms", code,
+            static_cast<int>(request->method_.len()), request->method_.data(),
+            static_cast<int>(request->uri_.len()), request->uri_.data(),
+            static_cast<int>(request->remote_ip_.len()),
+            request->remote_ip_.data(),
+            static_cast<long long>(request->request_time()));
+}
+
+} // namespace ctornado
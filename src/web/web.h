@@ -0,0 +1,204 @@
+//
+// Copyright (C) 2013 Yeolar <yeolar@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef __WEB_H
+#define __WEB_H
+
+#include "ctornado.h"
+
+namespace ctornado {
+
+class Application;
+
+//
+// Subclass this class and define get() or post() to make a handler.
+//
+// A handler is created for every request, and freed once the response
+// is finished.  The response is finished when the method returns, unless
+// auto_finish_ is cleared to finish it later, from a callback: Tornado's
+// @asynchronous.
+//
+// An HTTPError thrown by a method is sent as the error response with its
+// code, any other Error as 500.
+//
+class RequestHandler
+{
+public:
+    RequestHandler(Application *application, HTTPRequest *request);
+    virtual ~RequestHandler();
+
+    //
+    // Called at the beginning of a request before the method.  The
+    // request is not processed further if it finishes it.
+    //
+    virtual void prepare() {}
+
+    //
+    // Called once the response is finished, before it is written.
+    //
+    virtual void on_finish() {}
+
+    //
+    // Override to cache the GET and HEAD responses of the handler in the
+    // ResponseCache of the application: returns the time to live in msec
+    // (0 not to cache), and the request headers the response varies on.
+    // Called before prepare(), with the path arguments set.
+    //
+    virtual int64_t cache_ttl() { return 0; }
+    virtual StrVector cache_vary() { return StrVector(); }
+
+    //
+    // The HTTP methods, 405 Method Not Allowed if not overridden.
+    //
+    virtual void get();
+    virtual void head();
+    virtual void post();
+    virtual void put();
+    virtual void del();
+    virtual void patch();
+    virtual void options();
+
+    //
+    // Returns the path argument with the given name, the n-th one for a
+    // regex route, or default_value.  Path arguments are not unquoted.
+    //
+    Str get_path_argument(const Str& name, const Str& default_value=nullstr);
+    Str get_path_argument(size_t n, const Str& default_value=nullstr);
+
+    //
+    // Returns the value of the query or body argument with the given
+    // name, or default_value.
+    //
+    Str get_argument(const Str& name, const Str& default_value=nullstr);
+
+    void set_status(int code);
+    void add_header(const Str& name, const Str& value);
+
+    //
+    // Appends a chunk to the response body.
+    //
+    void write(const Str& chunk);
+
+    //
+    // Finishes the response, the handler is freed.
+    //
+    void finish();
+
+    //
+    // Sends a redirect to the given (optionally relative) URL.
+    //
+    void redirect(const Str& url, bool permanent=false);
+
+    //
+    // Sends the given HTTP error code to the browser, discarding the
+    // response so far.
+    //
+    void send_error(int code=500);
+
+    //
+    // Override to implement custom error pages.
+    //
+    virtual void write_error(int code);
+
+    Application *application_;
+    HTTPRequest *request_;
+    HTTPResponse *response_;
+    StrStrVector path_args_;
+    bool auto_finish_;
+    bool finished_;
+
+private:
+    friend class Application;
+
+    bool executing_;
+    Str cache_key_;
+    int64_t cache_ttl_;
+
+    void execute();
+    void end_cache(bool stored=false);
+};
+
+typedef function<RequestHandler *(Application *, HTTPRequest *)>
+    handler_factory_t;
+
+//
+// A collection of request handlers that make up a web application.
+//
+// Instances of this class are callable and can be passed directly to
+// HTTPServer to serve the application:
+//
+//    Application application;
+//    application.add_handler<MainPageHandler>("/");
+//    application.add_handler<UserHandler>("/users/{id:[0-9]+}");
+//    server = new HTTPServer(application.callback());
+//
+// The patterns are those of Router.  Unmatched requests get a 404.
+//
+// Set cache_ to a ResponseCache, not owned, to cache the responses of
+// the handlers defining cache_ttl().  The requests missing the cache
+// for a response which is being made wait for it, and if it is not
+// stored, are then made each without the cache.
+//
+class Application
+{
+public:
+    Application() : cache_(nullptr) {}
+    virtual ~Application() {}
+
+    Application(const Application&) = delete;
+    Application& operator=(const Application&) = delete;
+
+    //
+    // Routes the pattern to a new handler of class T for every request.
+    // Throws ValueError for an invalid or duplicate pattern.
+    //
+    template <class T>
+    void add_handler(const Str& pattern)
+    {
+        add_handler(pattern, [](Application *application,
+                    HTTPRequest *request) -> RequestHandler * {
+                return new T(application, request);
+            });
+    }
+
+    void add_handler(const Str& pattern, handler_factory_t factory);
+
+    //
+    // Runs the handler of the request.
+    //
+    void execute(HTTPRequest *request);
+
+    //
+    // Returns the request callback of an HTTPServer.
+    //
+    cb_req_t callback();
+
+    //
+    // Writes a completed HTTP request to the logs.
+    //
+    virtual void log_request(RequestHandler *handler);
+
+    Router router_;
+    vector<handler_factory_t> handlers_;
+    ResponseCache *cache_;
+
+private:
+    void run(HTTPRequest *request, bool coalesce);
+};
+
+} // namespace ctornado
+
+#endif // __WEB_H